@@ -1,13 +1,20 @@
 // copyright 2012–2021 nick black
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dm.h"
 #include "zfs.h"
 #include "mdadm.h"
-#include "popen.h"
 #include "crypt.h"
+#include "stack.h"
 #include "growlight.h"
 #include "aggregate.h"
 
-static int
-make_crypt(const char *name __attribute__ ((unused)),char * const *argv,int argc){
+int make_crypt_keyed(const char *name __attribute__ ((unused)),char * const *argv,
+			int argc,const char *passphrase,const char *keyfile){
 	device *d;
 
 	if(argc != 1){
@@ -17,7 +24,13 @@ make_crypt(const char *name __attribute__ ((unused)),char * const *argv,int argc
 	if((d = lookup_device(*argv)) == NULL){
 		return -1;
 	}
-	return cryptondev(d);
+	return cryptondev(d,passphrase,keyfile);
+}
+
+// The generic entry point has no key to offer; see make_crypt_keyed()
+static int
+make_crypt(const char *name,char * const *argv,int argc){
+	return make_crypt_keyed(name,argv,argc,NULL,NULL);
 }
 
 static const aggregate_type aggregates[] = {
@@ -113,24 +126,57 @@ static const aggregate_type aggregates[] = {
 		.defname = "SprezZRAID3",
 	},{
 		.name = "zil",
-		.desc = "ZFS Write-Intent Log",
+		.desc = "ZFS Write-Intent Log (added to a zpool)",
 		.mindisks = 1,
 		.maxfaulted = 0,
+		.makeagg = make_zlog,
 	},{
 		.name = "l2arc",
-		.desc = "ZFS Level 2 Adaptive Replacement Cache",
+		.desc = "ZFS Level 2 Adaptive Replacement Cache (added to a zpool)",
+		.mindisks = 1,
+		.maxfaulted = 0,
+		.makeagg = make_zcache,
+	},{
+		.name = "zspecial",
+		.desc = "ZFS special allocation class (added to a zpool)",
 		.mindisks = 1,
 		.maxfaulted = 0,
+		.makeagg = make_zspecial,
 	},{
 		.name = "dmlinear",
 		.desc = "Linear disk combination (DM)",
 		.mindisks = 2,
-		// .maxfaulted // FIXME need investigate
+		.maxfaulted = 0,
+		.makeagg = make_dmlinear,
+		.defname = "SprezzaLinear",
 	},{
 		.name = "dmstriped",
 		.desc = "Interleaved disk combination (striping) (DM)",
 		.mindisks = 2,
 		.maxfaulted = 0,
+		.makeagg = make_dmstriped,
+		.defname = "SprezzaStripe",
+	},{
+		.name = "dmcache",
+		.desc = "SSD read/write cache, writethrough (DM)",
+		.mindisks = 2,
+		.maxfaulted = 0,
+		.makeagg = make_dmcache_wt,
+		.defname = "SprezzaCache",
+	},{
+		.name = "dmcachewb",
+		.desc = "SSD read/write cache, writeback (DM)",
+		.mindisks = 2,
+		.maxfaulted = 0,
+		.makeagg = make_dmcache_wb,
+		.defname = "SprezzaCache",
+	},{
+		.name = "dmwritecache",
+		.desc = "SSD write cache (DM)",
+		.mindisks = 2,
+		.maxfaulted = 0,
+		.makeagg = make_dmwritecache,
+		.defname = "SprezzaWriteCache",
 	},{
 		.name = "dmcrypt",
 		.desc = "LUKS block encryption (DM)",
@@ -162,44 +208,643 @@ const aggregate_type *get_aggregate_types(int *count){
 	return aggregates;
 }
 
-int assemble_aggregates(void){
-	int zpool = 0,mdraid = 0;
+// Layouts the planner understands. Of n members, parity members' worth are
+// spent on redundancy, and the remainder hold ways copies of the data (0:
+// every member holds a full copy).
+static const struct {
+	const char *name;
+	unsigned parity;
+	unsigned ways;
+} plannable[] = {
+	{ "mdlinear", 0, 1, },
+	{ "mdraid0", 0, 1, },
+	{ "dmlinear", 0, 1, },
+	{ "dmstriped", 0, 1, },
+	{ "mdraid1", 0, 0, },
+	{ "zmirror", 0, 0, },
+	{ "dmmirror", 0, 0, },
+	{ "mdraid4", 1, 1, },
+	{ "mdraid5", 1, 1, },
+	{ "raidz1", 1, 1, },
+	{ "mdraid6", 2, 1, },
+	{ "raidz2", 2, 1, },
+	{ "raidz3", 3, 1, },
+	{ "mdraid10", 0, 2, },
+};
+
+// Members' worth of usable capacity from n members, or -1 if we don't know
+// how to plan the type.
+static int
+data_members(const aggregate_type *at,unsigned n){
+	unsigned z;
+
+	for(z = 0 ; z < sizeof(plannable) / sizeof(*plannable) ; ++z){
+		if(strcmp(plannable[z].name,at->name) == 0){
+			if(plannable[z].ways == 0){
+				return n ? 1 : 0;
+			}
+			if(n <= plannable[z].parity){
+				return 0;
+			}
+			return (n - plannable[z].parity) / plannable[z].ways;
+		}
+	}
+	return -1;
+}
+
+int aggregate_plannable_p(const aggregate_type *at){
+	return data_members(at,at->mindisks) >= 0;
+}
+
+typedef struct aggcand {
+	const device *d;	// device to be bound (disk or partition)
+	const device *disk;	// disk on which it lives
+	uintmax_t bw;		// nominal bandwidth of disk, UINTMAX_MAX if unknown
+	int picked;
+} aggcand;
+
+// Sets are matched first by model and size, then by size alone, then not at
+// all (the smallest member governing).
+typedef enum {
+	MATCH_MODEL,
+	MATCH_SIZE,
+	MATCH_ANY,
+} aggmatch;
+
+static int
+add_candidate(aggcand **cands,unsigned *count,const device *d,const device *disk){
+	aggcand *tmp;
+
+	if(!device_aggregablep(d) || d->mnttype){
+		return 0; // don't volunteer members of other aggregates
+	}
+	if((tmp = realloc(*cands,sizeof(**cands) * (*count + 1))) == NULL){
+		diag("Couldn't allocate planner candidate (%s?)\n",strerror(errno));
+		return -1;
+	}
+	*cands = tmp;
+	tmp[*count].d = d;
+	tmp[*count].disk = disk;
+	if((tmp[*count].bw = stack_member_bw(disk)) == 0){
+		tmp[*count].bw = UINTMAX_MAX;
+	}
+	tmp[*count].picked = 0;
+	++*count;
+	return 0;
+}
+
+// Unused disks and partitions. Called with the lock held.
+static int
+gather_candidates(const controller *ctrls,aggcand **cands,unsigned *count){
 	const controller *c;
 
-	// FIXME maybe only do it if there are both aggregable devices and
-	// they're not currently slaves of anything?
-	for(c = get_controllers() ; c ; c = c->next){
+	for(c = ctrls ; c ; c = c->next){
 		const device *d;
 
 		for(d = c->blockdevs ; d ; d = d->next){
 			const device *p;
 
-			if(d->mnttype){
-				if(zpool_p(d->mnttype)){
-					zpool = 1;
-				}else if(mdraid_p(d->mnttype)){
-					mdraid = 1;
-				}
+			if(d->layout != LAYOUT_NONE){
+				continue;
+			}
+			if(add_candidate(cands,count,d,d)){
+				return -1;
 			}
 			for(p = d->parts ; p ; p = p->next){
-				if(p->mnttype){
-					if(zpool_p(p->mnttype)){
-						zpool = 1;
-					}else if(mdraid_p(p->mnttype)){
-						mdraid = 1;
+				if(add_candidate(cands,count,p,d)){
+					return -1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+// Anchors are the smallest members of their sets
+static int
+class_member_p(const aggcand *anchor,const aggcand *c,aggmatch m){
+	const char *am = anchor->disk->model;
+	const char *cm = c->disk->model;
+
+	if(c->d->size < anchor->d->size){
+		return 0;
+	}
+	if(m == MATCH_ANY){
+		return 1;
+	}
+	if(c->d->size - anchor->d->size > anchor->d->size / 100 * AGGPLAN_SIZE_SLOP_PCT){
+		return 0;
+	}
+	if(m == MATCH_SIZE){
+		return 1;
+	}
+	return am && cm && strcmp(am,cm) == 0;
+}
+
+static const controller *
+cand_controller(const aggcand *c){
+	return c->disk->c;
+}
+
+// The most bandwidth a member on c can expect, given k members on c
+static uintmax_t
+controller_share(const controller *c,unsigned k){
+	if(c == NULL || c->bandwidth == 0){
+		return UINTMAX_MAX;
+	}
+	return c->bandwidth / k;
+}
+
+static intmax_t
+controller_headroom(const controller *c){
+	if(c == NULL || c->bandwidth == 0){
+		return 0;
+	}
+	return (intmax_t)c->bandwidth - (intmax_t)c->demand;
+}
+
+static unsigned
+picks_on(aggcand * const *picks,unsigned n,const controller *c){
+	unsigned z,k = 0;
+
+	for(z = 0 ; z < n ; ++z){
+		if(cand_controller(picks[z]) == c){
+			++k;
+		}
+	}
+	return k;
+}
+
+static int
+disk_picked_p(aggcand * const *picks,unsigned n,const device *disk){
+	unsigned z;
+
+	for(z = 0 ; z < n ; ++z){
+		if(picks[z]->disk == disk){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// The NUMA node hosting the most members of the class, -1 if none
+static int
+class_numa_node(const aggcand *cands,unsigned count,const aggcand *anchor,aggmatch m){
+	unsigned z,y,best = 0;
+	int node = -1;
+
+	for(z = 0 ; z < count ; ++z){
+		const controller *c = cand_controller(&cands[z]);
+		unsigned n = 0;
+
+		if(!c || c->numa_node < 0 || !class_member_p(anchor,&cands[z],m)){
+			continue;
+		}
+		for(y = 0 ; y < count ; ++y){
+			const controller *oc = cand_controller(&cands[y]);
+
+			if(oc && oc->numa_node == c->numa_node && class_member_p(anchor,&cands[y],m)){
+				++n;
+			}
+		}
+		if(n > best){
+			best = n;
+			node = c->numa_node;
+		}
+	}
+	return node;
+}
+
+// Greedily choose n members of the class anchored at anchor into picks,
+// each time taking whichever candidate least lowers the effective bandwidth
+// of the slowest member, that being min(disk, controller's bandwidth split
+// among the members it hosts). Ties go to the faster disk, then to the
+// NUMA node hosting most of the class, then to controllers with fewer
+// members, then to controllers with more headroom over their existing
+// demand. Returns the
+// slowest member's effective bandwidth (UINTMAX_MAX if unknown), or 0 if
+// the class can't supply n members on distinct disks.
+static uintmax_t
+pick_members(aggcand *cands,unsigned count,const aggcand *anchor,aggmatch m,
+			unsigned n,aggcand **picks){
+	uintmax_t setmin = UINTMAX_MAX;
+	int numa = class_numa_node(cands,count,anchor,m);
+	unsigned p,z;
+
+	for(p = 0 ; p < n ; ++p){
+		uintmax_t bestmin = 0,besteff = 0;
+		aggcand *best = NULL;
+		unsigned bestk = 0;
+
+		for(z = 0 ; z < count ; ++z){
+			aggcand *c = &cands[z];
+			const controller *ctrl = cand_controller(c);
+			uintmax_t eff,newmin;
+			unsigned k;
+
+			if(c->picked || !class_member_p(anchor,c,m)){
+				continue;
+			}
+			if(disk_picked_p(picks,p,c->disk)){
+				continue;
+			}
+			k = picks_on(picks,p,ctrl) + 1;
+			eff = controller_share(ctrl,k);
+			if(c->bw < eff){
+				eff = c->bw;
+			}
+			newmin = eff < setmin ? eff : setmin;
+			if(best){
+				const controller *bctrl = cand_controller(best);
+
+				if(newmin != bestmin){
+					if(newmin < bestmin){
+						continue;
+					}
+				}else if(eff != besteff){
+					if(eff < besteff){
+						continue;
 					}
+				}else if(numa >= 0 && ctrl && bctrl && ctrl->numa_node != bctrl->numa_node){
+					if(ctrl->numa_node != numa){
+						continue;
+					}
+				}else if(k != bestk){
+					if(k > bestk){
+						continue;
+					}
+				}else if(controller_headroom(ctrl) <= controller_headroom(bctrl)){
+					continue;
+				}
+			}
+			best = c;
+			bestmin = newmin;
+			besteff = eff;
+			bestk = k;
+		}
+		if(best == NULL){
+			while(p--){
+				picks[p]->picked = 0;
+			}
+			return 0;
+		}
+		best->picked = 1;
+		picks[p] = best;
+		setmin = bestmin;
+	}
+	for(p = 0 ; p < n ; ++p){
+		picks[p]->picked = 0;
+	}
+	return setmin;
+}
+
+// Fewest members of at providing capacity bytes from members of size bytes,
+// or the fewest providing the most capacity if capacity is 0. Returns 0 if
+// avail members can't do it.
+static unsigned
+members_needed(const aggregate_type *at,unsigned avail,uintmax_t size,
+			uintmax_t capacity){
+	unsigned n,best = 0;
+	int bestdm = 0;
+
+	for(n = at->mindisks ; n <= avail ; ++n){
+		int dm = data_members(at,n);
+
+		if(capacity){
+			if(dm > 0 && (uintmax_t)dm * size >= capacity){
+				return n;
+			}
+		}else if(dm > bestdm){
+			bestdm = dm;
+			best = n;
+		}
+	}
+	return best;
+}
+
+static unsigned
+class_disks(const aggcand *cands,unsigned count,const aggcand *anchor,aggmatch m){
+	unsigned z,y,disks = 0;
+
+	for(z = 0 ; z < count ; ++z){
+		if(!class_member_p(anchor,&cands[z],m)){
+			continue;
+		}
+		for(y = 0 ; y < z ; ++y){
+			if(cands[y].disk == cands[z].disk && class_member_p(anchor,&cands[y],m)){
+				break;
+			}
+		}
+		if(y == z){
+			++disks;
+		}
+	}
+	return disks;
+}
+
+static void
+explain_plan(FILE *fp,const aggplan *plan,aggcand * const *picks,aggmatch m,
+			uintmax_t capacity,uintmax_t setmin){
+	static const char * const matches[] = {
+		"disks of matching model and size",
+		"disks of matching size (models differ)",
+		"disks of differing size (the smallest governs)",
+	};
+	const char *model = picks[0]->disk->model;
+	unsigned z,y;
+
+	fprintf(fp,"%s from %u %s",plan->at->name,plan->count,matches[m]);
+	if(m == MATCH_MODEL && model){
+		fprintf(fp,", %s",model);
+	}
+	fprintf(fp,"\n");
+	fprintf(fp,"Usable capacity: %.1fGB",plan->capacity / 1000000000.0);
+	if(capacity){
+		fprintf(fp," (%.1fGB requested)",capacity / 1000000000.0);
+	}
+	fprintf(fp,"\n");
+	for(z = 0 ; z < plan->count ; ++z){
+		const controller *c = cand_controller(picks[z]);
+
+		for(y = 0 ; y < z ; ++y){
+			if(cand_controller(picks[y]) == c){
+				break;
+			}
+		}
+		if(y < z){
+			continue;
+		}
+		fprintf(fp,"%s:",c && c->ident ? c->ident : "unknown controller");
+		for(y = z ; y < plan->count ; ++y){
+			if(cand_controller(picks[y]) == c){
+				fprintf(fp," %s",picks[y]->d->name);
+			}
+		}
+		if(c && c->bandwidth){
+			fprintf(fp," (link %ju Mbps, demand %ju Mbps",
+				c->bandwidth / 1000000,c->demand / 1000000);
+		}else{
+			fprintf(fp," (link unknown");
+		}
+		if(c && c->numa_node >= 0){
+			fprintf(fp,", NUMA node %d",c->numa_node);
+		}
+		fprintf(fp,")\n");
+	}
+	for(z = 1 ; z < plan->count ; ++z){
+		const controller *c0 = cand_controller(picks[0]);
+		const controller *c = cand_controller(picks[z]);
+
+		if(c0 && c && c0->numa_node >= 0 && c->numa_node != c0->numa_node){
+			fprintf(fp,"Members span NUMA nodes\n");
+			break;
+		}
+	}
+	if(setmin == UINTMAX_MAX){
+		fprintf(fp,"Expected throughput unknown (no link speeds available)\n");
+		return;
+	}
+	for(z = 0 ; z < plan->count ; ++z){
+		if(picks[z]->bw == setmin){
+			fprintf(fp,"Limited by %s (%ju Mbps)\n",picks[z]->d->name,setmin / 1000000);
+			break;
+		}
+	}
+	if(z == plan->count){
+		for(z = 0 ; z < plan->count ; ++z){
+			const controller *c = cand_controller(picks[z]);
+
+			if(c && controller_share(c,picks_on(picks,plan->count,c)) == setmin){
+				fprintf(fp,"Limited by %s (%ju Mbps per member)\n",
+					c->ident ? c->ident : "controller",setmin / 1000000);
+				break;
+			}
+		}
+	}
+	fprintf(fp,"Expected throughput: %ju Mbps\n",plan->throughput / 1000000);
+}
+
+// Is the plan built from picks better than the best so far?
+static int
+better_plan(uintmax_t capacity,uintmax_t cap,uintmax_t tput,
+			uintmax_t bestcap,uintmax_t besttput){
+	if(capacity == 0 && cap != bestcap){
+		return cap > bestcap;
+	}
+	if(tput != besttput){
+		return tput > besttput;
+	}
+	return cap < bestcap;
+}
+
+static int
+fill_plan(aggplan *plan,aggcand **picks,unsigned n){
+	unsigned z;
+
+	if((plan->members = malloc(sizeof(*plan->members) * n)) == NULL){
+		diag("Couldn't allocate plan (%s?)\n",strerror(errno));
+		return -1;
+	}
+	for(plan->count = 0 ; plan->count < n ; ++plan->count){
+		if((plan->members[plan->count] = strdup(picks[plan->count]->d->name)) == NULL){
+			diag("Couldn't allocate plan (%s?)\n",strerror(errno));
+			return -1;
+		}
+	}
+	plan->capacity = UINTMAX_MAX;
+	for(z = 0 ; z < n ; ++z){
+		if(picks[z]->d->size < plan->capacity){
+			plan->capacity = picks[z]->d->size;
+		}
+	}
+	plan->capacity *= data_members(plan->at,n);
+	return 0;
+}
+
+int plan_aggregate_among(const aggregate_type *at,const controller *ctrls,
+			uintmax_t capacity,aggplan *plan){
+	aggcand *cands = NULL,**picks = NULL,**bestpicks = NULL;
+	uintmax_t bestcap = 0,besttput = 0,bestmin = 0;
+	unsigned count = 0,bestn = 0,z;
+	aggmatch m;
+	size_t len;
+	FILE *fp;
+
+	memset(plan,0,sizeof(*plan));
+	plan->at = at;
+	if(data_members(at,at->mindisks) < 0){
+		diag("Can't plan members for %s\n",at->name);
+		return -1;
+	}
+	if(gather_candidates(ctrls,&cands,&count)){
+		goto err;
+	}
+	if(count == 0){
+		diag("No unused devices are available for %s\n",at->name);
+		goto err;
+	}
+	if((picks = malloc(sizeof(*picks) * count)) == NULL ||
+			(bestpicks = malloc(sizeof(*bestpicks) * count)) == NULL){
+		diag("Couldn't allocate planner state (%s?)\n",strerror(errno));
+		goto err;
+	}
+	for(m = MATCH_MODEL ; m <= MATCH_ANY && bestn == 0 ; ++m){
+		for(z = 0 ; z < count ; ++z){
+			uintmax_t setmin,cap,tput,minsize;
+			unsigned n,y;
+
+			n = members_needed(at,class_disks(cands,count,&cands[z],m),
+						cands[z].d->size,capacity);
+			if(n == 0){
+				continue;
+			}
+			if((setmin = pick_members(cands,count,&cands[z],m,n,picks)) == 0){
+				continue;
+			}
+			minsize = UINTMAX_MAX;
+			for(y = 0 ; y < n ; ++y){
+				if(picks[y]->d->size < minsize){
+					minsize = picks[y]->d->size;
 				}
 			}
+			cap = minsize * data_members(at,n);
+			tput = setmin == UINTMAX_MAX ? 0 : setmin * data_members(at,n);
+			if(bestn && !better_plan(capacity,cap,tput,bestcap,besttput)){
+				continue;
+			}
+			memcpy(bestpicks,picks,sizeof(*picks) * n);
+			bestn = n;
+			bestcap = cap;
+			besttput = tput;
+			bestmin = setmin;
 		}
 	}
-	// probably don't always want to use -f FIXME
-	if(zpool){
-		diag("Scanning for zpools...\n");
-		vspopen_drain("zpool import -a -f");
+	if(bestn == 0){
+		diag("No set of unused devices can provide %s%s%.1fGB\n",at->name,
+				capacity ? " with " : "",capacity / 1000000000.0);
+		goto err;
+	}
+	--m;
+	if(fill_plan(plan,bestpicks,bestn)){
+		goto err;
 	}
-	if(mdraid){
-		diag("Scanning for MD devices...\n");
-		vspopen_drain("mdadm --assemble --scan");
+	plan->throughput = besttput;
+	if((fp = open_memstream(&plan->explanation,&len)) == NULL){
+		diag("Couldn't explain plan (%s?)\n",strerror(errno));
+		goto err;
 	}
+	explain_plan(fp,plan,bestpicks,m,capacity,bestmin);
+	if(fclose(fp)){
+		diag("Couldn't explain plan (%s?)\n",strerror(errno));
+		goto err;
+	}
+	free(bestpicks);
+	free(picks);
+	free(cands);
+	return 0;
+
+err:
+	free(bestpicks);
+	free(picks);
+	free(cands);
+	free_aggplan(plan);
+	return -1;
+}
+
+int plan_aggregate(const aggregate_type *at,uintmax_t capacity,aggplan *plan){
+	int r;
+
+	lock_growlight();
+	r = plan_aggregate_among(at,get_controllers(),capacity,plan);
+	unlock_growlight();
+	return r;
+}
+
+int crypt_aggregate_p(const aggregate_type *at){
+	return at->makeagg == make_crypt;
+}
+
+int cache_aggregate_p(const aggregate_type *at){
+	return at->makeagg == make_dmcache_wt || at->makeagg == make_dmcache_wb ||
+		at->makeagg == make_dmwritecache;
+}
+
+static int
+cand_size_cmp(const void *va,const void *vb){
+	const aggcand *a = va;
+	const aggcand *b = vb;
+
+	return a->d->size < b->d->size ? 1 : a->d->size > b->d->size ? -1 : 0;
+}
+
+char *suggest_cache_pairs(unsigned max){
+	aggcand *cands = NULL;
+	unsigned count = 0,z,y,n = 0;
+	char *ret = NULL;
+	size_t len;
+	FILE *fp;
+
+	lock_growlight();
+	if(gather_candidates(get_controllers(),&cands,&count)){
+		goto done;
+	}
+	qsort(cands,count,sizeof(*cands),cand_size_cmp);
+	if((fp = open_memstream(&ret,&len)) == NULL){
+		diag("Couldn't suggest pairings (%s?)\n",strerror(errno));
+		goto done;
+	}
+	// the largest origins, each with the largest cache that fits
+	for(z = 0 ; z < count && n < max ; ++z){
+		if(cands[z].picked || stack_solid_state_p(cands[z].disk)){
+			continue;
+		}
+		for(y = 0 ; y < count ; ++y){
+			if(cands[y].picked || !stack_solid_state_p(cands[y].disk)){
+				continue;
+			}
+			if(cands[y].disk == cands[z].disk || cands[y].d->size >= cands[z].d->size){
+				continue;
+			}
+			fprintf(fp,"%s (%.1fGB SSD) can cache %s (%.1fGB)\n",cands[y].d->name,
+					cands[y].d->size / 1000000000.0,cands[z].d->name,
+					cands[z].d->size / 1000000000.0);
+			cands[y].picked = cands[z].picked = 1;
+			++n;
+			break;
+		}
+	}
+	if(n == 0){
+		fprintf(fp,"No unused SSD is smaller than an unused rotating device\n");
+	}
+	if(fclose(fp)){
+		diag("Couldn't suggest pairings (%s?)\n",strerror(errno));
+		free(ret);
+		ret = NULL;
+	}
+
+done:
+	unlock_growlight();
+	free(cands);
+	return ret;
+}
+
+void free_aggplan(aggplan *plan){
+	unsigned z;
+
+	for(z = 0 ; z < plan->count ; ++z){
+		free(plan->members[z]);
+	}
+	free(plan->members);
+	plan->members = NULL;
+	plan->count = 0;
+	free(plan->explanation);
+	plan->explanation = NULL;
+}
+
+int assemble_aggregates(void){
+	// md first, since zpools might be built atop md. Failures have been
+	// diagnosed, and oughtn't prevent us from starting.
+	assemble_mdadm();
+	import_zpools();
 	return 0;
 }
@@ -2,6 +2,10 @@
 #ifndef GROWLIGHT_AGGREGATE
 #define GROWLIGHT_AGGREGATE
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #include "growlight.h"
 
 static inline int
@@ -75,6 +79,61 @@ device_aggregablep(const device *d){
 
 const aggregate_type *get_aggregate(const char *);
 
+// Members chosen for a new aggregate by plan_aggregate(), along with what
+// they're expected to deliver and why they were chosen.
+typedef struct aggplan {
+	const aggregate_type *at;
+	char **members;		// device names, suitable for at->makeagg
+	unsigned count;		// number of members
+	uintmax_t capacity;	// expected usable bytes
+	uintmax_t throughput;	// expected streaming bits/s, 0 if unknown
+	char *explanation;	// newline-delimited rationale
+} aggplan;
+
+// Members needing to match in size (to within this percentage) to be
+// considered a matched set. The smallest member governs regardless.
+#define AGGPLAN_SIZE_SLOP_PCT 1
+
+// Choose unused, unsignatured devices for an aggregate of type at providing
+// at least capacity usable bytes (0 for as much as a single matched set can
+// provide). Disks sharing a model and size are preferred, then disks sharing
+// a size, then whatever is available. Within a set, members are spread
+// across controllers so that no one controller's bandwidth is exhausted
+// (against its existing demand), favoring a single NUMA node, and never
+// placing two members on the same disk. Returns -1 if no set suffices.
+int plan_aggregate(const aggregate_type *at,uintmax_t capacity,aggplan *plan);
+
+// plan_aggregate() over the devices of ctrls, called with the lock held
+int plan_aggregate_among(const aggregate_type *at,const controller *ctrls,
+			uintmax_t capacity,aggplan *plan);
+
+void free_aggplan(aggplan *plan);
+
+// Can plan_aggregate() choose members for this type?
+int aggregate_plannable_p(const aggregate_type *at);
+
+// Is this a dm-cache or dm-writecache type, pairing an SSD with a slower
+// device?
+int cache_aggregate_p(const aggregate_type *at);
+
+// Suggest up to max pairings of unused devices for a cache: the largest
+// rotating devices, each with the largest SSD smaller than it, never
+// reusing a device or pairing two on one disk. Returns a heap-allocated,
+// newline-delimited description, or NULL on error.
+char *suggest_cache_pairs(unsigned max);
+
+// Is this LUKS, requiring a passphrase or keyfile from the user?
+int crypt_aggregate_p(const aggregate_type *at);
+
+// Create LUKS on the single member, keyed as per cryptondev(). The table's
+// makeagg for LUKS refuses, lacking any key.
+int make_crypt_keyed(const char *name,char * const *argv,int argc,
+			const char *passphrase,const char *keyfile);
+
 int assemble_aggregates(void);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
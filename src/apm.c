@@ -8,6 +8,7 @@
 #include <sys/mman.h>
 
 #include "apm.h"
+#include "image.h"
 #include "ptypes.h"
 #include "ptable.h"
 #include "growlight.h"
@@ -136,7 +137,7 @@ int new_apm(device *d){
 		diag("Won't create apm on empty disk %s\n", d->name);
 		return -1;
 	}
-	if((fd = openat(devfd, d->name, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
+	if((fd = open_blockdev(d, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
 		diag("Couldn't open %s (%s?)\n", d->name, strerror(errno));
 		return -1;
 	}
@@ -170,7 +171,7 @@ int zap_apm(device *d){
 			d->size, LBA_SIZE, d->size % LBA_SIZE, d->name);
 		return -1;
 	}
-	if((fd = openat(devfd, d->name, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
+	if((fd = open_blockdev(d, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
 		diag("Couldn't open %s (%s?)\n", d->name, strerror(errno));
 		return -1;
 	}
@@ -198,7 +199,7 @@ map_apm(const device *d, size_t *mapsize, int *fd, size_t lbasize){
 		diag("Bad pgsize for apm: %d\n", pgsize);
 		return MAP_FAILED;
 	}
-	if((*fd = openat(devfd, d->name, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
+	if((*fd = open_blockdev(d, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
 		diag("Couldn't open %s (%s?)\n", d->name, strerror(errno));
 		return MAP_FAILED;
 	}
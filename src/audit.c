@@ -0,0 +1,472 @@
+// copyright 2012–2021 nick black
+#include <zlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "gpt.h"
+#include "sha.h"
+#include "audit.h"
+#include "image.h"
+#include "ptable.h"
+#include "growlight.h"
+
+#define IO_ALIGN 4096
+#define MBR_CODE_SIZE 440
+#define MBR_TABLE_OFFSET 446
+#define MAX_AUDIT_THREADS 64
+#define MIN_GPT_ENTRY_BYTES (128 * sizeof(gpt_entry))
+
+// Everything a worker needs, copied from the device while locked
+typedef struct audit_job {
+	int fd;
+	char name[NAME_MAX + 1];
+	char pttable[16];
+	uint64_t lbas;
+	unsigned logsec;
+	unsigned hassha;
+	unsigned char sha[20];
+	int problems;
+	char *report;		// newline-separated problems
+	size_t reportlen;
+	FILE *out;
+} audit_job;
+
+static void
+problem(audit_job *j, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+
+static void
+problem(audit_job *j, const char *fmt, ...){
+	va_list va;
+
+	va_start(va, fmt);
+	fprintf(j->out, "%s: ", j->name);
+	vfprintf(j->out, fmt, va);
+	fputc('\n', j->out);
+	va_end(va);
+	++j->problems;
+}
+
+// Read count logical sectors starting at lba into an aligned buffer
+static void *
+read_sectors(audit_job *j, uint64_t lba, uint64_t count){
+	const size_t len = count * j->logsec;
+	void *buf;
+	ssize_t r;
+
+	if(lba + count > j->lbas){
+		problem(j, "read of %ju sectors at LBA %ju passes end (%ju)",
+			(uintmax_t)count, (uintmax_t)lba, (uintmax_t)j->lbas);
+		return NULL;
+	}
+	if(posix_memalign(&buf, IO_ALIGN, len)){
+		return NULL;
+	}
+	if((r = pread(j->fd, buf, len, lba * j->logsec)) != (ssize_t)len){
+		problem(j, "couldn't read %zub at LBA %ju (%s)", len, (uintmax_t)lba,
+			r < 0 ? strerror(errno) : "short read");
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+typedef struct extent {
+	uint64_t first, last;
+	unsigned idx;
+} extent;
+
+static int
+extent_cmp(const void *va, const void *vb){
+	const extent *a = va, *b = vb;
+
+	return a->first < b->first ? -1 : a->first > b->first;
+}
+
+// Sort and check a set of partition extents for overlap
+static void
+check_overlaps(audit_job *j, extent *ext, unsigned count){
+	unsigned z;
+
+	qsort(ext, count, sizeof(*ext), extent_cmp);
+	for(z = 1 ; z < count ; ++z){
+		if(ext[z].first <= ext[z - 1].last){
+			problem(j, "partition %u (%ju-%ju) overlaps partition %u (%ju-%ju)",
+				ext[z].idx + 1, (uintmax_t)ext[z].first, (uintmax_t)ext[z].last,
+				ext[z - 1].idx + 1, (uintmax_t)ext[z - 1].first, (uintmax_t)ext[z - 1].last);
+		}
+	}
+}
+
+static void
+audit_mbr_entries(audit_job *j, const unsigned char *mbr, unsigned gpt){
+	extent ext[4];
+	unsigned z, n = 0, protective = 0;
+
+	for(z = 0 ; z < 4 ; ++z){
+		const unsigned char *e = mbr + MBR_TABLE_OFFSET + z * 16;
+		uint32_t first, count;
+
+		if(e[4] == 0){
+			continue;
+		}
+		memcpy(&first, e + 8, sizeof(first));
+		memcpy(&count, e + 12, sizeof(count));
+		if(gpt){
+			const uint64_t want = j->lbas - 1 > 0xffffffffu ? 0xffffffffu : j->lbas - 1;
+
+			if(e[4] != 0xee){
+				problem(j, "hybrid MBR: entry %u has type 0x%02x", z + 1, e[4]);
+				continue;
+			}
+			++protective;
+			if(first != 1){
+				problem(j, "protective MBR starts at LBA %u, not 1", first);
+			}
+			// we (like many tools) write 0xffffffff regardless of size
+			if(count != want && count != 0xffffffffu){
+				problem(j, "protective MBR covers %u sectors, not %ju", count, (uintmax_t)want);
+			}
+			continue;
+		}
+		if(count == 0){
+			problem(j, "MBR entry %u is empty", z + 1);
+			continue;
+		}
+		if((uint64_t)first + count > j->lbas){
+			problem(j, "MBR entry %u (%u+%u) passes end of disk (%ju)",
+				z + 1, first, count, (uintmax_t)j->lbas);
+		}
+		ext[n].first = first;
+		ext[n].last = (uint64_t)first + count - 1;
+		ext[n].idx = z;
+		++n;
+	}
+	if(gpt && protective != 1){
+		problem(j, "%u protective MBR entries (wanted 1)", protective);
+	}
+	check_overlaps(j, ext, n);
+}
+
+// Validate a GPT header (at LBA hlba) and its entries. Returns the entries on
+// success (the caller must free them), or NULL if they couldn't be checked.
+static gpt_entry *
+audit_gpt_copy(audit_job *j, const gpt_header *gh, uint64_t hlba, const char *which){
+	gpt_header hcopy;
+	uint64_t entsecs;
+	gpt_entry *gpe;
+	size_t entbytes;
+	uint32_t crc;
+
+	if(memcmp(&gh->signature, "EFI PART", sizeof(gh->signature))){
+		problem(j, "no %s GPT header at LBA %ju", which, (uintmax_t)hlba);
+		return NULL;
+	}
+	if(gh->headsize < 92 || gh->headsize > j->logsec){
+		problem(j, "bad %s GPT header size %u", which, gh->headsize);
+		return NULL;
+	}
+	memcpy(&hcopy, gh, sizeof(hcopy));
+	hcopy.crc = 0;
+	crc = crc32(crc32(0, Z_NULL, 0), (const void *)&hcopy, sizeof(hcopy));
+	if(gh->headsize > sizeof(hcopy)){
+		crc = crc32(crc, (const unsigned char *)gh + sizeof(hcopy), gh->headsize - sizeof(hcopy));
+	}
+	if(crc != gh->crc){
+		problem(j, "%s GPT header CRC 0x%08x, computed 0x%08x", which, gh->crc, crc);
+	}
+	if(gh->lba != hlba){
+		problem(j, "%s GPT header at LBA %ju claims LBA %ju", which,
+			(uintmax_t)hlba, (uintmax_t)gh->lba);
+	}
+	if(gh->partsize < sizeof(gpt_entry) || gh->partsize % 128 || gh->partcount == 0){
+		problem(j, "%s GPT has invalid entries (%u x %uB)", which, gh->partcount, gh->partsize);
+		return NULL;
+	}
+	entbytes = (size_t)gh->partcount * gh->partsize;
+	if(entbytes < MIN_GPT_ENTRY_BYTES){
+		problem(j, "%s GPT entry array is only %zub", which, entbytes);
+	}
+	entsecs = (entbytes + j->logsec - 1) / j->logsec;
+	if((gpe = read_sectors(j, gh->partlba, entsecs)) == NULL){
+		return NULL;
+	}
+	if((crc = crc32(crc32(0, Z_NULL, 0), (const void *)gpe, entbytes)) != gh->partcrc){
+		problem(j, "%s GPT entry CRC 0x%08x, computed 0x%08x", which, gh->partcrc, crc);
+	}
+	return gpe;
+}
+
+static void
+audit_gpt(audit_job *j, const unsigned char *lead){
+	const gpt_header *pri = (const gpt_header *)(lead + j->logsec);
+	gpt_header *bak = NULL;
+	gpt_entry *pe = NULL, *be = NULL;
+	extent *ext = NULL;
+	unsigned z, n;
+
+	if((pe = audit_gpt_copy(j, pri, 1, "primary")) == NULL){
+		return;
+	}
+	// A disk which grew leaves its backup stranded at the old end; one
+	// which shrank has lost it entirely.
+	if(pri->backuplba >= j->lbas){
+		problem(j, "backup GPT at LBA %ju lies past end of disk (%ju sectors)",
+			(uintmax_t)pri->backuplba, (uintmax_t)j->lbas);
+	}else{
+		if(pri->backuplba != j->lbas - 1){
+			problem(j, "backup GPT at LBA %ju, not last LBA %ju (disk grew? %ju sectors unusable)",
+				(uintmax_t)pri->backuplba, (uintmax_t)(j->lbas - 1),
+				(uintmax_t)(j->lbas - 1 - pri->backuplba));
+		}
+		if( (bak = read_sectors(j, pri->backuplba, 1)) ){
+			be = audit_gpt_copy(j, bak, pri->backuplba, "backup");
+		}
+	}
+	if(pri->last_usable >= j->lbas || pri->first_usable > pri->last_usable){
+		problem(j, "usable range %ju-%ju invalid for %ju sectors",
+			(uintmax_t)pri->first_usable, (uintmax_t)pri->last_usable, (uintmax_t)j->lbas);
+	}else{
+		const uint64_t entsecs = ((uint64_t)pri->partcount * pri->partsize + j->logsec - 1) / j->logsec;
+
+		if(pri->first_usable < pri->partlba + entsecs){
+			problem(j, "first usable LBA %ju collides with primary GPT entries (%ju-%ju)",
+				(uintmax_t)pri->first_usable, (uintmax_t)pri->partlba,
+				(uintmax_t)(pri->partlba + entsecs - 1));
+		}
+		if(bak && be && pri->last_usable >= bak->partlba){
+			problem(j, "last usable LBA %ju collides with backup GPT entries at %ju",
+				(uintmax_t)pri->last_usable, (uintmax_t)bak->partlba);
+		}
+	}
+	if(bak && be){
+		if(memcmp(bak->disk_guid, pri->disk_guid, sizeof(pri->disk_guid))){
+			problem(j, "primary and backup GPT disk GUIDs differ");
+		}
+		if(bak->first_usable != pri->first_usable || bak->last_usable != pri->last_usable){
+			problem(j, "primary (%ju-%ju) and backup (%ju-%ju) usable ranges differ",
+				(uintmax_t)pri->first_usable, (uintmax_t)pri->last_usable,
+				(uintmax_t)bak->first_usable, (uintmax_t)bak->last_usable);
+		}
+		if(bak->backuplba != 1){
+			problem(j, "backup GPT refers to primary at LBA %ju", (uintmax_t)bak->backuplba);
+		}
+		if(bak->partcount != pri->partcount || bak->partsize != pri->partsize ||
+				bak->partcrc != pri->partcrc){
+			problem(j, "primary and backup GPT entries differ");
+		}
+	}
+	if( (ext = malloc(sizeof(*ext) * pri->partcount)) ){
+		static const unsigned char zguid[GUIDSIZE];
+
+		for(z = 0, n = 0 ; z < pri->partcount ; ++z){
+			const gpt_entry *e = (const gpt_entry *)((const char *)pe + (size_t)z * pri->partsize);
+
+			if(memcmp(e->type_guid, zguid, sizeof(zguid)) == 0){
+				continue;
+			}
+			if(e->first_lba > e->last_lba || e->first_lba < pri->first_usable ||
+					e->last_lba > pri->last_usable){
+				problem(j, "partition %u (%ju-%ju) lies outside usable range %ju-%ju",
+					z + 1, (uintmax_t)e->first_lba, (uintmax_t)e->last_lba,
+					(uintmax_t)pri->first_usable, (uintmax_t)pri->last_usable);
+			}
+			ext[n].first = e->first_lba;
+			ext[n].last = e->last_lba;
+			ext[n].idx = z;
+			++n;
+		}
+		check_overlaps(j, ext, n);
+		free(ext);
+	}
+	free(be);
+	free(bak);
+	free(pe);
+}
+
+static void
+audit_job_run(audit_job *j){
+	unsigned char *lead;
+	uint64_t leadsecs;
+
+	if((j->out = open_memstream(&j->report, &j->reportlen)) == NULL){
+		j->problems = -1;
+		return;
+	}
+	// MBR, primary GPT header, and a minimal primary entry array
+	leadsecs = 2 + MIN_GPT_ENTRY_BYTES / j->logsec;
+	if(leadsecs > j->lbas){
+		leadsecs = j->lbas;
+	}
+	if( (lead = read_sectors(j, 0, leadsecs)) ){
+		const unsigned gpt = strcmp(j->pttable, "gpt") == 0;
+
+		if(j->hassha){
+			unsigned char sha[sizeof(j->sha)];
+
+			sha1(lead, MBR_CODE_SIZE, sha);
+			if(memcmp(sha, j->sha, sizeof(sha))){
+				problem(j, "MBR boot code changed since it was scanned");
+			}
+		}
+		if(gpt || strcmp(j->pttable, "dos") == 0){
+			if(lead[510] != 0x55 || lead[511] != 0xaa){
+				problem(j, "missing MBR signature (0x%02x%02x)", lead[510], lead[511]);
+			}else{
+				audit_mbr_entries(j, lead, gpt);
+			}
+		}
+		if(gpt && leadsecs >= 2){
+			audit_gpt(j, lead);
+		}
+		free(lead);
+	}
+	fclose(j->out);
+	j->out = NULL;
+}
+
+static int
+prep_job(const device *d, audit_job *j){
+	memset(j, 0, sizeof(*j));
+	if(d->logsec == 0 || d->size / d->logsec < 2){
+		return -1;
+	}
+	if((j->fd = open_blockdev(d, O_RDONLY|O_CLOEXEC|O_DIRECT)) < 0){
+		diag("Couldn't open %s (%s?)\n", d->name, strerror(errno));
+		return -1;
+	}
+	snprintf(j->name, sizeof(j->name), "%s", d->name);
+	if(d->blkdev.pttable){
+		snprintf(j->pttable, sizeof(j->pttable), "%s", d->blkdev.pttable);
+	}
+	j->logsec = d->logsec;
+	j->lbas = d->size / d->logsec;
+	if(d->blkdev.biossha1){
+		memcpy(j->sha, d->blkdev.biossha1, sizeof(j->sha));
+		j->hassha = 1;
+	}
+	return 0;
+}
+
+// Report and release a completed job, returning its problem count
+static int
+finish_job(audit_job *j){
+	int r = j->problems;
+
+	close(j->fd);
+	if(j->report){
+		if(j->reportlen){
+			diag("%s", j->report);
+		}
+		free(j->report);
+	}
+	return r;
+}
+
+int audit_ptable(const device *d){
+	audit_job j;
+
+	if(d->layout != LAYOUT_NONE){
+		diag("%s is not a partitionable disk\n", d->name);
+		return -1;
+	}
+	if(prep_job(d, &j)){
+		return -1;
+	}
+	audit_job_run(&j);
+	return finish_job(&j);
+}
+
+typedef struct audit_pool {
+	audit_job *jobs;
+	unsigned count;
+	atomic_uint next;
+} audit_pool;
+
+static void *
+audit_thread(void *vpool){
+	audit_pool *pool = vpool;
+	unsigned idx;
+
+	while((idx = atomic_fetch_add(&pool->next, 1)) < pool->count){
+		audit_job_run(&pool->jobs[idx]);
+	}
+	return NULL;
+}
+
+int audit_ptables(unsigned *disks){
+	pthread_t tids[MAX_AUDIT_THREADS];
+	unsigned count = 0, z, threads;
+	const controller *c;
+	audit_pool pool;
+	const device *d;
+	int problems;
+	long cpus;
+
+	lock_growlight();
+	for(c = get_controllers() ; c ; c = c->next){
+		for(d = c->blockdevs ; d ; d = d->next){
+			++count;
+		}
+	}
+	if((pool.jobs = malloc(sizeof(*pool.jobs) * (count ? count : 1))) == NULL){
+		unlock_growlight();
+		return -1;
+	}
+	pool.count = 0;
+	for(c = get_controllers() ; c ; c = c->next){
+		for(d = c->blockdevs ; d ; d = d->next){
+			if(d->layout != LAYOUT_NONE || d->blkdev.unloaded || pool.count == count){
+				continue;
+			}
+			if(prep_job(d, &pool.jobs[pool.count]) == 0){
+				++pool.count;
+			}
+		}
+	}
+	unlock_growlight();
+	atomic_init(&pool.next, 0);
+	// These are dominated by device latency, not CPU, so oversubscribe
+	if((cpus = sysconf(_SC_NPROCESSORS_ONLN)) <= 0){
+		cpus = 1;
+	}
+	threads = cpus * 4;
+	if(threads > MAX_AUDIT_THREADS){
+		threads = MAX_AUDIT_THREADS;
+	}
+	if(threads > pool.count){
+		threads = pool.count;
+	}
+	for(z = 0 ; z < threads ; ++z){
+		if(pthread_create(&tids[z], NULL, audit_thread, &pool)){
+			diag("Couldn't launch audit thread (%s?)\n", strerror(errno));
+			break;
+		}
+	}
+	threads = z;
+	audit_thread(&pool); // participate, and cover for any failed launches
+	for(z = 0 ; z < threads ; ++z){
+		pthread_join(tids[z], NULL);
+	}
+	problems = 0;
+	for(z = 0 ; z < pool.count ; ++z){
+		int r = finish_job(&pool.jobs[z]);
+
+		if(r < 0){
+			problems = -1;
+		}else if(problems >= 0){
+			problems += r;
+		}
+	}
+	if(disks){
+		*disks = pool.count;
+	}
+	free(pool.jobs);
+	return problems;
+}
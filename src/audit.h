@@ -0,0 +1,35 @@
+// copyright 2012–2021 nick black
+#ifndef GROWLIGHT_AUDIT
+#define GROWLIGHT_AUDIT
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct device;
+
+// Partition table integrity audit. For each disk, we read only the sectors
+// required (MBR, GPT headers and both entry arrays) using aligned O_DIRECT
+// reads, and check:
+//
+//  - the MBR signature, and for GPT, the protective MBR
+//  - the MBR code area against the SHA1 we recorded at scan time
+//  - primary and backup GPT header and entry CRCs, and their agreement
+//  - backup header placement and last_usable against the actual size (disks
+//    grown in virtual environments leave the backup GPT stranded)
+//  - partitions which overlap, or fall outside the usable area
+//
+// Problems are reported via diag(). Returns the number of problems found,
+// or -1 if the device couldn't be audited.
+int audit_ptable(const struct device *);
+
+// Audit every partitionable (LAYOUT_NONE) disk with loaded media, in
+// parallel. Returns the total number of problems found, or -1 on error.
+// *disks, if non-NULL, receives the number of disks audited.
+int audit_ptables(unsigned *disks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
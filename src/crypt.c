@@ -1,38 +1,227 @@
 // copyright 2012–2021 nick black
 #include <stdio.h> // libcryptsetup.h needs size_t
+#include <unistd.h>
 #include <libcryptsetup.h>
 
 #include "crypt.h"
 #include "growlight.h"
 
-// Create LUKS on the device
-int cryptondev(device *d){
-	struct crypt_params_luks1 params;
+// Ciphers we're willing to use, in order of preference
+static const struct {
+	const char *cipher, *mode;
+	unsigned keybits;
+	unsigned ivbytes;
+} luks_ciphers[] = {
+	{ "aes", "xts-plain64", 512, 16, },
+	{ "aes", "xts-plain64", 256, 16, },
+	{ "serpent", "xts-plain64", 512, 16, },
+	{ "twofish", "xts-plain64", 512, 16, },
+	// for CPUs without AES instructions
+	{ "xchacha12,aes", "adiantum-plain64", 256, 32, },
+};
+
+// Benchmark each cipher, returning the index of the most preferred whose
+// slower direction is within CRYPT_BENCH_MARGIN_PCT of the fastest's, and
+// writing its throughput to mbs. Returns -1 if none could be benchmarked.
+static int
+pick_cipher(double *mbs){
+	double scores[sizeof(luks_ciphers) / sizeof(*luks_ciphers)];
+	double best = 0;
+	int z, pick = -1;
+
+	for(z = 0 ; z < (int)(sizeof(luks_ciphers) / sizeof(*luks_ciphers)) ; ++z){
+		double enc, dec;
+
+		scores[z] = 0;
+		if(crypt_benchmark(NULL, luks_ciphers[z].cipher, luks_ciphers[z].mode,
+					luks_ciphers[z].keybits / CHAR_BIT, luks_ciphers[z].ivbytes,
+					CRYPT_BENCH_BUFFER, &enc, &dec)){
+			verbf("Couldn't benchmark %s-%s\n", luks_ciphers[z].cipher, luks_ciphers[z].mode);
+			continue;
+		}
+		scores[z] = enc < dec ? enc : dec;
+		verbf("%s-%s/%u: %.1fMB/s\n", luks_ciphers[z].cipher, luks_ciphers[z].mode,
+				luks_ciphers[z].keybits, scores[z]);
+		if(scores[z] > best){
+			best = scores[z];
+		}
+	}
+	for(z = 0 ; z < (int)(sizeof(luks_ciphers) / sizeof(*luks_ciphers)) ; ++z){
+		if(scores[z] > 0 && scores[z] * 100 >= best * (100 - CRYPT_BENCH_MARGIN_PCT)){
+			pick = z;
+			*mbs = scores[z];
+			break;
+		}
+	}
+	return pick;
+}
+
+// Benchmark argon2id (falling back to PBKDF2) for CRYPT_PBKDF_MS of work on
+// this machine, with up to CRYPT_PBKDF_THREADS threads and a quarter of
+// memory (no more than CRYPT_PBKDF_MAX_KB).
+static int
+pick_pbkdf(struct crypt_pbkdf_type *pbkdf, size_t keybytes){
+	static const char salt[32] = "growlight pbkdf benchmark salt";
+	const long pagesz = sysconf(_SC_PAGESIZE);
+	const long pages = sysconf(_SC_PHYS_PAGES);
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uintmax_t memkb = CRYPT_PBKDF_MAX_KB;
+
+	if(pagesz > 0 && pages > 0 && (uintmax_t)pagesz * pages / 4 / 1024 < memkb){
+		memkb = (uintmax_t)pagesz * pages / 4 / 1024;
+	}
+	if(cpus <= 0){
+		cpus = 1;
+	}
+	memset(pbkdf, 0, sizeof(*pbkdf));
+	pbkdf->type = CRYPT_KDF_ARGON2ID;
+	pbkdf->hash = "sha256";
+	pbkdf->time_ms = CRYPT_PBKDF_MS;
+	pbkdf->max_memory_kb = memkb;
+	pbkdf->parallel_threads = cpus < CRYPT_PBKDF_THREADS ? cpus : CRYPT_PBKDF_THREADS;
+	if(crypt_benchmark_pbkdf(NULL, pbkdf, "benchmark", 9, salt, sizeof(salt),
+				keybytes, NULL, NULL) == 0){
+		pbkdf->flags = CRYPT_PBKDF_NO_BENCHMARK;
+		return 0;
+	}
+	verbf("Couldn't benchmark %s, trying %s\n", CRYPT_KDF_ARGON2ID, CRYPT_KDF_PBKDF2);
+	memset(pbkdf, 0, sizeof(*pbkdf));
+	pbkdf->type = CRYPT_KDF_PBKDF2;
+	pbkdf->hash = "sha256";
+	pbkdf->time_ms = CRYPT_PBKDF_MS;
+	if(crypt_benchmark_pbkdf(NULL, pbkdf, "benchmark", 9, salt, sizeof(salt),
+				keybytes, NULL, NULL) == 0){
+		pbkdf->flags = CRYPT_PBKDF_NO_BENCHMARK;
+		return 0;
+	}
+	diag("Couldn't benchmark a PBKDF\n");
+	return -1;
+}
+
+// dm-crypt sectors as large as the device's physical sectors, within what
+// LUKS2 supports
+static uint32_t
+luks_sector_size(const device *d){
+	unsigned ss = d->physsec > d->logsec ? d->physsec : d->logsec;
+
+	if(ss > 4096){
+		ss = 4096;
+	}
+	if(ss < 512 || (ss & (ss - 1))){
+		ss = 512;
+	}
+	// the data area must hold a whole number of sectors
+	while(ss > 512 && d->size % ss){
+		ss /= 2;
+	}
+	return ss;
+}
+
+// Create LUKS on the device, keyed by the passphrase or the keyfile
+int cryptondev(device *d, const char *passphrase, const char *keyfile){
+	struct crypt_params_luks2 params;
+	struct crypt_pbkdf_type pbkdf;
 	struct crypt_device *cctx;
 	char path[PATH_MAX + 1];
+	size_t keybytes, keylen;
+	char *keybuf = NULL;
+	const char *key;
+	double mbs;
+	int c;
 
+	if((passphrase == NULL || *passphrase == '\0') && keyfile == NULL){
+		diag("Won't create LUKS on %s without a passphrase or keyfile\n", d->name);
+		return -1;
+	}
 	if((unsigned)snprintf(path, sizeof(path), "/dev/%s", d->name) >= sizeof(path)){
 		diag("Bad path: /dev/%s\n", d->name);
 		return -1;
 	}
+	if((c = pick_cipher(&mbs)) < 0){
+		diag("Couldn't benchmark any cipher for %s\n", d->name);
+		return -1;
+	}
+	keybytes = luks_ciphers[c].keybits / CHAR_BIT;
+	if(pick_pbkdf(&pbkdf, keybytes)){
+		return -1;
+	}
 	if(crypt_init(&cctx, path)){
 		diag("Couldn't create LUKS context for %s\n", d->name);
 		return -1;
 	}
+	if(keyfile){
+		if(crypt_keyfile_read(cctx, keyfile, &keybuf, &keylen, 0, 0, 0) || keylen == 0){
+			diag("Couldn't read a key from %s\n", keyfile);
+			goto err;
+		}
+		key = keybuf;
+	}else{
+		key = passphrase;
+		keylen = strlen(passphrase);
+	}
 	memset(&params, 0, sizeof(params));
-	params.hash = "sha1";
-	if(crypt_format(cctx, CRYPT_LUKS1, "aes", "xts-plain64", NULL, NULL, 256 / CHAR_BIT, &params)){
+	params.pbkdf = &pbkdf;
+	params.sector_size = luks_sector_size(d);
+	diag("LUKS2 on %s: %s-%s/%u (%.1fMB/s), %uB sectors, %s\n", d->name,
+			luks_ciphers[c].cipher, luks_ciphers[c].mode, luks_ciphers[c].keybits,
+			mbs, params.sector_size, pbkdf.type);
+	if(crypt_format(cctx, CRYPT_LUKS2, luks_ciphers[c].cipher, luks_ciphers[c].mode,
+				NULL, NULL, keybytes, &params)){
 		diag("Couldn't format LUKS on %s\n", d->name);
-		crypt_free(cctx);
+		goto err;
+	}
+	if(crypt_keyslot_add_by_volume_key(cctx, CRYPT_ANY_SLOT, NULL, 0, key, keylen) < 0){
+		diag("Couldn't add a keyslot to LUKS on %s\n", d->name);
+		goto err;
+	}
+	crypt_safe_free(keybuf);
+	crypt_free(cctx);
+	return 0;
+
+err:
+	crypt_safe_free(keybuf);
+	crypt_free(cctx);
+	return -1;
+}
+
+int crypt_describe(device *d){
+	struct crypt_pbkdf_type pbkdf;
+	struct crypt_device *cctx;
+	char path[PATH_MAX + 1];
+	char *desc;
+	int slot, r;
+
+	free(d->crypt);
+	d->crypt = NULL;
+	if(d->mnttype == NULL || strcmp(d->mnttype, "crypto_LUKS")){
+		return 0;
+	}
+	if((unsigned)snprintf(path, sizeof(path), "/dev/%s", d->name) >= sizeof(path)){
 		return -1;
 	}
-	// FIXME acquire a real passphrase!
-	if(crypt_keyslot_add_by_volume_key(cctx, CRYPT_ANY_SLOT, NULL, 0, "r00tme", 6) < 0){
-		diag("Couldn't open LUKS on %s\n", d->name);
+	if(crypt_init(&cctx, path)){
+		return -1;
+	}
+	if(crypt_load(cctx, CRYPT_LUKS, NULL)){
+		verbf("Couldn't load LUKS header from %s\n", path);
 		crypt_free(cctx);
 		return -1;
 	}
+	for(slot = 0 ; slot < CRYPT_LUKS2_SLOTS ; ++slot){
+		if(crypt_keyslot_get_pbkdf(cctx, slot, &pbkdf) == 0){
+			break;
+		}
+	}
+	r = asprintf(&desc, "%s %s-%s/%d %dB sectors%s%s", crypt_get_type(cctx),
+			crypt_get_cipher(cctx), crypt_get_cipher_mode(cctx),
+			crypt_get_volume_key_size(cctx) * CHAR_BIT, crypt_get_sector_size(cctx),
+			slot < CRYPT_LUKS2_SLOTS ? " " : "",
+			slot < CRYPT_LUKS2_SLOTS ? pbkdf.type : "");
 	crypt_free(cctx);
+	if(r < 0){
+		return -1;
+	}
+	d->crypt = desc;
 	return 0;
 }
 
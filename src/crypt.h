@@ -8,8 +8,30 @@ extern "C" {
 
 struct device;
 
-// Create LUKS on the device
-int cryptondev(struct device *);
+// Ciphers are benchmarked over this many bytes. The most preferred cipher
+// within CRYPT_BENCH_MARGIN_PCT of the fastest's throughput is chosen.
+#define CRYPT_BENCH_BUFFER (1024 * 1024)
+#define CRYPT_BENCH_MARGIN_PCT 10
+
+// The PBKDF (argon2id where possible) is benchmarked to take CRYPT_PBKDF_MS
+// of this machine's time, using no more than CRYPT_PBKDF_THREADS threads and
+// CRYPT_PBKDF_MAX_KB of memory.
+#define CRYPT_PBKDF_MS 2000
+#define CRYPT_PBKDF_THREADS 4
+#define CRYPT_PBKDF_MAX_KB (1024 * 1024)
+
+#define CRYPT_LUKS2_SLOTS 32
+
+// Create LUKS2 on the device, with dm-crypt sectors matching its physical
+// sectors, and the cipher and PBKDF chosen by benchmarking this machine. The
+// first keyslot is keyed by the keyfile if one is provided, and otherwise by
+// the passphrase. Without either, the device is not touched.
+int cryptondev(struct device *, const char *passphrase, const char *keyfile);
+
+// Describe the LUKS header's cipher, key size, sector size and PBKDF in
+// d->crypt, if d->mnttype is crypto_LUKS. Called with the growlight lock
+// held as the device is probed.
+int crypt_describe(struct device *d);
 
 int crypt_start(void);
 int crypt_stop(void);
@@ -1,107 +1,769 @@
 // copyright 2012–2021 nick black
+#include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
 #include <unistd.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <libdevmapper.h>
 
 #include "dm.h"
+#include "stack.h"
 #include "sysfs.h"
 #include "growlight.h"
 
-int explore_dm_sysfs(device *d,int dirfd){
-	/*unsigned long rd;
-	mdslave **enqm;*/
+// Unlike md, dm doesn't enumerate its components within its own sysfs
+// directory, so we walk the block device's slaves/ (dirfd is its dm/).
+static int
+explore_dm_slaves(device *d,int dirfd){
+	struct dirent *dire;
+	mdslave **enqm;
+	DIR *dir;
+	int fd;
 
-	d->dmdev.disks = 1;
-	if((d->model = strdup("Linux devmapper")) == NULL){
-		return -1;
-	}
-	if((d->dmdev.uuid = get_sysfs_string(dirfd,"uuid")) == NULL){
-		verbf("Warning: no 'uuid' content in dm device %s\n",d->name);
+	if((fd = openat(dirfd,"../slaves",O_RDONLY|O_CLOEXEC|O_DIRECTORY)) < 0){
+		verbf("Warning: no slaves/ for dm device %s\n",d->name);
+		return 0;
 	}
-	if((d->dmdev.dmname = get_sysfs_string(dirfd,"name")) == NULL){
-		verbf("Warning: no 'name' content in dm device %s\n",d->name);
+	if((dir = fdopendir(fd)) == NULL){
+		diag("Couldn't get DIR * from fd %d for %s (%s)\n",fd,d->name,strerror(errno));
+		close(fd);
+		return -1;
 	}
-	d->dmdev.transport = AGGREGATE_UNKNOWN;
-	// FIXME need to browse slaves/ subdirectory in sysfs entry
-	/*enqm = &d->dmdev.slaves;
-	for(rd = 0 ; rd < d->dmdev.disks ; ++rd){
-		char buf[NAME_MAX],lbuf[NAME_MAX],*c;
+	enqm = &d->dmdev.slaves;
+	while(errno = 0, (dire = readdir(dir)) != NULL){
 		device *subd;
 		mdslave *m;
-		int r;
+		char *c;
 
-		if(snprintf(buf,sizeof(buf),"rd%lu",rd) >= (int)sizeof(buf)){
-			diag("Couldn't look up raid device %lu\n",rd);
-			errno = ENAMETOOLONG;
-			return -1;
-		}
-		r = readlinkat(dirfd,buf,lbuf,sizeof(lbuf));
-		if((r < 0 && errno != ENOENT) || r >= (int)sizeof(lbuf)){
-			int e = errno;
-
-			diag("Couldn't look up slave %s (%s?)\n",buf,strerror(errno));
-			errno = e;
-			return -1;
-		}else if(r < 0 && errno == ENOENT){
-			// missing/faulted device -- represent somehow?
+		if(dire->d_type != DT_LNK){
 			continue;
 		}
-		lbuf[r] = '\0';
-		if(strncmp(lbuf,"dev-",4)){
-			diag("Couldn't get device from %s\n",lbuf);
-			return -1;
-		}
-		if((c = strdup(lbuf + 4)) == NULL){
+		if((c = strdup(dire->d_name)) == NULL){
+			closedir(dir);
 			return -1;
 		}
 		if((m = malloc(sizeof(*m))) == NULL){
 			free(c);
+			closedir(dir);
 			return -1;
 		}
 		m->name = c;
 		m->next = NULL;
 		*enqm = m;
 		enqm = &m->next;
-		//m->component = subd;
+		++d->dmdev.disks;
 		lock_growlight();
 		if((subd = lookup_device(c)) == NULL){
 			unlock_growlight();
+			closedir(dir);
 			return -1;
 		}
-		switch(subd->layout){
-			case LAYOUT_NONE:
-				if(d->dmdev.transport == AGGREGATE_UNKNOWN){
-					d->dmdev.transport = subd->blkdev.transport;
-				}else if(d->dmdev.transport != subd->blkdev.transport){
-					d->dmdev.transport = AGGREGATE_MIXED;
-				}
-				break;
-			case LAYOUT_MDADM:
-				if(d->dmdev.transport == AGGREGATE_UNKNOWN){
-					d->dmdev.transport = subd->dmdev.transport;
-				}else if(d->dmdev.transport != subd->dmdev.transport){
-					d->dmdev.transport = AGGREGATE_MIXED;
-				}
-				break;
-			case LAYOUT_PARTITION:
-				if(d->dmdev.transport == AGGREGATE_UNKNOWN){
-					d->dmdev.transport = subd->partdev.parent->blkdev.transport;
-				}else if(d->dmdev.transport != subd->partdev.parent->blkdev.transport){
-					d->dmdev.transport = AGGREGATE_MIXED;
-				}
-				break;
-			case LAYOUT_ZPOOL:
-				if(d->dmdev.transport == AGGREGATE_UNKNOWN){
-					d->dmdev.transport = subd->zpool.transport;
-				}else if(d->dmdev.transport != subd->zpool.transport){
-					d->dmdev.transport = AGGREGATE_MIXED;
+		d->dmdev.transport = merge_transport(d->dmdev.transport,subd);
+		unlock_growlight();
+	}
+	if(errno){
+		diag("Error reading slaves of %s (%s)\n",d->name,strerror(errno));
+		closedir(dir);
+		return -1;
+	}
+	closedir(dir);
+	return 0;
+}
+
+int explore_dm_sysfs(device *d,int dirfd){
+	d->dmdev.disks = 0;
+	if((d->model = strdup("Linux devmapper")) == NULL){
+		return -1;
+	}
+	if((d->dmdev.uuid = get_sysfs_string(dirfd,"uuid")) == NULL){
+		verbf("Warning: no 'uuid' content in dm device %s\n",d->name);
+	}
+	if((d->dmdev.dmname = get_sysfs_string(dirfd,"name")) == NULL){
+		verbf("Warning: no 'name' content in dm device %s\n",d->name);
+	}
+	d->dmdev.transport = AGGREGATE_UNKNOWN;
+	if(explore_dm_slaves(d,dirfd)){
+		return -1;
+	}
+	return 0;
+}
+
+// A member of a new map, in 512-byte sectors
+typedef struct dmmember {
+	char *path;		// /dev path
+	uint64_t sectors;
+	const controller *c;
+	unsigned optio, minio, physsec;
+} dmmember;
+
+static void
+free_dmmembers(dmmember *m,int n){
+	while(n--){
+		free(m[n].path);
+	}
+	free(m);
+}
+
+// Look up and size each component. Returns NULL on failure.
+static dmmember *
+get_dmmembers(char * const *comps,int n){
+	dmmember *m;
+	int z;
+
+	if((m = calloc(n,sizeof(*m))) == NULL){
+		diag("Couldn't allocate %d members (%s?)\n",n,strerror(errno));
+		return NULL;
+	}
+	for(z = 0 ; z < n ; ++z){
+		uint64_t bytes;
+		device *d;
+		int fd;
+
+		lock_growlight();
+		if((d = lookup_device(comps[z])) == NULL){
+			unlock_growlight();
+			free_dmmembers(m,z);
+			return NULL;
+		}
+		m[z].c = d->c;
+		m[z].optio = d->optio;
+		m[z].minio = d->minio;
+		m[z].physsec = d->physsec;
+		unlock_growlight();
+		if((m[z].path = malloc(strlen(comps[z]) + 6)) == NULL){
+			free_dmmembers(m,z);
+			return NULL;
+		}
+		sprintf(m[z].path,"/dev/%s",comps[z]);
+		if((fd = openat(devfd,comps[z],O_RDONLY|O_CLOEXEC)) < 0){
+			diag("Couldn't open %s (%s?)\n",m[z].path,strerror(errno));
+			free_dmmembers(m,z + 1);
+			return NULL;
+		}
+		if(ioctl(fd,BLKGETSIZE64,&bytes)){
+			diag("Couldn't size %s (%s?)\n",m[z].path,strerror(errno));
+			close(fd);
+			free_dmmembers(m,z + 1);
+			return NULL;
+		}
+		close(fd);
+		if((m[z].sectors = bytes / 512) == 0){
+			diag("%s is empty\n",m[z].path);
+			free_dmmembers(m,z + 1);
+			return NULL;
+		}
+	}
+	return m;
+}
+
+// Order members so that consecutive chunks go to different controllers
+// wherever possible: round-robin over the controllers, in order of first
+// appearance, taking each controller's members in the order given.
+static void
+interleave_dmmembers(dmmember *m,int n){
+	dmmember *sorted;
+	int z,placed,*taken;
+
+	if((sorted = malloc(sizeof(*sorted) * n)) == NULL){
+		return; // merely suboptimal
+	}
+	if((taken = calloc(n,sizeof(*taken))) == NULL){
+		free(sorted);
+		return;
+	}
+	placed = 0;
+	while(placed < n){
+		const controller *seen[n];
+		int nseen = 0;
+
+		for(z = 0 ; z < n ; ++z){
+			int y;
+
+			if(taken[z]){
+				continue;
+			}
+			for(y = 0 ; y < nseen ; ++y){
+				if(seen[y] == m[z].c){
+					break;
 				}
-				break;
-			default:
-				diag("Unknown layout %d on %s\n",subd->layout,subd->name);
-				break;
+			}
+			if(y < nseen){
+				continue; // this pass already used the controller
+			}
+			seen[nseen++] = m[z].c;
+			sorted[placed++] = m[z];
+			taken[z] = 1;
+		}
+	}
+	memcpy(m,sorted,sizeof(*m) * n);
+	free(taken);
+	free(sorted);
+}
+
+static uintmax_t
+lcm(uintmax_t a,uintmax_t b){
+	uintmax_t x = a,y = b;
+
+	while(y){
+		uintmax_t t = x % y;
+
+		x = y;
+		y = t;
+	}
+	return a / x * b;
+}
+
+// The largest optimal I/O size any member reports (it's usually a RAID
+// set's stripe width, which a chunk ought cover whole), else the default,
+// made a multiple of every member's minimum I/O and physical sector size.
+static uintmax_t
+derive_stripe_chunk(const dmmember *m,int n){
+	uintmax_t chunk = 0,gran = 512;
+	int z;
+
+	for(z = 0 ; z < n ; ++z){
+		if(m[z].optio > chunk){
+			chunk = m[z].optio;
+		}
+		if(m[z].minio){
+			gran = lcm(gran,m[z].minio);
+		}
+		if(m[z].physsec){
+			gran = lcm(gran,m[z].physsec);
+		}
+	}
+	if(chunk == 0){
+		chunk = DM_STRIPE_DEFAULT_CHUNK;
+	}
+	return (chunk + gran - 1) / gran * gran;
+}
+
+uintmax_t dm_stripe_chunk(char * const *comps,int n){
+	uintmax_t chunk;
+	dmmember *m;
+
+	if((m = get_dmmembers(comps,n)) == NULL){
+		return 0;
+	}
+	chunk = derive_stripe_chunk(m,n);
+	free_dmmembers(m,n);
+	return chunk;
+}
+
+// Create the map from its table of count segments, and wait on udev to
+// make its nodes.
+static int
+create_dm_map(const char *name,const char *target,unsigned count,
+		const uint64_t *starts,const uint64_t *lengths,char * const *params){
+	uint32_t cookie = 0;
+	struct dm_task *dmt;
+	unsigned z;
+
+	if((dmt = dm_task_create(DM_DEVICE_CREATE)) == NULL){
+		diag("Couldn't create dm task for %s\n",name);
+		return -1;
+	}
+	if(!dm_task_set_name(dmt,name)){
+		diag("Couldn't name dm device %s\n",name);
+		dm_task_destroy(dmt);
+		return -1;
+	}
+	for(z = 0 ; z < count ; ++z){
+		verbf("%s: %ju %ju %s %s\n",name,(uintmax_t)starts[z],
+			(uintmax_t)lengths[z],target,params[z]);
+		if(!dm_task_add_target(dmt,starts[z],lengths[z],target,params[z])){
+			diag("Couldn't add %s target to %s\n",target,name);
+			dm_task_destroy(dmt);
+			return -1;
+		}
+	}
+	if(!dm_task_set_cookie(dmt,&cookie,0) || !dm_task_run(dmt)){
+		diag("Couldn't create dm device %s\n",name);
+		if(cookie){
+			dm_udev_wait(cookie);
+		}
+		dm_task_destroy(dmt);
+		return -1;
+	}
+	dm_udev_wait(cookie);
+	dm_task_destroy(dmt);
+	return 0;
+}
+
+int make_dmstriped_chunk(const char *name,char * const *comps,int n,uintmax_t chunk){
+	uint64_t start = 0,length,minsect;
+	size_t plen,pos;
+	char *params;
+	dmmember *m;
+	int z,r;
+
+	if(n < 2){
+		diag("Striping needs at least 2 devices (got %d)\n",n);
+		return -1;
+	}
+	if((m = get_dmmembers(comps,n)) == NULL){
+		return -1;
+	}
+	if(chunk == 0){
+		chunk = derive_stripe_chunk(m,n);
+	}
+	if(chunk % 512 || chunk / 512 > UINT32_MAX){
+		diag("Invalid chunk size %ju for %s\n",chunk,name);
+		free_dmmembers(m,n);
+		return -1;
+	}
+	interleave_dmmembers(m,n);
+	minsect = m[0].sectors;
+	plen = 64;
+	for(z = 0 ; z < n ; ++z){
+		if(m[z].sectors < minsect){
+			minsect = m[z].sectors;
 		}
+		plen += strlen(m[z].path) + 4;
+	}
+	// every member contributes the smallest member's worth of whole chunks
+	if((length = minsect / (chunk / 512) * (chunk / 512) * n) == 0){
+		diag("Members are smaller than the chunk (%ju)\n",chunk);
+		free_dmmembers(m,n);
+		return -1;
+	}
+	if((params = malloc(plen)) == NULL){
+		free_dmmembers(m,n);
+		return -1;
+	}
+	pos = sprintf(params,"%d %ju",n,chunk / 512);
+	for(z = 0 ; z < n ; ++z){
+		pos += sprintf(params + pos," %s 0",m[z].path);
+	}
+	diag("Striping %s across %d devices with %ju-byte chunks\n",name,n,chunk);
+	r = create_dm_map(name,"striped",1,&start,&length,&params);
+	free(params);
+	free_dmmembers(m,n);
+	return r;
+}
+
+int make_dmstriped(const char *name,char * const *comps,int n){
+	return make_dmstriped_chunk(name,comps,n,0);
+}
+
+int make_dmlinear(const char *name,char * const *comps,int n){
+	uint64_t *starts,*lengths,start = 0;
+	char **params;
+	dmmember *m;
+	int z,r = -1;
+
+	if((m = get_dmmembers(comps,n)) == NULL){
+		return -1;
+	}
+	starts = malloc(sizeof(*starts) * n);
+	lengths = malloc(sizeof(*lengths) * n);
+	params = calloc(n,sizeof(*params));
+	if(starts == NULL || lengths == NULL || params == NULL){
+		goto done;
+	}
+	for(z = 0 ; z < n ; ++z){
+		if((params[z] = malloc(strlen(m[z].path) + 3)) == NULL){
+			goto done;
+		}
+		sprintf(params[z],"%s 0",m[z].path);
+		starts[z] = start;
+		lengths[z] = m[z].sectors;
+		start += m[z].sectors;
+	}
+	r = create_dm_map(name,"linear",n,starts,lengths,params);
+
+done:
+	if(params){
+		for(z = 0 ; z < n ; ++z){
+			free(params[z]);
+		}
+	}
+	free(params);
+	free(lengths);
+	free(starts);
+	free_dmmembers(m,n);
+	return r;
+}
+
+static int
+remove_dm_map(const char *name){
+	uint32_t cookie = 0;
+	struct dm_task *dmt;
+	int r = 0;
+
+	if((dmt = dm_task_create(DM_DEVICE_REMOVE)) == NULL){
+		diag("Couldn't create dm task for %s\n",name);
+		return -1;
+	}
+	if(!dm_task_set_name(dmt,name) || !dm_task_set_cookie(dmt,&cookie,0) ||
+			!dm_task_run(dmt)){
+		diag("Couldn't remove dm device %s\n",name);
+		r = -1;
+	}
+	if(cookie){
+		dm_udev_wait(cookie);
+	}
+	dm_task_destroy(dmt);
+	return r;
+}
+
+// Is the component backed by solid-state storage, and how fast is its disk?
+static int
+cache_member_class(const char *comp,int *ssd,uintmax_t *bw){
+	const device *d;
+
+	lock_growlight();
+	if((d = lookup_device(comp)) == NULL){
 		unlock_growlight();
-	}*/
+		return -1;
+	}
+	*ssd = stack_solid_state_p(d);
+	if(d->layout == LAYOUT_PARTITION && d->partdev.parent){
+		d = d->partdev.parent;
+	}
+	if((*bw = stack_member_bw(d)) == 0){
+		stack_slowest(d,bw);
+	}
+	unlock_growlight();
+	return 0;
+}
+
+// Size the two components, and determine which is to be the cache: a
+// solid-state device fronts one with rotating disks beneath it, and failing
+// that, the one with more nominal bandwidth fronts the other. The cache must
+// be the smaller. Returns NULL on failure, otherwise the members, with the
+// cache's index written to fast.
+static dmmember *
+cache_pair(char * const *comps,int n,int *fast){
+	uintmax_t bw[2];
+	dmmember *m;
+	int ssd[2];
+
+	if(n != 2){
+		diag("A cache pairs exactly 2 devices (got %d)\n",n);
+		return NULL;
+	}
+	if(cache_member_class(comps[0],&ssd[0],&bw[0]) ||
+			cache_member_class(comps[1],&ssd[1],&bw[1])){
+		return NULL;
+	}
+	if(ssd[0] != ssd[1]){
+		*fast = ssd[0] ? 0 : 1;
+	}else if(bw[0] != bw[1]){
+		*fast = bw[0] > bw[1] ? 0 : 1;
+	}else{
+		diag("Can't tell which of %s and %s ought be the cache\n",comps[0],comps[1]);
+		return NULL;
+	}
+	if((m = get_dmmembers(comps,n)) == NULL){
+		return NULL;
+	}
+	if(m[*fast].sectors >= m[!*fast].sectors){
+		diag("Cache %s is no smaller than origin %s\n",m[*fast].path,m[!*fast].path);
+		free_dmmembers(m,n);
+		return NULL;
+	}
+	return m;
+}
+
+// Zero the first 4KiB of the cache, so that the target formats new metadata
+// rather than rejecting (or worse, trusting) whatever it finds there
+static int
+zero_cache_superblock(const char *path){
+	char buf[4096];
+	int fd;
+
+	memset(buf,0,sizeof(buf));
+	if((fd = open(path,O_WRONLY|O_CLOEXEC|O_EXCL)) < 0){
+		diag("Couldn't open %s (%s?)\n",path,strerror(errno));
+		return -1;
+	}
+	if(pwrite(fd,buf,sizeof(buf),0) != (ssize_t)sizeof(buf) || fsync(fd)){
+		diag("Couldn't zero %s (%s?)\n",path,strerror(errno));
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+uintmax_t dm_cache_block(uintmax_t cachebytes){
+	uintmax_t block = DM_CACHE_MIN_BLOCK;
+
+	while(cachebytes / block > DM_CACHE_MAX_BLOCKS){
+		block *= 2;
+	}
+	return block;
+}
+
+uintmax_t dm_cache_metadata(uintmax_t cachebytes){
+	uintmax_t blocks = cachebytes / dm_cache_block(cachebytes);
+	uintmax_t bytes = 4ull * 1024 * 1024 + 16 * blocks;
+
+	bytes = (bytes + 1024 * 1024 - 1) / (1024 * 1024) * 1024 * 1024;
+	return bytes < DM_CACHE_MIN_METADATA ? DM_CACHE_MIN_METADATA : bytes;
+}
+
+// Carve the cache into metadata and data linear maps, and put a cache
+// target over the origin atop them
+static int
+make_dmcache(const char *name,char * const *comps,int n,const char *mode){
+	char metaname[NAME_MAX],dataname[NAME_MAX],params[PATH_MAX * 3 + 64];
+	char metaparams[PATH_MAX + 32],dataparams[PATH_MAX + 32],*pp;
+	uint64_t metasect,datasect,blocksect,start = 0;
+	const dmmember *fast,*slow;
+	dmmember *m;
+	int f;
+
+	if((m = cache_pair(comps,n,&f)) == NULL){
+		return -1;
+	}
+	fast = &m[f];
+	slow = &m[!f];
+	metasect = dm_cache_metadata(fast->sectors * 512) / 512;
+	blocksect = dm_cache_block(fast->sectors * 512) / 512;
+	if(fast->sectors <= metasect + blocksect){
+		diag("%s is too small for a cache\n",fast->path);
+		free_dmmembers(m,n);
+		return -1;
+	}
+	datasect = (fast->sectors - metasect) / blocksect * blocksect;
+	snprintf(metaname,sizeof(metaname),"%s-cmeta",name);
+	snprintf(dataname,sizeof(dataname),"%s-cdata",name);
+	snprintf(metaparams,sizeof(metaparams),"%s 0",fast->path);
+	snprintf(dataparams,sizeof(dataparams),"%s %ju",fast->path,(uintmax_t)metasect);
+	snprintf(params,sizeof(params),"/dev/mapper/%s /dev/mapper/%s %s %ju 1 %s default 0",
+			metaname,dataname,slow->path,(uintmax_t)blocksect,mode);
+	diag("Caching %s with %s (%s, %juKiB blocks, %juMiB metadata)\n",slow->path,
+			fast->path,mode,(uintmax_t)blocksect / 2,(uintmax_t)metasect / 2048);
+	if(zero_cache_superblock(fast->path)){
+		free_dmmembers(m,n);
+		return -1;
+	}
+	pp = metaparams;
+	if(create_dm_map(metaname,"linear",1,&start,&metasect,&pp)){
+		free_dmmembers(m,n);
+		return -1;
+	}
+	pp = dataparams;
+	if(create_dm_map(dataname,"linear",1,&start,&datasect,&pp)){
+		remove_dm_map(metaname);
+		free_dmmembers(m,n);
+		return -1;
+	}
+	pp = params;
+	if(create_dm_map(name,"cache",1,&start,&slow->sectors,&pp)){
+		remove_dm_map(dataname);
+		remove_dm_map(metaname);
+		free_dmmembers(m,n);
+		return -1;
+	}
+	free_dmmembers(m,n);
 	return 0;
 }
+
+int make_dmcache_wt(const char *name,char * const *comps,int n){
+	return make_dmcache(name,comps,n,"writethrough");
+}
+
+int make_dmcache_wb(const char *name,char * const *comps,int n){
+	return make_dmcache(name,comps,n,"writeback");
+}
+
+int make_dmwritecache(const char *name,char * const *comps,int n){
+	char params[PATH_MAX * 2 + 32],*pp = params;
+	const dmmember *fast,*slow;
+	uint64_t start = 0;
+	unsigned block;
+	dmmember *m;
+	int f,r;
+
+	if((m = cache_pair(comps,n,&f)) == NULL){
+		return -1;
+	}
+	fast = &m[f];
+	slow = &m[!f];
+	// a block must cover either device's physical sector
+	block = fast->physsec > slow->physsec ? fast->physsec : slow->physsec;
+	if(block < 4096){
+		block = 4096;
+	}
+	snprintf(params,sizeof(params),"s %s %s %u 0",slow->path,fast->path,block);
+	diag("Write-caching %s with %s (%uB blocks)\n",slow->path,fast->path,block);
+	if(zero_cache_superblock(fast->path)){
+		free_dmmembers(m,n);
+		return -1;
+	}
+	r = create_dm_map(name,"writecache",1,&start,&slow->sectors,&pp);
+	free_dmmembers(m,n);
+	return r;
+}
+
+// Pull up to max unsigned integers out of a status line
+static int
+lex_status(const char *params,uintmax_t *vals,int max){
+	int n = 0;
+
+	while(n < max && *params){
+		char *e;
+
+		while(*params == ' '){
+			++params;
+		}
+		if(*params == '\0'){
+			break;
+		}
+		vals[n] = strtoumax(params,&e,10);
+		if(e == params){
+			break;
+		}
+		++n;
+		params = e;
+		if(*params == '/'){ // "used/total" pairs become two values
+			++params;
+		}
+	}
+	return n;
+}
+
+static void
+update_cache_counters(device *d,uintmax_t rh,uintmax_t rm,uintmax_t wh,uintmax_t wm){
+	uintmax_t oldhits = d->dmdev.readhits + d->dmdev.writehits;
+	uintmax_t oldmisses = d->dmdev.readmisses + d->dmdev.writemisses;
+
+	d->dmdev.hitsdelta = rh + wh >= oldhits ? rh + wh - oldhits : 0;
+	d->dmdev.missesdelta = rm + wm >= oldmisses ? rm + wm - oldmisses : 0;
+	d->dmdev.readhits = rh;
+	d->dmdev.readmisses = rm;
+	d->dmdev.writehits = wh;
+	d->dmdev.writemisses = wm;
+}
+
+// cache: <metablock> <used>/<total meta> <cacheblock> <used>/<total cache>
+//  <read hits> <read misses> <write hits> <write misses> <demotions>
+//  <promotions> <dirty> ...
+static void
+parse_cache_status(device *d,const char *params){
+	uintmax_t v[13];
+
+	if(lex_status(params,v,13) < 13){
+		return;
+	}
+	d->dmdev.cacheused = v[4];
+	d->dmdev.cachetotal = v[5];
+	update_cache_counters(d,v[6],v[7],v[8],v[9]);
+	d->dmdev.dirty = v[12];
+}
+
+// writecache: <error> <blocks> <free> <under writeback>, followed on newer
+//  kernels by <read blocks> <read hits> <write blocks> <uncommitted write
+//  hits> <committed write hits> ...
+static void
+parse_writecache_status(device *d,const char *params){
+	uintmax_t v[9];
+	int n;
+
+	if((n = lex_status(params,v,9)) < 4){
+		return;
+	}
+	d->dmdev.cachetotal = v[1];
+	d->dmdev.cacheused = v[1] >= v[2] ? v[1] - v[2] : 0;
+	d->dmdev.dirty = v[3];
+	if(n == 9){
+		uintmax_t wh = v[7] + v[8];
+
+		update_cache_counters(d,v[5],v[4] >= v[5] ? v[4] - v[5] : 0,
+				wh,v[6] >= wh ? v[6] - wh : 0);
+	}
+}
+
+// mirror: <#mirrors> <device>... <in sync>/<regions> ...
+static void
+parse_mirror_status(device *d,const char *params){
+	uintmax_t insync,regions;
+	unsigned long mirrors;
+	char *e;
+
+	d->dmdev.mirrored = 1;
+	mirrors = strtoul(params,&e,10);
+	if(e == params){
+		return;
+	}
+	while(mirrors--){
+		e += strspn(e," ");
+		e += strcspn(e," ");
+	}
+	if(sscanf(e," %ju/%ju",&insync,&regions) == 2){
+		d->dmdev.syncing = insync < regions;
+	}
+}
+
+// raid: <raid type> <#devices> <health> <in sync>/<total> [<sync action> ...]
+static void
+parse_raid_status(device *d,const char *params){
+	char level[16],action[16] = "";
+	uintmax_t insync,total;
+
+	if(sscanf(params,"%15s %*u %*s %ju/%ju %15s",level,&insync,&total,action) < 3){
+		return;
+	}
+	d->dmdev.mirrored = !strcmp(level,"raid1");
+	d->dmdev.syncing = insync < total ||
+		(*action && strcmp(action,"idle") && strcmp(action,"frozen"));
+}
+
+int dm_status_update(device *d){
+	uint64_t start,length;
+	char *type,*params;
+	struct dm_task *dmt;
+
+	if(d->dmdev.dmname == NULL){
+		return 0;
+	}
+	// only caches and mirrors have anything for us in their status, but
+	// we need ask once to learn the target
+	if(d->dmdev.target && strcmp(d->dmdev.target,"cache") &&
+			strcmp(d->dmdev.target,"writecache") &&
+			strcmp(d->dmdev.target,"mirror") && strcmp(d->dmdev.target,"raid")){
+		return 0;
+	}
+	if((dmt = dm_task_create(DM_DEVICE_STATUS)) == NULL){
+		return -1;
+	}
+	if(!dm_task_set_name(dmt,d->dmdev.dmname) || !dm_task_run(dmt)){
+		dm_task_destroy(dmt);
+		return -1;
+	}
+	type = params = NULL;
+	dm_get_next_target(dmt,NULL,&start,&length,&type,&params);
+	if(type == NULL){
+		dm_task_destroy(dmt);
+		return 0;
+	}
+	if(d->dmdev.target == NULL){
+		if((d->dmdev.target = strdup(type)) == NULL){
+			dm_task_destroy(dmt);
+			return -1;
+		}
+	}
+	if(params){
+		if(strcmp(type,"cache") == 0){
+			parse_cache_status(d,params);
+		}else if(strcmp(type,"writecache") == 0){
+			parse_writecache_status(d,params);
+		}else if(strcmp(type,"mirror") == 0){
+			parse_mirror_status(d,params);
+		}else if(strcmp(type,"raid") == 0){
+			parse_raid_status(d,params);
+		}
+	}
+	dm_task_destroy(dmt);
+	return 1;
+}
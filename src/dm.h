@@ -6,10 +6,60 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
 struct device;
 
 int explore_dm_sysfs(struct device *,int);
 
+// Chunk used for striping when no member reports an optimal I/O size
+#define DM_STRIPE_DEFAULT_CHUNK (512 * 1024)
+
+// The chunk (in bytes) make_dmstriped() would use for these components: the
+// largest optimal_io_size among them (or DM_STRIPE_DEFAULT_CHUNK), rounded
+// up to a multiple of each one's minimum I/O and physical sector sizes.
+// Returns 0 on error.
+uintmax_t dm_stripe_chunk(char * const *comps,int n);
+
+// Create a dm-striped device with the given chunk in bytes (0 derives it as
+// dm_stripe_chunk() does). Members are reordered so that consecutive chunks
+// alternate among controllers, and each contributes as many whole chunks as
+// the smallest member holds.
+int make_dmstriped_chunk(const char *name,char * const *comps,int n,uintmax_t chunk);
+int make_dmstriped(const char *name,char * const *comps,int n);
+
+// Create a dm-linear device concatenating the components in order
+int make_dmlinear(const char *name,char * const *comps,int n);
+
+// dm-cache blocks are the smallest power of two no less than
+// DM_CACHE_MIN_BLOCK which keeps the cache under DM_CACHE_MAX_BLOCKS blocks.
+// Metadata takes 4MiB plus 16 bytes per block, rounded up to a MiB, and no
+// less than DM_CACHE_MIN_METADATA.
+#define DM_CACHE_MIN_BLOCK (64 * 1024)
+#define DM_CACHE_MAX_BLOCKS 1000000
+#define DM_CACHE_MIN_METADATA (8 * 1024 * 1024)
+
+// Block and metadata sizes (in bytes) for a cache device of this many bytes
+uintmax_t dm_cache_block(uintmax_t cachebytes);
+uintmax_t dm_cache_metadata(uintmax_t cachebytes);
+
+// Put a solid-state device in front of a slower one. Exactly two components
+// are taken, in either order; the cache is the solid-state one (or, if both
+// or neither are, the one with more bandwidth), and must be the smaller. The
+// cache's first 4KiB are zeroed. dm-cache splits the cache into <name>-cmeta
+// and <name>-cdata linear maps, in writethrough or writeback mode.
+// dm-writecache only caches writes, using the cache whole.
+int make_dmcache_wt(const char *name,char * const *comps,int n);
+int make_dmcache_wb(const char *name,char * const *comps,int n);
+int make_dmwritecache(const char *name,char * const *comps,int n);
+
+// Read the device's dm status, learning its target on the first call, and
+// refreshing the hit, miss, occupancy and dirty counts of caches, and
+// whether mirrors (and raid targets) mirror and are in sync. Called
+// with the growlight lock held, from the stats tick. Returns 1 if the
+// counts were read, 0 if there's nothing to read, -1 on error.
+int dm_status_update(struct device *d);
+
 #ifdef __cplusplus
 }
 #endif
@@ -13,6 +13,18 @@
 #include "popen.h"
 #include "growlight.h"
 
+// btrfs sectors can't exceed the page size, nor be smaller than 4KiB
+static unsigned
+btrfs_sectsize(const struct mkfsmarshal *mkm){
+	const long pagesz = sysconf(_SC_PAGESIZE);
+	unsigned ss = MKFS_BLOCK_SIZE;
+
+	if(mkm->sectsize > ss && pagesz > 0 && mkm->sectsize <= (unsigned long)pagesz){
+		ss = mkm->sectsize;
+	}
+	return ss;
+}
+
 static int
 create_btrfs(const char *dev, const struct mkfsmarshal *mkm){
 	const char *name = mkm->name;
@@ -20,7 +32,8 @@ create_btrfs(const char *dev, const struct mkfsmarshal *mkm){
 	if(name == NULL){
 		name = "SprezzaBTRFS";
 	}
-	if(vspopen_drain("mkfs.btrfs -L \"%s\" %s", name, dev)){
+	if(vspopen_drain("mkfs.btrfs %s-s %u -L \"%s\" %s",
+			mkm->force ? "-f " : "", btrfs_sectsize(mkm), name, dev)){
 		return -1;
 	}
 	return 0;
@@ -67,17 +80,51 @@ jfs_mkfs(const char *dev, const struct mkfsmarshal *mkm){
 	return 0;
 }
 
+// Sector size, data stripe unit and width, and a log striped on the same
+// unit where XFS allows it
+static int
+xfs_topology_opts(const struct mkfsmarshal *mkm, char *buf, size_t len){
+	size_t pos = 0;
+	int r;
+
+	buf[0] = '\0';
+	if(mkm->sectsize > 512){
+		if((r = snprintf(buf, len, "-s size=%u ", mkm->sectsize)) < 0 || (size_t)r >= len){
+			return -1;
+		}
+		pos = r;
+	}
+	// stripe units must be a whole number of blocks
+	if(mkm->stride && mkm->swidth && mkm->stride % MKFS_BLOCK_SIZE == 0){
+		if((r = snprintf(buf + pos, len - pos, "-d su=%ju,sw=%ju ",
+				mkm->stride, mkm->swidth)) < 0 || (size_t)r >= len - pos){
+			return -1;
+		}
+		pos += r;
+		if(mkm->stride <= MKFS_XFS_MAX_LOG_SU){
+			if((r = snprintf(buf + pos, len - pos, "-l su=%ju ", mkm->stride)) < 0
+					|| (size_t)r >= len - pos){
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
 static int
 xfs_mkfs(const char *dev, const struct mkfsmarshal *mkm){
 	// allow -c (badblock check) FIXME
 	const char *name = mkm->name;
+	char opts[128];
 
 	if(name == NULL){
 		name = "SprezzaXFS";
 	}
-	// FIXME set -s to the physical sector size
-	if(vspopen_drain("mkfs.xfs %s-L \"%s\" %s",
-			mkm->force ? "-f ": "", name, dev)){
+	if(xfs_topology_opts(mkm, opts, sizeof(opts))){
+		return -1;
+	}
+	if(vspopen_drain("mkfs.xfs %s%s-L \"%s\" %s",
+			mkm->force ? "-f ": "", opts, name, dev)){
 		return -1;
 	}
 	return 0;
@@ -97,6 +144,21 @@ create_ntfs(const char *dev, const struct mkfsmarshal *mkm){
 	return 0;
 }
 
+// Sections (f2fs' unit of cleaning) spanning whole stripes, where a stripe
+// is a multiple of the segment size
+static unsigned
+f2fs_segs_per_sec(const struct mkfsmarshal *mkm){
+	uintmax_t width = mkm->stride * mkm->swidth;
+
+	if(width <= MKFS_F2FS_SEGMENT || width % MKFS_F2FS_SEGMENT){
+		return 1;
+	}
+	if(width / MKFS_F2FS_SEGMENT > MKFS_F2FS_MAX_SEGS_PER_SEC){
+		return 1;
+	}
+	return width / MKFS_F2FS_SEGMENT;
+}
+
 static int
 f2fs_mkfs(const char *dev, const struct mkfsmarshal *mkm){
 	const char *name = mkm->name;
@@ -104,7 +166,8 @@ f2fs_mkfs(const char *dev, const struct mkfsmarshal *mkm){
 	if(name == NULL){
 		name = "SprezzaF2FS";
 	}
-	if(vspopen_drain("mkfs.f2fs -l \"%s\" %s", name, dev)){
+	if(vspopen_drain("mkfs.f2fs %s-s %u -l \"%s\" %s",
+			mkm->force ? "-f " : "", f2fs_segs_per_sec(mkm), name, dev)){
 		return -1;
 	}
 	return 0;
@@ -155,6 +218,20 @@ ufs_mkfs(const char *dev, const struct mkfsmarshal *mkm){
 	return 0;
 }
 
+// Stride and stripe width are expressed in filesystem blocks, so the
+// block size must be fixed when they're used
+static const char *
+ext_topology_opts(const struct mkfsmarshal *mkm, char *buf, size_t len){
+	uintmax_t stride = mkm->stride / MKFS_BLOCK_SIZE;
+
+	if(stride == 0 || mkm->swidth == 0 || mkm->stride % MKFS_BLOCK_SIZE){
+		return "-b -2048 ";
+	}
+	snprintf(buf, len, "-b %d -E stride=%ju,stripe_width=%ju ",
+			MKFS_BLOCK_SIZE, stride, stride * mkm->swidth);
+	return buf;
+}
+
 static int
 ext4_mkfs(const char *dev, const struct mkfsmarshal *mkm){
 	// pass -M with mount point FIXME
@@ -162,18 +239,15 @@ ext4_mkfs(const char *dev, const struct mkfsmarshal *mkm){
 	// provide -o SprezzOS (and get it recognized rather than rejected) FIXME
 	// allow -c (badblock check) FIXME
 	const char *name = mkm->name;
+	char opts[80];
 
 	if(name == NULL){
 		name = "SprezzaEXT4";
 	}
 	// FIXME Support a thorough mode or something where we use:
 	// -E lazy_itable_init=0,lazy_journal_init=0 -O ^uninit_bg" or something
-	if(mkm->stride && mkm->swidth){
-		if(vspopen_drain("mkfs.ext4 -Estride=%ju,stripe_width=%ju %s-b -2048 -L \"%s\" -O dir_index,extent %s",
-			mkm->stride, mkm->swidth, mkm->force ? "-F " : "", name, dev)){
-		}
-	}else if(vspopen_drain("mkfs.ext4 %s-b -2048 -L \"%s\" -O dir_index,extent %s",
-			     mkm->force ? "-F " : "", name, dev)){
+	if(vspopen_drain("mkfs.ext4 %s%s-L \"%s\" -O dir_index,extent %s",
+			ext_topology_opts(mkm, opts, sizeof(opts)), mkm->force ? "-F " : "", name, dev)){
 		return -1;
 	}
 	return 0;
@@ -186,17 +260,14 @@ ext3_mkfs(const char *dev, const struct mkfsmarshal *mkm){
 	// provide -o SprezzOS (and get it recognized rather than rejected) FIXME
 	// allow -c (badblock check) FIXME
 	const char *name = mkm->name;
+	char opts[80];
 
 	if(name == NULL){
 		name = "SprezzaEXT3";
 	}
 	//if(vspopen_drain("mkfs.ext3 %s-b -2048 -E lazy_itable_init=0,lazy_journal_init=0 -L \"%s\" -O dir_index,extent %s",
-	if(mkm->stride && mkm->swidth){
-		if(vspopen_drain("mkfs.ext3 -Estride=%ju,stripe_width=%ju %s-b -2048 -L \"%s\" -O dir_index,extent %s",
-			mkm->stride, mkm->swidth, mkm->force ? "-F ": "", name, dev)){
-		}
-	}else if(vspopen_drain("mkfs.ext3 %s-b -2048 -L \"%s\" -O dir_index,extent %s",
-			mkm->force ? "-F ": "", name, dev)){
+	if(vspopen_drain("mkfs.ext3 %s%s-L \"%s\" -O dir_index,extent %s",
+			ext_topology_opts(mkm, opts, sizeof(opts)), mkm->force ? "-F " : "", name, dev)){
 		return -1;
 	}
 	return 0;
@@ -209,16 +280,13 @@ ext2_mkfs(const char *dev, const struct mkfsmarshal *mkm){
 	// provide -o SprezzOS (and get it recognized rather than rejected) FIXME
 	// allow -c (badblock check) FIXME
 	const char *name = mkm->name;
+	char opts[80];
 
 	if(name == NULL){
 		name = "SprezzaEXT2";
 	}
-	if(mkm->stride && mkm->swidth){
-		if(vspopen_drain("mkfs.ext2 -Estride=%ju,stripe_width=%ju %s-b -2048 -L \"%s\" -O dir_index,extent %s",
-			mkm->stride, mkm->swidth, mkm->force ? "-F " : "", name, dev)){
-		}
-	}else if(vspopen_drain("mkfs.ext2 %s-b -2048 -L \"%s\" -O dir_index,extent %s",
-			mkm->force ? "-F " : "", name, dev)){
+	if(vspopen_drain("mkfs.ext2 %s%s-L \"%s\" -O dir_index,extent %s",
+			ext_topology_opts(mkm, opts, sizeof(opts)), mkm->force ? "-F " : "", name, dev)){
 		return -1;
 	}
 	return 0;
@@ -596,6 +664,36 @@ err:
 	return NULL;
 }
 
+void mkfs_topology(const device *d, struct mkfsmarshal *mkm){
+	const device *under = d;
+
+	mkm->stride = 0;
+	mkm->swidth = 0;
+	mkm->sectsize = d->physsec > d->logsec ? d->physsec : d->logsec;
+	if(mkm->sectsize == 0){
+		mkm->sectsize = 512;
+	}
+	if(d->layout == LAYOUT_PARTITION && d->partdev.parent){
+		under = d->partdev.parent;
+	}
+	if(under->layout == LAYOUT_MDADM && under->mddev.stride && under->mddev.swidth){
+		mkm->stride = under->mddev.stride;
+		mkm->swidth = under->mddev.swidth;
+	}else if(d->minio && d->optio > d->minio && d->optio % d->minio == 0){
+		mkm->stride = d->minio;
+		mkm->swidth = d->optio / d->minio;
+	}
+	// the partition's start, not its alignment, must fall on a stripe unit.
+	// sysfs reports the start in 512-byte sectors, whatever the device's.
+	if(mkm->stride && d->layout == LAYOUT_PARTITION){
+		if((d->partdev.fsector * 512) % mkm->stride){
+			verbf("%s isn't aligned to its %juB stripe unit\n",d->name,mkm->stride);
+			mkm->stride = 0;
+			mkm->swidth = 0;
+		}
+	}
+}
+
 int make_filesystem(device *d, const char *pty, const char *name){
 	const struct fs *pt;
 	int force = 0;
@@ -644,9 +742,12 @@ int make_filesystem(device *d, const char *pty, const char *name){
 			// FIXME needs accept/set UUID!
 			marsh.name = name;
 			marsh.force = force;
-			if(d->layout == LAYOUT_MDADM){
-				marsh.stride = d->mddev.stride;
-				marsh.swidth = d->mddev.swidth;
+			mkfs_topology(d,&marsh);
+			if(marsh.stride && marsh.swidth){
+				diag("%s on %s: %juKiB stripe unit x %ju, %uB sectors\n",pty,
+					d->name,marsh.stride / 1024,marsh.swidth,marsh.sectsize);
+			}else{
+				diag("%s on %s: unstriped, %uB sectors\n",pty,d->name,marsh.sectsize);
 			}
 			if(pt->mkfs(dbuf,&marsh)){
 				free(mnttype);
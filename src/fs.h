@@ -33,13 +33,33 @@ aggregate_fs_p(const char *fstype){
 		!strcmp(fstype, "zfs_member");
 }
 
+// Topology is derived from the device by make_filesystem(). A striped md
+// array supplies its chunk and data disks, as do partitions of one. Other
+// devices (dm stripes, hardware RAID) whose optimal_io_size is a multiple
+// of their minimum_io_size supply those. Stripes are ignored if the
+// partition holding the filesystem doesn't start on a stripe unit.
 struct mkfsmarshal {
 	const char *name;	// supply this label, if possible
 	int force;		// supply a force directive, if one exists
-	uintmax_t stride;	// opt. for raid array of strideB chunks
-	uintmax_t swidth;	// opt. for raid array of swidth stripe width
+	uintmax_t stride;	// stripe unit (chunk) in bytes, 0 if unstriped
+	uintmax_t swidth;	// data members per stripe, 0 if unstriped
+	unsigned sectsize;	// physical sector size in bytes
 };
 
+// Filesystem block size assumed when translating stripes into blocks
+#define MKFS_BLOCK_SIZE 4096
+
+// f2fs segments are 2MiB. Sections grow to cover a stripe, up to this many
+// segments.
+#define MKFS_F2FS_SEGMENT (2 * 1024 * 1024)
+#define MKFS_F2FS_MAX_SEGS_PER_SEC 64
+
+// XFS can't stripe its log on units larger than this
+#define MKFS_XFS_MAX_LOG_SU (256 * 1024)
+
+// Derive the stripe unit, width and sector size from the device
+void mkfs_topology(const struct device *, struct mkfsmarshal *);
+
 // Does the filesystem support the concept of a name/label?
 int fstype_named_p(const char *);
 
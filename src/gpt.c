@@ -11,6 +11,7 @@
 #include <linux/byteorder/little_endian.h>
 
 #include "gpt.h"
+#include "image.h"
 #include "ptypes.h"
 #include "ptable.h"
 #include "growlight.h"
@@ -203,7 +204,8 @@ write_gpt(int fd, ssize_t lbasize, uint64_t lbas, unsigned realdata){
     munmap(map, mapsize);
     return -1;
   }
-  if(update_backup(fd, ghead, gptlbas, lbas, lbasize, pgsize, realdata)){
+  // gptlbas includes the MBR, which has no counterpart at the end
+  if(update_backup(fd, ghead, gptlbas - 1, lbas, lbasize, pgsize, realdata)){
     munmap(map, mapsize);
     return -1;
   }
@@ -232,7 +234,7 @@ int new_gpt(device *d){
     diag("Won't create GPT on %juB disk %s\n",d->size,d->name);
     return -1;
   }
-  if((fd = openat(devfd, d->name, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
+  if((fd = open_blockdev(d, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
     diag("Couldn't open %s (%s?)\n", d->name, strerror(errno));
     return -1;
   }
@@ -277,7 +279,7 @@ int zap_gpt(device *d){
     diag("No GPT on disk %s\n", d->name);
     return -1;
   }
-  if((fd = openat(devfd, d->name, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
+  if((fd = open_blockdev(d, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
     diag("Couldn't open %s (%s?)\n", d->name, strerror(errno));
     return -1;
   }
@@ -362,7 +364,7 @@ const_map_gpt(const device *d, size_t *mapsize, int *fd, size_t lbasize){
     diag("Bad mapsize %zu for page size %d\n", *mapsize, pgsize);
     return MAP_FAILED;
   }
-  if((*fd = openat(devfd, d->name, O_RDONLY|O_CLOEXEC|O_DIRECT)) < 0){
+  if((*fd = open_blockdev(d, O_RDONLY|O_CLOEXEC|O_DIRECT)) < 0){
     diag("Couldn't open %s (%s?)\n", d->name, strerror(errno));
     return MAP_FAILED;
   }
@@ -391,7 +393,7 @@ map_gpt(device *d, size_t *mapsize, int *fd, size_t lbasize){
     diag("Bad lbasize for GPT: %zu\n", lbasize);
     return MAP_FAILED;
   }
-  if((*fd = openat(devfd, d->name, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
+  if((*fd = open_blockdev(d, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
     diag("Couldn't open %s (%s?)\n", d->name, strerror(errno));
     return MAP_FAILED;
   }
@@ -569,7 +571,8 @@ int add_gpt(device *d, const wchar_t *name, uintmax_t fsec, uintmax_t lsec, unsi
   if(fsync(fd)){
     diag("Couldn't sync %d for %s\n", fd, d->name);
   }
-  r = blkpg_add_partition(fd, fsec * LBA_SIZE,
+  // the kernel knows nothing of image devices' partitions
+  r = image_device_p(d) ? 0 : blkpg_add_partition(fd, fsec * LBA_SIZE,
       (lsec - fsec + 1) * LBA_SIZE, z + 1, cname);
   if(close(fd)){
     int e = errno;
@@ -737,7 +740,8 @@ int del_gpt(const device *p){
   if(fsync(fd)){
     diag("Couldn't sync %d for %s\n", fd, p->name);
   }
-  r = blkpg_del_partition(fd, p->partdev.fsector * LBA_SIZE,
+  r = image_device_p(p->partdev.parent) ? 0 :
+    blkpg_del_partition(fd, p->partdev.fsector * LBA_SIZE,
         p->size, p->partdev.pnumber,
         p->partdev.parent->name);
   if(close(fd)){
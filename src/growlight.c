@@ -36,13 +36,18 @@
 #include "dmi.h"
 #include "mbr.h"
 #include "zfs.h"
+#include "scsi.h"
+#include "stack.h"
 #include "swap.h"
+#include "image.h"
+#include "irq.h"
 #include "udev.h"
 #include "nvme.h"
 #include "crypt.h"
 #include "mdadm.h"
 #include "popen.h"
 #include "smart.h"
+#include "smartpoll.h"
 #include "sysfs.h"
 #include "stats.h"
 #include "ptable.h"
@@ -87,6 +92,7 @@ static controller virtual_bus = {
 };
 
 static controller *controllers = &virtual_bus;
+static statrollup host_load; // All disks, as of the last stats tick
 
 static device *create_new_device(const char *);
 static device *create_new_device_inner(const char *);
@@ -194,6 +200,7 @@ free_controller(controller *c){
     free(c->ident);
     free(c->sysfs);
     free(c->name);
+    free_irqinfo(c->irqs);
   }
 }
 
@@ -209,6 +216,12 @@ kernelmodulep(const char *driver){
     return TRANSPORT_USB;
   }else if(strcmp(driver, "nvme") == 0){
     return TRANSPORT_NVME;
+  }else if(strcmp(driver, "mpt3sas") == 0 || strcmp(driver, "mpt2sas") == 0 ||
+           strcmp(driver, "mpi3mr") == 0 || strcmp(driver, "megaraid_sas") == 0 ||
+           strcmp(driver, "smartpqi") == 0 || strcmp(driver, "hpsa") == 0 ||
+           strcmp(driver, "aacraid") == 0 || strcmp(driver, "pm80xx") == 0 ||
+           strcmp(driver, "mvsas") == 0 || strcmp(driver, "isci") == 0){
+    return TRANSPORT_SAS;
   }
   return 0;
 }
@@ -324,6 +337,10 @@ find_pcie_controller(unsigned domain, unsigned bus, unsigned dev,
       /* Get the relevant address pointer */
       data = 0;
       if( (pcicap = pci_find_cap(pcidev, PCI_CAP_ID_EXP, PCI_CAP_NORMAL)) ){
+        uint32_t cap = pci_read_long(pcidev, pcicap->addr + PCI_EXP_LNKCAP);
+
+        c->pcie.gen_cap = cap & PCI_EXP_LNKCAP_SPEED;
+        c->pcie.lanes_cap = (cap & PCI_EXP_LNKCAP_WIDTH) >> 4u;
         data = pci_read_word(pcidev, pcicap->addr + PCI_EXP_LNKSTA);
       }else if( (pcicap = pci_find_cap(pcidev, PCI_CAP_ID_MSI, PCI_CAP_NORMAL)) ){
         // FIXME?
@@ -331,16 +348,12 @@ find_pcie_controller(unsigned domain, unsigned bus, unsigned dev,
       if(data){
         c->pcie.gen = data & PCI_EXP_LNKSTA_SPEED;
         c->pcie.lanes_neg = (data & PCI_EXP_LNKSTA_WIDTH) >> 4u;
-        if(c->pcie.gen == 1){
-          c->bandwidth = 250u * 8u * 1000000ull;
-        }else if(c->pcie.gen == 2){
-          c->bandwidth = 500u * 8u * 1000000ull;
-        }else if(c->pcie.gen == 3){
-          c->bandwidth = 1000u * 8u * 1000000ull;
-        }else if(c->pcie.gen == 4){
-          c->bandwidth = 2000u * 8u * 1000000ull;
+        c->bandwidth = pcie_link_bw(c->pcie.gen, c->pcie.lanes_neg);
+        if(pcie_degraded_p(c)){
+          diag("%s link trained to x%u gen %s, capable of x%u gen %s\n",
+               c->ident, c->pcie.lanes_neg, pcie_gen(c->pcie.gen),
+               c->pcie.lanes_cap, pcie_gen(c->pcie.gen_cap));
         }
-        c->bandwidth *= c->pcie.lanes_neg;
       }
       pci_free_dev(pcidev);
     }
@@ -370,14 +383,19 @@ internal_device_reset(device *d){
   device *p;
 
   lock_growlight();
+  stack_detach(d);
   switch(d->layout){
     case LAYOUT_NONE:{
       free(d->blkdev.biossha1); d->blkdev.biossha1 = NULL;
       free(d->blkdev.pttable); d->blkdev.pttable = NULL;
       free(d->blkdev.serial); d->blkdev.serial = NULL;
       free(d->blkdev.wwn); d->blkdev.wwn = NULL;
+      free(d->blkdev.nvme); d->blkdev.nvme = NULL;
+      free(d->blkdev.namespaces); d->blkdev.namespaces = NULL;
+      free(d->blkdev.scsi); d->blkdev.scsi = NULL;
+      d->blkdev.nscount = 0;
       if(d->c){
-        d->c->demand -= transport_bw(d->blkdev.transport);
+        d->c->demand -= blockdev_demand(d);
       }
       break;
     }case LAYOUT_MDADM:{
@@ -392,6 +410,7 @@ internal_device_reset(device *d){
       free(d->mddev.uuid); d->mddev.uuid = NULL;
       free(d->mddev.mdname); d->mddev.mdname = NULL;
       free(d->mddev.pttable); d->mddev.pttable = NULL;
+      free(d->mddev.syncaction); d->mddev.syncaction = NULL;
       d->mddev.degraded = 0;
       d->mddev.resync = 0;
       break;
@@ -407,6 +426,8 @@ internal_device_reset(device *d){
       free(d->dmdev.uuid); d->dmdev.uuid = NULL;
       free(d->dmdev.dmname); d->dmdev.dmname = NULL;
       free(d->dmdev.pttable); d->dmdev.pttable = NULL;
+      free(d->dmdev.target); d->dmdev.target = NULL;
+      d->dmdev.mirrored = d->dmdev.syncing = 0;
       d->mddev.degraded = 0;
       break;
     }case LAYOUT_PARTITION:{
@@ -414,6 +435,7 @@ internal_device_reset(device *d){
       free(d->partdev.uuid); d->partdev.uuid = NULL;
       break;
     }case LAYOUT_ZPOOL:{
+      free_zpool_info(d->zpool.info); d->zpool.info = NULL;
       break;
     }
   }
@@ -424,6 +446,7 @@ internal_device_reset(device *d){
   free(d->sched); d->sched = NULL;
   free(d->uuid); d->uuid = NULL;
   free(d->label); d->label = NULL;
+  free(d->crypt); d->crypt = NULL;
   free(d->model); d->model = NULL;
   free(d->revision); d->revision = NULL;
   d->slave = 0;
@@ -643,6 +666,9 @@ explore_sysfs_node_inner(DIR *dir,int fd,const char *name,device *d,int recurse)
       verbf("Couldn't get a revision for %s (%s)\n",name,strerror(errno));
     }
     get_sysfs_uint(sdevfd, "type", &d->kerneltype);
+    // SCSI and libata devices only; with NCQ, this is the tag count in use
+    d->blkdev.queuedepth = 0;
+    get_sysfs_uint(sdevfd, "queue_depth", &d->blkdev.queuedepth);
     verbf("\tModel: %s revision %s S/N %s type %lu\n",
         d->model ? d->model : "n/a",
         d->revision ? d->revision : "n/a",
@@ -679,6 +705,14 @@ explore_sysfs_node_inner(DIR *dir,int fd,const char *name,device *d,int recurse)
         }else{
           d->logsec = ul;
         }
+        // Striped devices (and some disks) report their stripe width and
+        // chunk here; most disks report 0 optimal and physsec minimum.
+        if(get_sysfs_uint(fd,"queue/minimum_io_size",&ul) == 0){
+          d->minio = ul;
+        }
+        if(get_sysfs_uint(fd,"queue/optimal_io_size",&ul) == 0){
+          d->optio = ul;
+        }
       }else if((subfd = openat(fd,dire->d_name,O_RDONLY|O_CLOEXEC|O_DIRECTORY)) > 0){
         dev_t devno;
 
@@ -1003,13 +1037,19 @@ rescan(const char *name,device *d){
           clobber_device(d);
           return NULL;
         }
-        probe_smart(d);
       }else if(d->c->transport == TRANSPORT_NVME){
         if(nvme_interrogate(d, dfd)){
           close(dfd);
           clobber_device(d);
           return NULL;
         }
+      }else if(d->c->transport == TRANSPORT_SAS){
+        // hands SATA disks (behind the HBA's SAT layer) to sg_interrogate()
+        if(scsi_interrogate(d, dfd)){
+          close(dfd);
+          clobber_device(d);
+          return NULL;
+        }
       }else if(d->c->transport == TRANSPORT_USB){
         d->blkdev.transport = SERIAL_USB;
       }else if(d->c->transport == TRANSPORT_USB2){
@@ -1033,6 +1073,7 @@ rescan(const char *name,device *d){
     snprintf(devbuf, sizeof(devbuf), DEVROOT "/%s", name);
     // FIXME move all this to its own function
     if(probe_blkid_superblock(devbuf, &pr, d) == 0){
+      crypt_describe(d);
       if( (ppl = blkid_probe_get_partitions(pr)) && (ptbl = blkid_partlist_get_table(ppl))){
         const char *pttable;
         device *p;
@@ -1059,6 +1100,7 @@ rescan(const char *name,device *d){
               blkid_free_probe(pr);
               return NULL;
             }
+            crypt_describe(p);
             flags = blkid_partition_get_flags(part);
             if(strcmp(pttable, "gpt") == 0){
               // FIXME verify bootable flag?
@@ -1115,6 +1157,8 @@ rescan(const char *name,device *d){
     for(p = d->parts ; p ; p = p->next){
       p->logsec = d->logsec;
       p->physsec = d->physsec;
+      p->minio = d->minio;
+      p->optio = d->optio;
       p->size *= p->logsec;
       p->partdev.alignment = alignment(p->partdev.fsector * p->logsec);
     }
@@ -1127,9 +1171,13 @@ rescan(const char *name,device *d){
     d->next = d->c->blockdevs;
     d->c->blockdevs = d;
     if(d->layout == LAYOUT_NONE){
-      d->c->demand += transport_bw(d->blkdev.transport);
+      d->c->demand += blockdev_demand(d);
+    }
+    if(stack_attach(d)){
+      diag("Couldn't link %s into its stack\n", d->name);
     }
     d->uistate = gui->block_event(d,d->uistate);
+    stack_notify(d);
   unlock_growlight();
   return d;
 }
@@ -1209,11 +1257,33 @@ controller *lookup_controller(const char *name){
   return c;
 }
 
+// Like lookup_device(), but neither waits on discovery nor creates the
+// device. growlight must be locked on entry!
+device *find_device(const char *name){
+  controller *c;
+  device *d;
+
+  for(c = controllers ; c ; c = c->next){
+    for(d = c->blockdevs ; d ; d = d->next){
+      device *p;
+
+      if(strcmp(name, d->name) == 0){
+        return d;
+      }
+      for(p = d->parts ; p ; p = p->next){
+        if(strcmp(name, p->name) == 0){
+          return p;
+        }
+      }
+    }
+  }
+  return NULL;
+}
+
 // name must be an entry in /sys/class/block, and also one in /dev
 // growlight must be locked on entry!
 device *lookup_device(const char *name){
   struct dlist *dl;
-  controller *c;
   device *d;
   size_t s;
 
@@ -1245,19 +1315,8 @@ device *lookup_device(const char *name){
     }
     name += s;
   }while(s);
-  for(c = controllers ; c ; c = c->next){
-    for(d = c->blockdevs ; d ; d = d->next){
-      device *p;
-
-      if(strcmp(name, d->name) == 0){
-        return d;
-      }
-      for(p = d->parts ; p ; p = p->next){
-        if(strcmp(name, p->name) == 0){
-          return p;
-        }
-      }
-    }
+  if( (d = find_device(name)) ){
+    return d;
   }
   if( (d = create_new_device(name)) ){
     pthread_cond_broadcast(&discovery_cond);
@@ -1499,6 +1558,17 @@ watch_dir(int fd, const char *dfp, eventfxn fxn, int *wd, int timeout){
   return r;
 }
 
+// Block until every device thread spawned by discovery has finished
+static void
+wait_discovery(void){
+  pthread_mutex_lock(&barrier);
+  while(thrcount){
+    verbf("Assembly waits on %u devices\n", thrcount);
+    pthread_cond_wait(&barrier_cond, &barrier);
+  }
+  pthread_mutex_unlock(&barrier);
+}
+
 static void
 version(const char *name){
   diag("%s version %s\n", basename(name), VERSION);
@@ -1507,7 +1577,7 @@ version(const char *name){
 static void
 usage(const char *name, int disphelp){
   diag("usage: %s [ -h|--help ] [ -v|--verbose ] [ -V|--version ]\n"
-    "\t[ -t|--target=path ] [ --notroot ] [ -i|--import ]%s\n",
+    "\t[ -t|--target=path ] [ --notroot ] [ --notune ] [ -i|--import ]%s\n",
     basename(name), disphelp ? " [ --disphelp ]" : "");
 }
 
@@ -1533,19 +1603,105 @@ update_stats(const diskstats *stats, const struct timeval *tv, int statcount) {
       continue;
     }
     if(d->stats.sectors_read == UINTMAX_MAX){
-      d->statdelta.sectors_read = 0;
-      d->statdelta.sectors_written = 0;
+      memset(&d->statdelta, 0, sizeof(d->statdelta));
     }else{
       d->statdelta.sectors_read = ds->total.sectors_read - d->stats.sectors_read;
       d->statdelta.sectors_written = ds->total.sectors_written - d->stats.sectors_written;
+      d->statdelta.reads = ds->total.reads - d->stats.reads;
+      d->statdelta.writes = ds->total.writes - d->stats.writes;
+      d->statdelta.io_ms = ds->total.io_ms - d->stats.io_ms;
     }
-    d->stats.sectors_read = ds->total.sectors_read;
-    d->stats.sectors_written = ds->total.sectors_written;
+    d->stats = ds->total;
     memcpy(&d->statq, tv, sizeof(*tv));
+    if(d->layout == LAYOUT_MDADM){
+      // md doesn't send uevents as syncs start and progress
+      md_sync_update(d, tv);
+    }else if(d->layout == LAYOUT_DM){
+      // nor does dm as cache contents change
+      dm_status_update(d);
+    }
     d->uistate = gui->block_event(d, d->uistate);
   }
 }
 
+// Fold a disk's last tick into a rollup. util is accumulated as a sum of
+// percentages until finish_rollup().
+static void
+rollup_disk(statrollup *r, const device *d){
+  uintmax_t usec = d->statq.tv_sec * 1000000ull + d->statq.tv_usec;
+  uintmax_t util;
+
+  if(usec == 0){
+    return;
+  }
+  // diskstats sectors are always 512 bytes, whatever the device's
+  r->rxbps += d->statdelta.sectors_read * 512 * 8 * 1000000ull / usec;
+  r->txbps += d->statdelta.sectors_written * 512 * 8 * 1000000ull / usec;
+  r->iops += (d->statdelta.reads + d->statdelta.writes) * 1000000ull / usec;
+  util = d->statdelta.io_ms * 1000 * 100 / usec;
+  r->util += util > 100 ? 100 : util;
+  ++r->disks;
+}
+
+static void
+finish_rollup(statrollup *r){
+  if(r->disks){
+    r->util /= r->disks;
+  }
+}
+
+const statrollup *get_host_load(void){
+  return &host_load;
+}
+
+// One pass over the devices each tick: disks roll up into their controller
+// and the host, and stacked devices sum their members (and look for a member
+// doing more than its share). Loop devices and the like don't count towards
+// the host, as their I/O is also seen on whatever backs them. To be called
+// only while holding the growlight lock, following update_stats().
+static void
+update_rollups(void){
+  controller *c;
+
+  memset(&host_load, 0, sizeof(host_load));
+  for(c = controllers ; c ; c = c->next){
+    device *d;
+
+    memset(&c->load, 0, sizeof(c->load));
+    for(d = c->blockdevs ; d ; d = d->next){
+      if(d->layout == LAYOUT_NONE){
+        rollup_disk(&c->load, d);
+        if(d->blkdev.realdev){
+          rollup_disk(&host_load, d);
+        }
+      }
+      if(d->members){
+        const device *hot = d->hotmember;
+
+        stack_rollup(d);
+        if(d->hotmember && d->hotmember != hot){
+          verbf("%s: %s is doing over %dx the I/O of its peers\n",
+                d->name, d->hotmember->name, STACK_IMBALANCE_RATIO);
+        }
+      }
+    }
+    finish_rollup(&c->load);
+  }
+  finish_rollup(&host_load);
+}
+
+// To be called only while holding the growlight lock.
+static void
+update_irqs(const irqtable *it){
+  controller *c;
+
+  for(c = controllers ; c ; c = c->next){
+    if(irq_update(c, it) > 0 && c->uistate){
+      c->uistate = gui->adapter_event(c, c->uistate);
+    }
+  }
+}
+
 void timeval_subtract(struct timeval *elapsed, const struct timeval *minuend,
       const struct timeval *subtrahend) {
   *elapsed = *minuend;
@@ -1681,6 +1837,7 @@ event_posix_thread(void *unsafe){
           struct timeval now;
           uint64_t dontcare;
           diskstats *dstats;
+          irqtable *itab;
           int statcount;
 
           if(read(em->stats_timerfd, &dontcare, sizeof(dontcare)) < 0){
@@ -1689,16 +1846,24 @@ event_posix_thread(void *unsafe){
                   }
           gettimeofday(&now, NULL);
           statcount = read_proc_diskstats(&dstats);
+          itab = read_proc_interrupts();
           lock_growlight();
           struct timeval timeq;
           timeval_subtract(&timeq, &now, &laststatcheck);
           if(statcount >= 0){
             update_stats(dstats, &timeq, statcount);
+            update_rollups();
+            laststatcheck = now;
+          }
+          if(itab){
+            update_irqs(itab);
           }
           unlock_growlight();
+          free_irqtable(itab);
           if(statcount >= 0){
             free(dstats);
           }
+          zpool_tick(gui);
         }else{
           diag("Unknown fd %d saw event\n", events[r].data.fd);
         }
@@ -1913,6 +2078,11 @@ int growlight_init(int argc, char * const *argv, const glightui *ui, int *disphe
       .has_arg = 0,
       .flag = NULL,
       .val = 'R',
+    }, {
+      .name = "notune",
+      .has_arg = 0,
+      .flag = NULL,
+      .val = 'T',
     }, {
       .name = "import",
       .has_arg = 0,
@@ -2002,6 +2172,9 @@ int growlight_init(int argc, char * const *argv, const glightui *ui, int *disphe
     }case 'R':{
       notroot = 1;
       break;
+    }case 'T':{
+      md_set_autotune(0);
+      break;
     }case 'D':{
       if(!detcopy){
         diag("Error: unknown option --disphelp\n");
@@ -2065,14 +2238,20 @@ int growlight_init(int argc, char * const *argv, const glightui *ui, int *disphe
   if(init_zfs_support(gui)){
     goto err;
   }
+  if(watch_dir(fd, SYSROOT, scan_device, &syswd, 1)){
+    goto err;
+  }
+  // Assembly works from the signatures discovery found on each device.
+  // Newly-assembled md and dm aggregates show up through the sysfs watch,
+  // while import_zpools() rescans the pools it imports. The sysfs
+  // scan gives up waiting on slow devices after its timeout, but a member
+  // still being probed would see its array started degraded; wait it out.
   if(import){
+    wait_discovery();
     if(assemble_aggregates()){
       goto err;
     }
   }
-  if(watch_dir(fd, SYSROOT, scan_device, &syswd, 1)){
-    goto err;
-  }
   if(watch_dir(fd, DEVMD, scan_mdalias, &mdwd, 0)){
     // They won't necessarily have a /dev/md, especially if they
     // have no md devices. Unfortunately, if we then create one,
@@ -2101,6 +2280,9 @@ int growlight_init(int argc, char * const *argv, const glightui *ui, int *disphe
   if(event_thread(fd, udevfd, syswd, bypathwd, byidwd, mdwd)){
     goto err;
   }
+  if(start_smart_poller()){
+    goto err;
+  }
   return 0;
 
 err:
@@ -2113,6 +2295,8 @@ err:
 int growlight_stop(int retcode){
   int r = 0;
 
+  diag("Stopping the SMART poller...\n");
+  r |= stop_smart_poller();
   diag("Killing the event thread...\n");
   r |= kill_event_thread();
   /*diag("Closing libblkid...\n");
@@ -2199,6 +2383,14 @@ rescan_blockdev_internal(const device *d, int killedpart){
   char buf[PATH_MAX];
   int fd;
 
+  if(d->layout == LAYOUT_PARTITION && image_device_p(d->partdev.parent)){
+    d = d->partdev.parent;
+  }
+  if(image_device_p(d)){
+    // image devices are private to their creator; nothing to tell the
+    // kernel, and no udev event will arrive. reread it directly.
+    return rescan_image_device((device *)d);
+  }
   if(snprintf(buf, sizeof(buf), SYSROOT"/%s/device/rescan", d->name) >= (int)sizeof(buf)){
     diag("Name too long: %s\n", d->name);
     return -1;
@@ -87,6 +87,7 @@ typedef enum {
 	SERIAL_USB,
 	SERIAL_USB2,
 	SERIAL_USB3,
+	SERIAL_SAS,
 	DIRECT_NVME,
 	AGGREGATE_UNKNOWN,
 	AGGREGATE_MIXED,
@@ -98,6 +99,22 @@ typedef enum {
 	RWVERIFY_SUPPORTED_ON,
 } rwverify_status;
 
+// Keys the union within a device
+typedef enum {
+	LAYOUT_NONE,
+	LAYOUT_MDADM,
+	LAYOUT_DM,
+	LAYOUT_PARTITION,
+	LAYOUT_ZPOOL,
+} layout_e;
+
+// Keys the union within a controller
+typedef enum {
+	BUS_UNKNOWN,
+	BUS_VIRTUAL,
+	BUS_PCIe,
+} bus_e;
+
 typedef struct {
 	unsigned count;
 	char **list;
@@ -129,6 +146,7 @@ typedef struct device {
 	char *uuid;			// *Filesystem* UUID
 	char *label;			// *Filesystem* label
 	char *mnttype;			// Type of mount (can be "swap")
+	char *crypt;			// LUKS parameters if crypto_LUKS
   unsigned long kerneltype; // scsi type, from block/DEV/device/type / SG_GET_SCSI_ID
                             // from scsi.h: TYPE_DISK, TYPE_TAPE, TYPE_ROM, etc.
 	uintmax_t mntsize;		// Filesystem size in bytes
@@ -144,6 +162,8 @@ typedef struct device {
 	} swapprio;		// Priority as a swap device
 	unsigned logsec;	// Logical sector size in bytes
 	unsigned physsec;	// Physical sector size in bytes
+	unsigned minio;		// Minimum I/O size in bytes (0: unreported)
+	unsigned optio;		// Optimal I/O size in bytes (0: unreported)
 	struct controller *c;
 	char *sched;		// I/O scheduler (can be NULL)
 	unsigned roflag;	// Read-only flag (hdparm -r, blockdev --getro)
@@ -161,12 +181,27 @@ typedef struct device {
 						//  2: supported, on
 						//  (see rwverify_status above)
 			unsigned unloaded: 1;	// No media loaded
+			// The following are taken from ATA IDENTIFY
+			unsigned trim: 1;	// DATA SET MANAGEMENT TRIM
+			unsigned drat: 1;	// Deterministic read after TRIM
+			unsigned rzat: 1;	// Read zeroes after TRIM
+			unsigned ncq: 1;	// Native Command Queueing
 			void *biossha1;		// SHA1 of first 440 bytes
 			char *pttable;		// Partition table type (can be NULL)
 			char *serial;		// Serial number (can be NULL)
 			char *wwn;		// World Wide Name
 			int32_t rotation;	// Rotation rate:
 						// 0 == unknown, -1 (SSD_ROTATION) == SSD
+			unsigned trimblocks;	// 512-byte blocks of TRIM ranges
+						//  per command (64 ranges each)
+			unsigned ncqdepth;	// Drive's NCQ queue depth
+			unsigned long queuedepth; // Kernel's queue depth; NCQ is
+						//  only in use if this exceeds 1
+			unsigned alignoff;	// Byte offset of LBA 0 within its
+						//  physical sector
+			unsigned satacap;	// Fastest SATA generation
+						//  supported (1--3), 0 if unknown
+			unsigned satalink;	// Negotiated SATA generation
 
 			// The following two are relative to the static
 			// partition table metainfo, not created partitions.
@@ -174,8 +209,17 @@ typedef struct device {
 			uint64_t last_usable;	// Last usable logical sector
 
 			int smart;		// -1 for no support, otherwise
-						//  SkSmartOverall enum values
+						//  smart_status (see smart.h)
 			uint64_t celsius;	// Last-polled temperature
+			char *image;		// Backing image file, if not a
+						//  true block device (see image.h)
+			struct nvme_health *nvme; // NVMe SMART / Health log
+						//  readings (see nvme.h), or NULL
+			uint32_t nsid;		// NVMe namespace of this device
+			unsigned nscount;	// active namespaces on controller
+			struct nvme_namespace *namespaces;
+			struct scsi_info *scsi;	// SCSI VPD and log page data
+						//  (see scsi.h), or NULL
 		} blkdev;
 		struct { // mdadm (MDRAID)
 			unsigned long disks;	// RAID disks in md
@@ -186,7 +230,26 @@ typedef struct device {
 			transport_e transport;
 			unsigned long degraded;	// number of missing devices
 			char *pttable;		// Partition table type (can be NULL)
-			unsigned resync;
+			unsigned resync;	// a sync_action other than idle
+						//  (or frozen) is under way
+			char *syncaction;	// sync_action (can be NULL)
+			uintmax_t syncdone;	// sync_completed (sectors)
+			uintmax_t synctotal;
+			unsigned long syncspeed; // sync_speed (KiB/s)
+			unsigned long syncmin;	// sync_speed_min (KiB/s)
+			unsigned long syncmax;	// sync_speed_max (KiB/s)
+			unsigned synclocal;	// MD_SYNC_LOCAL_{MIN,MAX} (see
+						//  mdadm.h): limit is per-array
+			uintmax_t mismatches;	// mismatch_cnt (sectors)
+			uintmax_t syncrate;	// measured over the last stats
+						//  tick (sectors/s), 0 if unknown
+			uintmax_t synceta;	// seconds remaining, 0 if unknown
+			unsigned long stripecache; // stripe_cache_size (RAID 4/5/6
+						//  only, otherwise 0)
+			unsigned long groupthreads; // group_thread_cnt
+			unsigned long prereadbypass; // preread_bypass_threshold
+			unsigned long bitmapchunk; // bitmap/chunksize (bytes), 0
+						//  without a write-intent bitmap
 			uintmax_t stride;	// Chunk (stride in ext4 talk)
 			unsigned swidth;	// Stripe width (non-parity drives)
 		} mddev;
@@ -198,6 +261,20 @@ typedef struct device {
 			char *dmname;
 			transport_e transport;
 			char *pttable;		// Partition table type (can be NULL)
+			char *target;		// Type of the live table's first
+						//  target, NULL until known
+			// cache and writecache targets, from the status line
+			// as of the last stats tick (see dm.h)
+			uintmax_t readhits, readmisses;
+			uintmax_t writehits, writemisses;
+			uintmax_t hitsdelta, missesdelta; // over the last tick
+			uintmax_t cacheused, cachetotal; // cache blocks
+			uintmax_t dirty;	// dirty blocks (writecache: those
+						//  being written back)
+			// mirror and raid targets, from the status line
+			unsigned mirrored;	// every member takes every write
+						//  (mirror, or raid running raid1)
+			unsigned syncing;	// regions not yet in sync
 		} dmdev;
 		struct { // Partitions are kept in on-disk order
 			// The *partition* UUID, not the filesystem's or disk's
@@ -225,16 +302,14 @@ typedef struct device {
 			unsigned long disks;	// vdevs in zpool
 			char *level;		// zraid level
 			unsigned state;		// POOL_STATE_[UN]AVAILABLE
+			struct zpool_info *info; // properties and vdevs (see
+						//  zfs.h), or NULL
 		} zpool;
 	};
-	enum {
-		LAYOUT_NONE,
-		LAYOUT_MDADM,
-		LAYOUT_DM,
-		LAYOUT_PARTITION,
-		LAYOUT_ZPOOL,
-	} layout;
+	layout_e layout;
 	struct device *parts;	// Partitions (can be NULL)
+	struct stackedge *holders; // Devices built atop this one, and
+	struct stackedge *members; //  those it's built atop (see stack.h)
 	dev_t devno;		// Don't expose this non-persistent datum
 	statpack stats;		// Stats since device came online, as returned
 				//  in most recent call to read_diskstats()
@@ -242,6 +317,10 @@ typedef struct device {
 				//  its previous value (after two samples)
 	struct timeval statq;	// Timespan of statdelta. statdelta is
 				//  defined iff statq is not all 0s.
+	statpack memberdelta;	// Sum of the members' statdelta, for
+				//  devices with stacked members
+	const struct device *hotmember; // Member doing disproportionate I/O
+				//  over the last tick (see stack_rollup())
 	void *uistate;		// UI-managed opaque state
 } device;
 
@@ -255,17 +334,14 @@ typedef struct controller {
 	char *ident;		// Manufactured identifier to reference adapter
 	char *fwver;		// Firmware version, if known
 	char *biosver;		// BIOS version, if known
-	enum {
-		BUS_UNKNOWN,
-		BUS_VIRTUAL,
-		BUS_PCIe,
-	} bus;
+	bus_e bus;
 	enum {
 		TRANSPORT_ATA,
 		TRANSPORT_USB,
 		TRANSPORT_USB2,
 		TRANSPORT_USB3,
 		TRANSPORT_NVME,
+		TRANSPORT_SAS,		// SAS/SCSI HBAs (can host SATA disks)
 	} transport;
 	int numa_node;		// -1: no NUMA in use
 	// Union parameterized on bus type
@@ -276,12 +352,19 @@ typedef struct controller {
 			//  1.0: 2.5GT/s each way
 			//  2.0: 5GT/s each way
 			//  3.0: 8GT/s each way
+			//  4.0: 16GT/s each way
+			//  5.0: 32GT/s each way
+			//  6.0: 64GT/s each way (PAM4)
+			//
+			// 1.0 and 2.0 use 8b/10b encoding, 3.0 through 5.0 use
+			// 128b/130b, and 6.0 carries 242B of payload in each
+			// 256B FLIT. 1.0 thus gives you a peak of 250MB/s/lane,
+			// and 3.0 about 985MB/s/lane. Further overheads can
+			// reduce the useful throughput (see pcie_link_bw()).
 			//
-			// 1.0 and 2.0 use 8/10 encoding, while 3.0 uses 8/128
-			// encoding. 1.0 thus gives you a peak of 250MB/s/lane,
-			// and 2.0 offers 500MB/s/lane. Further overheads can
-			// reduce the useful throughput.
-			unsigned gen;
+			//  gen: negotiated generation
+			//  gen_cap: card capabilities
+			unsigned gen,gen_cap;
 			// A physical slot can be incompletely wired, allowing
 			// a card of n lanes to be used in a slot with only m
 			// electronically-wired lanes, n > m.
@@ -296,6 +379,8 @@ typedef struct controller {
 	uintmax_t bandwidth;	// Bandwidth in bits per second. 0 -> unknown.
 	uintmax_t demand;	// Theoretical bandwidth in bits per second
 				//  used by attached devices
+	statrollup load;	// Attached disks' I/O over the last stats tick
+	struct irqinfo *irqs;	// MSI-X vectors and blk-mq queues, if sampled
 	device *blockdevs;
 	struct controller *next;
 	dev_t devno;		// Don't expose this non-persistent datum
@@ -322,8 +407,12 @@ last_usable_sector(const device *d){
 // simply will not fly in the long run -- FIXME
 const controller *get_controllers(void);
 
+// All disks' I/O over the last stats tick
+const statrollup *get_host_load(void);
+
 // These are similarly no good FIXME
 device *lookup_device(const char *name);
+device *find_device(const char *name);
 controller *lookup_controller(const char *name);
 
 // Supported partition table types
@@ -384,11 +473,62 @@ pcie_gen(unsigned gen){
 		case 1: return "1.0";
 		case 2: return "2.0";
 		case 3: return "3.0";
-    case 4: return "4.0";
+		case 4: return "4.0";
+		case 5: return "5.0";
+		case 6: return "6.0";
 		default: return "unknown";
 	}
 }
 
+// Usable bandwidth of a PCIe link in bits/s each way, after line encoding.
+// 0 if the generation is unknown.
+static inline uintmax_t
+pcie_link_bw(unsigned gen,unsigned lanes){
+	static const struct {
+		unsigned mts;		// Megatransfers per second per lane
+		unsigned num,den;	// Payload bits per bits on the wire
+	} gens[] = {
+		{ 2500, 8, 10, },
+		{ 5000, 8, 10, },
+		{ 8000, 128, 130, },
+		{ 16000, 128, 130, },
+		{ 32000, 128, 130, },
+		{ 64000, 242, 256, },
+	};
+
+	if(gen == 0 || gen > sizeof(gens) / sizeof(*gens)){
+		return 0;
+	}
+	--gen;
+	return gens[gen].mts * 1000000ull * lanes * gens[gen].num / gens[gen].den;
+}
+
+// Did the link train to fewer lanes or a lower generation than the card
+// supports (an incompletely-wired slot, a bad riser, a slot shared with a
+// neighbour)?
+static inline int
+pcie_degraded_p(const controller *c){
+	if(c->bus != BUS_PCIe || c->pcie.lanes_neg == 0){
+		return 0;
+	}
+	return c->pcie.lanes_neg < c->pcie.lanes_cap || c->pcie.gen < c->pcie.gen_cap;
+}
+
+// A controller at or beyond this much of its link bandwidth is saturated
+#define CONTROLLER_SATURATED_PCT 90
+
+// Live load on the controller's link as a percentage of its bandwidth. PCIe
+// is full duplex, so this is the busier direction. 0 if unknown.
+static inline unsigned
+controller_saturation(const controller *c){
+	uintmax_t bps = c->load.rxbps > c->load.txbps ? c->load.rxbps : c->load.txbps;
+
+	if(c->bandwidth == 0){
+		return 0;
+	}
+	return bps * 100 / c->bandwidth;
+}
+
 static inline int
 parttype_aggregablep(unsigned pt){
 	const ptype *pptr;
@@ -417,13 +557,14 @@ transport_str(transport_e t){
 		t == SERIAL_ATAII ? "SAT2" :
 	 	t == SERIAL_ATAI ? "SAT1" : t == SERIAL_ATA8 ? "ATA8" :
 	 	t == SERIAL_UNKNOWN ? "SATA" : t == PARALLEL_ATA ? "PATA" :
-		t == DIRECT_NVME ? "NVMe" :
+		t == DIRECT_NVME ? "NVMe" : t == SERIAL_SAS ? "SAS" :
 	 	t == AGGREGATE_MIXED ? "Mix" : "?";
 }
 
+// Nominal bandwidth of a transport in bits/s. NVMe depends on the PCIe link,
+// so this is merely a guess; prefer blockdev_bw() given the device.
 static inline uintmax_t
 transport_bw(transport_e t){
-  // FIXME NVMe is dependent on PCIe version and number of links
 	return t == DIRECT_NVME ? 32000000000 :
     t == SERIAL_USB3 ? 5000000000 :
 		t == SERIAL_USB2 ? 480000000 :
@@ -434,9 +575,85 @@ transport_bw(transport_e t){
 		t == PARALLEL_ATA ? 133000000 : 0;
 }
 
+// Nominal bandwidth of a disk's transport in bits/s. An NVMe disk is its own
+// PCIe endpoint, and gets its controller's negotiated link when that's known.
+static inline uintmax_t
+blockdev_bw(const device *d){
+	if(d->blkdev.transport == DIRECT_NVME && d->c && d->c->bus == BUS_PCIe
+			&& d->c->bandwidth){
+		return d->c->bandwidth;
+	}
+	return transport_bw(d->blkdev.transport);
+}
+
+// A disk's contribution to its controller's demand. An NVMe controller's
+// namespaces share its one link, so it's demanded only while some namespace
+// is present: added with the first, and removed with the last.
+static inline uintmax_t
+blockdev_demand(const device *d){
+	const device *o;
+
+	if(d->blkdev.transport == DIRECT_NVME){
+		for(o = d->c->blockdevs ; o ; o = o->next){
+			if(o != d && o->layout == LAYOUT_NONE && o->blkdev.transport == DIRECT_NVME){
+				return 0;
+			}
+		}
+	}
+	return blockdev_bw(d);
+}
+
+// The transport underlying a device. Partitions take that of their disk, and
+// aggregates are AGGREGATE_MIXED if their components' transports differ.
+static inline transport_e
+device_transport(const device *d){
+	switch(d->layout){
+		case LAYOUT_NONE: return d->blkdev.transport;
+		case LAYOUT_MDADM: return d->mddev.transport;
+		case LAYOUT_DM: return d->dmdev.transport;
+		case LAYOUT_ZPOOL: return d->zpool.transport;
+		case LAYOUT_PARTITION:
+			return d->partdev.parent ? device_transport(d->partdev.parent)
+				: TRANSPORT_UNKNOWN;
+	}
+	return TRANSPORT_UNKNOWN;
+}
+
+// Fold a component's transport into that of the aggregate it belongs to
+static inline transport_e
+merge_transport(transport_e agg, const device *component){
+	transport_e t = device_transport(component);
+
+	if(agg == AGGREGATE_UNKNOWN){
+		return t;
+	}
+	return agg == t ? agg : AGGREGATE_MIXED;
+}
+
+// Was the disk interrogated via ATA IDENTIFY (perhaps through a SAS HBA)?
+static inline int
+ata_transport_p(transport_e t){
+	return t == PARALLEL_ATA || t == SERIAL_UNKNOWN || t == SERIAL_ATA8 ||
+		t == SERIAL_ATAI || t == SERIAL_ATAII || t == SERIAL_ATAIII;
+}
+
+// SATA generations 1, 2 and 3 signal at 1.5, 3 and 6 Gbps
+static inline const char *
+sata_gen_str(unsigned gen){
+	return gen == 1 ? "1.5Gbps" : gen == 2 ? "3Gbps" : gen == 3 ? "6Gbps" : "?";
+}
+
+// A SATA drive negotiated a slower link than it supports. Either the host
+// port is slower, or there's a bad cable, backplane, or connector.
+static inline int
+sata_degraded_p(const device *d){
+	return d->layout == LAYOUT_NONE && d->blkdev.satalink &&
+		d->blkdev.satalink < d->blkdev.satacap;
+}
+
 static inline const char *
 guidstr_be(const void *guid,char *str){
-	const unsigned char *gc = guid;
+	const unsigned char *gc = (const unsigned char *)guid;
 
 	sprintf(str,"%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
 			gc[3], gc[2], gc[1], gc[0], gc[5], gc[4], gc[7], gc[6], gc[8],
@@ -446,7 +663,7 @@ guidstr_be(const void *guid,char *str){
 
 static inline const char *
 guidstr(const void *guid,char *str){
-	const unsigned char *gc = guid;
+	const unsigned char *gc = (const unsigned char *)guid;
 
 	sprintf(str,"%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
 			gc[0], gc[1], gc[2], gc[3], gc[4], gc[5], gc[6], gc[7], gc[8],
@@ -521,7 +738,7 @@ static inline int
 add_string(stringlist *sl,const char *s){
 	char **tmp;
 
-	if((tmp = realloc(sl->list,sizeof(*sl->list) * (sl->count + 1))) == NULL){
+	if((tmp = (char **)realloc(sl->list,sizeof(*sl->list) * (sl->count + 1))) == NULL){
 		return -1;
 	}
 	sl->list = tmp;
@@ -538,7 +755,7 @@ add_string_exclusive(stringlist *sl,const char *s){
 	if(string_included_p(sl,s)){
 		return 0;
 	}
-	if((tmp = realloc(sl->list,sizeof(*sl->list) * (sl->count + 1))) == NULL){
+	if((tmp = (char **)realloc(sl->list,sizeof(*sl->list) * (sl->count + 1))) == NULL){
 		return -1;
 	}
 	sl->list = tmp;
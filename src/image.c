@@ -0,0 +1,172 @@
+// copyright 2012–2021 nick black
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#include "mbr.h"
+#include "gpt.h"
+#include "image.h"
+#include "ptable.h"
+#include "growlight.h"
+
+#define LBA_SIZE 512u
+
+// Signatures as written by new_gpt(), new_apm() and new_msdos()
+static const unsigned char GPT_SIG[8] = "EFI PART";
+static const unsigned char APM_SIG[2] = { 0x4d, 0x50 };
+static const unsigned char MBR_SIG[2] = { 0x55, 0xaa };
+
+int image_device_p(const device *d){
+	return d->layout == LAYOUT_NONE && d->blkdev.image;
+}
+
+int open_blockdev(const device *d, int flags){
+	if(d->layout == LAYOUT_NONE && d->blkdev.image){
+		return open(d->blkdev.image, flags & ~O_DIRECT);
+	}
+	return openat(devfd, d->name, flags);
+}
+
+// Identify the partition table by its signature. GPT is checked first, since
+// it is always accompanied by a (protective) MBR.
+static const char *
+sniff_ptable(const unsigned char *sectors){
+	if(memcmp(sectors + LBA_SIZE, GPT_SIG, sizeof(GPT_SIG)) == 0){
+		return "gpt";
+	}
+	if(memcmp(sectors + LBA_SIZE, APM_SIG, sizeof(APM_SIG)) == 0){
+		return "apm";
+	}
+	if(memcmp(sectors + LBA_SIZE - sizeof(MBR_SIG), MBR_SIG, sizeof(MBR_SIG)) == 0){
+		return "dos";
+	}
+	return NULL;
+}
+
+int rescan_image_device(device *d){
+	unsigned char sectors[LBA_SIZE * 2];
+	const char *pt;
+	ssize_t r;
+	int fd;
+
+	if(!image_device_p(d)){
+		diag("%s is not an image device\n", d->name);
+		return -1;
+	}
+	if((fd = open_blockdev(d, O_RDONLY|O_CLOEXEC)) < 0){
+		diag("Couldn't open %s (%s?)\n", d->blkdev.image, strerror(errno));
+		return -1;
+	}
+	if((r = pread(fd, sectors, sizeof(sectors), 0)) != (ssize_t)sizeof(sectors)){
+		diag("Short read %zd/%zu from %s\n", r, sizeof(sectors), d->blkdev.image);
+		close(fd);
+		return -1;
+	}
+	if(mbrsha1(d, fd, d->blkdev.biossha1)){
+		close(fd);
+		return -1;
+	}
+	if(close(fd)){
+		diag("Couldn't close %s (%s?)\n", d->blkdev.image, strerror(errno));
+		return -1;
+	}
+	d->blkdev.biosboot = !zerombrp(d->blkdev.biossha1);
+	free(d->blkdev.pttable);
+	d->blkdev.pttable = NULL;
+	if( (pt = sniff_ptable(sectors)) ){
+		if((d->blkdev.pttable = strdup(pt)) == NULL){
+			return -1;
+		}
+	}
+	d->blkdev.first_usable = lookup_first_usable_sector(d);
+	d->blkdev.last_usable = lookup_last_usable_sector(d);
+	return 0;
+}
+
+device *create_image_device(const char *path, uintmax_t size, unsigned logsec,
+				unsigned physsec, unsigned prealloc){
+	char *bname;
+	device *d;
+	int fd, e;
+
+	if(logsec == 0 || physsec < logsec || physsec % logsec){
+		diag("Invalid sector sizes (%u logical, %u physical)\n", logsec, physsec);
+		return NULL;
+	}
+	if(logsec != LBA_SIZE){
+		diag("Only %uB logical sectors are supported (got %u)\n", LBA_SIZE, logsec);
+		return NULL;
+	}
+	if(size < 2 * LBA_SIZE || size % logsec){
+		diag("Invalid image size %ju\n", size);
+		return NULL;
+	}
+	if((d = malloc(sizeof(*d))) == NULL){
+		diag("Couldn't allocate device (%s?)\n", strerror(errno));
+		return NULL;
+	}
+	memset(d, 0, sizeof(*d));
+	d->layout = LAYOUT_NONE;
+	d->swapprio = SWAP_INVALID;
+	d->size = size;
+	d->logsec = logsec;
+	d->physsec = physsec;
+	d->blkdev.realdev = 0;
+	d->blkdev.smart = -1;
+	if((d->blkdev.image = strdup(path)) == NULL || (bname = strdup(path)) == NULL){
+		free(d->blkdev.image);
+		free(d);
+		return NULL;
+	}
+	snprintf(d->name, sizeof(d->name), "%s", basename(bname));
+	free(bname);
+	if((d->blkdev.biossha1 = malloc(20)) == NULL){
+		free_image_device(d);
+		return NULL;
+	}
+	if((fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, S_IRUSR|S_IWUSR)) < 0){
+		diag("Couldn't open %s (%s?)\n", path, strerror(errno));
+		free_image_device(d);
+		return NULL;
+	}
+	if(ftruncate(fd, size)){
+		e = errno;
+		diag("Couldn't size %s to %ju (%s?)\n", path, size, strerror(errno));
+		goto err;
+	}
+	if(prealloc && (e = posix_fallocate(fd, 0, size))){
+		diag("Couldn't allocate %ju for %s (%s?)\n", size, path, strerror(e));
+		goto err;
+	}
+	if(close(fd)){
+		diag("Couldn't close %s (%s?)\n", path, strerror(errno));
+		free_image_device(d);
+		return NULL;
+	}
+	if(rescan_image_device(d)){
+		free_image_device(d);
+		return NULL;
+	}
+	verbf("Image %s: %juB (%u/%u) table %s\n", path, size, logsec, physsec,
+		d->blkdev.pttable ? d->blkdev.pttable : "none");
+	return d;
+
+err:
+	close(fd);
+	free_image_device(d);
+	errno = e;
+	return NULL;
+}
+
+void free_image_device(device *d){
+	if(d){
+		free(d->blkdev.image);
+		free(d->blkdev.pttable);
+		free(d->blkdev.biossha1);
+		free(d);
+	}
+}
@@ -0,0 +1,47 @@
+// copyright 2012–2021 nick black
+#ifndef GROWLIGHT_IMAGE
+#define GROWLIGHT_IMAGE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct device;
+
+// A device can be backed by a regular file rather than a node in /dev. Such
+// image devices are standalone: they're not attached to any controller, get
+// no udev events, and the kernel knows nothing about their partitions, so
+// BLKPG/BLKRRPART are skipped. They need neither root nor loop devices, and
+// are suitable for rehearsing layouts and for testing/benchmarking the
+// partition table code.
+
+// Create (or reuse) the image file at path, sized to size bytes, and return a
+// LAYOUT_NONE device backed by it. The file is left sparse unless prealloc is
+// non-zero, in which case its blocks are allocated up front. An existing
+// file is truncated or extended to size, retaining its contents.
+struct device *create_image_device(const char *path, uintmax_t size,
+                                   unsigned logsec, unsigned physsec,
+                                   unsigned prealloc);
+
+// Release the device. The image file itself is not removed.
+void free_image_device(struct device *);
+
+// Is this device backed by an image file?
+int image_device_p(const struct device *);
+
+// Reread the image's partition table type and usable sector range. This is
+// the image equivalent of rescan_blockdev().
+int rescan_image_device(struct device *);
+
+// Open the block device underlying d with the specified flags. Image devices
+// are opened via their backing path, and have O_DIRECT stripped (not all
+// filesystems support it, and all image I/O goes through mmap() regardless).
+int open_blockdev(const struct device *, int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,616 @@
+// copyright 2012–2021 nick black
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "irq.h"
+#include "stats.h"
+#include "sysfs.h"
+#include "growlight.h"
+
+static const char PROCFS_INTERRUPTS[] = "/proc/interrupts";
+static const char SYSFS_NODES[] = "/sys/devices/system/node";
+
+// A numbered line of /proc/interrupts
+struct irqline {
+	unsigned irq;
+	const char *counts;	// First per-CPU count, within the table's text
+};
+
+struct irqtable {
+	char *text;
+	struct irqline *lines;	// In order of appearance, which is by IRQ
+	unsigned count;
+	unsigned cpus;		// Per-CPU columns, as named in the header
+	unsigned *cpuids;	// CPU number of each column (offline CPUs are absent)
+	struct timespec when;
+};
+
+// NUMA node of each CPU, read once. -1 where unknown.
+static int *cpunodes;
+static unsigned cpunodecount;
+static int cpunodes_read;
+
+void free_irqtable(irqtable *it){
+	if(it){
+		free(it->cpuids);
+		free(it->lines);
+		free(it->text);
+		free(it);
+	}
+}
+
+// The header names each CPU column: "CPU0 CPU1 CPU3 ...". Offline CPUs
+// have no column, so the column index needn't be the CPU number.
+static int
+lex_cpu_header(irqtable *it,const char *line,const char *eol){
+	while( (line = strstr(line,"CPU")) && line < eol){
+		unsigned long cpu;
+		unsigned *tmp;
+		char *e;
+
+		line += 3;
+		if(!isdigit(*line) || (cpu = strtoul(line,&e,10)) >= INT_MAX){
+			return -1;
+		}
+		if((tmp = realloc(it->cpuids,sizeof(*tmp) * (it->cpus + 1))) == NULL){
+			return -1;
+		}
+		it->cpuids = tmp;
+		it->cpuids[it->cpus++] = cpu;
+		line = e;
+	}
+	return 0;
+}
+
+irqtable *read_proc_interrupts(void){
+	const char *line,*eol;
+	irqtable *it;
+	size_t len;
+
+	if((it = malloc(sizeof(*it))) == NULL){
+		return NULL;
+	}
+	memset(it,0,sizeof(*it));
+	clock_gettime(CLOCK_MONOTONIC,&it->when);
+	if((it->text = read_procfs_file(PROCFS_INTERRUPTS,&len)) == NULL){
+		free(it);
+		return NULL;
+	}
+	if((eol = strchr(it->text,'\n')) == NULL){
+		free_irqtable(it);
+		return NULL;
+	}
+	if(lex_cpu_header(it,it->text,eol)){
+		diag("Couldn't lex %s header\n",PROCFS_INTERRUPTS);
+		free_irqtable(it);
+		return NULL;
+	}
+	for(line = eol + 1 ; *line ; line = eol + 1){
+		struct irqline *tmp;
+		unsigned long irq;
+		char *e;
+
+		if((eol = strchr(line,'\n')) == NULL){
+			eol = line + strlen(line);
+		}
+		while(isspace(*line) && line < eol){
+			++line;
+		}
+		// NMI, LOC, ERR etc. aren't device interrupts
+		if(isdigit(*line) && (irq = strtoul(line,&e,10)) < UINT_MAX && *e == ':'){
+			if((tmp = realloc(it->lines,sizeof(*tmp) * (it->count + 1))) == NULL){
+				free_irqtable(it);
+				return NULL;
+			}
+			it->lines = tmp;
+			it->lines[it->count].irq = irq;
+			it->lines[it->count].counts = e + 1;
+			++it->count;
+		}
+		if(!*eol){
+			break;
+		}
+	}
+	return it;
+}
+
+static int
+irqline_cmp(const void *vk,const void *vl){
+	const struct irqline *l = vl;
+	unsigned irq = *(const unsigned *)vk;
+
+	return irq < l->irq ? -1 : irq > l->irq ? 1 : 0;
+}
+
+static const struct irqline *
+find_irqline(const irqtable *it,unsigned irq){
+	return bsearch(&irq,it->lines,it->count,sizeof(*it->lines),irqline_cmp);
+}
+
+// Lex the per-CPU counts from a line, returning the action name which ends
+// it (a pointer into the table, length written to *namelen).
+static const char *
+lex_irqline(const irqtable *it,const struct irqline *l,uint64_t *counts,
+				size_t *namelen){
+	const char *cur = l->counts;
+	const char *name;
+	unsigned z;
+
+	for(z = 0 ; z < it->cpus ; ++z){
+		char *e;
+
+		counts[z] = strtoull(cur,&e,10);
+		if(e == cur){
+			return NULL;
+		}
+		cur = e;
+	}
+	*namelen = strcspn(cur,"\n");
+	while(*namelen && isspace(cur[*namelen - 1])){
+		--*namelen;
+	}
+	name = cur + *namelen;
+	while(name > cur && !isspace(name[-1])){
+		--name;
+	}
+	*namelen -= name - cur;
+	return name;
+}
+
+int cpulist_walk(const char *list,int (*fxn)(unsigned,void *),void *curry){
+	while(*list){
+		unsigned long lo,hi;
+		char *e;
+
+		if(!isdigit(*list)){
+			return -1;
+		}
+		lo = hi = strtoul(list,&e,10);
+		if(*e == '-'){
+			list = e + 1;
+			if(!isdigit(*list)){
+				return -1;
+			}
+			hi = strtoul(list,&e,10);
+		}
+		if(hi < lo || hi >= INT_MAX){
+			return -1;
+		}
+		while(lo <= hi){
+			if(fxn(lo++,curry)){
+				return -1;
+			}
+		}
+		if(*e == ','){
+			++e;
+		}else if(*e){
+			return -1;
+		}
+		list = e;
+	}
+	return 0;
+}
+
+static int
+set_cpunode(unsigned cpu,void *vnode){
+	if(cpu >= cpunodecount){
+		int *tmp = realloc(cpunodes,sizeof(*tmp) * (cpu + 1));
+
+		if(tmp == NULL){
+			return -1;
+		}
+		cpunodes = tmp;
+		while(cpunodecount <= cpu){
+			cpunodes[cpunodecount++] = -1;
+		}
+	}
+	cpunodes[cpu] = *(const int *)vnode;
+	return 0;
+}
+
+// Map CPUs to nodes using each node's cpulist. Without NUMA there's no
+// such directory, and every CPU remains unknown.
+static void
+read_cpunodes(void){
+	struct dirent *dire;
+	DIR *dir;
+
+	cpunodes_read = 1;
+	if((dir = opendir(SYSFS_NODES)) == NULL){
+		verbf("Couldn't open %s (%s)\n",SYSFS_NODES,strerror(errno));
+		return;
+	}
+	while( (dire = readdir(dir)) ){
+		char path[PATH_MAX],*list;
+		int node;
+
+		if(sscanf(dire->d_name,"node%d",&node) != 1 || node < 0){
+			continue;
+		}
+		snprintf(path,sizeof(path),"%s/%s/cpulist",SYSFS_NODES,dire->d_name);
+		if((list = get_sysfs_string(sysfd,path)) == NULL){
+			continue;
+		}
+		if(cpulist_walk(list,set_cpunode,&node)){
+			diag("Couldn't parse %s (%s)\n",path,list);
+		}
+		free(list);
+	}
+	closedir(dir);
+}
+
+static int
+cpu_node(int cpu){
+	if(!cpunodes_read){
+		read_cpunodes();
+	}
+	if(cpu < 0 || (unsigned)cpu >= cpunodecount){
+		return -1;
+	}
+	return cpunodes[cpu];
+}
+
+void free_irqinfo(irqinfo *ii){
+	unsigned z;
+
+	if(ii){
+		for(z = 0 ; z < ii->veccount ; ++z){
+			free(ii->vecs[z].counts);
+			free(ii->vecs[z].name);
+		}
+		free(ii->vecs);
+		for(z = 0 ; z < ii->hwqs ; ++z){
+			free(ii->hwqcpus[z]);
+		}
+		free(ii->hwqcpus);
+		free(ii->cpuids);
+		free(ii);
+	}
+}
+
+static int
+irqvector_cmp(const void *va,const void *vb){
+	const irqvector *a = va;
+	const irqvector *b = vb;
+
+	return a->irq < b->irq ? -1 : a->irq > b->irq ? 1 : 0;
+}
+
+// Each MSI or MSI-X vector allocated to the function is a file in msi_irqs/.
+// A controller using legacy INTx has none.
+static int
+discover_vectors(const controller *c,irqinfo *ii){
+	char path[PATH_MAX];
+	struct dirent *dire;
+	DIR *dir;
+
+	if(snprintf(path,sizeof(path),"%s/msi_irqs",c->sysfs) >= (int)sizeof(path)){
+		diag("Name too long: %s\n",c->sysfs);
+		return -1;
+	}
+	if((dir = opendir(path)) == NULL){
+		verbf("No MSI vectors for %s (%s)\n",c->ident,strerror(errno));
+		return 0;
+	}
+	while( (dire = readdir(dir)) ){
+		unsigned long irq;
+		irqvector *tmp;
+		char *e;
+
+		if(!isdigit(dire->d_name[0]) || (irq = strtoul(dire->d_name,&e,10)) >= UINT_MAX || *e){
+			continue;
+		}
+		if((tmp = realloc(ii->vecs,sizeof(*tmp) * (ii->veccount + 1))) == NULL){
+			closedir(dir);
+			return -1;
+		}
+		ii->vecs = tmp;
+		memset(&ii->vecs[ii->veccount],0,sizeof(*ii->vecs));
+		ii->vecs[ii->veccount].irq = irq;
+		ii->vecs[ii->veccount].hwq = -1;
+		ii->vecs[ii->veccount].cpu = -1;
+		ii->vecs[ii->veccount].node = -1;
+		++ii->veccount;
+	}
+	closedir(dir);
+	qsort(ii->vecs,ii->veccount,sizeof(*ii->vecs),irqvector_cmp);
+	return 0;
+}
+
+// All namespaces of an NVMe controller share its tagset, and thus its
+// hardware queues, so the first disk's mq/ describes them all.
+static int
+discover_hwqs(const controller *c,irqinfo *ii){
+	char path[PATH_MAX];
+	struct dirent *dire;
+	const device *d;
+	DIR *dir;
+	int fd;
+
+	for(d = c->blockdevs ; d ; d = d->next){
+		if(d->layout == LAYOUT_NONE){
+			break;
+		}
+	}
+	if(d == NULL){
+		return 0;
+	}
+	if(snprintf(path,sizeof(path),"%s/mq",d->name) >= (int)sizeof(path)){
+		diag("Name too long: %s\n",d->name);
+		return -1;
+	}
+	if((fd = openat(sysfd,path,O_RDONLY|O_CLOEXEC|O_DIRECTORY)) < 0){
+		verbf("No blk-mq contexts for %s (%s)\n",d->name,strerror(errno));
+		return 0;
+	}
+	if((dir = fdopendir(fd)) == NULL){
+		diag("Couldn't get DIR * from fd %d for %s (%s)\n",fd,path,strerror(errno));
+		close(fd);
+		return -1;
+	}
+	while( (dire = readdir(dir)) ){
+		char cpath[PATH_MAX];
+		unsigned long hwq;
+		char *e;
+
+		if(!isdigit(dire->d_name[0]) || (hwq = strtoul(dire->d_name,&e,10)) >= UINT_MAX || *e){
+			continue;
+		}
+		if(hwq >= ii->hwqs){
+			char **tmp = realloc(ii->hwqcpus,sizeof(*tmp) * (hwq + 1));
+
+			if(tmp == NULL){
+				closedir(dir);
+				return -1;
+			}
+			ii->hwqcpus = tmp;
+			while(ii->hwqs <= hwq){
+				ii->hwqcpus[ii->hwqs++] = NULL;
+			}
+		}
+		snprintf(cpath,sizeof(cpath),"%s/%s/cpu_list",path,dire->d_name);
+		ii->hwqcpus[hwq] = get_sysfs_string(sysfd,cpath);
+	}
+	closedir(dir);
+	return 0;
+}
+
+static irqinfo *
+discover_irqs(const controller *c){
+	irqinfo *ii;
+
+	if((ii = malloc(sizeof(*ii))) == NULL){
+		return NULL;
+	}
+	memset(ii,0,sizeof(*ii));
+	if(discover_vectors(c,ii) || discover_hwqs(c,ii)){
+		free_irqinfo(ii);
+		return NULL;
+	}
+	verbf("%s: %u interrupt vectors, %u hardware queues\n",c->ident,ii->veccount,ii->hwqs);
+	return ii;
+}
+
+// The NVMe driver names its vectors <ctrl>q<qid>, where qid 0 is the admin
+// queue and I/O queue qid is served by hardware context qid - 1.
+static int
+vector_hwq(const irqinfo *ii,const char *name){
+	const char *q = strrchr(name,'q');
+	unsigned long qid;
+	char *e;
+
+	if(q == NULL || !isdigit(q[1])){
+		return -1;
+	}
+	qid = strtoul(q + 1,&e,10);
+	if(*e || qid == 0 || qid > ii->hwqs){
+		return -1;
+	}
+	return qid - 1;
+}
+
+// Update a vector from its line, accumulating its per-CPU interrupts over
+// the sample into busy. Returns the number of interrupts it saw.
+static uint64_t
+sample_vector(irqinfo *ii,irqvector *v,const irqtable *it,
+			const struct irqline *l,uint64_t *cur,uint64_t *busy){
+	uint64_t total = 0,most = 0;
+	const char *name;
+	size_t namelen;
+	unsigned z;
+
+	if((name = lex_irqline(it,l,cur,&namelen)) == NULL){
+		return 0;
+	}
+	if(v->name == NULL && namelen){
+		if( (v->name = strndup(name,namelen)) ){
+			v->hwq = vector_hwq(ii,v->name);
+		}
+	}
+	if(v->counts == NULL){
+		if((v->counts = malloc(sizeof(*v->counts) * it->cpus)) == NULL){
+			return 0;
+		}
+		memcpy(v->counts,cur,sizeof(*cur) * it->cpus);
+		return 0;
+	}
+	for(z = 0 ; z < it->cpus ; ++z){
+		uint64_t delta = cur[z] - v->counts[z];
+
+		if(delta > most){
+			most = delta;
+			v->cpu = it->cpuids[z];
+		}
+		busy[z] += delta;
+		total += delta;
+	}
+	memcpy(v->counts,cur,sizeof(*cur) * it->cpus);
+	if(total){
+		v->node = cpu_node(v->cpu);
+	}
+	return total;
+}
+
+struct queuecpus {
+	int cpu,node;		// CPU servicing the vector, and its node
+	unsigned oncpu;		// cpu is among the queue's submitters
+	unsigned onnode;	// some submitter shares node
+};
+
+static int
+match_queuecpu(unsigned cpu,void *vqc){
+	struct queuecpus *qc = vqc;
+
+	if((int)cpu == qc->cpu){
+		qc->oncpu = 1;
+	}
+	if(qc->node >= 0 && cpu_node(cpu) == qc->node){
+		qc->onnode = 1;
+	}
+	return 0;
+}
+
+// Compare a vector's servicing CPU to the CPUs submitting to its queue. The
+// completion ought be handled on a submitter, and certainly on a submitter's
+// node; the controller's own node doesn't enter into it.
+static unsigned
+vector_problems(const irqinfo *ii,const irqvector *v){
+	struct queuecpus qc;
+	unsigned problems = 0;
+
+	if(v->hwq < 0 || v->cpu < 0 || ii->hwqcpus[v->hwq] == NULL){
+		return 0;
+	}
+	memset(&qc,0,sizeof(qc));
+	qc.cpu = v->cpu;
+	qc.node = v->node;
+	if(cpulist_walk(ii->hwqcpus[v->hwq],match_queuecpu,&qc)){
+		return 0;
+	}
+	if(!qc.oncpu){
+		problems |= IRQ_OFF_QUEUE;
+	}
+	if(qc.node >= 0 && !qc.onnode){
+		problems |= IRQ_REMOTE_NODE;
+	}
+	return problems;
+}
+
+static void
+forget_counts(irqinfo *ii){
+	unsigned z;
+
+	for(z = 0 ; z < ii->veccount ; ++z){
+		free(ii->vecs[z].counts);
+		ii->vecs[z].counts = NULL;
+		ii->vecs[z].rate = 0;
+	}
+	ii->sampled.tv_sec = ii->sampled.tv_nsec = 0;
+}
+
+int irq_update(controller *c,const irqtable *it){
+	unsigned z,active,busycpus,problems;
+	uint64_t *cur,*busy;
+	uint64_t elapsed;
+	irqinfo *ii;
+
+	if(c->bus != BUS_PCIe || c->transport != TRANSPORT_NVME || c->sysfs == NULL){
+		return 0;
+	}
+	if(c->irqs == NULL){
+		if(c->blockdevs == NULL){
+			return 0; // wait for its disks, and thus its queues
+		}
+		if((c->irqs = discover_irqs(c)) == NULL){
+			return -1;
+		}
+	}
+	ii = c->irqs;
+	if(ii->veccount == 0 || it->cpus == 0){
+		return 0;
+	}
+	if(ii->cpus != it->cpus || memcmp(ii->cpuids,it->cpuids,sizeof(*it->cpuids) * it->cpus)){
+		unsigned *tmp;
+
+		// CPU hotplug changed the columns
+		if((tmp = realloc(ii->cpuids,sizeof(*tmp) * it->cpus)) == NULL){
+			return -1;
+		}
+		ii->cpuids = tmp;
+		memcpy(ii->cpuids,it->cpuids,sizeof(*tmp) * it->cpus);
+		forget_counts(ii);
+		ii->cpus = it->cpus;
+	}
+	if((cur = malloc(sizeof(*cur) * it->cpus * 2)) == NULL){
+		return -1;
+	}
+	busy = cur + it->cpus;
+	memset(busy,0,sizeof(*busy) * it->cpus);
+	elapsed = (it->when.tv_sec - ii->sampled.tv_sec) * 1000000000ull +
+		it->when.tv_nsec - ii->sampled.tv_nsec;
+	active = 0;
+	for(z = 0 ; z < ii->veccount ; ++z){
+		irqvector *v = &ii->vecs[z];
+		const struct irqline *l;
+		uint64_t total;
+
+		if((l = find_irqline(it,v->irq)) == NULL){
+			// the driver reallocated its vectors; start anew next tick
+			verbf("%s lost IRQ %u, rediscovering\n",c->ident,v->irq);
+			free(cur);
+			free_irqinfo(ii);
+			c->irqs = NULL;
+			return 0;
+		}
+		total = sample_vector(ii,v,it,l,cur,busy);
+		v->rate = ii->sampled.tv_sec && elapsed ? total * 1000000000ull / elapsed : 0;
+		if(total){
+			v->problems = vector_problems(ii,v);
+			++active;
+		}
+	}
+	busycpus = 0;
+	for(z = 0 ; z < it->cpus ; ++z){
+		if(busy[z]){
+			++busycpus;
+		}
+	}
+	free(cur);
+	ii->sampled = it->when;
+	if(active == 0){
+		return 0; // an idle controller tells us nothing new
+	}
+	problems = 0;
+	for(z = 0 ; z < ii->veccount ; ++z){
+		problems |= ii->vecs[z].problems;
+	}
+	if(active > 1 && busycpus == 1){
+		problems |= IRQ_ONE_CPU;
+	}
+	if(problems == ii->problems){
+		return 0;
+	}
+	if(problems & ~ii->problems){
+		diag("%s: %s\n",c->ident,irq_problem_str(problems & ~ii->problems));
+	}
+	ii->problems = problems;
+	return 1;
+}
+
+const char *irq_problem_str(unsigned problems){
+	if(problems & IRQ_ONE_CPU){
+		return "interrupts all on one CPU";
+	}else if(problems & IRQ_REMOTE_NODE){
+		return "interrupts on remote NUMA node";
+	}else if(problems & IRQ_OFF_QUEUE){
+		return "interrupts off their queues' CPUs";
+	}
+	return NULL;
+}
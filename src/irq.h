@@ -0,0 +1,72 @@
+// copyright 2012–2021 nick black
+#ifndef GROWLIGHT_IRQ
+#define GROWLIGHT_IRQ
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <time.h>
+#include <stdint.h>
+
+struct controller;
+
+// NVMe controllers get an MSI-X vector per blk-mq hardware queue (plus one
+// for the admin queue), each meant to be serviced on the CPUs which submit
+// to that queue. We sample each vector's per-CPU counts from /proc/interrupts
+// with every stats tick, and note where its interrupts are actually landing.
+
+// Problems found in a controller's interrupt routing
+#define IRQ_REMOTE_NODE	0x1u	// vectors serviced on no submitting CPU's node
+#define IRQ_ONE_CPU	0x2u	// several busy vectors all serviced by one CPU
+#define IRQ_OFF_QUEUE	0x4u	// vectors serviced on a CPU not submitting to them
+
+typedef struct irqvector {
+	unsigned irq;		// Linux IRQ number, from msi_irqs/
+	char *name;		// Action from /proc/interrupts, i.e. "nvme0q3"
+	int hwq;		// blk-mq hardware context served, -1 if none
+	uint64_t *counts;	// Per-CPU interrupts as of the last sample
+	uint64_t rate;		// Interrupts/s over the last sample
+	int cpu;		// CPU last taking the bulk of them, -1 if unknown
+	int node;		// NUMA node of cpu, -1 if unknown
+	unsigned problems;	// IRQ_REMOTE_NODE|IRQ_OFF_QUEUE when last busy
+} irqvector;
+
+typedef struct irqinfo {
+	irqvector *vecs;	// Sorted by IRQ number
+	unsigned veccount;
+	unsigned cpus;		// Length of each vector's counts
+	unsigned *cpuids;	// CPU number of each count
+	char **hwqcpus;		// cpu_list of each blk-mq hardware context
+	unsigned hwqs;
+	unsigned problems;	// IRQ_* problems as of the last busy sample
+	struct timespec sampled;// CLOCK_MONOTONIC time of counts, 0 if none
+} irqinfo;
+
+// /proc/interrupts, as read at one stats tick
+typedef struct irqtable irqtable;
+
+// Read /proc/interrupts. Called from the stats tick, without the lock held.
+irqtable *read_proc_interrupts(void);
+
+void free_irqtable(irqtable *);
+
+// Update the controller's vectors from the table, discovering them and its
+// hardware queues if necessary. Called with the growlight lock held. Returns
+// 1 if the controller's problems changed, 0 if they didn't, and -1 on error.
+int irq_update(struct controller *c, const irqtable *it);
+
+// Describe the most severe of a set of IRQ_* problems, NULL if none
+const char *irq_problem_str(unsigned problems);
+
+void free_irqinfo(irqinfo *);
+
+// Invoke fxn on each CPU of a Linux cpulist ("0-3,8,10-11"), stopping with
+// -1 if it returns non-zero. Returns -1 on a malformed list.
+int cpulist_walk(const char *list,int (*fxn)(unsigned,void *),void *curry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
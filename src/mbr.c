@@ -13,6 +13,8 @@
 
 #include "mbr.h"
 #include "sha.h"
+#include "image.h"
+#include "snapshot.h"
 #include "growlight.h"
 
 #define MBR_SIZE 512
@@ -73,7 +75,7 @@ wipe_first_sector(device *d, size_t wipe, size_t wipeend){
 		diag("Bad device name: %s\n", d->name);
 		return -1;
 	}
-	if((fd = openat(devfd, d->name, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
+	if((fd = open_blockdev(d, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
 		int e = errno;
 		diag("Couldn't open /dev/%s (%s?)\n", d->name, strerror(errno));
 		errno = e;
@@ -110,9 +112,10 @@ wipe_first_sector(device *d, size_t wipe, size_t wipeend){
 	if(zerombrp(d->blkdev.biossha1)){
 		d->blkdev.biosboot = 0;
 	}
-	// FIXME we still have valid filesystems, but no longer have valid
-	//   partition table entries for them (iff we were using MBR). add
-	//   "recovery"? gparted can supposedly find lost filesystems....
+	// We still have valid filesystems, but no longer have valid partition
+	// table entries for them (iff we were using MBR). Our callers snapshot
+	// the metadata beforehand, so restore_ptable_snapshot() recovers it.
+	// FIXME absent a snapshot, gparted can supposedly find lost filesystems
 	if(rescan_blockdev(d)){
 		return -1;
 	}
@@ -120,10 +123,16 @@ wipe_first_sector(device *d, size_t wipe, size_t wipeend){
 }
 
 int wipe_biosboot(device *d){
+	if(snapshot_before_wipe(d)){
+		return -1;
+	}
 	return wipe_first_sector(d, 0, MBR_CODE_SIZE);
 }
 
 int wipe_dosmbr(device *d){
+	if(snapshot_before_wipe(d)){
+		return -1;
+	}
 	if(wipe_first_sector(d, 0, MBR_SIZE)){
 		return -1;
 	}
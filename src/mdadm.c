@@ -1,34 +1,390 @@
 // copyright 2012–2021 nick black
 #include <assert.h>
 #include <errno.h>
+#include <dirent.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <endian.h>
 #include <unistd.h>
+#include <linux/fs.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/major.h>
+#include <sys/sysmacros.h>
+#include <linux/raid/md_p.h>
+#include <linux/raid/md_u.h>
 
+#include "ssd.h"
 #include "sysfs.h"
 #include "mdadm.h"
+#include "stack.h"
 #include "popen.h"
 #include "growlight.h"
 #include "aggregate.h"
 
+// sync_speed_{min,max} read as e.g. "1000 (system)" or "50000 (local)"
+static int
+get_sync_limit(int dirfd,const char *node,unsigned long *limit,unsigned *local,unsigned bit){
+	char *s,*end;
+
+	if((s = get_sysfs_string(dirfd,node)) == NULL){
+		return -1;
+	}
+	*limit = strtoul(s,&end,10);
+	if(end == s){
+		diag("Malformed %s: %s\n",node,s);
+		free(s);
+		return -1;
+	}
+	if(strstr(end,"local")){
+		*local |= bit;
+	}else{
+		*local &= ~bit;
+	}
+	free(s);
+	return 0;
+}
+
+// Read the sync state from the md/ directory. Progress is only read while a
+// sync is under way; it otherwise reads "none".
+static int
+md_sync_state(device *d,int dirfd){
+	uintmax_t done,total;
+	unsigned long ul;
+	char *s;
+
+	free(d->mddev.syncaction);
+	if((d->mddev.syncaction = get_sysfs_string(dirfd,"sync_action")) == NULL){
+		verbf("Warning: no 'sync_action' content in mdadm device %s\n",d->name);
+		d->mddev.resync = 0;
+		return -1;
+	}
+	d->mddev.resync = strcmp(d->mddev.syncaction,"idle") && strcmp(d->mddev.syncaction,"frozen");
+	get_sync_limit(dirfd,"sync_speed_min",&d->mddev.syncmin,&d->mddev.synclocal,MD_SYNC_LOCAL_MIN);
+	get_sync_limit(dirfd,"sync_speed_max",&d->mddev.syncmax,&d->mddev.synclocal,MD_SYNC_LOCAL_MAX);
+	if(get_sysfs_uint(dirfd,"mismatch_cnt",&ul) == 0){
+		d->mddev.mismatches = ul;
+	}
+	d->mddev.syncspeed = 0;
+	if(!d->mddev.resync){
+		d->mddev.syncdone = d->mddev.synctotal = 0;
+		d->mddev.syncrate = d->mddev.synceta = 0;
+		return 0;
+	}
+	// "none" between actions, "delayed" while waiting on another array
+	// sharing a disk
+	if((s = get_sysfs_string(dirfd,"sync_completed")) == NULL){
+		verbf("Warning: no 'sync_completed' content in mdadm device %s\n",d->name);
+	}else{
+		if(sscanf(s,"%ju / %ju",&done,&total) == 2 && total){
+			d->mddev.syncdone = done;
+			d->mddev.synctotal = total;
+		}
+		free(s);
+	}
+	if(get_sysfs_uint(dirfd,"sync_speed",&d->mddev.syncspeed)){
+		d->mddev.syncspeed = 0; // "none"
+	}
+	return 0;
+}
+
+// Spares and faulty members take none of the array's I/O (a spare being
+// rebuilt takes only writes), so they mustn't be weighed against the rest.
+static void
+md_member_states(device *d,int dirfd){
+	stackedge *e;
+
+	for(e = d->members ; e ; e = e->mnext){
+		char node[NAME_MAX + 16];
+		char *s;
+
+		e->idle = 0;
+		if((unsigned)snprintf(node,sizeof(node),"dev-%s/state",e->member->name) >= sizeof(node)){
+			continue;
+		}
+		if( (s = get_sysfs_string(dirfd,node)) ){
+			e->idle = strstr(s,"spare") || strstr(s,"faulty");
+			free(s);
+		}
+	}
+}
+
+int md_sync_update(device *d,const struct timeval *elapsed){
+	uintmax_t prevdone = d->mddev.syncdone;
+	unsigned prevresync = d->mddev.resync;
+	uintmax_t prevmismatches = d->mddev.mismatches;
+	uintmax_t usec,rate;
+	char path[NAME_MAX + 4];
+	int dirfd,r;
+
+	if(d->layout != LAYOUT_MDADM){
+		return -1;
+	}
+	if((unsigned)snprintf(path,sizeof(path),"%s/md",d->name) >= sizeof(path)){
+		return -1;
+	}
+	if((dirfd = openat(sysfd,path,O_RDONLY|O_CLOEXEC|O_DIRECTORY)) < 0){
+		return -1;
+	}
+	r = md_sync_state(d,dirfd);
+	md_member_states(d,dirfd);
+	close(dirfd);
+	if(r){
+		return -1;
+	}
+	if(!d->mddev.resync){
+		return prevresync || prevmismatches != d->mddev.mismatches;
+	}
+	// prefer the progress we saw over the last tick, falling back to the
+	// kernel's own (KiB/s) figure at the start, or across a restart
+	usec = elapsed->tv_sec * 1000000ull + elapsed->tv_usec;
+	rate = d->mddev.syncspeed * 2;
+	if(prevresync && usec && d->mddev.syncdone > prevdone){
+		rate = (d->mddev.syncdone - prevdone) * 1000000ull / usec;
+	}
+	d->mddev.syncrate = rate;
+	d->mddev.synceta = 0;
+	if(rate && d->mddev.synctotal > d->mddev.syncdone){
+		d->mddev.synceta = (d->mddev.synctotal - d->mddev.syncdone) / rate;
+	}
+	return 1;
+}
+
+// Write val to the node within the named array's md/ sysfs directory
+static int
+write_md_sysfs(const char *name,const char *node,const char *val){
+	char path[PATH_MAX];
+
+	if((unsigned)snprintf(path,sizeof(path),"%s/md/%s",name,node) >= sizeof(path)){
+		diag("Name too long: %s\n",name);
+		return -1;
+	}
+	if(write_sysfsat(sysfd,path,val)){
+		diag("Couldn't write %s to %s (%s?)\n",val,path,strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int
+write_sync_limit(const device *d,const char *node,unsigned long limit){
+	char val[32];
+
+	if(limit == 0){
+		return write_md_sysfs(d->name,node,"system");
+	}
+	snprintf(val,sizeof(val),"%lu",limit);
+	return write_md_sysfs(d->name,node,val);
+}
+
+static unsigned autotune = 1;
+
+void md_set_autotune(int enable){
+	autotune = enable;
+}
+
+unsigned long md_stripe_cache_recommendation(unsigned long disks,uintmax_t chunk){
+	const long pagesz = sysconf(_SC_PAGESIZE);
+	const long pages = sysconf(_SC_PHYS_PAGES);
+	unsigned long want,cap;
+
+	if(disks == 0 || pagesz <= 0){
+		return MD_STRIPE_CACHE_DEFAULT;
+	}
+	// wider arrays need more stripes in flight to assemble full-stripe
+	// writes, and each should hold a few chunks' worth
+	want = MD_STRIPE_CACHE_PER_DISK * disks;
+	if(chunk / pagesz * 4 > want){
+		want = chunk / pagesz * 4;
+	}
+	// each entry costs a page per member
+	if(pages > 0){
+		cap = pages / MD_STRIPE_CACHE_MEM_FRACTION / disks;
+		if(want > cap){
+			want = cap;
+		}
+	}
+	if(want < MD_STRIPE_CACHE_DEFAULT){
+		want = MD_STRIPE_CACHE_DEFAULT;
+	}else if(want > MD_STRIPE_CACHE_MAX){
+		want = MD_STRIPE_CACHE_MAX;
+	}
+	return want;
+}
+
+int md_set_tunable(device *d,const char *knob,unsigned long val){
+	char sval[32];
+
+	if(d == NULL || d->layout != LAYOUT_MDADM){
+		diag("%s is not an MD device\n",d ? d->name : "(null)");
+		return -1;
+	}
+	if(strcmp(knob,"bitmap_chunk") == 0){
+		// only settable while no bitmap is active, so recreate it
+		if(d->mddev.bitmapchunk == 0){
+			diag("%s has no write-intent bitmap\n",d->name);
+			return -1;
+		}
+		// validate before dropping the bitmap, lest we be left without
+		if(val < MD_BITMAP_CHUNK_MIN || (val & (val - 1))){
+			diag("Bitmap chunk must be a power of two, at least %d bytes\n",
+					MD_BITMAP_CHUNK_MIN);
+			return -1;
+		}
+		if(vspopen_drain("mdadm --grow /dev/%s --bitmap=none",d->name)){
+			return -1;
+		}
+		if(vspopen_drain("mdadm --grow /dev/%s --bitmap=internal --bitmap-chunk=%luK",
+					d->name,val / 1024)){
+			diag("Restoring %s's %juKiB bitmap chunk\n",d->name,
+					(uintmax_t)d->mddev.bitmapchunk / 1024);
+			if(vspopen_drain("mdadm --grow /dev/%s --bitmap=internal --bitmap-chunk=%juK",
+						d->name,(uintmax_t)d->mddev.bitmapchunk / 1024)){
+				diag("%s has no write-intent bitmap!\n",d->name);
+				d->mddev.bitmapchunk = 0;
+			}
+			return -1;
+		}
+		d->mddev.bitmapchunk = val;
+		return 0;
+	}
+	if(strcmp(knob,"stripe_cache_size") && strcmp(knob,"group_thread_cnt") &&
+			strcmp(knob,"preread_bypass_threshold")){
+		diag("Unknown md tunable: %s\n",knob);
+		return -1;
+	}
+	if(d->mddev.stripecache == 0){
+		diag("%s is not a parity (RAID 4/5/6) array\n",d->name);
+		return -1;
+	}
+	snprintf(sval,sizeof(sval),"%lu",val);
+	if(write_md_sysfs(d->name,knob,sval)){
+		return -1;
+	}
+	if(strcmp(knob,"stripe_cache_size") == 0){
+		d->mddev.stripecache = val;
+	}else if(strcmp(knob,"group_thread_cnt") == 0){
+		d->mddev.groupthreads = val;
+	}else{
+		d->mddev.prereadbypass = val;
+	}
+	return 0;
+}
+
+// Find the md array holding the component comp, through comp's holders/ in
+// sysfs. mdadm -C has bound the components before it returns, but udev
+// might not yet have created the /dev/md/ link.
+static int
+md_holding(const char *comp,char *md,size_t len){
+	char path[PATH_MAX];
+	struct dirent *dire;
+	DIR *dir;
+	int fd,r;
+
+	if(snprintf(path,sizeof(path),"%s/holders",comp) >= (int)sizeof(path)){
+		diag("Name too long: %s\n",comp);
+		return -1;
+	}
+	if((fd = openat(sysfd,path,O_RDONLY|O_CLOEXEC|O_DIRECTORY)) < 0){
+		diag("Couldn't open %s (%s?)\n",path,strerror(errno));
+		return -1;
+	}
+	if((dir = fdopendir(fd)) == NULL){
+		diag("Couldn't get DIR * from fd %d for %s (%s)\n",fd,path,strerror(errno));
+		close(fd);
+		return -1;
+	}
+	r = -1;
+	while(errno = 0, (dire = readdir(dir)) != NULL){
+		if(dire->d_type != DT_LNK){
+			continue;
+		}
+		if(snprintf(path,sizeof(path),"%s/md/array_state",dire->d_name) >= (int)sizeof(path)){
+			continue;
+		}
+		if(faccessat(sysfd,path,F_OK,0) == 0 && strlen(dire->d_name) < len){
+			strcpy(md,dire->d_name);
+			r = 0;
+			break;
+		}
+	}
+	closedir(dir);
+	return r;
+}
+
+// Size the stripe cache of a newly-created parity array. mdadm -N names the
+// array; the kernel name is found through its components' holders/.
+static void
+autotune_parity(const char *name,char * const *comps,int num){
+	char md[NAME_MAX + 1],val[32];
+	unsigned long rec;
+	int z;
+
+	if(!autotune){
+		return;
+	}
+	for(z = 0 ; z < num ; ++z){
+		if(strcmp(comps[z],"missing") && md_holding(comps[z],md,sizeof(md)) == 0){
+			break;
+		}
+	}
+	if(z == num){
+		diag("Couldn't find the md device for %s, not tuning\n",name);
+		return;
+	}
+	// the array doesn't yet exist for us, so assume the default chunk
+	rec = md_stripe_cache_recommendation(num,MD_DEFAULT_CHUNK);
+	snprintf(val,sizeof(val),"%lu",rec);
+	if(write_md_sysfs(md,"stripe_cache_size",val) == 0){
+		verbf("%s (%s): stripe_cache_size %lu\n",name,md,rec);
+	}
+}
+
+int md_set_sync_speed(device *d,unsigned long min,unsigned long max){
+	if(d == NULL || d->layout != LAYOUT_MDADM){
+		diag("%s is not an MD device\n",d ? d->name : "(null)");
+		return -1;
+	}
+	if(min && max && min > max){
+		diag("Minimum sync speed %lu exceeds maximum %lu\n",min,max);
+		return -1;
+	}
+	// never invert the limits in passing: when raising the minimum past
+	// the current maximum, write the maximum first
+	if(min && min > d->mddev.syncmax){
+		if(write_sync_limit(d,"sync_speed_max",max) || write_sync_limit(d,"sync_speed_min",min)){
+			return -1;
+		}
+	}else if(write_sync_limit(d,"sync_speed_min",min) || write_sync_limit(d,"sync_speed_max",max)){
+		return -1;
+	}
+	verbf("%s sync speed limits: %lu-%lu KiB/s\n",d->name,min,max);
+	return 0;
+}
+
 int explore_md_sysfs(device *d,int dirfd){
 	unsigned degraded = 0;
 	unsigned long rd;
 	mdslave **enqm;
-	char *syncpct;
 	char buf[30];
 
-	if((syncpct = get_sysfs_string(dirfd,"sync_completed")) == NULL){
-		verbf("Warning: no 'sync_completed' content in mdadm device %s\n",d->name);
-	}else if(strcmp(syncpct,"none") == 0){
-		d->mddev.resync = 0;
-	}else{
-		// FIXME lex "%ju / %ju"
-		d->mddev.resync = 1;
+	md_sync_state(d,dirfd);
+	// the stripe cache and its knobs are only present for RAID 4/5/6
+	if(get_sysfs_uint(dirfd,"stripe_cache_size",&d->mddev.stripecache)){
+		d->mddev.stripecache = 0;
+	}
+	if(get_sysfs_uint(dirfd,"group_thread_cnt",&d->mddev.groupthreads)){
+		d->mddev.groupthreads = 0;
+	}
+	if(get_sysfs_uint(dirfd,"preread_bypass_threshold",&d->mddev.prereadbypass)){
+		d->mddev.prereadbypass = 0;
+	}
+	// 0 if there's no write-intent bitmap
+	if(get_sysfs_uint(dirfd,"bitmap/chunksize",&d->mddev.bitmapchunk)){
+		d->mddev.bitmapchunk = 0;
 	}
-	free(syncpct);
 	// These files will be empty on incomplete arrays like the md0 that
 	// sometimes pops up.
 	if(get_sysfs_uint(dirfd,"raid_disks",&d->mddev.disks)){
@@ -108,48 +464,10 @@ int explore_md_sysfs(device *d,int dirfd){
 			unlock_growlight();
 			return -1;
 		}
-		// m->component = subd;
-		switch(subd->layout){
-			case LAYOUT_NONE:
-				if(d->mddev.transport == AGGREGATE_UNKNOWN){
-					d->mddev.transport = subd->blkdev.transport;
-				}else if(d->mddev.transport != subd->blkdev.transport){
-					d->mddev.transport = AGGREGATE_MIXED;
-				}
-				break;
-			case LAYOUT_MDADM:
-				if(d->mddev.transport == AGGREGATE_UNKNOWN){
-					d->mddev.transport = subd->mddev.transport;
-				}else if(d->mddev.transport != subd->mddev.transport){
-					d->mddev.transport = AGGREGATE_MIXED;
-				}
-				break;
-			case LAYOUT_PARTITION:
-				if(d->mddev.transport == AGGREGATE_UNKNOWN){
-					d->mddev.transport = subd->partdev.parent->blkdev.transport;
-				}else if(d->mddev.transport != subd->partdev.parent->blkdev.transport){
-					d->mddev.transport = AGGREGATE_MIXED;
-				}
-				break;
-			case LAYOUT_ZPOOL:
-				if(d->mddev.transport == AGGREGATE_UNKNOWN){
-					d->mddev.transport = subd->zpool.transport;
-				}else if(d->mddev.transport != subd->zpool.transport){
-					d->mddev.transport = AGGREGATE_MIXED;
-				}
-				break;
-			default:
-				diag("Unknown layout %d on %s\n",subd->layout,subd->name);
-				break;
-		}
+		d->mddev.transport = merge_transport(d->mddev.transport,subd);
 		unlock_growlight();
 	}
 	d->mddev.degraded = degraded;
-	if(d->mddev.resync && !d->mddev.degraded){
-		// FIXME why do we indicate resync as "1-degraded"?
-		// don't overload this
-		d->mddev.degraded = 1;
-	}
 	d->mddev.swidth = 0;
 	if(d->mddev.level && d->mddev.disks && d->mddev.stride){
 		const aggregate_type *agg;
@@ -182,30 +500,71 @@ int destroy_mdadm(device *d){
 	return 0;
 }
 
+// md only passes discards through parity RAID when raid456's
+// devices_handle_discard_safely parameter is set, and that's only correct if
+// every member reads back zeroes after TRIM. Say whether it could be.
+static void
+check_parity_discard(const char *name,char * const *comps,int num){
+	unsigned safe = 0;
+	int z;
+
+	lock_growlight();
+	for(z = 0 ; z < num ; ++z){
+		const device *d;
+		discard_e ds;
+
+		if(strcmp(comps[z],"missing") == 0){
+			continue;
+		}
+		if((d = lookup_device(comps[z])) == NULL){
+			continue;
+		}
+		if(discard_safe_p(d,1)){
+			++safe;
+		}else if((ds = discard_state(d)) == DISCARD_NONDET || ds == DISCARD_DETERMINISTIC){
+			diag("%s: %s discards are %s, not zeroes; md won't pass discards through\n",
+				name,d->name,discard_str(ds));
+		}
+	}
+	unlock_growlight();
+	if(safe && safe == (unsigned)num){
+		verbf("%s: all members read zeroes after TRIM (raid456 devices_handle_discard_safely is safe)\n",name);
+	}
+}
+
 static int
 generic_mdadm_create(const char *name,const char *metadata,const char *level,
 			char * const *comps,int num,int bitmap){
 	char buf[BUFSIZ] = "";
+	int z,parity;
 	size_t pos;
-	int z;
 
+	parity = strcmp(level,"raid4") == 0 || strcmp(level,"raid5") == 0 || strcmp(level,"raid6") == 0;
+	if(parity){
+		check_parity_discard(name,comps,num);
+	}
 	pos = 0;
 #define PREFIX "/dev/"
 	for(z = 0 ; z < num ; ++z){
 		if((unsigned)snprintf(buf + pos,sizeof(buf) - pos," %s%s",
-				strcmp(*comps,"missing") ? "/dev/" : "",
-				*comps) >= sizeof(buf) - pos){
+				strcmp(comps[z],"missing") ? "/dev/" : "",
+				comps[z]) >= sizeof(buf) - pos){
 			diag("Too many arguments for MD creation\n");
 			return -1;
 		}
-		++comps;
 		pos += strlen(buf + pos);
 	}
 #undef PREFIX
 	// FIXME provide a way to let user control write intent bitmap
-	return vspopen_drain("mdadm -C \"%s\" --auto=md -e %s -l %s -N \"%s\" -n %d%s%s",
+	if(vspopen_drain("mdadm -C \"%s\" --auto=md -e %s -l %s -N \"%s\" -n %d%s%s",
 				name,metadata,level,name,num,
-				bitmap ? " -b internal" : "",buf);
+				bitmap ? " -b internal" : "",buf)){
+		return -1;
+	}
+	if(parity){
+		autotune_parity(name,comps,num);
+	}
+	return 0;
 }
 
 int make_mdraid0(const char *name,char * const *comps,int num){
@@ -231,3 +590,436 @@ int make_mdraid6(const char *name,char * const *comps,int num){
 int make_mdraid10(const char *name,char * const *comps,int num){
 	return generic_mdadm_create(name,"1.2","raid10",comps,num,1);
 }
+
+// A member as described by its superblock
+typedef struct mdmember {
+	char *name;
+	dev_t devno;
+	int role;		// slot in the array, -1 for spares and faulty
+	uint64_t events;
+	struct mdmember *next;
+} mdmember;
+
+// Members sharing an array UUID
+typedef struct mdset {
+	unsigned char uuid[16];
+	int major,minor;	// superblock version (0.90, 1.0, 1.1, 1.2)
+	int level;
+	unsigned layout;
+	unsigned raid_disks;
+	int preferred;		// 0.90's md_minor, otherwise -1
+	uint64_t events;	// freshest among members
+	char *desc;		// set_name for 1.x, otherwise the first member
+	mdmember *members;
+	struct mdset *next;
+} mdset;
+
+// The superblock's location, in bytes, for 1.x minor version minor
+static off_t
+sb1_offset(int minor,uint64_t bytes){
+	uint64_t sectors = bytes / 512;
+
+	switch(minor){
+		case 0: return (off_t)(((sectors - 8 * 2) & ~(uint64_t)(4 * 2 - 1)) * 512);
+		case 1: return 0;
+		case 2: return 4096;
+	}
+	return -1;
+}
+
+static int
+read_sb1(int fd,uint64_t bytes,mdset *set,mdmember *m){
+	union {
+		struct mdp_superblock_1 sb;
+		unsigned char buf[4096];
+	} u;
+	int minor;
+
+	for(minor = 0 ; minor <= 2 ; ++minor){
+		off_t off = sb1_offset(minor,bytes);
+		unsigned devnum,role,maxdev;
+
+		if(off < 0 || (uint64_t)off + sizeof(u) > bytes){
+			continue;
+		}
+		if(pread(fd,u.buf,sizeof(u),off) != (ssize_t)sizeof(u)){
+			continue;
+		}
+		if(le32toh(u.sb.magic) != MD_SB_MAGIC || le32toh(u.sb.major_version) != 1){
+			continue;
+		}
+		if(le64toh(u.sb.super_offset) != (uint64_t)off / 512){
+			continue; // a superblock belonging to some other layer
+		}
+		devnum = le32toh(u.sb.dev_number);
+		maxdev = le32toh(u.sb.max_dev);
+		if(maxdev > (sizeof(u) - sizeof(u.sb)) / sizeof(*u.sb.dev_roles) || devnum >= maxdev){
+			continue;
+		}
+		memcpy(set->uuid,u.sb.set_uuid,sizeof(set->uuid));
+		set->major = 1;
+		set->minor = minor;
+		set->level = (int)le32toh(u.sb.level);
+		set->layout = le32toh(u.sb.layout);
+		set->raid_disks = le32toh(u.sb.raid_disks);
+		set->preferred = -1;
+		if((set->desc = strndup(u.sb.set_name,sizeof(u.sb.set_name))) == NULL){
+			return -1;
+		}
+		role = le16toh(u.sb.dev_roles[devnum]);
+		m->role = role < MD_DISK_ROLE_MAX ? (int)role : -1;
+		m->events = le64toh(u.sb.events);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+read_sb090(int fd,uint64_t bytes,mdset *set,mdmember *m){
+	off_t off;
+	mdp_super_t sb;
+
+	if(bytes / 512 < MD_RESERVED_SECTORS * 2){
+		return 0;
+	}
+	off = (off_t)MD_NEW_SIZE_SECTORS(bytes / 512) * 512;
+	if(pread(fd,&sb,sizeof(sb),off) != (ssize_t)sizeof(sb)){
+		return 0;
+	}
+	if(sb.md_magic != MD_SB_MAGIC || sb.major_version != 0 || sb.minor_version != 90){
+		return 0;
+	}
+	memcpy(set->uuid,&sb.set_uuid0,4);
+	memcpy(set->uuid + 4,&sb.set_uuid1,4);
+	memcpy(set->uuid + 8,&sb.set_uuid2,4);
+	memcpy(set->uuid + 12,&sb.set_uuid3,4);
+	set->major = 0;
+	set->minor = 90;
+	set->level = (int)sb.level;
+	set->layout = sb.layout;
+	set->raid_disks = sb.raid_disks;
+	set->preferred = (int)sb.md_minor;
+	set->desc = NULL;
+	m->role = (sb.this_disk.state & (1u << MD_DISK_SYNC)) &&
+		!(sb.this_disk.state & (1u << MD_DISK_FAULTY)) &&
+		sb.this_disk.raid_disk < sb.raid_disks ? (int)sb.this_disk.raid_disk : -1;
+	m->events = ((uint64_t)sb.events_hi << 32) | sb.events_lo;
+	return 1;
+}
+
+// Read whichever md superblock is present on the device into a fresh set
+// and member. Returns 1 if one was found, 0 if not, and -1 on error.
+static int
+read_md_superblock(const char *name,mdset *set,mdmember *m){
+	uint64_t bytes;
+	struct stat st;
+	int fd,r;
+
+	if((fd = openat(devfd,name,O_RDONLY|O_CLOEXEC)) < 0){
+		diag("Couldn't open /dev/%s (%s?)\n",name,strerror(errno));
+		return -1;
+	}
+	if(fstat(fd,&st) || ioctl(fd,BLKGETSIZE64,&bytes)){
+		diag("Couldn't size /dev/%s (%s?)\n",name,strerror(errno));
+		close(fd);
+		return -1;
+	}
+	m->devno = st.st_rdev;
+	if((r = read_sb1(fd,bytes,set,m)) == 0){
+		r = read_sb090(fd,bytes,set,m);
+	}
+	close(fd);
+	return r;
+}
+
+static void
+free_mdsets(mdset *sets){
+	mdset *set;
+
+	while( (set = sets) ){
+		mdmember *m;
+
+		sets = set->next;
+		while( (m = set->members) ){
+			set->members = m->next;
+			free(m->name);
+			free(m);
+		}
+		free(set->desc);
+		free(set);
+	}
+}
+
+// File the member's superblock under its array's set
+static int
+file_md_member(mdset **sets,const char *name){
+	mdset *set,*s;
+	mdmember *m;
+	int r;
+
+	if((set = malloc(sizeof(*set))) == NULL){
+		return -1;
+	}
+	memset(set,0,sizeof(*set));
+	if((m = malloc(sizeof(*m))) == NULL){
+		free(set);
+		return -1;
+	}
+	memset(m,0,sizeof(*m));
+	if((r = read_md_superblock(name,set,m)) <= 0 || (m->name = strdup(name)) == NULL){
+		if(r == 0){
+			verbf("No md superblock on %s\n",name);
+		}
+		free(set->desc);
+		free(set);
+		free(m);
+		return r > 0 ? -1 : r;
+	}
+	for(s = *sets ; s ; s = s->next){
+		if(s->major == set->major && memcmp(s->uuid,set->uuid,sizeof(s->uuid)) == 0){
+			break;
+		}
+	}
+	if(s){
+		free(set->desc);
+		free(set);
+		set = s;
+	}else{
+		if(set->desc == NULL || set->desc[0] == '\0'){
+			free(set->desc);
+			set->desc = strdup(name);
+		}
+		set->next = *sets;
+		*sets = set;
+	}
+	if(m->events > set->events){
+		set->events = m->events;
+	}
+	m->next = set->members;
+	set->members = m;
+	return 0;
+}
+
+// Members whose superblocks lag the freshest by more than this many events
+// are stale, and left out (mdadm allows the same margin).
+#define MD_EVENT_MARGIN 1
+
+static int
+md_member_current_p(const mdset *set,const mdmember *m){
+	return m->events + MD_EVENT_MARGIN >= set->events;
+}
+
+// How many missing members the level survives, or -1 if we don't assemble
+// it (containers, multipath and the like are left to mdadm).
+static int
+md_tolerance(const mdset *set){
+	unsigned copies;
+
+	switch(set->level){
+		case -1: case 0: return 0;
+		case 1: return set->raid_disks - 1;
+		case 4: case 5: return 1;
+		case 6: return 2;
+		case 10:
+			// near and far copies; offset layouts are encoded in far
+			copies = (set->layout & 0xff) * ((set->layout >> 8) & 0xff);
+			return copies ? (int)copies - 1 : 0;
+	}
+	return -1;
+}
+
+// Number of distinct slots filled by current members
+static unsigned
+md_slots_filled(const mdset *set){
+	unsigned filled = 0;
+	const mdmember *m,*o;
+
+	for(m = set->members ; m ; m = m->next){
+		if(m->role < 0 || (unsigned)m->role >= set->raid_disks || !md_member_current_p(set,m)){
+			continue;
+		}
+		for(o = set->members ; o != m ; o = o->next){
+			if(o->role == m->role && md_member_current_p(set,o)){
+				break;
+			}
+		}
+		if(o == m){
+			++filled;
+		}
+	}
+	return filled;
+}
+
+// An unused md minor, preferring the one recorded in 0.90 superblocks, and
+// otherwise counting down from 127 as mdadm does
+static int
+free_md_minor(int preferred){
+	char name[NAME_MAX];
+	int minor;
+
+	if(preferred >= 0){
+		snprintf(name,sizeof(name),"md%d",preferred);
+		if(faccessat(sysfd,name,F_OK,0)){
+			return preferred;
+		}
+	}
+	for(minor = 127 ; minor >= 0 ; --minor){
+		snprintf(name,sizeof(name),"md%d",minor);
+		if(faccessat(sysfd,name,F_OK,0)){
+			return minor;
+		}
+	}
+	return -1;
+}
+
+static int
+open_md_node(int minor){
+	char name[NAME_MAX];
+	int fd;
+
+	snprintf(name,sizeof(name),"md%d",minor);
+	if((fd = openat(devfd,name,O_RDWR|O_CLOEXEC)) < 0 && errno == ENOENT){
+		// udev creates it once the array exists, but the array
+		// comes into existence by way of opening it
+		if(mknodat(devfd,name,S_IFBLK | 0660,makedev(MD_MAJOR,minor)) == 0){
+			fd = openat(devfd,name,O_RDWR|O_CLOEXEC);
+		}
+	}
+	if(fd < 0){
+		diag("Couldn't open /dev/%s (%s?)\n",name,strerror(errno));
+	}
+	return fd;
+}
+
+// Hand the current members to the kernel, which reads their superblocks
+// itself, and start the array.
+static int
+run_md_set(const mdset *set,unsigned filled){
+	mdu_array_info_t ainfo;
+	const mdmember *m;
+	int fd,minor;
+
+	if((minor = free_md_minor(set->preferred)) < 0){
+		diag("No free md minor for %s\n",set->desc);
+		return -1;
+	}
+	if((fd = open_md_node(minor)) < 0){
+		return -1;
+	}
+	memset(&ainfo,0,sizeof(ainfo));
+	ainfo.major_version = set->major;
+	ainfo.minor_version = set->minor;
+	if(ioctl(fd,SET_ARRAY_INFO,&ainfo)){
+		diag("Couldn't set up md%d for %s (%s?)\n",minor,set->desc,strerror(errno));
+		close(fd);
+		return -1;
+	}
+	for(m = set->members ; m ; m = m->next){
+		mdu_disk_info_t dinfo;
+
+		if(!md_member_current_p(set,m)){
+			diag("Leaving stale %s out of %s\n",m->name,set->desc);
+			continue;
+		}
+		memset(&dinfo,0,sizeof(dinfo));
+		dinfo.major = major(m->devno);
+		dinfo.minor = minor(m->devno);
+		if(ioctl(fd,ADD_NEW_DISK,&dinfo)){
+			diag("Couldn't add %s to %s (%s?)\n",m->name,set->desc,strerror(errno));
+		}
+	}
+	if(ioctl(fd,RUN_ARRAY,NULL)){
+		diag("Couldn't start %s as md%d (%s?)\n",set->desc,minor,strerror(errno));
+		ioctl(fd,STOP_ARRAY,NULL);
+		close(fd);
+		return -1;
+	}
+	diag("Assembled %s as md%d (%u/%u members)\n",set->desc,minor,filled,set->raid_disks);
+	close(fd);
+	return 0;
+}
+
+static int
+add_name(char ***names,unsigned *count,const char *name){
+	char **tmp;
+
+	if((tmp = realloc(*names,sizeof(**names) * (*count + 1))) == NULL){
+		return -1;
+	}
+	*names = tmp;
+	if((tmp[*count] = strdup(name)) == NULL){
+		return -1;
+	}
+	++*count;
+	return 0;
+}
+
+// Name every device discovery marked linux_raid_member, and that nothing
+// yet holds (its array isn't running).
+static int
+collect_md_members(char ***names,unsigned *count){
+	const controller *c;
+	int r = 0;
+
+	lock_growlight();
+	for(c = get_controllers() ; c && !r ; c = c->next){
+		const device *d;
+
+		for(d = c->blockdevs ; d && !r ; d = d->next){
+			const device *p;
+
+			if(d->mnttype && mdraid_p(d->mnttype) && !d->holders){
+				r = add_name(names,count,d->name);
+			}
+			for(p = d->parts ; p && !r ; p = p->next){
+				if(p->mnttype && mdraid_p(p->mnttype) && !p->holders){
+					r = add_name(names,count,p->name);
+				}
+			}
+		}
+	}
+	unlock_growlight();
+	return r;
+}
+
+int assemble_mdadm(void){
+	char **names = NULL;
+	unsigned count = 0,z;
+	mdset *sets = NULL,*set;
+	int r = 0;
+
+	if(collect_md_members(&names,&count)){
+		r = -1;
+		goto done;
+	}
+	for(z = 0 ; z < count ; ++z){
+		if(file_md_member(&sets,names[z]) < 0){
+			r = -1;
+		}
+	}
+	for(set = sets ; set ; set = set->next){
+		unsigned filled = md_slots_filled(set);
+		int tol = md_tolerance(set);
+
+		if(tol < 0){
+			verbf("Not assembling level %d array %s\n",set->level,set->desc);
+			continue;
+		}
+		if(filled + tol < set->raid_disks){
+			diag("Not assembling %s: only %u/%u members present\n",
+				set->desc,filled,set->raid_disks);
+			continue;
+		}
+		if(run_md_set(set,filled)){
+			r = -1;
+		}
+	}
+
+done:
+	free_mdsets(sets);
+	for(z = 0 ; z < count ; ++z){
+		free(names[z]);
+	}
+	free(names);
+	return r;
+}
@@ -6,6 +6,9 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+#include <sys/time.h>
+
 struct device;
 
 // Wants a dirfd corresponding to the md/ sysfs directory for the node
@@ -13,6 +16,57 @@ int explore_md_sysfs(struct device *,int);
 
 int destroy_mdadm(struct device *);
 
+// Assemble arrays from devices discovery found to be linux_raid_member, and
+// which aren't already held by a running array. Their v0.90 or v1.x
+// superblocks are read directly and grouped by array UUID, and complete or
+// degraded (but startable) sets are handed to the kernel through the md
+// ioctls. Members lagging the freshest superblock's event count are left
+// out. Call without the growlight lock held.
+int assemble_mdadm(void);
+
+// mddev.synclocal bits: the limit was set for this array (otherwise, it
+// tracks dev.raid.speed_limit_{min,max})
+#define MD_SYNC_LOCAL_MIN 0x1
+#define MD_SYNC_LOCAL_MAX 0x2
+
+// Called from the stats tick with the time since the last one. Rereads
+// sync_action, and if a sync is under way, its progress, updating the rate
+// and ETA from the change in sync_completed. Spare and faulty members have
+// their stack edges marked idle. Returns 1 if anything changed,
+// 0 if not, and -1 on error. Call with the growlight lock held.
+int md_sync_update(struct device *, const struct timeval *elapsed);
+
+// The kernel's default stripe_cache_size (entries, each a page per member
+// device) and its maximum. The default leaves large writes to wide parity
+// arrays far short of what the members can sustain.
+#define MD_STRIPE_CACHE_DEFAULT 256
+#define MD_STRIPE_CACHE_MAX 32768
+#define MD_STRIPE_CACHE_PER_DISK 1024
+// Spend no more than 1/MD_STRIPE_CACHE_MEM_FRACTION of memory on the cache
+#define MD_STRIPE_CACHE_MEM_FRACTION 32
+// mdadm's default chunk for new arrays
+#define MD_DEFAULT_CHUNK (512 * 1024)
+// Smallest write-intent bitmap chunk we'll set (it must be a power of two)
+#define MD_BITMAP_CHUNK_MIN 4096
+
+// Recommended stripe_cache_size for a parity array of disks members with
+// the given chunk size in bytes.
+unsigned long md_stripe_cache_recommendation(unsigned long disks, uintmax_t chunk);
+
+// RAID 4/5/6 arrays we create get the recommended stripe_cache_size, unless
+// this has been disabled (--notune).
+void md_set_autotune(int enable);
+
+// Set "stripe_cache_size", "group_thread_cnt" or "preread_bypass_threshold"
+// (RAID 4/5/6 only), or "bitmap_chunk" in bytes (a power of two no less than
+// MD_BITMAP_CHUNK_MIN, recreating the internal write-intent bitmap).
+int md_set_tunable(struct device *, const char *knob, unsigned long val);
+
+// Set the array's resync/recovery speed limits, in KiB/s. 0 returns that
+// limit to the system-wide default. Takes effect immediately, trading
+// rebuild time against foreground latency.
+int md_set_sync_speed(struct device *, unsigned long min, unsigned long max);
+
 int make_mdraid0(const char *name,char * const *,int);
 int make_mdraid1(const char *name,char * const *,int);
 int make_mdraid4(const char *name,char * const *,int);
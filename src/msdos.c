@@ -9,6 +9,7 @@
 #include <sys/random.h>
 
 #include "mbr.h"
+#include "image.h"
 #include "msdos.h"
 #include "ptypes.h"
 #include "ptable.h"
@@ -110,7 +111,7 @@ int new_msdos(device *d){
 		diag("Won't create msdos on empty disk %s\n", d->name);
 		return -1;
 	}
-	if((fd = openat(devfd, d->name, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
+	if((fd = open_blockdev(d, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
 		diag("Couldn't open %s (%s?)\n", d->name, strerror(errno));
 		return -1;
 	}
@@ -151,7 +152,7 @@ map_msdos(device *d, size_t *mapsize, int *fd, size_t lbasize){
 		diag("Bad pgsize for msdos: %d\n", pgsize);
 		return MAP_FAILED;
 	}
-	if((*fd = openat(devfd, d->name, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
+	if((*fd = open_blockdev(d, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
 		diag("Couldn't open %s (%s?)\n", d->name, strerror(errno));
 		return MAP_FAILED;
 	}
@@ -279,7 +280,8 @@ int add_msdos(device *d, const wchar_t *name, uintmax_t fsec, uintmax_t lsec, un
 	if(fsync(fd)){
 		diag("Couldn't sync %d for %s\n", fd, d->name);
 	}
-	r = blkpg_add_partition(fd, fsec * LBA_SIZE,
+	// the kernel knows nothing of image devices' partitions
+	r = image_device_p(d) ? 0 : blkpg_add_partition(fd, fsec * LBA_SIZE,
 			(lsec - fsec + 1) * LBA_SIZE, z + 1, "");
 	if(close(fd)){
 		int e = errno;
@@ -434,7 +436,8 @@ int del_msdos(const device *p){
 	if(fsync(fd)){
 		diag("Couldn't sync %d for %s\n", fd, p->name);
 	}
-	r = blkpg_del_partition(fd, p->partdev.fsector * LBA_SIZE,
+	r = image_device_p(p->partdev.parent) ? 0 :
+		blkpg_del_partition(fd, p->partdev.fsector * LBA_SIZE,
 				p->size, p->partdev.pnumber,
 				p->partdev.parent->name);
 	if(close(fd)){
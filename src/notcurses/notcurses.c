@@ -7,14 +7,17 @@
 #include <string.h>
 #include <locale.h>
 #include <pthread.h>
-#include <atasmart.h>
 #include <scsi/scsi.h>
 
 #include "fs.h"
 #include "mbr.h"
+#include "irq.h"
+#include "nvme.h"
 #include "zfs.h"
 #include "swap.h"
+#include "stack.h"
 #include "mdadm.h"
+#include "smart.h"
 #include "health.h"
 #include "ptable.h"
 #include "ptypes.h"
@@ -1244,12 +1247,12 @@ case LAYOUT_ZPOOL:
   if(line + 1 < rows/* - !drawfromtop*/ && line + 1 >= drawfromtop){
     const wchar_t* rep = L" ";
     if(bo->d->blkdev.smart >= 0){
-      if(bo->d->blkdev.smart == SK_SMART_OVERALL_GOOD){
+      if(bo->d->blkdev.smart == SMART_GOOD){
         ncplane_set_styles(n, NCSTYLE_BOLD);
         compat_set_fg(n, GREEN_COLOR);
         rep = L"✔";
-      }else if(bo->d->blkdev.smart != SK_SMART_OVERALL_BAD_STATUS
-          && bo->d->blkdev.smart != SK_SMART_OVERALL_BAD_SECTOR_MANY){
+      }else if(bo->d->blkdev.smart != SMART_BAD_STATUS
+          && bo->d->blkdev.smart != SMART_BAD_SECTOR_MANY){
         ncplane_set_styles(n, NCSTYLE_BOLD);
         compat_set_fg(n, ORANGE_COLOR);
         rep = L"☠";
@@ -1293,6 +1296,10 @@ case LAYOUT_ZPOOL:
         compat_set_fg(n, FUCKED_COLOR);
         cmvwprintw(n, sumline, START_COL,
             "%1lux☠ ", bo->d->mddev.degraded);
+      }else if(bo->d->mddev.resync && bo->d->mddev.synctotal){
+        compat_set_fg(n, ORANGE_COLOR);
+        cmvwprintw(n, sumline, START_COL, "%2ju%% ",
+            bo->d->mddev.syncdone * 100 / bo->d->mddev.synctotal);
       }else{
         compat_set_fg(n, GREEN_COLOR);
         cmvwprintw(n, sumline, START_COL, "up  ");
@@ -1413,23 +1420,43 @@ adapter_box(const adapterstate* as, struct ncplane* nc, bool drawtop,
     if(as->c->numa_node >= 0){
       cwprintw(nc, " [%d]", as->c->numa_node);
     }
+    if(as->c->irqs && as->c->irqs->problems){
+      compat_set_fg(nc, FUCKED_COLOR);
+      cwprintw(nc, " [%s]", irq_problem_str(as->c->irqs->problems));
+      compat_set_fg(nc, hcolor);
+    }
     if(as->c->bandwidth){
       char buf[PREFIXSTRLEN + 1], dbuf[PREFIXSTRLEN + 1];
+      unsigned sat = controller_saturation(as->c);
 
       if(as->c->demand){
-        cwprintw(nc, " (%sbps to chip, %sbps (%ju%%) demanded)",
+        cwprintw(nc, " (%sbps to chip, %sbps (%ju%%) demanded, ",
           qprefix(as->c->bandwidth, 1, buf, 1),
           qprefix(as->c->demand, 1, dbuf, 1),
           as->c->demand * 100 / as->c->bandwidth);
       }else{
-        cwprintw(nc, " (%sbps to chip)",
+        cwprintw(nc, " (%sbps to chip, ",
           qprefix(as->c->bandwidth, 1, buf, 1));
       }
+      if(sat >= CONTROLLER_SATURATED_PCT){
+        compat_set_fg(nc, FUCKED_COLOR);
+      }
+      cwprintw(nc, "%u%% live", sat);
+      compat_set_fg(nc, hcolor);
+      cwprintw(nc, ")");
     }else if(as->c->bus != BUS_VIRTUAL && as->c->demand){
       char dbuf[PREFIXSTRLEN + 1];
 
       cwprintw(nc, " (%sbps demanded)", qprefix(as->c->demand, 1, dbuf, 1));
     }
+    if(as->c->load.disks){
+      const statrollup *l = &as->c->load;
+      char rbuf[PREFIXSTRLEN + 1], wbuf[PREFIXSTRLEN + 1];
+
+      cwprintw(nc, " {%sbps r %sbps w %ju IOPS %u%% busy}",
+               qprefix(l->rxbps, 1, rbuf, 1), qprefix(l->txbps, 1, wbuf, 1),
+               l->iops, l->util);
+    }
     compat_set_fg(nc, bcolor);
     cwprintw(nc, "]");
     ncplane_on_styles(nc, NCSTYLE_BOLD);
@@ -1452,10 +1479,17 @@ adapter_box(const adapterstate* as, struct ncplane* nc, bool drawtop,
           as->c->pcie.domain, as->c->pcie.bus,
           as->c->pcie.dev, as->c->pcie.func);
       }else{
-        cwprintw(nc, "PCI Express %04x:%02x.%02x.%x (x%u, gen %s)",
+        cwprintw(nc, "PCI Express %04x:%02x.%02x.%x (x%u, gen %s",
             as->c->pcie.domain, as->c->pcie.bus,
             as->c->pcie.dev, as->c->pcie.func,
             as->c->pcie.lanes_neg, pcie_gen(as->c->pcie.gen));
+        if(pcie_degraded_p(as->c)){
+          compat_set_fg(nc, ORANGE_COLOR);
+          cwprintw(nc, " of x%u gen %s", as->c->pcie.lanes_cap,
+                   pcie_gen(as->c->pcie.gen_cap));
+          compat_set_fg(nc, hcolor);
+        }
+        cwprintw(nc, ")");
       }
       compat_set_fg(nc, bcolor);
       cwprintw(nc, "]");
@@ -3060,6 +3094,11 @@ detail_fs(struct ncplane* hw, const device* d, int row){
       cwprintw(hw, " %ls%s%ls", L"“", d->label, L"”");
       ncplane_on_styles(hw, NCSTYLE_BOLD);
     }
+    if(d->crypt){
+      ncplane_off_styles(hw, NCSTYLE_BOLD);
+      cwprintw(hw, " (%s)", d->crypt);
+      ncplane_on_styles(hw, NCSTYLE_BOLD);
+    }
     cwprintw(hw, "%s", d->mnt.count ? " at " : "");
     ncplane_off_styles(hw, NCSTYLE_BOLD);
     cwprintw(hw, "%s", d->mnt.count ? d->mnt.list[0] : "");
@@ -3067,13 +3106,177 @@ detail_fs(struct ncplane* hw, const device* d, int row){
   }
 }
 
+// Wear, write rate and thermal throttling from the NVMe health log, on one
+// line. Throttling is highlighted, as it's otherwise invisible latency.
+static void
+detail_nvme_health(struct ncplane* hw, const nvme_health* nh, int row){
+  const nvme_health_log* h = &nh->last;
+  nvme_rates r;
+
+  nvme_health_rates(nh, &r);
+  cmvwprintw(hw, row, START_COL, "Wear: ");
+  ncplane_off_styles(hw, NCSTYLE_BOLD);
+  cwprintw(hw, "%u%%", h->percent_used);
+  if(r.days_to_worn >= 0){
+    cwprintw(hw, " (~%.0fd left)", r.days_to_worn);
+  }
+  ncplane_on_styles(hw, NCSTYLE_BOLD);
+  cwprintw(hw, " Writes: ");
+  ncplane_off_styles(hw, NCSTYLE_BOLD);
+  cwprintw(hw, "%.3fTB/day", r.tbw_per_day_session >= 0 ? r.tbw_per_day_session :
+           r.tbw_per_day >= 0 ? r.tbw_per_day : 0);
+  ncplane_on_styles(hw, NCSTYLE_BOLD);
+  cwprintw(hw, " Throttled: ");
+  ncplane_off_styles(hw, NCSTYLE_BOLD);
+  if(r.throttled_pct_session > 0){
+    compat_set_fg(hw, ORANGE_COLOR);
+  }
+  cwprintw(hw, "%jus", (uintmax_t)r.throttled_secs);
+  if(r.throttled_pct_session >= 0){
+    cwprintw(hw, " (%.1f%% now)", r.throttled_pct_session);
+  }
+  compat_set_fg(hw, SUBDISPLAY_COLOR);
+  ncplane_on_styles(hw, NCSTYLE_BOLD);
+  cwprintw(hw, " Errors: ");
+  ncplane_off_styles(hw, NCSTYLE_BOLD);
+  cwprintw(hw, "%ju", (uintmax_t)h->media_errors);
+  ncplane_on_styles(hw, NCSTYLE_BOLD);
+}
+
+// Sync action, progress, rate, ETA and the speed limits of an md device
+static void
+detail_md_sync(struct ncplane* hw, const device* d, int row){
+  cmvwprintw(hw, row, START_COL, "Sync: ");
+  ncplane_off_styles(hw, NCSTYLE_BOLD);
+  if(d->mddev.resync){
+    compat_set_fg(hw, ORANGE_COLOR);
+  }
+  cwprintw(hw, "%s", d->mddev.syncaction ? d->mddev.syncaction : "n/a");
+  if(d->mddev.resync && d->mddev.synctotal){
+    cwprintw(hw, " %.1f%%", d->mddev.syncdone * 100.0 / d->mddev.synctotal);
+  }
+  compat_set_fg(hw, SUBDISPLAY_COLOR);
+  if(d->mddev.resync && d->mddev.syncrate){
+    cwprintw(hw, " %.1fMB/s", d->mddev.syncrate * 512.0 / 1000000);
+  }
+  if(d->mddev.resync && d->mddev.synceta){
+    cwprintw(hw, " ETA %juh%02jum", d->mddev.synceta / 3600, d->mddev.synceta % 3600 / 60);
+  }
+  ncplane_on_styles(hw, NCSTYLE_BOLD);
+  cwprintw(hw, " Limits: ");
+  ncplane_off_styles(hw, NCSTYLE_BOLD);
+  cwprintw(hw, "%lu-%luKiB/s", d->mddev.syncmin, d->mddev.syncmax);
+  if(d->mddev.mismatches){
+    ncplane_on_styles(hw, NCSTYLE_BOLD);
+    cwprintw(hw, " Mismatches: ");
+    ncplane_off_styles(hw, NCSTYLE_BOLD);
+    cwprintw(hw, "%ju", d->mddev.mismatches);
+  }
+  ncplane_on_styles(hw, NCSTYLE_BOLD);
+}
+
+// Pool health, and any leaf vdevs lagging behind their siblings
+static void
+detail_zpool(struct ncplane* hw, const zpool_info* zi, int row){
+  unsigned z, slow = 0;
+
+  cmvwprintw(hw, row, START_COL, "Health: ");
+  ncplane_off_styles(hw, NCSTYLE_BOLD);
+  cwprintw(hw, "%s %u%% full", zi->health, zi->capacity);
+  for(z = 0 ; z < zi->vdevcount ; ++z){
+    const zpool_vdev* v = &zi->vdevs[z];
+
+    if(v->slow){
+      if(slow++ == 0){
+        compat_set_fg(hw, FUCKED_COLOR);
+        cwprintw(hw, " Slow:");
+      }
+      cwprintw(hw, " %s (%jums)", v->devname ? v->devname : v->type,
+               (uintmax_t)v->latus / 1000);
+    }
+  }
+  compat_set_fg(hw, SUBDISPLAY_COLOR);
+  ncplane_on_styles(hw, NCSTYLE_BOLD);
+}
+
+static inline int
+dm_cache_p(const device* d){
+  return d->dmdev.target && (!strcmp(d->dmdev.target, "cache") ||
+                             !strcmp(d->dmdev.target, "writecache"));
+}
+
+// Hit rate (overall and over the last stats tick), occupancy and dirt of a
+// dm-cache or dm-writecache
+static void
+detail_dm_cache(struct ncplane* hw, const device* d, int row){
+  uintmax_t hits = d->dmdev.readhits + d->dmdev.writehits;
+  uintmax_t misses = d->dmdev.readmisses + d->dmdev.writemisses;
+
+  cmvwprintw(hw, row, START_COL, "Cache: ");
+  ncplane_off_styles(hw, NCSTYLE_BOLD);
+  if(hits + misses){
+    cwprintw(hw, "%.1f%% hits", hits * 100.0 / (hits + misses));
+  }else{
+    cwprintw(hw, "no hits");
+  }
+  if(d->dmdev.hitsdelta + d->dmdev.missesdelta){
+    cwprintw(hw, " (%.1f%% now)", d->dmdev.hitsdelta * 100.0 /
+             (d->dmdev.hitsdelta + d->dmdev.missesdelta));
+  }
+  if(d->dmdev.cachetotal){
+    cwprintw(hw, " %.1f%% used", d->dmdev.cacheused * 100.0 / d->dmdev.cachetotal);
+  }
+  if(d->dmdev.dirty){
+    compat_set_fg(hw, ORANGE_COLOR);
+    cwprintw(hw, " %ju dirty", d->dmdev.dirty);
+    compat_set_fg(hw, SUBDISPLAY_COLOR);
+  }
+  ncplane_on_styles(hw, NCSTYLE_BOLD);
+}
+
+// Aggregates show their slowest member, and anything wrong beneath them
+static void
+detail_stack(struct ncplane* hw, const device* d, int row){
+  const device* slow;
+  const char* prob;
+  uintmax_t bw;
+
+  cmvwprintw(hw, row, START_COL, "Members: ");
+  ncplane_off_styles(hw, NCSTYLE_BOLD);
+  cwprintw(hw, "%s", transport_str(device_transport(d)));
+  if( (slow = stack_slowest(d, &bw)) ){
+    cwprintw(hw, " slowest %s (%juMbps)", slow->name, bw / 1000000);
+  }
+  if( (prob = stack_problem_str(stack_problems(d))) ){
+    compat_set_fg(hw, FUCKED_COLOR);
+    cwprintw(hw, " %s", prob);
+    compat_set_fg(hw, SUBDISPLAY_COLOR);
+  }
+  if(d->statq.tv_sec || d->statq.tv_usec){
+    uintmax_t usec = d->statq.tv_sec * 1000000ull + d->statq.tv_usec;
+    const statpack *m = &d->memberdelta;
+    char buf[BPREFIXSTRLEN + 1];
+
+    cwprintw(hw, " members %sB/s %ju IOPS",
+             bprefix((m->sectors_read + m->sectors_written) * 512 * 1000000ull / usec,
+                     1, buf, 1),
+             (m->reads + m->writes) * 1000000ull / usec);
+  }
+  if(d->hotmember){
+    compat_set_fg(hw, ORANGE_COLOR);
+    cwprintw(hw, " hot: %s", d->hotmember->name);
+    compat_set_fg(hw, SUBDISPLAY_COLOR);
+  }
+  ncplane_on_styles(hw, NCSTYLE_BOLD);
+}
+
 // One must not call diag() from any function called by update_details(), or
 // else you will get one of a deadlock or a stack overflow due to corecursion.
 static int
 update_details(struct ncplane* hw){
   const controller* c = get_current_controller();
   char buf[BPREFIXSTRLEN + 1];
-  int cols, rows, curcol, n;
+  int cols, rows, curcol, n, row;
   const char* pttype;
   const blockobj* b;
   const device* d;
@@ -3115,6 +3318,17 @@ update_details(struct ncplane* hw){
     ncplane_putstr(hw, buf);
     ncplane_putstr(hw, "bps");
     ncplane_on_styles(hw, NCSTYLE_BOLD);
+    ncplane_putstr(hw, " Live: ");
+    ncplane_off_styles(hw, NCSTYLE_BOLD);
+    cwprintw(hw, "%sbps read ", qprefix(c->load.rxbps, 1, buf, 1));
+    cwprintw(hw, "%sbps written ", qprefix(c->load.txbps, 1, buf, 1));
+    cwprintw(hw, "%ju IOPS", c->load.iops);
+    ncplane_on_styles(hw, NCSTYLE_BOLD);
+    ncplane_putstr(hw, " Host: ");
+    ncplane_off_styles(hw, NCSTYLE_BOLD);
+    cwprintw(hw, "%sbps ", qprefix(get_host_load()->rxbps + get_host_load()->txbps, 1, buf, 1));
+    cwprintw(hw, "%ju IOPS", get_host_load()->iops);
+    ncplane_on_styles(hw, NCSTYLE_BOLD);
   }
   if((b = get_selected_blockobj()) == NULL){
     return 0;
@@ -3138,6 +3352,12 @@ update_details(struct ncplane* hw){
         d->blkdev.rwverify == RWVERIFY_SUPPORTED_ON ? '+' :
         d->blkdev.rwverify == RWVERIFY_SUPPORTED_OFF ? '-' : 'x',
         d->roflag ? '+' : '-');
+    if(ata_transport_p(d->blkdev.transport)){
+      // TRIM: z reads zeroes, d deterministic, + nondeterministic
+      cwprintw(hw, " TRIM%c NCQ%c",
+          d->blkdev.rzat ? 'z' : d->blkdev.drat ? 'd' : d->blkdev.trim ? '+' : '-',
+          !d->blkdev.ncq ? 'x' : d->blkdev.queuedepth > 1 ? '+' : '-');
+    }
     assert(d->physsec <= 4096);
     cmvwprintw(hw, 4, START_COL, "Sectors: ");
     ncplane_off_styles(hw, NCSTYLE_BOLD);
@@ -3153,8 +3373,14 @@ update_details(struct ncplane* hw){
     ncplane_on_styles(hw, NCSTYLE_BOLD);
     cwprintw(hw, "physical) %s",
     transport_str(d->blkdev.transport));
-    if(transport_bw(d->blkdev.transport)){
-      uintmax_t transbw = transport_bw(d->blkdev.transport);
+    const nvme_namespace* ns = nvme_device_namespace(d);
+    if(ns && ns->better >= 0){
+      compat_set_fg(hw, ORANGE_COLOR);
+      cwprintw(hw, " LBAF%d faster", ns->better);
+      compat_set_fg(hw, SUBDISPLAY_COLOR);
+    }
+    if(blockdev_bw(d)){
+      uintmax_t transbw = blockdev_bw(d);
       cwprintw(hw, " (");
       ncplane_off_styles(hw, NCSTYLE_BOLD);
       // FIXME throws -Wformat-truncation on gcc9
@@ -3162,6 +3388,11 @@ update_details(struct ncplane* hw){
       ncplane_on_styles(hw, NCSTYLE_BOLD);
       cwprintw(hw, ")");
     }
+    if(sata_degraded_p(d)){
+      compat_set_fg(hw, ORANGE_COLOR);
+      cwprintw(hw, " link %s", sata_gen_str(d->blkdev.satalink));
+      compat_set_fg(hw, SUBDISPLAY_COLOR);
+    }
   }else{
     cmvwprintw(hw, 3, START_COL, "%s: %s %s (%s) RO%c", d->name,
           d->model ? d->model : "n/a",
@@ -3185,6 +3416,27 @@ update_details(struct ncplane* hw){
         cwprintw(hw, "%u", d->mddev.swidth);
       }
       ncplane_on_styles(hw, NCSTYLE_BOLD);
+      if(d->mddev.stripecache){
+        cwprintw(hw, " SCache: ");
+        ncplane_off_styles(hw, NCSTYLE_BOLD);
+        // flag a cache well short of the recommendation
+        if(d->mddev.stripecache * 2 <= md_stripe_cache_recommendation(d->mddev.disks, d->mddev.stride)){
+          compat_set_fg(hw, ORANGE_COLOR);
+        }
+        cwprintw(hw, "%lu", d->mddev.stripecache);
+        compat_set_fg(hw, SUBDISPLAY_COLOR);
+        ncplane_on_styles(hw, NCSTYLE_BOLD);
+        cwprintw(hw, " Threads: ");
+        ncplane_off_styles(hw, NCSTYLE_BOLD);
+        cwprintw(hw, "%lu", d->mddev.groupthreads);
+        ncplane_on_styles(hw, NCSTYLE_BOLD);
+      }
+      if(d->mddev.bitmapchunk){
+        cwprintw(hw, " Bitmap: ");
+        ncplane_off_styles(hw, NCSTYLE_BOLD);
+        cwprintw(hw, "%sB", bprefix(d->mddev.bitmapchunk, 1, buf, 1));
+        ncplane_on_styles(hw, NCSTYLE_BOLD);
+      }
     }
     assert(d->physsec <= 4096);
     cmvwprintw(hw, 4, START_COL, "Sectors: ");
@@ -3213,8 +3465,20 @@ update_details(struct ncplane* hw){
   ncplane_off_styles(hw, NCSTYLE_BOLD);
   ncplane_putstr(hw, d->sched ? d->sched : "custom");
   ncplane_on_styles(hw, NCSTYLE_BOLD);
+  row = 6;
+  if(d->layout == LAYOUT_NONE && d->blkdev.nvme){
+    detail_nvme_health(hw, d->blkdev.nvme, row++);
+  }else if(d->layout == LAYOUT_MDADM && (d->mddev.resync || !d->members)){
+    detail_md_sync(hw, d, row++);
+  }else if(d->layout == LAYOUT_ZPOOL && d->zpool.info){
+    detail_zpool(hw, d->zpool.info, row++);
+  }else if(d->layout == LAYOUT_DM && dm_cache_p(d)){
+    detail_dm_cache(hw, d, row++);
+  }else if(d->members){ // an idle array's sync line yields to its members
+    detail_stack(hw, d, row++);
+  }
   if(blockobj_unloadedp(b)){
-    cmvwprintw(hw, 6, START_COL, "Media is not loaded");
+    cmvwprintw(hw, row, START_COL, "Media is not loaded");
     return 0;
   }
   if(blockobj_unpartitionedp(b)){
@@ -3222,10 +3486,10 @@ update_details(struct ncplane* hw){
 
     bprefix(d->size, 1, ubuf, 1);
     ncplane_off_styles(hw, NCSTYLE_BOLD);
-    cmvwprintw(hw, 6, START_COL, "%*sB ", BPREFIXFMT(ubuf));
+    cmvwprintw(hw, row, START_COL, "%*sB ", BPREFIXFMT(ubuf));
     ncplane_on_styles(hw, NCSTYLE_BOLD);
     cwprintw(hw, "%s", "unpartitioned media");
-    detail_fs(hw, b->d, 7);
+    detail_fs(hw, b->d, row + 1);
     return 0;
   }
   if(b->zone){
@@ -3238,7 +3502,7 @@ update_details(struct ncplane* hw){
       // FIXME limit length!
       bprefix(d->logsec * (b->zone->lsector - b->zone->fsector + 1),1, zbuf, 1);
       ncplane_off_styles(hw, NCSTYLE_BOLD);
-      cmvwprintw(hw, 6, START_COL, "%*sB ", BPREFIXFMT(zbuf));
+      cmvwprintw(hw, row, START_COL, "%*sB ", BPREFIXFMT(zbuf));
       ncplane_on_styles(hw, NCSTYLE_BOLD);
       cwprintw(hw, "P%lc%lc ", subscript((b->zone->p->partdev.pnumber % 100 / 10)),
           subscript((b->zone->p->partdev.pnumber % 10)));
@@ -3259,14 +3523,14 @@ update_details(struct ncplane* hw){
       ncplane_on_styles(hw, NCSTYLE_BOLD);
       cwprintw(hw, "%04x", get_code_specific(pttype, b->zone->p->partdev.ptype));
       cwprintw(hw, " %sB align", align);
-      detail_fs(hw, b->zone->p, 7);
+      detail_fs(hw, b->zone->p, row + 1);
     }else{
       // FIXME print alignment for unpartitioned space as well,
       // but not until we implement zones in core (bug 252)
       // or we'll need recreate alignment() etc here
       ncplane_off_styles(hw, NCSTYLE_BOLD);
       bprefix(d->logsec * (b->zone->lsector - b->zone->fsector + 1), 1, zbuf, 1);
-      cmvwprintw(hw, 6, START_COL, "%*sB ", BPREFIXFMT(zbuf));
+      cmvwprintw(hw, row, START_COL, "%*sB ", BPREFIXFMT(zbuf));
       ncplane_on_styles(hw, NCSTYLE_BOLD);
       ncplane_off_styles(hw, NCSTYLE_BOLD);
       cwprintw(hw, "%ju", b->zone->fsector);
@@ -3544,7 +3808,7 @@ err:
   return -1;
 }
 
-static const int DETAILROWS = 7; // FIXME make it dynamic based on selections
+static const int DETAILROWS = 8; // FIXME make it dynamic based on selections
 
 static int
 display_details(struct ncplane* mainw, struct panel_state* ps){
@@ -1,8 +1,11 @@
 // copyright 2012–2021 nick black
 #include <errno.h>
+#include <ctype.h>
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 
+#include "dm.h"
 #include "growlight.h"
 #include "aggregate.h"
 #include "notcurses-ui.h"
@@ -11,7 +14,28 @@
 static const char AGGCOMP_TEXT[] =
 "Bind devices to the new aggregate. To be eligible, a device must either be "
 "unpartitioned, or be a partition having the appropriate component type. The "
-"device furthermore must not have a valid filesystem signature.";
+"device furthermore must not have a valid filesystem signature. Select 'auto' "
+"to have members chosen for a desired capacity.";
+
+static const char AGGCAP_TEXT[] =
+"Enter the desired usable capacity, optionally suffixed with K, M, G, T, P or "
+"E (powers of 1000), or leave it blank for as much as a matched set of devices "
+"can provide. Members will be spread across controllers so that no one "
+"controller limits the aggregate's throughput.";
+
+// Cache pairings suggested when a dm-cache or dm-writecache is selected
+#define AGGCACHE_SUGGESTIONS 3
+
+static const char AGGCHUNK_TEXT[] =
+"Enter the stripe chunk size in bytes. The default covers the largest "
+"optimal I/O size any member reports (a RAID set's stripe width, for "
+"instance), and is a multiple of each member's minimum I/O size. Consecutive "
+"chunks alternate among controllers.";
+
+static const char AGGKEY_TEXT[] =
+"Enter the path of a keyfile for the new LUKS volume's first keyslot. Input "
+"forms echo what is typed, so passphrases are not accepted here; LUKS will "
+"not be created without a key.";
 
 static const char AGGTYPE_TEXT[] =
 "What kind of aggregate do you hope to create?";
@@ -56,9 +80,21 @@ struct form_state {
 
 static char *pending_aggname;
 static char *pending_aggtype;
+static char **pending_comps;	// components awaiting a chunk size or key
+static int pending_compcount;
+
+static void
+destroy_pending_comps(void){
+	while(pending_compcount){
+		free(pending_comps[--pending_compcount]);
+	}
+	free(pending_comps);
+	pending_comps = NULL;
+}
 
 static void
 destroy_agg_forms(void){
+	destroy_pending_comps();
 	free(pending_aggtype);
 	pending_aggtype = NULL;
 	free(pending_aggname);
@@ -234,6 +270,17 @@ component_table(const aggregate_type *at,int *count,const char *match,int *defid
 			}
 		}
 	}
+	if(*count >= (int)at->mindisks && aggregate_plannable_p(at)){
+		device fauxd;
+
+		memset(&fauxd,0,sizeof(fauxd));
+		strncpy(fauxd.name,"auto",sizeof(fauxd.name));
+		fauxd.bypath = "choose members automatically";
+		if((tmp = grow_component_table(&fauxd,count,match,defidx,selarray,selections,fo)) == NULL){
+			goto err;
+		}
+		fo = tmp;
+	}
 	if(at->maxfaulted){
 		device fauxd;
 
@@ -260,6 +307,132 @@ err:
 
 static void agg_callback(const char *);
 static void aggname_callback(const char *);
+static void aggcomp_callback(const char *,char **,int,int);
+
+// Raise the component form, preselecting selarray (which it takes)
+static void
+raise_component_form(const aggregate_type *at,char **selarray,int selections,
+			int scrollp){
+	struct form_option *comps_agg;
+	int opcount,defidx;
+
+	if((comps_agg = component_table(at,&opcount,NULL,&defidx,&selarray,&selections)) == NULL){
+		struct form_option *ops_agg;
+
+		if( (ops_agg = agg_table(&opcount,pending_aggtype,&defidx)) ){
+			raise_form("select an aggregate type",agg_callback,ops_agg,
+					opcount,defidx,AGGTYPE_TEXT);
+		}else{
+			destroy_agg_forms();
+		}
+		locked_diag("insufficiently many available devices for %s",pending_aggtype);
+		return;
+	}
+	raise_multiform("select aggregate components",aggcomp_callback,comps_agg,
+			opcount,defidx,at->mindisks,selarray,selections,AGGCOMP_TEXT,scrollp);
+}
+
+// Offer the user SSD/HDD pairings for a cache
+static void
+suggest_cache_members(void){
+	char *pairs,*line,*nl;
+
+	if((pairs = suggest_cache_pairs(AGGCACHE_SUGGESTIONS)) == NULL){
+		return;
+	}
+	for(line = pairs ; *line ; line = nl){
+		if( (nl = strchr(line,'\n')) ){
+			*nl++ = '\0';
+		}else{
+			nl = line + strlen(line);
+		}
+		locked_diag("%s",line);
+	}
+	free(pairs);
+}
+
+// Decimal capacity with an optional SI suffix. Blank is 0 (maximum).
+static int
+lex_capacity(const char *str,uintmax_t *cap){
+	unsigned long long ull;
+	char *e;
+
+	while(isspace(*str)){
+		++str;
+	}
+	if(*str == '\0'){
+		*cap = 0;
+		return 0;
+	}
+	if(*str == '-'){
+		return -1;
+	}
+	errno = 0;
+	if(((ull = strtoull(str,&e,0)) == ULLONG_MAX && errno == ERANGE) || e == str){
+		return -1;
+	}
+	*cap = ull;
+	if(*e){
+		uintmax_t mult;
+
+		switch(*e++){
+			case 'E': case 'e': mult = 1000000000000000000ull; break;
+			case 'P': case 'p': mult = 1000000000000000ull; break;
+			case 'T': case 't': mult = 1000000000000ull; break;
+			case 'G': case 'g': mult = 1000000000ull; break;
+			case 'M': case 'm': mult = 1000000ull; break;
+			case 'K': case 'k': mult = 1000ull; break;
+			default: return -1;
+		}
+		if(*e == 'B' || *e == 'b'){
+			++e;
+		}
+		if(*e || *cap > UINTMAX_MAX / mult){
+			return -1;
+		}
+		*cap *= mult;
+	}
+	return 0;
+}
+
+// Plan members for the desired capacity, and offer them up for approval
+static void
+aggcap_callback(const char *fn){
+	const aggregate_type *at;
+	aggplan plan;
+	uintmax_t cap;
+	char *line,*nl;
+
+	if((at = get_aggregate(pending_aggtype)) == NULL){
+		destroy_agg_forms();
+		return;
+	}
+	if(fn == NULL){
+		raise_component_form(at,NULL,0,0);
+		return;
+	}
+	if(lex_capacity(fn,&cap)){
+		raise_str_form("enter desired capacity",aggcap_callback,fn,AGGCAP_TEXT);
+		locked_diag("invalid capacity: %s",fn);
+		return;
+	}
+	if(plan_aggregate(at,cap,&plan)){
+		raise_component_form(at,NULL,0,0);
+		return;
+	}
+	raise_component_form(at,plan.members,plan.count,0);
+	plan.members = NULL; // now owned by the form
+	plan.count = 0;
+	for(line = plan.explanation ; line && *line ; line = nl){
+		if( (nl = strchr(line,'\n')) ){
+			*nl++ = '\0';
+		}else{
+			nl = line + strlen(line);
+		}
+		locked_diag("%s",line);
+	}
+	free_aggplan(&plan);
+}
 
 static void
 do_agg(const aggregate_type *at,char * const *selarray,int selections){
@@ -281,6 +454,95 @@ do_agg(const aggregate_type *at,char * const *selarray,int selections){
 	}
 }
 
+static void
+aggchunk_callback(const char *fn){
+	struct panel_state *ps;
+	const aggregate_type *at;
+	uintmax_t chunk;
+	int r;
+
+	if((at = get_aggregate(pending_aggtype)) == NULL){
+		destroy_agg_forms();
+		return;
+	}
+	if(fn == NULL){
+		raise_component_form(at,pending_comps,pending_compcount,0);
+		pending_comps = NULL; // now owned by the form
+		pending_compcount = 0;
+		return;
+	}
+	if(lex_capacity(fn,&chunk) || (chunk && chunk % 512)){
+		raise_str_form("enter chunk size",aggchunk_callback,fn,AGGCHUNK_TEXT);
+		locked_diag("invalid chunk size (must be a multiple of 512): %s",fn);
+		return;
+	}
+	ps = show_splash(L"Creating aggregate...");
+	r = make_dmstriped_chunk(pending_aggname,pending_comps,pending_compcount,chunk);
+	if(ps){
+		kill_splash(ps);
+	}
+	if(r == 0){
+		locked_diag("Successfully created %s",pending_aggtype);
+	}
+	destroy_agg_forms();
+}
+
+static void
+aggkey_callback(const char *fn){
+	struct panel_state *ps;
+	const aggregate_type *at;
+	int r;
+
+	if((at = get_aggregate(pending_aggtype)) == NULL){
+		destroy_agg_forms();
+		return;
+	}
+	if(fn == NULL){
+		raise_component_form(at,pending_comps,pending_compcount,0);
+		pending_comps = NULL; // now owned by the form
+		pending_compcount = 0;
+		return;
+	}
+	if(*fn == '\0'){
+		raise_str_form("enter keyfile",aggkey_callback,NULL,AGGKEY_TEXT);
+		locked_diag("LUKS requires a keyfile");
+		return;
+	}
+	ps = show_splash(L"Creating aggregate...");
+	r = make_crypt_keyed(pending_aggname,pending_comps,pending_compcount,NULL,fn);
+	if(ps){
+		kill_splash(ps);
+	}
+	if(r == 0){
+		locked_diag("Successfully created %s",pending_aggtype);
+	}
+	destroy_agg_forms();
+}
+
+// LUKS takes a key, which we'll only accept as a keyfile
+static void
+raise_key_form(char **selarray,int selections){
+	destroy_pending_comps();
+	pending_comps = selarray;
+	pending_compcount = selections;
+	raise_str_form("enter keyfile",aggkey_callback,NULL,AGGKEY_TEXT);
+}
+
+// Striping takes a chunk size, defaulting to one derived from the members
+static void
+raise_chunk_form(char **selarray,int selections){
+	char def[32] = "";
+	uintmax_t chunk;
+
+	destroy_pending_comps();
+	pending_comps = selarray;
+	pending_compcount = selections;
+	if( (chunk = dm_stripe_chunk(selarray,selections)) ){
+		snprintf(def,sizeof(def),"%ju",chunk);
+	}
+	raise_str_form("enter chunk size",aggchunk_callback,def,AGGCHUNK_TEXT);
+}
+
 static void
 aggcomp_callback(const char *fn,char **selarray,int selections,int scrollp){
 	struct form_option *comps_agg;
@@ -299,11 +561,27 @@ aggcomp_callback(const char *fn,char **selarray,int selections,int scrollp){
 	}
 	if(strcmp(fn,"") == 0){
 		if((unsigned)selections >= at->mindisks){
+			if(at->makeagg == make_dmstriped){
+				raise_chunk_form(selarray,selections);
+				return;
+			}
+			if(crypt_aggregate_p(at)){
+				raise_key_form(selarray,selections);
+				return;
+			}
 			do_agg(at,selarray,selections);
 			destroy_agg_forms();
 			return;
 		}
 	}
+	if(strcmp(fn,"auto") == 0){
+		while(selections--){
+			free(selarray[selections]);
+		}
+		free(selarray);
+		raise_str_form("enter desired capacity",aggcap_callback,NULL,AGGCAP_TEXT);
+		return;
+	}
 	if((comps_agg = component_table(at,&opcount,fn,&defidx,&selarray,&selections)) == NULL){
 		struct form_option *ops_agg;
 
@@ -327,11 +605,8 @@ aggcomp_callback(const char *fn,char **selarray,int selections,int scrollp){
 
 static void
 aggname_callback(const char *fn){
-	struct form_option *comps_agg;
 	const aggregate_type *at;
-	int selections = 0;
 	int opcount,defidx;
-	char **selarray;
 
 	if(fn == NULL){
 		struct form_option *ops_agg;
@@ -350,21 +625,10 @@ aggname_callback(const char *fn){
 		destroy_agg_forms();
 		return;
 	}
-	selarray = NULL;
-	if((comps_agg = component_table(at,&opcount,NULL,&defidx,&selarray,&selections)) == NULL){
-		struct form_option *ops_agg;
-
-		if( (ops_agg = agg_table(&opcount,pending_aggtype,&defidx)) ){
-			raise_form("select an aggregate type",agg_callback,ops_agg,
-					opcount,defidx,AGGTYPE_TEXT);
-		}else{
-			destroy_agg_forms();
-		}
-		locked_diag("insufficiently many available devices for %s",pending_aggtype);
-		return;
+	raise_component_form(at,NULL,0,0);
+	if(cache_aggregate_p(at)){
+		suggest_cache_members();
 	}
-	raise_multiform("select aggregate components",aggcomp_callback,comps_agg,
-			opcount,defidx,at->mindisks,selarray,selections,AGGCOMP_TEXT,0);
 }
 
 static void
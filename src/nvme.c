@@ -1,9 +1,13 @@
 // copyright 2012–2021 nick black
 #include "sg.h"
 #include "nvme.h"
+#include "smart.h"
+#include "stack.h"
+#include "snapshot.h"
 #include <stdio.h>
 #include <errno.h>
-#include <atasmart.h>
+#include <fcntl.h>
+#include <endian.h>
 #include "growlight.h"
 #include <sys/ioctl.h>
 #include <linux/nvme_ioctl.h>
@@ -126,12 +130,382 @@ struct nvme_smart_log {
         __u8                    rsvd232[280];
 };
 
+struct nvme_id_lbaf {
+        __le16                  ms;
+        __u8                    ds;
+        __u8                    rp;
+};
+
+struct nvme_id_ns {
+        __le64                  nsze;
+        __le64                  ncap;
+        __le64                  nuse;
+        __u8                    nsfeat;
+        __u8                    nlbaf;
+        __u8                    flbas;
+        __u8                    mc;
+        __u8                    dpc;
+        __u8                    dps;
+        __u8                    nmic;
+        __u8                    rescap;
+        __u8                    fpi;
+        __u8                    dlfeat;
+        __le16                  nawun;
+        __le16                  nawupf;
+        __le16                  nacwu;
+        __le16                  nabsn;
+        __le16                  nabo;
+        __le16                  nabspf;
+        __le16                  noiob;
+        __u8                    nvmcap[16];
+        __le16                  npwg;
+        __le16                  npwa;
+        __le16                  npdg;
+        __le16                  npda;
+        __le16                  nows;
+        __u8                    rsvd74[18];
+        __le32                  anagrpid;
+        __u8                    rsvd96[3];
+        __u8                    nsattr;
+        __le16                  nvmsetid;
+        __le16                  endgid;
+        __u8                    nguid[16];
+        __u8                    eui64[8];
+        struct nvme_id_lbaf     lbaf[16];
+        __u8                    rsvd192[192];
+        __u8                    vs[3712];
+};
+
+// Admin opcodes and Identify CNS values (NVMe 1.4 5, 5.15.1)
 #define NVME_LOG_SMART 2
 #define NVME_ADMIN_GET_LOG_PAGE 2
 #define NVME_ADMIN_IDENTIFY 6
+#define NVME_ADMIN_FORMAT_NVM 0x80
+#define NVME_ID_CNS_NS 0
+#define NVME_ID_CNS_CTRL 1
+#define NVME_ID_CNS_NS_ACTIVE_LIST 2
+#define NVME_NSID_LIST_LEN 1024
+#define NVME_FORMAT_TIMEOUT_MS 600000
 
+static const char * const rpnames[] = {
+	"best", "better", "good", "degraded",
+};
+
+const char *nvme_rp_str(unsigned rp){
+	return rp < sizeof(rpnames) / sizeof(*rpnames) ? rpnames[rp] : "unknown";
+}
+
+// Issue an Identify without complaint, for CNS values which older
+// controllers are entitled to reject.
 static int
-nvme_smart_log(struct device *d, int fd){
+nvme_identify_quiet(int fd, unsigned cns, uint32_t nsid, void *buf, size_t len){
+	struct nvme_admin_cmd nvmeio;
+
+	memset(buf, 0, len);
+	memset(&nvmeio, 0, sizeof(nvmeio));
+	nvmeio.opcode = NVME_ADMIN_IDENTIFY;
+	nvmeio.nsid = nsid;
+	nvmeio.addr = (uintptr_t)buf;
+	nvmeio.data_len = len;
+	nvmeio.cdw10 = cns;
+	return ioctl(fd, NVME_IOCTL_ADMIN_CMD, &nvmeio) ? -1 : 0;
+}
+
+static int
+nvme_identify(const char *name, int fd, unsigned cns, uint32_t nsid, void *buf, size_t len){
+	if(nvme_identify_quiet(fd, cns, nsid, buf, len)){
+		diag("Couldn't perform nvme_admin_identify 0x%02x on %s:%d (%s?)\n",
+				cns, name, fd, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Is format a faster than b? Lower RP values are better; among equals, the
+// larger data size means fewer, larger I/Os (i.e. 4KiB over 512B). We never
+// recommend a change of metadata size, since that's not about performance.
+static int
+lbaf_better_p(const nvme_lbaf *a, const nvme_lbaf *b){
+	if(a->ms != b->ms || a->lbads < 9){
+		return 0;
+	}
+	if(a->rp != b->rp){
+		return a->rp < b->rp;
+	}
+	return a->lbads > b->lbads;
+}
+
+static int
+nvme_namespace_probe(const char *name, int fd, uint32_t nsid, nvme_namespace *ns){
+	struct nvme_id_ns idns;
+	unsigned z;
+
+	if(nvme_identify(name, fd, NVME_ID_CNS_NS, nsid, &idns, sizeof(idns))){
+		return -1;
+	}
+	memset(ns, 0, sizeof(*ns));
+	ns->nsid = nsid;
+	ns->nsze = le64toh(idns.nsze);
+	ns->nuse = le64toh(idns.nuse);
+	ns->flbas = idns.flbas & 0xfu;
+	ns->nlbaf = idns.nlbaf + 1u; // zero-based
+	if(ns->nlbaf > NVME_MAX_LBAF){
+		ns->nlbaf = NVME_MAX_LBAF;
+	}
+	for(z = 0 ; z < ns->nlbaf ; ++z){
+		ns->lbaf[z].ms = le16toh(idns.lbaf[z].ms);
+		ns->lbaf[z].lbads = idns.lbaf[z].ds;
+		ns->lbaf[z].rp = idns.lbaf[z].rp & 0x3u;
+	}
+	ns->better = -1;
+	if(ns->flbas < ns->nlbaf){
+		for(z = 0 ; z < ns->nlbaf ; ++z){
+			const nvme_lbaf *cand = ns->better >= 0 ? &ns->lbaf[ns->better] : &ns->lbaf[ns->flbas];
+
+			if(lbaf_better_p(&ns->lbaf[z], cand)){
+				ns->better = z;
+			}
+		}
+	}
+	if(ns->better >= 0){
+		verbf("%s namespace %u: LBA format %u (%uB, %s) is faster than %u (%uB, %s)\n",
+			name, nsid, ns->better, 1u << ns->lbaf[ns->better].lbads,
+			nvme_rp_str(ns->lbaf[ns->better].rp), ns->flbas,
+			1u << ns->lbaf[ns->flbas].lbads, nvme_rp_str(ns->lbaf[ns->flbas].rp));
+	}
+	return 0;
+}
+
+// Enumerate the active namespaces on the controller. Pre-1.1 controllers
+// lack the active namespace list; try each of 1..nn on those.
+static int
+nvme_namespaces_probe(device *d, int fd, uint32_t nn){
+	uint32_t *nsids, count = 0, z;
+	nvme_namespace *nses;
+	int nsid;
+
+	if((nsid = ioctl(fd, NVME_IOCTL_ID)) < 0){
+		diag("Couldn't get %s namespace ID (%s?)\n", d->name, strerror(errno));
+		return -1;
+	}
+	d->blkdev.nsid = nsid;
+	if((nsids = malloc(sizeof(*nsids) * NVME_NSID_LIST_LEN)) == NULL){
+		return -1;
+	}
+	if(nvme_identify_quiet(fd, NVME_ID_CNS_NS_ACTIVE_LIST, 0, nsids,
+				sizeof(*nsids) * NVME_NSID_LIST_LEN) == 0){
+		while(count < NVME_NSID_LIST_LEN && nsids[count]){
+			nsids[count] = le32toh(nsids[count]);
+			++count;
+		}
+	}else{
+		verbf("%s has no active namespace list (%s), trying 1..%u\n",
+				d->name, strerror(errno), nn);
+		for(count = 0 ; count < nn && count < NVME_NSID_LIST_LEN ; ++count){
+			nsids[count] = count + 1;
+		}
+	}
+	if((nses = malloc(sizeof(*nses) * (count ? count : 1))) == NULL){
+		free(nsids);
+		return -1;
+	}
+	d->blkdev.nscount = 0;
+	for(z = 0 ; z < count ; ++z){
+		if(nvme_namespace_probe(d->name, fd, nsids[z], &nses[d->blkdev.nscount]) == 0){
+			// inactive namespaces identify as all zeroes
+			if(nses[d->blkdev.nscount].nsze){
+				++d->blkdev.nscount;
+			}
+		}
+	}
+	free(nsids);
+	free(d->blkdev.namespaces);
+	d->blkdev.namespaces = nses;
+	return 0;
+}
+
+const nvme_namespace *nvme_device_namespace(const device *d){
+	unsigned z;
+
+	for(z = 0 ; z < d->blkdev.nscount ; ++z){
+		if(d->blkdev.namespaces[z].nsid == d->blkdev.nsid){
+			return &d->blkdev.namespaces[z];
+		}
+	}
+	return NULL;
+}
+
+// Refuse to format a namespace with anything mounted on or stacked atop it
+// or its partitions.
+static int
+nvme_namespace_busy_p(const device *d){
+	const device *p;
+
+	if(d->mnt.count){
+		diag("%s is mounted on %s; not formatting\n", d->name, d->mnt.list[0]);
+		return 1;
+	}
+	if(d->holders){
+		diag("%s is in use by %s; not formatting\n", d->name, d->holders->holder->name);
+		return 1;
+	}
+	for(p = d->parts ; p ; p = p->next){
+		if(p->mnt.count){
+			diag("%s is mounted on %s; not formatting\n", p->name, p->mnt.list[0]);
+			return 1;
+		}
+		if(p->holders){
+			diag("%s is in use by %s; not formatting\n", p->name, p->holders->holder->name);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// With FNA bit 0 set (NVMe 1.4 5.15.2.2), a Format applies to every namespace
+// on the controller, whatever namespace it names. Each of them must then be
+// idle, and has its partition table snapshotted.
+static int
+nvme_format_siblings_check(const device *d){
+	const device *sib;
+
+	for(sib = d->c->blockdevs ; sib ; sib = sib->next){
+		if(sib == d || sib->layout != LAYOUT_NONE || sib->blkdev.transport != DIRECT_NVME){
+			continue;
+		}
+		if(nvme_namespace_busy_p(sib)){
+			diag("Format of %s would erase %s\n", d->name, sib->name);
+			return -1;
+		}
+		if(sib->blkdev.pttable && snapshot_before_wipe(sib)){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void
+nvme_format_siblings_rescan(const device *d){
+	const device *sib;
+
+	for(sib = d->c->blockdevs ; sib ; sib = sib->next){
+		if(sib != d && sib->layout == LAYOUT_NONE && sib->blkdev.transport == DIRECT_NVME){
+			rescan_blockdev(sib);
+		}
+	}
+}
+
+int nvme_format(device *d, unsigned lbaf){
+	struct nvme_admin_cmd nvmeio;
+	struct nvme_id_ctrl ctrl;
+	const nvme_namespace *ns;
+	int fd, allns;
+
+	if(d->layout != LAYOUT_NONE || d->blkdev.transport != DIRECT_NVME){
+		diag("%s is not an NVMe namespace\n", d->name);
+		return -1;
+	}
+	if((ns = nvme_device_namespace(d)) == NULL){
+		diag("Couldn't find %s namespace %u\n", d->name, d->blkdev.nsid);
+		return -1;
+	}
+	if(lbaf >= ns->nlbaf){
+		diag("%s supports LBA formats 0..%u\n", d->name, ns->nlbaf - 1);
+		return -1;
+	}
+	if(nvme_namespace_busy_p(d)){
+		return -1;
+	}
+	if((fd = openat(devfd, d->name, O_RDONLY|O_CLOEXEC)) < 0){
+		diag("Couldn't open %s (%s?)\n", d->name, strerror(errno));
+		return -1;
+	}
+	if(nvme_identify(d->name, fd, NVME_ID_CNS_CTRL, 0, &ctrl, sizeof(ctrl))){
+		close(fd);
+		return -1;
+	}
+	if( (allns = ctrl.fna & 0x1u) ){
+		diag("%s formats all of its controller's namespaces together\n", d->name);
+		if(d->c == NULL || nvme_format_siblings_check(d)){
+			close(fd);
+			return -1;
+		}
+	}
+	if(d->blkdev.pttable && snapshot_before_wipe(d)){
+		close(fd);
+		return -1;
+	}
+	memset(&nvmeio, 0, sizeof(nvmeio));
+	nvmeio.opcode = NVME_ADMIN_FORMAT_NVM;
+	nvmeio.nsid = d->blkdev.nsid;
+	// LBAF in 3:0; no protection information change, no secure erase
+	nvmeio.cdw10 = lbaf;
+	nvmeio.timeout_ms = NVME_FORMAT_TIMEOUT_MS;
+	diag("Formatting %s namespace %u with LBA format %u (%uB)...\n", d->name,
+		d->blkdev.nsid, lbaf, 1u << ns->lbaf[lbaf].lbads);
+	if(ioctl(fd, NVME_IOCTL_ADMIN_CMD, &nvmeio)){
+		diag("Couldn't format %s (%s?)\n", d->name, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	if(allns){
+		nvme_format_siblings_rescan(d);
+	}
+	// the kernel revalidates the namespace's geometry following a format
+	return rescan_blockdev(d);
+}
+
+// Little-endian 128-bit counters, saturated to 64 bits
+static uint64_t
+le128_sat(const __u8 *le){
+	uint64_t v = 0;
+	int z;
+
+	for(z = 8 ; z < 16 ; ++z){
+		if(le[z]){
+			return UINT64_MAX;
+		}
+	}
+	for(z = 7 ; z >= 0 ; --z){
+		v = (v << 8u) | le[z];
+	}
+	return v;
+}
+
+static void
+nvme_health_parse(const struct nvme_smart_log *smart, nvme_health_log *h){
+	unsigned z;
+
+	memset(h, 0, sizeof(*h));
+	clock_gettime(CLOCK_MONOTONIC, &h->when);
+	h->critical_warning = smart->critical_warning;
+	h->avail_spare = smart->avail_spare;
+	h->spare_thresh = smart->spare_thresh;
+	h->percent_used = smart->percent_used;
+	h->data_units_read = le128_sat(smart->data_units_read);
+	h->data_units_written = le128_sat(smart->data_units_written);
+	h->host_reads = le128_sat(smart->host_reads);
+	h->host_writes = le128_sat(smart->host_writes);
+	h->power_cycles = le128_sat(smart->power_cycles);
+	h->power_on_hours = le128_sat(smart->power_on_hours);
+	h->unsafe_shutdowns = le128_sat(smart->unsafe_shutdowns);
+	h->media_errors = le128_sat(smart->media_errors);
+	h->err_log_entries = le128_sat(smart->num_err_log_entries);
+	h->warning_temp_mins = le32toh(smart->warning_temp_time);
+	h->critical_temp_mins = le32toh(smart->critical_comp_time);
+	for(z = 0 ; z < NVME_TEMP_SENSORS ; ++z){
+		unsigned kelvin = le16toh(smart->temp_sensor[z]);
+
+		h->sensors[z] = kelvin ? (int)kelvin - 273 : NVME_NO_SENSOR;
+	}
+	h->tmt_transitions[0] = le32toh(smart->thm_temp1_trans_count);
+	h->tmt_transitions[1] = le32toh(smart->thm_temp2_trans_count);
+	h->tmt_secs[0] = le32toh(smart->thm_temp1_total_time);
+	h->tmt_secs[1] = le32toh(smart->thm_temp2_total_time);
+}
+
+int nvme_smart_sample(const char *name, int fd, smart_sample *s, nvme_health_log *h){
 	struct nvme_admin_cmd nvmeio;
 	struct nvme_smart_log smart;
 
@@ -149,33 +523,102 @@ nvme_smart_log(struct device *d, int fd){
 	nvmeio.cdw11 = numdu;
 	if(ioctl(fd, NVME_IOCTL_ADMIN_CMD, &nvmeio)){
 		diag("Couldn't perform nvme_admin_get_log_page on %s:%d (%s?)\n",
-				d->name, fd, strerror(errno));
+				name, fd, strerror(errno));
 		return -1;
 	}
 	if(smart.critical_warning){
-		d->blkdev.smart = SK_SMART_OVERALL_BAD_STATUS;
+		s->smart = SMART_BAD_STATUS;
 	}else{
-		d->blkdev.smart = SK_SMART_OVERALL_GOOD;
+		s->smart = SMART_GOOD;
 	}
 	// nvme smart reports temp in kelvin integer degrees, huh
-	d->blkdev.celsius = ((smart.temperature[1] << 8) | smart.temperature[0]) - 273;
+	s->celsius = ((smart.temperature[1] << 8) | smart.temperature[0]) - 273;
+	if(h){
+		nvme_health_parse(&smart, h);
+	}
+	return 0;
+}
+
+int nvme_health_update(device *d, const nvme_health_log *h){
+	nvme_health *nh;
+
+	if((nh = d->blkdev.nvme) == NULL){
+		if((nh = malloc(sizeof(*nh))) == NULL){
+			return 0;
+		}
+		nh->first = *h;
+		nh->last = *h;
+		d->blkdev.nvme = nh;
+		return 1;
+	}
+	// everything but the time of the reading
+	if(memcmp((const char *)&nh->last + sizeof(h->when),
+				(const char *)h + sizeof(h->when),
+				sizeof(*h) - sizeof(h->when)) == 0){
+		nh->last.when = h->when;
+		return 0;
+	}
+	nh->last = *h;
+	return 1;
+}
+
+static double
+timespec_secs(const struct timespec *t1, const struct timespec *t0){
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+void nvme_health_rates(const nvme_health *nh, nvme_rates *r){
+	const nvme_health_log *f = &nh->first;
+	const nvme_health_log *l = &nh->last;
+	double secs;
+
+	r->tbw_per_day = -1;
+	r->tbw_per_day_session = -1;
+	r->days_to_worn = -1;
+	r->throttled_pct_session = -1;
+	r->throttled_secs = (uint64_t)l->tmt_secs[0] + l->tmt_secs[1];
+	if(l->power_on_hours >= 24){
+		r->tbw_per_day = l->data_units_written * NVME_DATA_UNIT / 1e12
+			/ (l->power_on_hours / 24.0);
+	}
+	// wear is only reported in whole percent; extrapolate over the life
+	if(l->percent_used >= 100){
+		r->days_to_worn = 0;
+	}else if(l->percent_used && l->power_on_hours){
+		r->days_to_worn = (l->power_on_hours / 24.0) * (100 - l->percent_used)
+			/ l->percent_used;
+	}
+	// wait for a few poll intervals before reporting session rates
+	if((secs = timespec_secs(&l->when, &f->when)) >= 60){
+		uint64_t tsecs = r->throttled_secs - f->tmt_secs[0] - f->tmt_secs[1];
+
+		r->tbw_per_day_session = (l->data_units_written - f->data_units_written)
+			* NVME_DATA_UNIT / 1e12 * (86400 / secs);
+		r->throttled_pct_session = tsecs * 100 / secs;
+		if(r->throttled_pct_session > 100){
+			r->throttled_pct_session = 100;
+		}
+	}
+}
+
+static int
+nvme_smart_log(struct device *d, int fd){
+	nvme_health_log h;
+	smart_sample s;
+
+	if(nvme_smart_sample(d->name, fd, &s, &h)){
+		return -1;
+	}
+	d->blkdev.smart = s.smart;
+	d->blkdev.celsius = s.celsius;
+	nvme_health_update(d, &h);
 	return 0;
 }
 
 int nvme_interrogate(struct device *d, int fd){
-	struct nvme_admin_cmd nvmeio;
 	struct nvme_id_ctrl ctrl;
 
-	memset(&ctrl, 0, sizeof(ctrl));
-	memset(&nvmeio, 0, sizeof(nvmeio));
-	// FIXME where can we get this value from besides nvme-cli source?
-	nvmeio.opcode = NVME_ADMIN_IDENTIFY;
-	nvmeio.addr = (uintptr_t)&ctrl;
-	nvmeio.data_len = sizeof(ctrl);
-	nvmeio.cdw10 = 1; // FIXME what is this?
-	if(ioctl(fd, NVME_IOCTL_ADMIN_CMD, &nvmeio)){
-		diag("Couldn't perform nvme_admin_identify on %s:%d (%s?)\n",
-				d->name, fd, strerror(errno));
+	if(nvme_identify(d->name, fd, NVME_ID_CNS_CTRL, 0, &ctrl, sizeof(ctrl))){
 		return -1;
 	}
 	if((d->blkdev.serial = cleanup_serial(ctrl.sn, sizeof(ctrl.sn))) == NULL){
@@ -185,6 +628,7 @@ int nvme_interrogate(struct device *d, int fd){
 	d->blkdev.wwn = strdup(d->blkdev.serial);
 	d->blkdev.transport = DIRECT_NVME;
 	d->blkdev.rotation = -1; // non-rotating store
+	nvme_namespaces_probe(d, fd, le32toh(ctrl.nn));
 	nvme_smart_log(d, fd);
 	return 0;
 }
@@ -6,10 +6,104 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+#include <time.h>
+
 struct device;
+struct smart_sample;
+
+#define NVME_TEMP_SENSORS 8
+#define NVME_NO_SENSOR -274 // unimplemented temperature sensor
+
+// Data units read and written are each 1000 512-byte sectors
+#define NVME_DATA_UNIT 512000.0
+
+// The SMART / Health Information log page (NVMe 1.4 5.14.1.2), as of one
+// reading. The 128-bit counters saturate at UINT64_MAX.
+typedef struct nvme_health_log {
+	struct timespec when;		// CLOCK_MONOTONIC time of the reading
+	unsigned critical_warning;	// bitmask
+	unsigned avail_spare;		// percent
+	unsigned spare_thresh;		// percent
+	unsigned percent_used;		// estimated wear; may exceed 100
+	uint64_t data_units_read;	// in thousands of 512-byte units
+	uint64_t data_units_written;
+	uint64_t host_reads;		// read commands completed
+	uint64_t host_writes;
+	uint64_t power_cycles;
+	uint64_t power_on_hours;
+	uint64_t unsafe_shutdowns;
+	uint64_t media_errors;
+	uint64_t err_log_entries;
+	uint32_t warning_temp_mins;	// minutes above the warning threshold
+	uint32_t critical_temp_mins;	// minutes above the critical threshold
+	int sensors[NVME_TEMP_SENSORS];	// celsius, or NVME_NO_SENSOR
+	uint32_t tmt_transitions[2];	// entries into light/heavy throttling
+	uint32_t tmt_secs[2];		// seconds spent in each
+} nvme_health_log;
+
+// The first reading taken since the device was (re)scanned, and the latest.
+// Session rates are taken between the two.
+typedef struct nvme_health {
+	nvme_health_log first;
+	nvme_health_log last;
+} nvme_health;
+
+// Trends derived from an nvme_health. Values which can't (yet) be computed
+// are negative.
+typedef struct nvme_rates {
+	double tbw_per_day;		// lifetime average, from power-on hours
+	double tbw_per_day_session;	// since the first reading
+	double days_to_worn;		// until percent_used reaches 100
+	uint64_t throttled_secs;	// lifetime, light plus heavy
+	double throttled_pct_session;	// share of time throttled since first
+} nvme_rates;
+
+#define NVME_MAX_LBAF 16
+
+// One supported LBA format of a namespace
+typedef struct nvme_lbaf {
+	unsigned lbads;		// log2 of the data size
+	unsigned ms;		// metadata bytes per block
+	unsigned rp;		// relative performance, 0 (best) to 3 (degraded)
+} nvme_lbaf;
 
+typedef struct nvme_namespace {
+	uint32_t nsid;
+	uint64_t nsze;		// size in blocks
+	uint64_t nuse;		// blocks in use
+	unsigned flbas;		// index of the LBA format in use
+	unsigned nlbaf;		// number of supported LBA formats
+	nvme_lbaf lbaf[NVME_MAX_LBAF];
+	int better;		// index of the fastest format with the same
+				//  metadata size, if faster than flbas, else -1
+} nvme_namespace;
+
+// Also enumerates the controller's active namespaces and their LBA formats,
+// flagging those which could be formatted faster.
 int nvme_interrogate(struct device *, int sd);
 
+// The device's own namespace among those enumerated, or NULL.
+const nvme_namespace *nvme_device_namespace(const struct device *);
+
+// "best", "better", "good" or "degraded"
+const char *nvme_rp_str(unsigned rp);
+
+// Reformat the device's namespace with the LBA format at index lbaf, using
+// the native NVMe Format NVM command (without secure erase). All data on the
+// namespace is lost. Refuses if anything on the namespace is mounted.
+int nvme_format(struct device *, unsigned lbaf);
+
+// Read the SMART / Health Information log page from the open fd into the
+// sample and, if non-NULL, the log. Safe to call without holding the lock.
+int nvme_smart_sample(const char *name, int fd, struct smart_sample *, nvme_health_log *);
+
+// Fold a new reading into the device's health. Returns non-zero if anything
+// we display has changed. Call while holding the lock.
+int nvme_health_update(struct device *, const nvme_health_log *);
+
+void nvme_health_rates(const nvme_health *, nvme_rates *);
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,6 +18,7 @@
 #include "msdos.h"
 #include "ptypes.h"
 #include "ptable.h"
+#include "snapshot.h"
 #include "growlight.h"
 
 #define LBA_SIZE 512
@@ -238,6 +239,9 @@ int wipe_ptable(device *d, const char *pty){
 	}
 	for(ptp = ptables ; ptp->name ; ++ptp){
 		if(strcmp(ptp->name, pt) == 0){
+			if(snapshot_before_wipe(d)){
+				return -1;
+			}
 			if(ptp->zap(d)){
 				return -1;
 			}
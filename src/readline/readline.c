@@ -7,14 +7,25 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <locale.h>
+#include <termios.h>
 #include <version.h>
-#include <atasmart.h>
 #include <notcurses/direct.h>
 
 #include "fs.h"
+#include "irq.h"
+#include "audit.h"
 #include "mbr.h"
+#include "mdadm.h"
+#include "nvme.h"
 #include "zfs.h"
+#include "crypt.h"
+#include "ssd.h"
+#include "scsi.h"
 #include "swap.h"
+#include "tune.h"
+#include "stack.h"
+#include "smart.h"
+#include "smartpoll.h"
 #include "stats.h"
 #include "sysfs.h"
 #include "popen.h"
@@ -24,6 +35,7 @@
 #include "secure.h"
 #include "ptable.h"
 #include "health.h"
+#include "snapshot.h"
 #include "growlight.h"
 
 #define U64STRLEN 20    // Does not include a '\0' (18,446,744,073,709,551,616)
@@ -363,14 +375,40 @@ print_drive_stats(const device *d) {
 static int
 print_drive_stats_identified(const device *d) {
   printf("SecRead    %16ju SecReadΔ    %16ju\n"
-         "SecWritten %16ju SecWrittenΔ %16ju\n",
+         "SecWritten %16ju SecWrittenΔ %16ju\n"
+         "Reads      %16ju ReadsΔ      %16ju\n"
+         "Writes     %16ju WritesΔ     %16ju\n",
     d->stats.sectors_read,
     d->statdelta.sectors_read,
     d->stats.sectors_written,
-    d->statdelta.sectors_written);
+    d->statdelta.sectors_written,
+    d->stats.reads,
+    d->statdelta.reads,
+    d->stats.writes,
+    d->statdelta.writes);
+  if(d->members){
+    printf("MembersΔ   %16ju sectors    %16ju requests\n",
+      d->memberdelta.sectors_read + d->memberdelta.sectors_written,
+      d->memberdelta.reads + d->memberdelta.writes);
+    if(d->hotmember){
+      use_terminfo_color(COLOR_RED, 1);
+      printf("%s is doing over %dx the I/O of its peers\n",
+             d->hotmember->name, STACK_IMBALANCE_RATIO);
+      use_terminfo_color(COLOR_WHITE, 1);
+    }
+  }
   return 0;
 }
 
+static int
+print_rollup(const char *name, const statrollup *l){
+  char rbuf[PREFIXSTRLEN + 1], wbuf[PREFIXSTRLEN + 1];
+
+  return printf("%-10.10s %12sbps %12sbps %10ju %5u%%\n", name,
+                qprefix(l->rxbps, 1, rbuf, 1), qprefix(l->txbps, 1, wbuf, 1),
+                l->iops, l->util);
+}
+
 // Yellow - hard disk
 // Cyan -- SSD
 // Magena -- virtual
@@ -407,9 +445,9 @@ print_drive(const device *d, int descend){
       d->physsec,
       d->blkdev.unloaded ? L"U" :
        d->blkdev.removable ? L"R" :
-       d->blkdev.smart == SK_SMART_OVERALL_GOOD ? L"✔" :
-       (d->blkdev.smart == SK_SMART_OVERALL_BAD_STATUS ||
-         d->blkdev.smart == SK_SMART_OVERALL_BAD_SECTOR_MANY) ? L"✗" :
+       d->blkdev.smart == SMART_GOOD ? L"✔" :
+       (d->blkdev.smart == SMART_BAD_STATUS ||
+         d->blkdev.smart == SMART_BAD_SECTOR_MANY) ? L"✗" :
        d->blkdev.smart > 0 ? L"☠" :
        d->blkdev.realdev ? L"." : L"V",
       d->blkdev.rotation >= 0 ? L"O" : L".",
@@ -514,6 +552,7 @@ print_drive(const device *d, int descend){
 static int
 print_zpool(const device *d, int descend){
   char buf[PREFIXSTRLEN + 1];
+  const stackedge *e;
   int r = 0, rr;
 
   if(d->layout != LAYOUT_ZPOOL){
@@ -532,6 +571,12 @@ print_zpool(const device *d, int descend){
   if(!descend){
     return r;
   }
+  for(e = d->members ; e ; e = e->mnext){
+    r += rr = print_dev_mplex(e->member, 1, descend);
+    if(rr < 0){
+      return -1;
+    }
+  }
   return r;
 }
 
@@ -586,6 +631,78 @@ print_dm(const device *d, int prefix, int descend){
   return r;
 }
 
+// Sync progress, rate and ETA, followed by the speed limits
+static int
+print_md_sync(const device *d, int prefix){
+  int r = 0, rr;
+
+  if(d->mddev.resync){
+    r += rr = printf("%-*.*s %s", prefix, prefix, "", d->mddev.syncaction);
+    if(rr < 0){
+      return -1;
+    }
+    if(d->mddev.synctotal){
+      r += rr = printf(" %.2f%% (%ju/%ju)",
+                       d->mddev.syncdone * 100.0 / d->mddev.synctotal,
+                       d->mddev.syncdone, d->mddev.synctotal);
+      if(rr < 0){
+        return -1;
+      }
+    }
+    if(d->mddev.syncrate){
+      r += rr = printf(" %.1fMB/s", d->mddev.syncrate * 512.0 / 1000000);
+      if(rr < 0){
+        return -1;
+      }
+    }
+    if(d->mddev.synceta){
+      r += rr = printf(" ETA %juh%02jum", d->mddev.synceta / 3600,
+                       d->mddev.synceta % 3600 / 60);
+      if(rr < 0){
+        return -1;
+      }
+    }
+  }else{
+    r += rr = printf("%-*.*s %s", prefix, prefix, "",
+                     d->mddev.syncaction ? d->mddev.syncaction : "n/a");
+    if(rr < 0){
+      return -1;
+    }
+  }
+  r += rr = printf(" limits %lu%s-%lu%s KiB/s", d->mddev.syncmin,
+                   d->mddev.synclocal & MD_SYNC_LOCAL_MIN ? "" : "(system)",
+                   d->mddev.syncmax,
+                   d->mddev.synclocal & MD_SYNC_LOCAL_MAX ? "" : "(system)");
+  if(rr < 0){
+    return -1;
+  }
+  if(d->mddev.mismatches){
+    r += rr = printf(" %ju mismatched sectors", d->mddev.mismatches);
+    if(rr < 0){
+      return -1;
+    }
+  }
+  if((rr = printf("\n")) < 0){
+    return -1;
+  }
+  return r + rr;
+}
+
+static void
+print_md_tuning(const device *d){
+  if(d->mddev.stripecache){
+    unsigned long rec = md_stripe_cache_recommendation(d->mddev.disks, d->mddev.stride);
+
+    printf("Stripe cache: %lu (recommended: %lu) group threads: %lu preread bypass: %lu\n",
+           d->mddev.stripecache, rec, d->mddev.groupthreads, d->mddev.prereadbypass);
+  }
+  if(d->mddev.bitmapchunk){
+    printf("Write-intent bitmap chunk: %luKiB\n", d->mddev.bitmapchunk / 1024);
+  }else{
+    printf("Write-intent bitmap: none\n");
+  }
+}
+
 static int
 print_mdadm(const device *d, int prefix, int descend){
   char buf[PREFIXSTRLEN + 1];
@@ -607,6 +724,12 @@ print_mdadm(const device *d, int prefix, int descend){
   if(rr < 0){
     return -1;
   }
+  if(d->mddev.resync || d->mddev.mismatches){
+    r += rr = print_md_sync(d, prefix);
+    if(rr < 0){
+      return -1;
+    }
+  }
   if(!descend){
     return r;
   }
@@ -670,11 +793,24 @@ print_controller(const controller *c, int descend){
       }else{
         char buf[PREFIXSTRLEN + 1];
 
-        r += rr = printf("[%s] PCI Express %04x:%02x.%02x.%x (gen %s x%u, %sbps)\n ",
+        r += rr = printf("[%s] PCI Express %04x:%02x.%02x.%x (gen %s x%u",
           c->ident, c->pcie.domain, c->pcie.bus,
           c->pcie.dev, c->pcie.func,
-          pcie_gen(c->pcie.gen), c->pcie.lanes_neg,
-          qprefix(c->bandwidth, 1, buf, 1));
+          pcie_gen(c->pcie.gen), c->pcie.lanes_neg);
+        if(rr < 0){
+          return -1;
+        }
+        if(pcie_degraded_p(c)){
+          use_terminfo_color(COLOR_RED, 1);
+          r += rr = printf(" of gen %s x%u", pcie_gen(c->pcie.gen_cap),
+                           c->pcie.lanes_cap);
+          use_terminfo_color(COLOR_WHITE, 1);
+          if(rr < 0){
+            return -1;
+          }
+        }
+        r += rr = printf(", %sbps, %u%% live)\n ",
+          qprefix(c->bandwidth, 1, buf, 1), controller_saturation(c));
       }
       break;
     case BUS_VIRTUAL:
@@ -706,6 +842,63 @@ print_controller(const controller *c, int descend){
   return r;
 }
 
+// Each blk-mq hardware queue, the cores submitting to it, and where its
+// vector's interrupts are being serviced
+static int
+print_irqs(const controller *c){
+  const irqinfo *ii = c->irqs;
+  const char *problem;
+  unsigned z;
+
+  if(printf("Interrupts: %u vector%s, %u hardware queue%s",
+            ii->veccount, ii->veccount == 1 ? "" : "s",
+            ii->hwqs, ii->hwqs == 1 ? "" : "s") < 0){
+    return -1;
+  }
+  if( (problem = irq_problem_str(ii->problems)) ){
+    use_terminfo_color(COLOR_RED, 1);
+    if(printf(" (%s)", problem) < 0){
+      return -1;
+    }
+    use_terminfo_color(COLOR_WHITE, 1);
+  }
+  if(printf("\n%4.4s %-16.16s %5.5s %-12.12s %8.8s %4.4s %4.4s\n",
+            "hwq", "cores", "irq", "vector", "irq/s", "cpu", "node") < 0){
+    return -1;
+  }
+  for(z = 0 ; z < ii->veccount ; ++z){
+    const irqvector *v = &ii->vecs[z];
+    char hwq[12], cpu[12], node[12];
+    const char *cores = "";
+
+    snprintf(hwq, sizeof(hwq), "-");
+    if(v->hwq >= 0){
+      snprintf(hwq, sizeof(hwq), "%d", v->hwq);
+      if(ii->hwqcpus[v->hwq]){
+        cores = ii->hwqcpus[v->hwq];
+      }
+    }
+    snprintf(cpu, sizeof(cpu), "-");
+    if(v->cpu >= 0){
+      snprintf(cpu, sizeof(cpu), "%d", v->cpu);
+    }
+    snprintf(node, sizeof(node), "-");
+    if(v->node >= 0){
+      snprintf(node, sizeof(node), "%d", v->node);
+    }
+    if(v->problems){
+      use_terminfo_color(COLOR_RED, 1);
+    }
+    if(printf("%4.4s %-16.16s %5u %-12.12s %8ju %4.4s %4.4s\n",
+              hwq, cores, v->irq, v->name ? v->name : "",
+              (uintmax_t)v->rate, cpu, node) < 0){
+      return -1;
+    }
+    use_terminfo_color(COLOR_WHITE, 1);
+  }
+  return 0;
+}
+
 static int
 detail_controller(const controller *c){
   int r, rr;
@@ -717,6 +910,19 @@ detail_controller(const controller *c){
   if(rr < 0){
     return -1;
   }
+  if(c->bus != BUS_VIRTUAL){
+    char rbuf[PREFIXSTRLEN + 1], wbuf[PREFIXSTRLEN + 1], dbuf[PREFIXSTRLEN + 1];
+
+    r += rr = printf("Load: %sbps read, %sbps written, %ju IOPS, %u%% busy, %sbps nominal demand\n",
+                     qprefix(c->load.rxbps, 1, rbuf, 1), qprefix(c->load.txbps, 1, wbuf, 1),
+                     c->load.iops, c->load.util, qprefix(c->demand, 1, dbuf, 1));
+    if(rr < 0){
+      return -1;
+    }
+  }
+  if(c->irqs && print_irqs(c) < 0){
+    return -1;
+  }
   return 0;
 }
 
@@ -952,6 +1158,208 @@ blockdev_dump(int descend){
   return 0;
 }
 
+static void
+print_nvme_health(const nvme_health *nh){
+  const nvme_health_log *h = &nh->last;
+  nvme_rates r;
+  unsigned z;
+
+  nvme_health_rates(nh, &r);
+  printf("Wear: %u%% used, spare %u%% (threshold %u%%)", h->percent_used,
+         h->avail_spare, h->spare_thresh);
+  if(r.days_to_worn >= 0){
+    printf(", ~%.0f days to 100%%", r.days_to_worn);
+  }
+  printf("\nWritten: %.2f TB (%.3f TB/day lifetime", h->data_units_written * NVME_DATA_UNIT / 1e12,
+         r.tbw_per_day < 0 ? 0 : r.tbw_per_day);
+  if(r.tbw_per_day_session >= 0){
+    printf(", %.3f TB/day recently", r.tbw_per_day_session);
+  }
+  printf(") Read: %.2f TB\n", h->data_units_read * NVME_DATA_UNIT / 1e12);
+  printf("Commands: %ju reads %ju writes Power-on: %juh Cycles: %ju Unsafe shutdowns: %ju\n",
+         (uintmax_t)h->host_reads, (uintmax_t)h->host_writes,
+         (uintmax_t)h->power_on_hours, (uintmax_t)h->power_cycles,
+         (uintmax_t)h->unsafe_shutdowns);
+  printf("Media errors: %ju Error log entries: %ju Critical warning: 0x%02x\n",
+         (uintmax_t)h->media_errors, (uintmax_t)h->err_log_entries, h->critical_warning);
+  printf("Temperature sensors:");
+  for(z = 0 ; z < NVME_TEMP_SENSORS ; ++z){
+    if(h->sensors[z] != NVME_NO_SENSOR){
+      printf(" %d°C", h->sensors[z]);
+    }
+  }
+  printf("\nThrottled: %jus (%u light / %u heavy entries, %us / %us)",
+         (uintmax_t)r.throttled_secs, h->tmt_transitions[0], h->tmt_transitions[1],
+         h->tmt_secs[0], h->tmt_secs[1]);
+  if(r.throttled_pct_session >= 0){
+    printf(", %.1f%% of the time recently", r.throttled_pct_session);
+  }
+  printf("\nOver temperature: %u min warning, %u min critical\n",
+         h->warning_temp_mins, h->critical_temp_mins);
+}
+
+static void
+print_nvme_namespaces(const device *d){
+  unsigned z, f;
+
+  printf("Namespaces: %u\n", d->blkdev.nscount);
+  for(z = 0 ; z < d->blkdev.nscount ; ++z){
+    const nvme_namespace *ns = &d->blkdev.namespaces[z];
+
+    printf(" %c%u: %ju blocks (%ju used) formats:", ns->nsid == d->blkdev.nsid ? '*' : ' ',
+           ns->nsid, (uintmax_t)ns->nsze, (uintmax_t)ns->nuse);
+    for(f = 0 ; f < ns->nlbaf ; ++f){
+      printf(" %s%u:%uB", f == ns->flbas ? "[" : "", f, 1u << ns->lbaf[f].lbads);
+      if(ns->lbaf[f].ms){
+        printf("+%u", ns->lbaf[f].ms);
+      }
+      printf("/%s%s", nvme_rp_str(ns->lbaf[f].rp), f == ns->flbas ? "]" : "");
+    }
+    printf("\n");
+    if(ns->better >= 0){
+      printf("  Running a slower format than available: LBA format %d (%uB, %s)\n",
+             ns->better, 1u << ns->lbaf[ns->better].lbads,
+             nvme_rp_str(ns->lbaf[ns->better].rp));
+    }
+  }
+}
+
+static void
+print_ata_capabilities(const device *d){
+  if(d->blkdev.trim){
+    printf("TRIM: reads after TRIM are %s", discard_str(discard_state(d)));
+    if(d->blkdev.trimblocks){ // 0 is unspecified
+      printf(", %u ranges/command", d->blkdev.trimblocks * 64);
+    }
+    printf("\n");
+  }else{
+    printf("TRIM: unsupported\n");
+  }
+  if(d->blkdev.ncq){
+    printf("NCQ: depth %u, %s (queue depth %lu)\n", d->blkdev.ncqdepth,
+           d->blkdev.queuedepth > 1 ? "enabled" : "disabled", d->blkdev.queuedepth);
+  }
+  if(d->blkdev.alignoff){
+    printf("Alignment offset: %uB\n", d->blkdev.alignoff);
+  }
+  if(d->blkdev.satalink){
+    printf("SATA link: %s (supports %s)%s\n", sata_gen_str(d->blkdev.satalink),
+           sata_gen_str(d->blkdev.satacap), sata_degraded_p(d) ? " DEGRADED" : "");
+  }
+}
+
+static void
+print_scsi_errors(const char *what, const scsi_errcount *ec){
+  if(ec->valid){
+    printf("%s errors: %ju corrected, %ju uncorrected\n", what,
+           (uintmax_t)ec->corrected, (uintmax_t)ec->uncorrected);
+  }
+}
+
+static void
+print_scsi_info(const device *d){
+  const scsi_info *si = d->blkdev.scsi;
+
+  printf("UNMAP: %s", d->blkdev.trim ? discard_str(discard_state(d)) : "unsupported");
+  if(si->unmapgran){
+    printf(", granularity %u blocks", si->unmapgran);
+  }
+  if(si->maxunmap){
+    printf(", max %u blocks", si->maxunmap);
+  }
+  printf("\n");
+  if(si->optxfer || si->maxxfer){
+    printf("Transfer length: optimal %u, maximum %u, granularity %u blocks\n",
+           si->optxfer, si->maxxfer, si->optxfergran);
+  }
+  if(si->reftemp >= 0){
+    printf("Reference temperature: %dC\n", si->reftemp);
+  }
+  if(si->ie_asc){
+    printf("Failure predicted: ASC 0x%02x ASCQ 0x%02x\n", si->ie_asc, si->ie_ascq);
+  }
+  print_scsi_errors("Read", &si->read);
+  print_scsi_errors("Write", &si->write);
+  print_scsi_errors("Verify", &si->verify);
+}
+
+// Per-vdev I/O over the most recent stats tick
+static void
+print_zpool_vdevs(const zpool_info *zi){
+  char rbuf[PREFIXSTRLEN + 1], wbuf[PREFIXSTRLEN + 1];
+  unsigned z;
+
+  printf("%-24.24s %*s %*s %6s %6s %8s %6s\n", "vdev",
+         PREFIXSTRLEN + 1, "rd B/s", PREFIXSTRLEN + 1, "wr B/s",
+         "rd/s", "wr/s", "latency", "errors");
+  for(z = 0 ; z < zi->vdevcount ; ++z){
+    const zpool_vdev *v = &zi->vdevs[z];
+    const char *name = v->devname ? v->devname : v->type;
+
+    qprefix(v->bps[0], 1, rbuf, 0);
+    qprefix(v->bps[1], 1, wbuf, 0);
+    printf("%*s%-*.*s %*s %*s %6ju %6ju %6juus %6ju", v->depth * 2 - 2, "",
+           26 - v->depth * 2, 26 - v->depth * 2, name,
+           PREFIXFMT(rbuf), PREFIXFMT(wbuf),
+           (uintmax_t)v->iops[0], (uintmax_t)v->iops[1],
+           (uintmax_t)v->latus, (uintmax_t)v->errors);
+    if(v->slow){
+      use_terminfo_color(COLOR_RED, 1);
+      printf(" SLOW");
+      use_terminfo_color(COLOR_WHITE, 1);
+    }
+    printf("\n");
+  }
+}
+
+// Where the device sits among the dm, md and partitions stacked atop disks
+static void
+print_stack(const device *d){
+  const stackedge *e;
+  const device *slow;
+  const char *prob;
+  uintmax_t bw;
+
+  if(d->members){
+    printf("Transport: %s\nMembers:", transport_str(device_transport(d)));
+    for(e = d->members ; e ; e = e->mnext){
+      printf(" %s", e->member->name);
+    }
+    printf("\n");
+    if( (slow = stack_slowest(d, &bw)) ){
+      printf("Slowest member: %s (%ju Mbps)\n", slow->name, bw / 1000000);
+    }
+    if( (prob = stack_problem_str(stack_problems(d))) ){
+      use_terminfo_color(COLOR_RED, 1);
+      printf("Problems beneath: %s\n", prob);
+      use_terminfo_color(COLOR_WHITE, 1);
+    }
+  }
+  if(d->holders){
+    printf("Holders:");
+    for(e = d->holders ; e ; e = e->hnext){
+      printf(" %s", e->holder->name);
+    }
+    printf("\n");
+  }
+}
+
+// Hits, misses, occupancy and dirt of a dm-cache or dm-writecache
+static void
+print_dm_cache(const device *d){
+  if(d->layout != LAYOUT_DM || d->dmdev.target == NULL){
+    return;
+  }
+  if(strcmp(d->dmdev.target, "cache") && strcmp(d->dmdev.target, "writecache")){
+    return;
+  }
+  printf("Cache (%s): read %ju hits %ju misses, write %ju hits %ju misses\n",
+         d->dmdev.target, d->dmdev.readhits, d->dmdev.readmisses,
+         d->dmdev.writehits, d->dmdev.writemisses);
+  printf("Cache blocks: %ju/%ju used, %ju dirty\n", d->dmdev.cacheused,
+         d->dmdev.cachetotal, d->dmdev.dirty);
+}
+
 static inline int
 blockdev_details(const device *d){
   char buf[BUFSIZ];
@@ -966,6 +1374,11 @@ blockdev_details(const device *d){
   use_terminfo_color(COLOR_WHITE, 1);
   printf("Logical sector size: %u Physical: %u\n", d->logsec, d->physsec);
   printf("I/O scheduler: %s\n", d->sched ? d->sched : "N/A");
+  print_stack(d);
+  print_dm_cache(d);
+  if(d->crypt){
+    printf("Encryption: %s\n", d->crypt);
+  }
   if(d->layout == LAYOUT_NONE){
     if(d->blkdev.biossha1){
       if(printf("\nBIOS boot SHA-1: ") < 0){
@@ -982,6 +1395,17 @@ blockdev_details(const device *d){
     }
     printf("Serial number: %s\n", d->blkdev.serial ? d->blkdev.serial : "n/a");
     printf("Transport: %s\n", transport_str(d->blkdev.transport));
+    if(ata_transport_p(d->blkdev.transport)){
+      print_ata_capabilities(d);
+    }else if(d->blkdev.scsi){
+      print_scsi_info(d);
+    }
+    if(d->blkdev.nscount){
+      print_nvme_namespaces(d);
+    }
+    if(d->blkdev.nvme){
+      print_nvme_health(d->blkdev.nvme);
+    }
     if(d->blkdev.transport == DIRECT_NVME){
       if(snprintf(buf, sizeof(buf), "nvme id-ctrl /dev/%s", d->name) >= (int)sizeof(buf)){
         return -1;
@@ -992,6 +1416,9 @@ blockdev_details(const device *d){
       }
     }
   }else if(d->layout == LAYOUT_MDADM){
+    printf("Sync:");
+    print_md_sync(d, 0);
+    print_md_tuning(d);
     if(snprintf(buf, sizeof(buf), "mdadm --detail /dev/%s", d->name) >= (int)sizeof(buf)){
       return -1;
     }
@@ -1000,6 +1427,11 @@ blockdev_details(const device *d){
       return -1;
     }
   }else if(d->layout == LAYOUT_ZPOOL){
+    if(d->zpool.info){
+      printf("Health: %s Capacity: %u%% Dedup: %s\n", d->zpool.info->health,
+             d->zpool.info->capacity, d->zpool.info->dedupratio);
+      print_zpool_vdevs(d->zpool.info);
+    }
     if(snprintf(buf, sizeof(buf), "zpool status %s", d->name) >= (int)sizeof(buf)){
       return -1;
     }
@@ -1012,6 +1444,67 @@ blockdev_details(const device *d){
   return 0;
 }
 
+// Read a line from the terminal without echoing it, stripping the newline
+static int
+read_passphrase(const char *prompt, char *buf, size_t len){
+  struct termios t, noecho;
+  size_t l;
+  int r = 0;
+
+  if(tcgetattr(STDIN_FILENO, &t)){
+    fprintf(stderr, "Couldn't get terminal attributes (%s?)\n", strerror(errno));
+    return -1;
+  }
+  noecho = t;
+  noecho.c_lflag &= ~ECHO;
+  noecho.c_lflag |= ECHONL;
+  if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &noecho)){
+    fprintf(stderr, "Couldn't disable echo (%s?)\n", strerror(errno));
+    return -1;
+  }
+  printf("%s", prompt);
+  fflush(stdout);
+  if(fgets(buf, len, stdin) == NULL){
+    r = -1;
+  }else if((l = strlen(buf)) && buf[l - 1] == '\n'){
+    buf[l - 1] = '\0';
+  }
+  tcsetattr(STDIN_FILENO, TCSAFLUSH, &t);
+  return r;
+}
+
+// Create LUKS keyed by the keyfile, or by a passphrase entered twice
+static int
+luks_blockdev(device *d, const wchar_t *wkeyfile){
+  char pass[BUFSIZ], verify[BUFSIZ];
+  char keyfile[PATH_MAX];
+  int r;
+
+  if(wkeyfile){
+    if(snprintf(keyfile, sizeof(keyfile), "%ls", wkeyfile) >= (int)sizeof(keyfile)){
+      fprintf(stderr, "Bad keyfile path: %ls\n", wkeyfile);
+      return -1;
+    }
+    return cryptondev(d, NULL, keyfile);
+  }
+  if(read_passphrase("Passphrase: ", pass, sizeof(pass))){
+    return -1;
+  }
+  if(read_passphrase("Verify passphrase: ", verify, sizeof(verify))){
+    explicit_bzero(pass, sizeof(pass));
+    return -1;
+  }
+  if(strcmp(pass, verify)){
+    fprintf(stderr, "Passphrases didn't match\n");
+    r = -1;
+  }else{
+    r = cryptondev(d, pass, NULL);
+  }
+  explicit_bzero(pass, sizeof(pass));
+  explicit_bzero(verify, sizeof(verify));
+  return r;
+}
+
 static int
 blockdev(wchar_t * const *args, const char *arghelp){
   device *d;
@@ -1061,6 +1554,12 @@ blockdev(wchar_t * const *args, const char *arghelp){
       return -1;
     }
     return wipe_ptable(d, NULL);
+  }else if(wcscmp(args[1], L"luks") == 0){
+    if(args[3] && args[4]){
+      usage(args, arghelp);
+      return -1;
+    }
+    return luks_blockdev(d, args[3]);
   }else if(wcscmp(args[1], L"wipebiosboot") == 0){
     if(args[3]){
       usage(args, arghelp);
@@ -1073,6 +1572,143 @@ blockdev(wchar_t * const *args, const char *arghelp){
       return -1;
     }
     return wipe_dosmbr(d);
+  }else if(wcscmp(args[1], L"snapshot") == 0){
+    char *path;
+
+    if(args[3]){
+      usage(args, arghelp);
+      return -1;
+    }
+    if((path = snapshot_ptable(d)) == NULL){
+      return -1;
+    }
+    printf("Saved %s partitioning to %s\n", d->name, path);
+    free(path);
+    return 0;
+  }else if(wcscmp(args[1], L"snapdiff") == 0 || wcscmp(args[1], L"restore") == 0){
+    const wchar_t *snap;
+    int n, force = 0;
+    char *path;
+    int r;
+
+    n = 0;
+    while(args[3 + n]){
+      ++n;
+    }
+    // "force" can only come last
+    if(n && wcscmp(args[1], L"restore") == 0 && wcscmp(args[2 + n], L"force") == 0){
+      force = 1;
+      --n;
+    }
+    if(n > 1){
+      usage(args, arghelp);
+      return -1;
+    }
+    snap = n ? args[3] : NULL;
+    if(snap){
+      if((path = malloc(PATH_MAX)) == NULL){
+        return -1;
+      }
+      if(snprintf(path, PATH_MAX, "%ls", snap) >= PATH_MAX){
+        fprintf(stderr, "Bad snapshot path: %ls\n", snap);
+        free(path);
+        return -1;
+      }
+    }else if((path = latest_ptable_snapshot(d)) == NULL){
+      return -1;
+    }
+    if(wcscmp(args[1], L"restore") == 0){
+      if((r = restore_ptable_snapshot(d, path, force)) == 0){
+        printf("Restored %s partitioning from %s\n", d->name, path);
+      }
+    }else if((r = diff_ptable_snapshot(d, path)) >= 0){
+      printf("%d difference%s between %s and %s\n", r, r == 1 ? "" : "s", d->name, path);
+      r = 0;
+    }
+    free(path);
+    return r;
+  }else if(wcscmp(args[1], L"poll") == 0){
+    wchar_t *end;
+    unsigned long secs;
+
+    if(args[3] == NULL || args[4]){
+      usage(args, arghelp);
+      return -1;
+    }
+    secs = wcstoul(args[3], &end, 0);
+    if(*end || secs > UINT_MAX){
+      fprintf(stderr, "Bad interval: %ls\n", args[3]);
+      return -1;
+    }
+    return set_smart_poll_interval(d, secs);
+  }else if(wcscmp(args[1], L"syncspeed") == 0){
+    unsigned long min, max;
+    wchar_t *end;
+
+    if(args[3] == NULL || args[4] == NULL || args[5]){
+      usage(args, arghelp);
+      return -1;
+    }
+    min = wcstoul(args[3], &end, 0);
+    if(*end){
+      fprintf(stderr, "Bad minimum: %ls\n", args[3]);
+      return -1;
+    }
+    max = wcstoul(args[4], &end, 0);
+    if(*end){
+      fprintf(stderr, "Bad maximum: %ls\n", args[4]);
+      return -1;
+    }
+    if(md_set_sync_speed(d, min, max)){
+      return -1;
+    }
+    md_sync_update(d, &(struct timeval){ .tv_sec = 0, });
+    return print_md_sync(d, 0) < 0 ? -1 : 0;
+  }else if(wcscmp(args[1], L"mdtune") == 0){
+    char knob[32];
+    unsigned long val;
+    wchar_t *end;
+
+    if(args[3] == NULL){
+      if(d->layout != LAYOUT_MDADM){
+        fprintf(stderr, "%s is not an md device\n", d->name);
+        return -1;
+      }
+      print_md_tuning(d);
+      return 0;
+    }
+    if(args[4] == NULL || args[5]){
+      usage(args, arghelp);
+      return -1;
+    }
+    if(snprintf(knob, sizeof(knob), "%ls", args[3]) >= (int)sizeof(knob)){
+      fprintf(stderr, "Bad tunable: %ls\n", args[3]);
+      return -1;
+    }
+    if(wcscmp(args[4], L"recommended") == 0 && strcmp(knob, "stripe_cache_size") == 0){
+      val = md_stripe_cache_recommendation(d->mddev.disks, d->mddev.stride);
+    }else{
+      val = wcstoul(args[4], &end, 0);
+      if(*end){
+        fprintf(stderr, "Bad value: %ls\n", args[4]);
+        return -1;
+      }
+    }
+    return md_set_tunable(d, knob, val);
+  }else if(wcscmp(args[1], L"nvmeformat") == 0){
+    wchar_t *end;
+    unsigned long lbaf;
+
+    if(args[3] == NULL || args[4]){
+      usage(args, arghelp);
+      return -1;
+    }
+    lbaf = wcstoul(args[3], &end, 0);
+    if(*end || lbaf >= NVME_MAX_LBAF){
+      fprintf(stderr, "Bad LBA format: %ls\n", args[3]);
+      return -1;
+    }
+    return nvme_format(d, lbaf);
   }else if(wcscmp(args[1], L"ataerase") == 0){
     if(args[3]){
       usage(args, arghelp);
@@ -1588,18 +2224,141 @@ benchmark(wchar_t * const *args, const char *arghelp){
   return 0;
 }
 
+static int
+audit_all(void){
+  struct timespec t0, t1;
+  unsigned disks;
+  int r;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if((r = audit_ptables(&disks)) < 0){
+    return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  printf("Audited %u disk%s in %.3fs: %d problem%s\n", disks, disks == 1 ? "" : "s",
+         (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9,
+         r, r == 1 ? "" : "s");
+  return 0;
+}
+
+static int
+audit(wchar_t * const *args, const char *arghelp){
+  device *d;
+  int r;
+
+  if(args[1] == NULL){
+    return audit_all();
+  }
+  if(args[2]){
+    usage(args, arghelp);
+    return -1;
+  }
+  if((d = lookup_wdevice(args[1])) == NULL){
+    return -1;
+  }
+  if((r = audit_ptable(d)) < 0){
+    return -1;
+  }
+  printf("%s: %d problem%s\n", d->name, r, r == 1 ? "" : "s");
+  return 0;
+}
+
+static void
+print_tune_plan(const tune_plan *tp){
+  unsigned z;
+
+  use_terminfo_color(COLOR_WHITE, 1);
+  printf("%s (%s profile)\n", tp->name, tune_profile_str(tp->profile));
+  for(z = 0 ; z < TUNE_KNOBS ; ++z){
+    const tune_knob *k = &tp->knobs[z];
+    int change = k->recommended && strcmp(k->current ? k->current : "", k->recommended);
+
+    if(k->current == NULL){
+      continue;
+    }
+    if(change){
+      use_terminfo_color(COLOR_YELLOW, 1);
+    }
+    printf("  %-16s %-14s %s\n", k->node, k->current,
+           k->recommended ? k->recommended : "-");
+    if(change){
+      use_terminfo_color(COLOR_WHITE, 1);
+    }
+  }
+}
+
+static int
+tune(wchar_t * const *args, const char *arghelp){
+  char sdev[NAME_MAX], path[PATH_MAX];
+  const char *name = NULL;
+  tune_plan *plans;
+  unsigned count, z;
+  int r = 0;
+
+  if(args[1] && wcscmp(args[1], L"all")){
+    if(snprintf(sdev, sizeof(sdev), "%ls", args[1]) >= (int)sizeof(sdev)){
+      fprintf(stderr, "Bad device name: %ls\n", args[1]);
+      return -1;
+    }
+    name = sdev;
+  }
+  if(args[1] && args[2]){
+    if(wcscmp(args[2], L"apply") == 0 ? args[3] != NULL :
+        wcscmp(args[2], L"export") || args[3] == NULL || args[4]){
+      usage(args, arghelp);
+      return -1;
+    }
+  }
+  if(tune_plan_devices(name, &plans, &count)){
+    return -1;
+  }
+  if(args[1] == NULL || args[2] == NULL){
+    printf("%-18s %-14s %s\n", "Device/attribute", "Current", "Recommended");
+    for(z = 0 ; z < count ; ++z){
+      print_tune_plan(&plans[z]);
+    }
+  }else if(wcscmp(args[2], L"apply") == 0){
+    unsigned changes;
+    int failed;
+
+    failed = tune_apply(plans, count, &changes);
+    printf("Applied %u of %u change%s\n", changes - failed, changes, changes == 1 ? "" : "s");
+    r = failed ? -1 : 0;
+  }else{
+    FILE *fp;
+
+    if(snprintf(path, sizeof(path), "%ls", args[3]) >= (int)sizeof(path)){
+      fprintf(stderr, "Bad path: %ls\n", args[3]);
+      free_tune_plans(plans, count);
+      return -1;
+    }
+    if((fp = fopen(path, "we")) == NULL){
+      fprintf(stderr, "Couldn't open %s (%s?)\n", path, strerror(errno));
+      free_tune_plans(plans, count);
+      return -1;
+    }
+    r = tune_export_udev(fp, plans, count);
+    if(fclose(fp) || r){
+      fprintf(stderr, "Couldn't write %s (%s?)\n", path, strerror(errno));
+      r = -1;
+    }else{
+      printf("Wrote rules for %u device%s to %s\n", count, count == 1 ? "" : "s", path);
+    }
+  }
+  free_tune_plans(plans, count);
+  return r;
+}
+
 static int
 troubleshoot(wchar_t * const *args, const char *arghelp){
   ZERO_ARG_CHECK(args, arghelp);
-  fprintf(stderr, "Sorry, not yet implemented\n");
   // FIXME things to do:
   // FIXME check PCIe bandwidth against SATA bandwidth
   // FIXME check for proper alignment of partitions
   // FIXME check for msdos, apm or bsd partition tables
   // FIXME check for filesystems without noatime
   // FIXME check for SSD erase block size alignment
-  // FIXME check for GPT partition table validity
-  return -1;
+  return audit_all();
 }
 
 static device *
@@ -1939,6 +2698,18 @@ stats(wchar_t * const *args, const char *arghelp){
       }
     }
   }
+  use_terminfo_color(COLOR_WHITE, 1);
+  printf("\n%-10.10s %15s %15s %10s %6s\n", "Adapter", "Read rate",
+         "Write rate", "IOPS", "Busy");
+  use_terminfo_color(COLOR_BLUE, 1);
+  for(c = get_controllers() ; c ; c = c->next){
+    if(c->load.disks && print_rollup(c->ident, &c->load) < 0){
+      return -1;
+    }
+  }
+  if(print_rollup("host", get_host_load()) < 0){
+    return -1;
+  }
   return 0;
 }
 
@@ -1964,7 +2735,22 @@ static const struct fxn {
       "                 | [ \"wipebiosboot\" blockdev ]\n"
       "                 | [ \"wipedosmbr\" blockdev ]\n"
       "                 | [ \"ataerase\" blockdev ]\n"
+      "                 | [ \"nvmeformat\" blockdev lbaf ]\n"
+      "                 | [ \"poll\" blockdev seconds ]\n"
+      "                    SMART/temperature interval, 0 to disable\n"
+      "                 | [ \"syncspeed\" mddev min max ]\n"
+      "                    md resync limits in KiB/s, 0 for system default\n"
+      "                 | [ \"mdtune\" mddev [ tunable value ] ]\n"
+      "                    stripe_cache_size [ \"recommended\" ], group_thread_cnt,\n"
+      "                    preread_bypass_threshold, bitmap_chunk (bytes)\n"
       "                 | [ \"rmtable\" blockdev ]\n"
+      "                 | [ \"luks\" blockdev [ keyfile ] ]\n"
+      "                    passphrase is prompted for without a keyfile\n"
+      "                 | [ \"snapshot\" blockdev ]\n"
+      "                 | [ \"snapdiff\" blockdev [ snapshot ] ]\n"
+      "                 | [ \"restore\" blockdev [ snapshot ] [ \"force\" ] ]\n"
+      "                    latest snapshot is used if none is specified\n"
+      "                    force restores another device's snapshot\n"
       "                 | [ \"mktable\" [ blockdev tabletype ] ]\n"
       "                    | no arguments to list supported table types\n"
       "                 | [ \"detail\" blockdev ]\n"
@@ -2013,6 +2799,8 @@ static const struct fxn {
   FXN(diags, "[ count ]"),
   FXN(grubmap, ""),
   FXN(benchmark, "blockdev"),
+  FXN(audit, "[ blockdev ] no arguments to audit all partition tables"),
+  FXN(tune, "[ blockdev | \"all\" [ \"apply\" | \"export\" rulesfile ] ]"),
   FXN(troubleshoot, ""),
   FXN(version, ""),
   FXN(help, "[ command ]"),
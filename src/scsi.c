@@ -0,0 +1,435 @@
+// copyright 2012–2021 nick black
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <scsi/sg.h>
+#include <sys/ioctl.h>
+
+#include "sg.h"
+#include "scsi.h"
+#include "smart.h"
+#include "growlight.h"
+
+// Consult SPC-4 (INQUIRY, LOG SENSE) and SBC-3 (the block device VPD pages)
+#define SCSI_INQUIRY		0x12
+#define SCSI_LOG_SENSE		0x4d
+#define SCSI_TIMEOUT_MS		5000
+#define SCSI_BUFLEN		512
+
+#define VPD_SUPPORTED		0x00
+#define VPD_SERIAL		0x80
+#define VPD_DEVID		0x83
+#define VPD_ATA			0x89 // present behind a SCSI/ATA translator
+#define VPD_BLOCK_LIMITS	0xb0
+#define VPD_BLOCK_CHARS		0xb1
+#define VPD_LB_PROVISIONING	0xb2
+
+#define LOG_SUPPORTED		0x00
+#define LOG_WRITE_ERRORS	0x02
+#define LOG_READ_ERRORS		0x03
+#define LOG_VERIFY_ERRORS	0x05
+#define LOG_TEMPERATURE		0x0d
+#define LOG_IE			0x2f // informational exceptions
+#define LOG_PC_CUMULATIVE	0x40 // current cumulative values
+
+#define ERRPARAM_CORRECTED	0x0003
+#define ERRPARAM_UNCORRECTED	0x0006
+
+#define DESIG_ASSOC_LU		0x00
+#define DESIG_EUI64		0x02
+#define DESIG_NAA		0x03
+
+// Returns the number of bytes transferred, or -1 on error. Failures are only
+// reported verbosely, since optional pages are routinely rejected.
+static int
+scsi_cmd(const char *name, int fd, unsigned char *cdb, unsigned cdblen,
+		unsigned char *buf, unsigned len){
+	unsigned char sb[32];
+	unsigned key;
+	sg_io_hdr_t io;
+
+	memset(buf, 0, len);
+	memset(&io, 0, sizeof(io));
+	io.interface_id = 'S';
+	io.dxfer_direction = SG_DXFER_FROM_DEV;
+	io.cmd_len = cdblen;
+	io.cmdp = cdb;
+	io.dxfer_len = len;
+	io.dxferp = buf;
+	io.mx_sb_len = sizeof(sb);
+	io.sbp = sb;
+	io.timeout = SCSI_TIMEOUT_MS;
+	if(ioctl(fd, SG_IO, &io)){
+		diag("Couldn't perform SG_IO ioctl on %s:%d (%s?)\n", name, fd, strerror(errno));
+		return -1;
+	}
+	if((io.info & SG_INFO_OK_MASK) != SG_INFO_OK){
+		key = 0;
+		if(io.sb_len_wr > 2){ // descriptor (72h/73h) or fixed format
+			key = ((sb[0] & 0x7fu) >= 0x72 ? sb[1] : sb[2]) & 0xfu;
+		}
+		verbf("%s rejected 0x%02x/0x%02x (status 0x%x host 0x%x driver 0x%x sense key 0x%x)\n",
+			name, cdb[0], cdb[2], io.status, io.host_status, io.driver_status, key);
+		return -1;
+	}
+	return len - io.resid;
+}
+
+static inline unsigned
+be16(const unsigned char *b){
+	return ((unsigned)b[0] << 8u) | b[1];
+}
+
+static inline uint32_t
+be32(const unsigned char *b){
+	return ((uint32_t)b[0] << 24u) | ((uint32_t)b[1] << 16u) | ((uint32_t)b[2] << 8u) | b[3];
+}
+
+// Returns the page length (excluding the 4-byte header), or -1.
+static int
+inquiry_vpd(const char *name, int fd, unsigned page, unsigned char *buf){
+	unsigned char cdb[6] = { SCSI_INQUIRY, 0x01, page, SCSI_BUFLEN >> 8u, SCSI_BUFLEN & 0xffu, 0, };
+	int r;
+
+	if((r = scsi_cmd(name, fd, cdb, sizeof(cdb), buf, SCSI_BUFLEN)) < 4){
+		return -1;
+	}
+	if(buf[1] != page){
+		verbf("%s returned VPD page 0x%02x for 0x%02x\n", name, buf[1], page);
+		return -1;
+	}
+	r -= 4;
+	return (int)be16(buf + 2) < r ? (int)be16(buf + 2) : r;
+}
+
+// Returns the page length (excluding the 4-byte header), or -1.
+static int
+log_sense(const char *name, int fd, unsigned page, unsigned char *buf){
+	unsigned char cdb[10] = { SCSI_LOG_SENSE, 0, LOG_PC_CUMULATIVE | page, 0, 0, 0, 0,
+					SCSI_BUFLEN >> 8u, SCSI_BUFLEN & 0xffu, 0, };
+	int r;
+
+	if((r = scsi_cmd(name, fd, cdb, sizeof(cdb), buf, SCSI_BUFLEN)) < 4){
+		return -1;
+	}
+	if((buf[0] & 0x3fu) != page){
+		verbf("%s returned log page 0x%02x for 0x%02x\n", name, buf[0] & 0x3fu, page);
+		return -1;
+	}
+	r -= 4;
+	return (int)be16(buf + 2) < r ? (int)be16(buf + 2) : r;
+}
+
+// Log parameters are a 2-byte code, a control byte, a length, and the value.
+// Invokes cb on each, stopping early if it returns non-zero.
+static void
+log_params(const unsigned char *buf, int len,
+		int (*cb)(unsigned code, const unsigned char *val, unsigned vlen, void *),
+		void *arg){
+	const unsigned char *p = buf + 4;
+
+	while(p + 4 <= buf + 4 + len){
+		unsigned vlen = p[3];
+
+		if(p + 4 + vlen > buf + 4 + len){
+			break;
+		}
+		if(cb(be16(p), p + 4, vlen, arg)){
+			break;
+		}
+		p += 4 + vlen;
+	}
+}
+
+// Supported pages lists (VPD and log) are a byte per page following the
+// header. Log page codes occupy only the low six bits.
+static int
+page_listed(const unsigned char *buf, int len, unsigned page, unsigned mask){
+	int z;
+
+	for(z = 0 ; z < len ; ++z){
+		if((buf[4 + z] & mask) == page){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static uint64_t
+log_counter(const unsigned char *val, unsigned vlen){
+	uint64_t v = 0;
+	unsigned z;
+
+	// counters are variable length; keep the low 64 bits
+	for(z = vlen > 8 ? vlen - 8 : 0 ; z < vlen ; ++z){
+		v = (v << 8u) | val[z];
+	}
+	return v;
+}
+
+static int
+errcount_cb(unsigned code, const unsigned char *val, unsigned vlen, void *vec){
+	scsi_errcount *ec = vec;
+
+	if(code == ERRPARAM_CORRECTED){
+		ec->corrected = log_counter(val, vlen);
+	}else if(code == ERRPARAM_UNCORRECTED){
+		ec->uncorrected = log_counter(val, vlen);
+	}
+	return 0;
+}
+
+typedef struct tempstate {
+	int celsius;
+	int reftemp;
+} tempstate;
+
+static int
+temp_cb(unsigned code, const unsigned char *val, unsigned vlen, void *vts){
+	tempstate *ts = vts;
+
+	// the temperature is in byte 1 of the value; 0xff is "unavailable"
+	if(vlen >= 2 && val[1] != 0xff){
+		if(code == 0x0000){
+			ts->celsius = val[1];
+		}else if(code == 0x0001){
+			ts->reftemp = val[1];
+		}
+	}
+	return 0;
+}
+
+typedef struct iestate {
+	unsigned asc, ascq;
+	int celsius;
+	int valid;
+} iestate;
+
+static int
+ie_cb(unsigned code, const unsigned char *val, unsigned vlen, void *vie){
+	iestate *ie = vie;
+
+	if(code == 0x0000 && vlen >= 2){
+		ie->asc = val[0];
+		ie->ascq = val[1];
+		if(vlen >= 3 && val[2] != 0xff){
+			ie->celsius = val[2];
+		}
+		ie->valid = 1;
+		return 1;
+	}
+	return 0;
+}
+
+// The informational exceptions page is the SCSI analogue of SMART RETURN
+// STATUS: a nonzero ASC (usually 5Dh, failure prediction threshold exceeded)
+// means the device expects to fail.
+static int
+read_ie(const char *name, int fd, unsigned char *buf, iestate *ie){
+	int len;
+
+	memset(ie, 0, sizeof(*ie));
+	ie->celsius = -1;
+	if((len = log_sense(name, fd, LOG_IE, buf)) < 0){
+		return -1;
+	}
+	log_params(buf, len, ie_cb, ie);
+	return ie->valid ? 0 : -1;
+}
+
+static int
+read_temp(const char *name, int fd, unsigned char *buf, tempstate *ts){
+	int len;
+
+	ts->celsius = -1;
+	ts->reftemp = -1;
+	if((len = log_sense(name, fd, LOG_TEMPERATURE, buf)) < 0){
+		return -1;
+	}
+	log_params(buf, len, temp_cb, ts);
+	return 0;
+}
+
+int scsi_smart_sample(const char *name, int fd, smart_sample *s){
+	unsigned char buf[SCSI_BUFLEN];
+	tempstate ts;
+	iestate ie;
+
+	if(read_ie(name, fd, buf, &ie)){
+		return -1;
+	}
+	s->smart = ie.asc ? SMART_BAD_STATUS : SMART_GOOD;
+	s->celsius = ie.celsius;
+	if(read_temp(name, fd, buf, &ts) == 0 && ts.celsius >= 0){
+		s->celsius = ts.celsius;
+	}
+	return 0;
+}
+
+// Prefer a logical unit NAA designator, falling back to an EUI-64.
+static char *
+devid_wwn(const unsigned char *buf, int len){
+	const unsigned char *p, *best = NULL;
+	char *wwn;
+	unsigned z;
+
+	for(p = buf + 4 ; p + 4 <= buf + 4 + len ; p += 4 + p[3]){
+		unsigned type = p[1] & 0xfu;
+		unsigned assoc = (p[1] >> 4u) & 0x3u;
+
+		if(p + 4 + p[3] > buf + 4 + len){
+			break;
+		}
+		// binary code set only
+		if(assoc != DESIG_ASSOC_LU || (p[0] & 0xfu) != 1 || p[3] == 0){
+			continue;
+		}
+		if(type == DESIG_NAA){
+			best = p;
+			break;
+		}else if(type == DESIG_EUI64 && best == NULL){
+			best = p;
+		}
+	}
+	if(best == NULL){
+		return NULL;
+	}
+	if((wwn = malloc(best[3] * 2 + 1)) == NULL){
+		return NULL;
+	}
+	for(z = 0 ; z < best[3] ; ++z){
+		sprintf(wwn + z * 2, "%02x", best[4 + z]);
+	}
+	return wwn;
+}
+
+static void
+block_limits(scsi_info *si, const unsigned char *buf, int len){
+	if(len >= 0x0c){
+		si->optxfergran = be16(buf + 6);
+		si->maxxfer = be32(buf + 8);
+		si->optxfer = be32(buf + 12);
+	}
+	if(len >= 0x1c){
+		si->maxunmap = be32(buf + 20);
+		si->unmapgran = be32(buf + 28) & 0x7fffffffu;
+	}
+}
+
+static void
+error_counters(const char *name, int fd, unsigned char *buf, unsigned page, scsi_errcount *ec){
+	int len;
+
+	memset(ec, 0, sizeof(*ec));
+	if((len = log_sense(name, fd, page, buf)) >= 0){
+		log_params(buf, len, errcount_cb, ec);
+		ec->valid = 1;
+	}
+}
+
+int scsi_interrogate(device *d, int fd){
+	unsigned char vpds[SCSI_BUFLEN], logs[SCSI_BUFLEN], buf[SCSI_BUFLEN];
+	int vlen, llen, len;
+	scsi_info *si;
+	unsigned rot;
+
+	if((vlen = inquiry_vpd(d->name, fd, VPD_SUPPORTED, vpds)) < 0){
+		verbf("No VPD pages on %s\n", d->name);
+		return 0;
+	}
+	if(page_listed(vpds, vlen, VPD_ATA, 0xffu)){
+		verbf("\t%s is behind a SCSI/ATA translator\n", d->name);
+		return sg_interrogate(d, fd);
+	}
+	d->blkdev.transport = SERIAL_SAS;
+	if((si = malloc(sizeof(*si))) == NULL){
+		diag("Couldn't allocate SCSI info (%s?)\n", strerror(errno));
+		return -1;
+	}
+	memset(si, 0, sizeof(*si));
+	si->reftemp = -1;
+	free(d->blkdev.scsi);
+	d->blkdev.scsi = si;
+	if(page_listed(vpds, vlen, VPD_SERIAL, 0xffu)){
+		if((len = inquiry_vpd(d->name, fd, VPD_SERIAL, buf)) > 0){
+			free(d->blkdev.serial);
+			if((d->blkdev.serial = cleanup_serial(buf + 4, len)) == NULL){
+				return -1;
+			}
+		}
+	}
+	if(page_listed(vpds, vlen, VPD_DEVID, 0xffu)){
+		if((len = inquiry_vpd(d->name, fd, VPD_DEVID, buf)) > 0){
+			char *wwn;
+
+			if( (wwn = devid_wwn(buf, len)) ){
+				free(d->blkdev.wwn);
+				d->blkdev.wwn = wwn;
+			}
+		}
+	}
+	if(page_listed(vpds, vlen, VPD_BLOCK_LIMITS, 0xffu)){
+		if((len = inquiry_vpd(d->name, fd, VPD_BLOCK_LIMITS, buf)) > 0){
+			block_limits(si, buf, len);
+		}
+	}
+	if(page_listed(vpds, vlen, VPD_BLOCK_CHARS, 0xffu)){
+		if((len = inquiry_vpd(d->name, fd, VPD_BLOCK_CHARS, buf)) >= 2){
+			// same encoding as ATA's NMRR
+			if((rot = be16(buf + 4)) == 1){
+				d->blkdev.rotation = SSD_ROTATION;
+			}else if(rot > 0x400 && rot < 0xffff){
+				d->blkdev.rotation = rot;
+			}
+		}
+	}
+	d->blkdev.trim = d->blkdev.drat = d->blkdev.rzat = 0;
+	if(page_listed(vpds, vlen, VPD_LB_PROVISIONING, 0xffu)){
+		if((len = inquiry_vpd(d->name, fd, VPD_LB_PROVISIONING, buf)) >= 2){
+			// LBPU: UNMAP is supported. LBPRZ: unmapped blocks read
+			// back as zeroes (SBC-3 has no weaker determinism flag).
+			d->blkdev.trim = !!(buf[5] & 0x80u);
+			d->blkdev.drat = d->blkdev.rzat = d->blkdev.trim && (buf[5] & 0x1cu);
+		}
+	}
+	verbf("\t%s S/N %s WWN %s xfer %u/%u unmap %u/%u\n", d->name,
+		d->blkdev.serial ? d->blkdev.serial : "n/a", d->blkdev.wwn ? d->blkdev.wwn : "n/a",
+		si->optxfer, si->maxxfer, si->unmapgran, si->maxunmap);
+	d->blkdev.smart = -1;
+	if((llen = log_sense(d->name, fd, LOG_SUPPORTED, logs)) < 0){
+		return 0;
+	}
+	if(page_listed(logs, llen, LOG_TEMPERATURE, 0x3fu)){
+		tempstate ts;
+
+		if(read_temp(d->name, fd, buf, &ts) == 0){
+			if(ts.celsius >= 0){
+				d->blkdev.celsius = ts.celsius;
+			}
+			si->reftemp = ts.reftemp;
+		}
+	}
+	if(page_listed(logs, llen, LOG_IE, 0x3fu)){
+		iestate ie;
+
+		if(read_ie(d->name, fd, buf, &ie) == 0){
+			si->ie_asc = ie.asc;
+			si->ie_ascq = ie.ascq;
+			d->blkdev.smart = ie.asc ? SMART_BAD_STATUS : SMART_GOOD;
+			if(ie.asc){
+				diag("%s predicts failure (ASC 0x%02x ASCQ 0x%02x)\n", d->name, ie.asc, ie.ascq);
+			}
+		}
+	}
+	if(page_listed(logs, llen, LOG_WRITE_ERRORS, 0x3fu)){
+		error_counters(d->name, fd, buf, LOG_WRITE_ERRORS, &si->write);
+	}
+	if(page_listed(logs, llen, LOG_READ_ERRORS, 0x3fu)){
+		error_counters(d->name, fd, buf, LOG_READ_ERRORS, &si->read);
+	}
+	if(page_listed(logs, llen, LOG_VERIFY_ERRORS, 0x3fu)){
+		error_counters(d->name, fd, buf, LOG_VERIFY_ERRORS, &si->verify);
+	}
+	return 0;
+}
@@ -0,0 +1,53 @@
+// copyright 2012–2021 nick black
+#ifndef GROWLIGHT_SCSI
+#define GROWLIGHT_SCSI
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct device;
+struct smart_sample;
+
+// Counters from the write (02h), read (03h) and verify (05h) error counter
+// log pages. Only meaningful if the page was read.
+typedef struct scsi_errcount {
+	unsigned valid;
+	uint64_t corrected;	// Total errors corrected (0003h)
+	uint64_t uncorrected;	// Total uncorrected errors (0006h)
+} scsi_errcount;
+
+// What SCSI (SAS, FC) disks tell us beyond the serial number, WWN and
+// rotation rate, which are kept in the blkdev proper. Transfer lengths and
+// unmap values are in logical blocks, 0 if unreported.
+typedef struct scsi_info {
+	uint32_t maxxfer;	// Maximum transfer length (VPD B0h)
+	uint32_t optxfer;	// Optimal transfer length
+	uint32_t optxfergran;	// Optimal transfer length granularity
+	uint32_t maxunmap;	// Maximum unmap LBA count
+	uint32_t unmapgran;	// Optimal unmap granularity
+	int reftemp;		// Reference temperature, -1 if unknown
+	unsigned ie_asc;	// Most recent informational exception
+	unsigned ie_ascq;	//  (0/0 if none)
+	scsi_errcount write, read, verify;
+} scsi_info;
+
+// Interrogate a SCSI disk with INQUIRY VPD pages 80h (serial), 83h (device
+// identification), B0h (block limits), B1h (block device characteristics)
+// and B2h (logical block provisioning), and LOG SENSE for temperature,
+// informational exceptions and the error counters. Takes an open fd on the
+// device node. SATA disks behind a SAT layer (those with VPD page 89h) are
+// handed to sg_interrogate() instead, since ATA IDENTIFY tells us more.
+int scsi_interrogate(struct device *, int fd);
+
+// Read the temperature and informational exceptions log pages. Like
+// sg_smart_sample(), this takes no device, so it can be run without the lock.
+int scsi_smart_sample(const char *name, int fd, struct smart_sample *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
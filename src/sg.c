@@ -14,6 +14,7 @@
 #include <linux/hdreg.h>
 
 #include "sg.h"
+#include "smart.h"
 #include "sysfs.h"
 #include "growlight.h"
 
@@ -30,11 +31,20 @@
 // Mark Lord (mlord@pobox.com)
 static const int SG_ATA_16 = 0x85; // 16-byte ATA pass-though command
 #define SG_ATA_16_LEN	16
+static const int SG_ATA_PROTO_NON_DATA = 3;
 static const int SG_ATA_PROTO_PIO_IN = 4;
 #define SG_CHECK_CONDITION	0x02
 #define SG_DRIVER_SENSE		0x08
 #define START_SERIAL            10  // ASCII serial number
 #define LENGTH_SERIAL           20
+#define ADDL_SUPP               69  // additional supported
+#define ADDL_SUPP_DRAT          0x4000
+#define ADDL_SUPP_RZAT          0x0020
+#define QUEUE_DEPTH             75  // maximum queue depth - 1, bits 4:0
+#define SATA_CAP                76  // SATA capabilities
+#define SATA_CAP_NCQ            0x0100
+#define SATA_CAP_GENS           0x000e // bits 3:1: gen 1, 2, 3
+#define SATA_CAP_2              77  // bits 3:1: current negotiated speed
 #define CMDS_SUPP_0             82  // command/feature set(s) supported
 #define FEATURE_WRITE_CACHE     16  // use with CMDS_SUPP_1
 #define CMDS_SUPP_1             83
@@ -45,15 +55,25 @@ static const int SG_ATA_PROTO_PIO_IN = 4;
 #define CMDS_EN_1               86
 #define CMDS_EN_2               87
 #define CMDS_EN_3               120
+#define DSM_MAX_BLOCKS          105 // 512-byte blocks of DSM ranges
+#define SECTOR_SIZE             106 // physical/logical sector size
+#define SECTOR_SIZE_MULTI       0x2000 // multiple logical per physical
+#define SECTOR_SIZE_LONG        0x1000 // logical sector > 256 words
+#define LOGICAL_WORDS           117 // 117--118: logical sector in words
+#define DSM_SUPP                169 // data set management
+#define DSM_SUPP_TRIM           0x0001
+#define ALIGNMENT               209 // alignment of logical in physical
 #define TRANSPORT_MAJOR         222
 #define TRANSPORT_MINOR         223
 #define NMRR                    217
 #define WWN_SUP			0x100
+#define SMART_SUP		0x1 // use with CMDS_SUPP_0 / CMDS_EN_0
 
 enum {
         SG_CDB2_TLEN_NSECT      = 2 << 0,
         SG_CDB2_TLEN_SECTORS    = 1 << 2,
         SG_CDB2_TDIR_FROM_DEV   = 1 << 3,
+        SG_CDB2_CHECK_COND      = 1 << 5,
 };
 
 enum {
@@ -91,6 +111,314 @@ struct scsi_sg_io_hdr {
 };
 // Material taken from hdparm ends here
 
+// SMART subcommands and their LBA signature come from linux/hdreg.h. RETURN
+// STATUS (SMART_STATUS) replaces the signature with this upon threshold
+// exceedance.
+#define SMART_BAD_LBA_MID	0xf4
+#define SMART_BAD_LBA_HIGH	0x2c
+
+// SMART READ DATA / READ THRESHOLDS sector layouts (vendor-specific, but
+// every vendor uses these offsets)
+#define SMART_ATTRIBUTES	30
+#define SMART_ATTR_LEN		12
+#define SMART_ATTR_PREFAIL	0x1 // flags bit 0
+
+// Attributes we interpret
+#define SMART_ATTR_REALLOCATED	5
+#define SMART_ATTR_AIRFLOW_TEMP	190
+#define SMART_ATTR_TEMP		194
+#define SMART_ATTR_PENDING	197
+
+// Issue an ATA command via ATA PASS-THROUGH (16) on an already-open fd. If
+// buf is non-NULL, one sector is read into it (PIO-in). Otherwise the command
+// is non-data, and we ask for the ATA registers back in descriptor sense
+// data, copying the 14-byte ATA Status Return descriptor to regs. Returns -1
+// if the pass-through itself failed (the caller ought try another path), or
+// 0 on success.
+static int
+ata_cmd(const char *name, int fd, unsigned cmd, unsigned feature,
+		void *buf, unsigned char *regs){
+	unsigned char cdb[SG_ATA_16_LEN];
+	struct scsi_sg_io_hdr io;
+	unsigned char sb[32];
+
+	memset(cdb, 0, sizeof(cdb));
+	memset(sb, 0, sizeof(sb));
+	cdb[0] = SG_ATA_16;
+	cdb[4] = feature;
+	if(cmd == WIN_SMART){
+		cdb[10] = SMART_LCYL_PASS;
+		cdb[12] = SMART_HCYL_PASS;
+	}
+	cdb[13] = ATA_USING_LBA;
+	cdb[14] = cmd;
+	memset(&io, 0, sizeof(io));
+	io.interface_id = 'S';
+	io.mx_sb_len = sizeof(sb);
+	io.cmdp = cdb;
+	io.sbp = sb;
+	io.cmd_len = sizeof(cdb);
+	if(buf){
+		cdb[1] = SG_ATA_PROTO_PIO_IN << 1u;
+		cdb[2] = SG_CDB2_TLEN_NSECT | SG_CDB2_TLEN_SECTORS | SG_CDB2_TDIR_FROM_DEV;
+		cdb[6] = 1;
+		io.dxfer_direction = SG_DXFER_FROM_DEV;
+		io.dxfer_len = 512;
+		io.dxferp = buf;
+	}else{
+		cdb[1] = SG_ATA_PROTO_NON_DATA << 1u;
+		cdb[2] = SG_CDB2_CHECK_COND;
+		io.dxfer_direction = SG_DXFER_NONE;
+	}
+	if(ioctl(fd, SG_IO, &io)){
+		verbf("Couldn't issue ATA 0x%02x/0x%02x on %s (%s?)\n", cmd, feature, name, strerror(errno));
+		return -1;
+	}
+	if(io.host_status || (io.driver_status && io.driver_status != SG_DRIVER_SENSE)){
+		verbf("Bad ATA 0x%02x/0x%02x status 0x%x/0x%x on %s\n", cmd, feature,
+			io.host_status, io.driver_status, name);
+		return -1;
+	}
+	if(buf == NULL){
+		if(io.sb_len_wr < 8 + 14 || (sb[0] & 0x7f) != 0x72 || sb[8] != 0x09){
+			verbf("No ATA registers in 0x%02x/0x%02x sense on %s\n", cmd, feature, name);
+			return -1;
+		}
+		memcpy(regs, sb + 8, 14);
+		return 0;
+	}
+	if(io.status && io.status != SG_CHECK_CONDITION){
+		verbf("Bad ATA 0x%02x/0x%02x check condition 0x%x on %s\n", cmd, feature, io.status, name);
+		return -1;
+	}
+	return 0;
+}
+
+// SMART data structures end with a checksum byte, such that the sum of all
+// 512 bytes is 0 (mod 256).
+static int
+smart_checksum_ok(const unsigned char *sector){
+	unsigned char sum = 0;
+	unsigned z;
+
+	for(z = 0 ; z < 512 ; ++z){
+		sum += sector[z];
+	}
+	return sum == 0;
+}
+
+static unsigned
+log2_64(uint64_t v){
+	unsigned r = 0;
+
+	while(v >>= 1u){
+		++r;
+	}
+	return r;
+}
+
+// Derive the overall SMART verdict from RETURN STATUS and the attribute and
+// threshold sectors, following libatasmart's classification so that
+// verdicts don't change depending on which path produced them.
+static void
+smart_classify(const char *name, uint64_t size, const unsigned char *data,
+		const unsigned char *thresh, int bad, smart_sample *s){
+	int now = 0, past = 0, temp = -1, airtemp = -1;
+	uint64_t sectors = 0;
+	unsigned z;
+
+	for(z = 0 ; z < SMART_ATTRIBUTES ; ++z){
+		const unsigned char *a = data + 2 + z * SMART_ATTR_LEN;
+		const unsigned char *t = NULL;
+		uint64_t raw = 0;
+		unsigned y;
+
+		if(a[0] == 0){
+			continue;
+		}
+		for(y = 0 ; y < 6 ; ++y){
+			raw |= (uint64_t)a[5 + y] << (8u * y);
+		}
+		if(a[0] == SMART_ATTR_REALLOCATED || a[0] == SMART_ATTR_PENDING){
+			sectors += raw & 0xffffffffu;
+		}else if(a[0] == SMART_ATTR_TEMP){
+			temp = raw & 0xffffu;
+		}else if(a[0] == SMART_ATTR_AIRFLOW_TEMP){
+			airtemp = raw & 0xffffu;
+		}
+		// thresholds are listed in the same order as the attributes, but
+		// don't rely upon it
+		for(y = 0 ; y < SMART_ATTRIBUTES ; ++y){
+			t = thresh + 2 + y * SMART_ATTR_LEN;
+			if(t[0] == a[0]){
+				break;
+			}
+		}
+		if(y == SMART_ATTRIBUTES || t[1] == 0 || t[1] == 0xfe){
+			continue; // no threshold, or "always passing"
+		}
+		if(a[3] <= t[1] && ((a[1] | (a[2] << 8u)) & SMART_ATTR_PREFAIL)){
+			now = 1;
+		}
+		if(a[4] <= t[1]){
+			past = 1;
+		}
+	}
+	if(bad){
+		s->smart = SMART_BAD_STATUS;
+	}else if(sectors > log2_64(size / 512) * 1024ull){
+		s->smart = SMART_BAD_SECTOR_MANY;
+	}else if(now){
+		s->smart = SMART_BAD_ATTRIBUTE_NOW;
+	}else if(sectors){
+		s->smart = SMART_BAD_SECTOR;
+	}else if(past){
+		s->smart = SMART_BAD_ATTRIBUTE_IN_THE_PAST;
+	}else{
+		s->smart = SMART_GOOD;
+	}
+	if(temp >= 0 && temp < 200){
+		s->celsius = temp;
+	}else if(airtemp >= 0 && airtemp < 200){
+		s->celsius = airtemp;
+	}else{
+		s->celsius = -1;
+	}
+	verbf("Disk (%s) SMART status: %d (%ju bad sectors)\n", name,
+		s->smart, (uintmax_t)sectors);
+}
+
+int sg_smart_sample(const char *name, int fd, uint64_t size, smart_sample *s){
+	unsigned char data[512], thresh[512], regs[14];
+	int bad = 0;
+
+	if(ata_cmd(name, fd, WIN_SMART, SMART_READ_VALUES, data, NULL)){
+		return -1;
+	}
+	if(ata_cmd(name, fd, WIN_SMART, SMART_READ_THRESHOLDS, thresh, NULL)){
+		return -1;
+	}
+	if(!smart_checksum_ok(data) || !smart_checksum_ok(thresh)){
+		verbf("Bad SMART checksum on %s\n", name);
+		return -1;
+	}
+	// not all SATL implementations return registers; carry on without
+	if(ata_cmd(name, fd, WIN_SMART, SMART_STATUS, NULL, regs) == 0){
+		bad = (regs[9] == SMART_BAD_LBA_MID && regs[11] == SMART_BAD_LBA_HIGH);
+	}
+	smart_classify(name, size, data, thresh, bad, s);
+	return 0;
+}
+
+int sg_standby_p(const char *name, int fd){
+	unsigned char regs[14];
+
+	if(ata_cmd(name, fd, WIN_CHECKPOWERMODE1, 0, NULL, regs)){
+		return -1;
+	}
+	// the power mode is returned in the count register: 0x00 is standby,
+	// 0x40/0x41 are NV cache power modes (spindle down), 0x80 is idle, and
+	// 0xff is active or idle
+	return regs[5] == 0x00 || regs[5] == 0x40 || regs[5] == 0x41;
+}
+
+// Read SMART data and thresholds using the fd and IDENTIFY data from
+// sg_interrogate(). Returns -1 if the pass-through failed (e.g. behind a
+// USB bridge which doesn't implement it), in which case the libatasmart
+// path might yet succeed.
+static int
+sg_smart(device *d, int fd, const uint16_t *ident){
+	smart_sample s;
+
+	d->blkdev.smart = -1;
+	if(!(ident[CMDS_SUPP_0] & SMART_SUP)){
+		verbf("SMART is unavailable: %s\n", d->name);
+		return 0;
+	}
+	if(!(ident[CMDS_EN_0] & SMART_SUP)){
+		verbf("SMART is disabled: %s\n", d->name);
+		return 0;
+	}
+	if(sg_smart_sample(d->name, fd, d->size, &s)){
+		return -1;
+	}
+	d->blkdev.smart = s.smart;
+	if(s.celsius >= 0){
+		d->blkdev.celsius = s.celsius;
+	}
+	return 0;
+}
+
+// Words 106 and 209 are only valid with bit 14 set and bit 15 clear.
+static inline int
+ident_valid(uint16_t w){
+	return (w & 0xc000u) == 0x4000u;
+}
+
+// Pull out the capabilities relevant to performance and to the safety of
+// discards: TRIM and its read-after semantics, NCQ, the sector layout, and
+// the SATA link speed.
+static void
+sg_capabilities(device *d, const uint16_t *ident){
+	unsigned logsec = 512, physsec, gen;
+
+	d->blkdev.trim = !!(ident[DSM_SUPP] & DSM_SUPP_TRIM);
+	d->blkdev.trimblocks = d->blkdev.trim ? ident[DSM_MAX_BLOCKS] : 0;
+	// DRAT and RZAT are only meaningful with TRIM
+	d->blkdev.drat = d->blkdev.trim && (ident[ADDL_SUPP] & ADDL_SUPP_DRAT);
+	d->blkdev.rzat = d->blkdev.drat && (ident[ADDL_SUPP] & ADDL_SUPP_RZAT);
+	d->blkdev.ncq = 0;
+	d->blkdev.ncqdepth = 0;
+	d->blkdev.satacap = 0;
+	d->blkdev.satalink = 0;
+	// word 76 is all zeroes or all ones on PATA
+	if(ident[SATA_CAP] && ident[SATA_CAP] != 0xffffu){
+		if(ident[SATA_CAP] & SATA_CAP_NCQ){
+			d->blkdev.ncq = 1;
+			d->blkdev.ncqdepth = (ident[QUEUE_DEPTH] & 0x1fu) + 1;
+		}
+		for(gen = 3 ; gen ; --gen){
+			if(ident[SATA_CAP] & (1u << gen)){
+				d->blkdev.satacap = gen;
+				break;
+			}
+		}
+		gen = (ident[SATA_CAP_2] & SATA_CAP_GENS) >> 1u;
+		if(gen >= 1 && gen <= 3){
+			d->blkdev.satalink = gen;
+		}
+	}
+	d->blkdev.alignoff = 0;
+	if(ident_valid(ident[SECTOR_SIZE])){
+		if(ident[SECTOR_SIZE] & SECTOR_SIZE_LONG){
+			logsec = (ident[LOGICAL_WORDS] | ((unsigned)ident[LOGICAL_WORDS + 1] << 16u)) * 2;
+		}
+		physsec = logsec;
+		if(ident[SECTOR_SIZE] & SECTOR_SIZE_MULTI){
+			physsec <<= (ident[SECTOR_SIZE] & 0xfu);
+		}
+		if(ident_valid(ident[ALIGNMENT])){
+			d->blkdev.alignoff = (ident[ALIGNMENT] & 0x3fffu) * logsec;
+		}
+		// USB bridges in particular have been known to misreport these
+		if((d->logsec && logsec != d->logsec) || (d->physsec && physsec != d->physsec)){
+			diag("%s reports %u/%uB sectors, kernel uses %u/%uB\n", d->name,
+				logsec, physsec, d->logsec, d->physsec);
+		}
+		if(d->blkdev.alignoff){
+			diag("%s LBA 0 is %uB into its physical sector\n", d->name, d->blkdev.alignoff);
+		}
+	}
+	verbf("\t%s TRIM: %s (%u blocks/cmd)%s%s NCQ: %u\n", d->name,
+			d->blkdev.trim ? "yes" : "no", d->blkdev.trimblocks,
+			d->blkdev.drat ? " DRAT" : "", d->blkdev.rzat ? " RZAT" : "",
+			d->blkdev.ncqdepth);
+	if(sata_degraded_p(d)){
+		diag("%s negotiated %s, but supports %s\n", d->name,
+			sata_gen_str(d->blkdev.satalink), sata_gen_str(d->blkdev.satacap));
+	}
+}
+
 int sg_interrogate(device *d, int fd){
 #define IDSECTORS 1
 	unsigned char cdb[SG_ATA_16_LEN];
@@ -136,10 +464,12 @@ int sg_interrogate(device *d, int fd){
 	}
 	if(io.status && io.status != SG_CHECK_CONDITION){
 		verbf("Bad check condition 0x%x on %s\n", io.status, d->name);
+		probe_smart(d);
 		return 0; // FIXME
 	}
 	if(io.host_status){
 		verbf("Bad host status 0x%x on %s\n", io.host_status, d->name);
+		probe_smart(d);
 		return 0; // FIXME
 	}
 	maj = buf[TRANSPORT_MAJOR] >> 12u;
@@ -193,6 +523,10 @@ int sg_interrogate(device *d, int fd){
 	verbf("\t%s read-write-verify: %s\n", d->name,
 			d->blkdev.rwverify == RWVERIFY_UNSUPPORTED ? "Not present" :
 			d->blkdev.rwverify == RWVERIFY_SUPPORTED_OFF ? "Disabled" : "Enabled");
+	sg_capabilities(d, buf);
+	if(sg_smart(d, fd, buf)){
+		probe_smart(d);
+	}
 	for(n = START_SERIAL ; n < START_SERIAL + LENGTH_SERIAL ; ++n){
 		buf[n] = ntohs(buf[n]);
 	}
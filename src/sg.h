@@ -7,12 +7,25 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 
 struct device;
+struct smart_sample;
 
 // Takes an open file descriptor on the device node
 int sg_interrogate(struct device *, int);
 
+// Read ATA SMART data, thresholds and status from the open fd into the
+// sample. size (in bytes) scales the "many bad sectors" threshold. These
+// take no device, so that they can be run without holding the lock. Returns
+// -1 if the pass-through failed.
+int sg_smart_sample(const char *name, int fd, uint64_t size, struct smart_sample *);
+
+// Issue ATA CHECK POWER MODE. Returns 1 if the device is spun down, 0 if it
+// is active or idle, or -1 if the power mode couldn't be determined. Unlike
+// SMART READ DATA, this never spins up a sleeping disk.
+int sg_standby_p(const char *name, int fd);
+
 // Take the incoming serial number and trim leading, repeated, or trailing
 // whitespace. The serial number may or may not be NUL-terminated (don't blame
 // me; it's how the ioctls work). A NUL-terminator must be respected, but if
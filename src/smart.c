@@ -6,11 +6,20 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <version.h>
+#ifdef USE_LIBATASMART
 #include <atasmart.h>
+#endif
 
 #include "smart.h"
 #include "growlight.h"
 
+#ifndef USE_LIBATASMART
+int probe_smart(device *d){
+	verbf("Built without libatasmart; can't probe %s SMART\n", d->name);
+	return -1;
+}
+#else
 int probe_smart(device *d){
 	char path[PATH_MAX];
 	SkBool avail, good;
@@ -51,9 +60,9 @@ int probe_smart(device *d){
 
 		if(sk_disk_smart_get_overall(sk, &overall)){
 			if(good){
-				d->blkdev.smart = SK_SMART_OVERALL_GOOD;
+				d->blkdev.smart = SMART_GOOD;
 			}else{
-				d->blkdev.smart = SK_SMART_OVERALL_BAD_STATUS;
+				d->blkdev.smart = SMART_BAD_STATUS;
 			}
 		}else{
 			d->blkdev.smart = overall;
@@ -67,3 +76,4 @@ int probe_smart(device *d){
 	sk_disk_free(sk);
 	return 0;
 }
+#endif
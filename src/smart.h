@@ -8,6 +8,26 @@ extern "C" {
 
 struct device;
 
+// Overall SMART verdicts, as stored in blkdev.smart. These share the values
+// (and semantics) of libatasmart's SkSmartOverall.
+typedef enum {
+	SMART_GOOD,
+	SMART_BAD_ATTRIBUTE_IN_THE_PAST,
+	SMART_BAD_SECTOR,
+	SMART_BAD_ATTRIBUTE_NOW,
+	SMART_BAD_SECTOR_MANY,
+	SMART_BAD_STATUS,
+} smart_status;
+
+// One reading of a device's SMART verdict and temperature.
+typedef struct smart_sample {
+	int smart;	// smart_status, or -1 if unavailable
+	int celsius;	// -1 if unavailable
+} smart_sample;
+
+// ATA SMART is normally read natively by sg_interrogate(). This libatasmart
+// path, which opens the device anew and reissues IDENTIFY, is only used when
+// that fails. Returns -1 if libatasmart isn't available.
 int probe_smart(struct device *d);
 
 #ifdef __cplusplus
@@ -0,0 +1,416 @@
+// copyright 2012–2021 nick black
+#include <time.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sg.h"
+#include "nvme.h"
+#include "scsi.h"
+#include "smart.h"
+#include "stack.h"
+#include "smartpoll.h"
+#include "growlight.h"
+
+#define SMARTPOLL_THREADS 4
+
+// One per pollable device. Everything here is protected by plock. Since the
+// device can disappear whenever we don't hold the growlight lock, we keep a
+// copy of what the workers need, and look the device up anew by name when
+// applying a sample. c is only ever compared, never dereferenced.
+typedef struct pollent {
+	char name[NAME_MAX + 1];
+	const controller *c;
+	uint64_t size;		// bytes
+	unsigned nvme;		// NVMe, otherwise ATA or SCSI
+	unsigned scsi;		// SCSI LOG SENSE, otherwise ATA
+	unsigned rotational;	// check the power mode first
+	unsigned interval;	// seconds, 0 to disable
+	unsigned override;	// interval was set explicitly; keep it
+	unsigned present;	// eligible as of the last scheduling pass
+	unsigned seen;		// found during this scheduling pass
+	unsigned queued;	// due, awaiting a worker
+	unsigned running;	// a worker is talking to the device
+	struct timespec due;
+	struct pollent *next;
+} pollent;
+
+static pthread_mutex_t plock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pcond = PTHREAD_COND_INITIALIZER;
+static pthread_t scheduler;
+static pthread_t workers[SMARTPOLL_THREADS];
+static unsigned workercount;
+static unsigned scheduling;
+static unsigned stopping;
+static pollent *pollents;
+
+static pollent *
+find_pollent(const char *name){
+	pollent *p;
+
+	for(p = pollents ; p ; p = p->next){
+		if(strcmp(p->name, name) == 0){
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static pollent *
+create_pollent(const char *name){
+	pollent *p;
+
+	if(strlen(name) >= sizeof(p->name)){
+		diag("Name too long: %s\n", name);
+		return NULL;
+	}
+	if((p = malloc(sizeof(*p))) == NULL){
+		diag("Couldn't allocate poll entry (%s?)\n", strerror(errno));
+		return NULL;
+	}
+	memset(p, 0, sizeof(*p));
+	strcpy(p->name, name);
+	p->next = pollents;
+	pollents = p;
+	return p;
+}
+
+static int
+timespec_before(const struct timespec *a, const struct timespec *b){
+	return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+// Schedule the next poll interval seconds out, plus or minus the jitter.
+static void
+schedule_pollent(pollent *p, unsigned *seed){
+	const long long span = p->interval * 1000ll * SMARTPOLL_JITTER_PCT / 100;
+	long long ms = p->interval * 1000ll;
+
+	if(span){
+		ms += rand_r(seed) % (2 * span + 1) - span;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &p->due);
+	p->due.tv_sec += ms / 1000;
+	p->due.tv_nsec += (ms % 1000) * 1000000;
+	if(p->due.tv_nsec >= 1000000000){
+		p->due.tv_nsec -= 1000000000;
+		++p->due.tv_sec;
+	}
+}
+
+static int
+pollable_p(const device *d){
+	if(d->layout != LAYOUT_NONE || !d->blkdev.realdev || d->blkdev.image){
+		return 0;
+	}
+	if(d->blkdev.unloaded || d->blkdev.smart < 0){
+		return 0;
+	}
+	return d->c->transport == TRANSPORT_ATA || d->c->transport == TRANSPORT_NVME ||
+		ata_transport_p(d->blkdev.transport) || d->blkdev.transport == SERIAL_SAS;
+}
+
+// Bring the entries in line with the current set of devices. Lock order is
+// the growlight lock, then plock.
+static void
+refresh_pollents(unsigned *seed){
+	const controller *c;
+	pollent *p, **pp;
+	const device *d;
+
+	lock_growlight();
+	pthread_mutex_lock(&plock);
+	for(p = pollents ; p ; p = p->next){
+		p->seen = 0;
+	}
+	for(c = get_controllers() ; c ; c = c->next){
+		for(d = c->blockdevs ; d ; d = d->next){
+			if(!pollable_p(d)){
+				continue;
+			}
+			if((p = find_pollent(d->name)) == NULL){
+				if((p = create_pollent(d->name)) == NULL){
+					continue;
+				}
+			}
+			p->c = c;
+			p->size = d->size;
+			p->nvme = c->transport == TRANSPORT_NVME;
+			p->scsi = d->blkdev.transport == SERIAL_SAS;
+			// SCSI disks answer LOG SENSE without spinning up
+			p->rotational = !p->nvme && !p->scsi && d->blkdev.rotation != SSD_ROTATION;
+			if(!p->override){
+				p->interval = p->rotational ? SMARTPOLL_HDD_SECS : SMARTPOLL_SSD_SECS;
+			}
+			if(!p->present && !p->queued && !p->running){
+				// newly (re)discovered; the scan just read its values
+				schedule_pollent(p, seed);
+			}
+			p->present = 1;
+			p->seen = 1;
+		}
+	}
+	pp = &pollents;
+	while( (p = *pp) ){
+		if(!p->seen){
+			p->present = 0;
+		}
+		if(!p->present && !p->override && !p->queued && !p->running){
+			*pp = p->next;
+			free(p);
+		}else{
+			pp = &p->next;
+		}
+	}
+	pthread_mutex_unlock(&plock);
+	unlock_growlight();
+}
+
+// Take the I/O-free path back into the device table, invoking block_event
+// only if something changed.
+static void
+apply_sample(const char *name, const smart_sample *s, const nvme_health_log *h){
+	device *d;
+
+	lock_growlight();
+	if( (d = lookup_device(name)) ){
+		if(d->layout == LAYOUT_NONE && d->blkdev.smart >= 0){
+			int changed = 0, verdict = 0;
+
+			if(d->blkdev.smart != s->smart){
+				verbf("%s SMART status: %d -> %d\n", name, d->blkdev.smart, s->smart);
+				d->blkdev.smart = s->smart;
+				changed = verdict = 1;
+			}
+			if(s->celsius >= 0 && d->blkdev.celsius != (uint64_t)s->celsius){
+				d->blkdev.celsius = s->celsius;
+				changed = 1;
+			}
+			if(h && nvme_health_update(d, h)){
+				changed = 1;
+			}
+			if(changed){
+				const glightui *gui = get_glightui();
+
+				d->uistate = gui->block_event(d, d->uistate);
+			}
+			if(verdict){ // aggregates atop the disk reflect its health
+				stack_notify(d);
+			}
+		}
+	}
+	unlock_growlight();
+}
+
+static void
+poll_device(const pollent *p){
+	nvme_health_log h;
+	smart_sample s;
+	int fd, r;
+
+	if((fd = openat(devfd, p->name, O_RDONLY|O_NONBLOCK|O_CLOEXEC)) < 0){
+		verbf("Couldn't open %s for polling (%s?)\n", p->name, strerror(errno));
+		return;
+	}
+	if(p->nvme){
+		r = nvme_smart_sample(p->name, fd, &s, &h);
+	}else if(p->scsi){
+		r = scsi_smart_sample(p->name, fd, &s);
+	}else{
+		if(p->rotational){
+			// SMART READ DATA would spin the disk back up. If we can't
+			// learn the power mode, assume the worst.
+			if((r = sg_standby_p(p->name, fd)) != 0){
+				verbf("%s %s, not polling\n", p->name,
+					r > 0 ? "is in standby" : "power mode unknown");
+				close(fd);
+				return;
+			}
+		}
+		r = sg_smart_sample(p->name, fd, p->size, &s);
+	}
+	close(fd);
+	if(r == 0){
+		apply_sample(p->name, &s, p->nvme ? &h : NULL);
+	}
+}
+
+// A queued entry may be run if its controller isn't already at its limit.
+static pollent *
+next_job(void){
+	pollent *p, *q;
+
+	for(p = pollents ; p ; p = p->next){
+		unsigned inflight = 0;
+
+		if(!p->queued){
+			continue;
+		}
+		for(q = pollents ; q ; q = q->next){
+			if(q->running && q->c == p->c){
+				++inflight;
+			}
+		}
+		if(inflight < SMARTPOLL_PER_CONTROLLER){
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static void *
+poll_worker(void *vseed){
+	unsigned seed = (uintptr_t)vseed;
+	pollent *p, job;
+
+	pthread_mutex_lock(&plock);
+	while(!stopping){
+		if((p = next_job()) == NULL){
+			pthread_cond_wait(&pcond, &plock);
+			continue;
+		}
+		p->queued = 0;
+		p->running = 1;
+		job = *p; // p can't be freed while running is set
+		pthread_mutex_unlock(&plock);
+		poll_device(&job);
+		pthread_mutex_lock(&plock);
+		p->running = 0;
+		schedule_pollent(p, &seed);
+		pthread_cond_broadcast(&pcond);
+	}
+	pthread_mutex_unlock(&plock);
+	return NULL;
+}
+
+// Once a second, rediscover pollable devices and queue those which are due.
+static void *
+poll_scheduler(void *vseed){
+	unsigned seed = (uintptr_t)vseed;
+	struct timespec now, wake;
+	unsigned queued;
+	pollent *p;
+
+	pthread_mutex_lock(&plock);
+	while(!stopping){
+		pthread_mutex_unlock(&plock);
+		refresh_pollents(&seed);
+		pthread_mutex_lock(&plock);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		queued = 0;
+		for(p = pollents ; p ; p = p->next){
+			if(p->present && p->interval && !p->queued && !p->running
+					&& !timespec_before(&now, &p->due)){
+				p->queued = 1;
+				++queued;
+			}
+		}
+		if(queued){
+			pthread_cond_broadcast(&pcond);
+		}
+		wake = now;
+		++wake.tv_sec;
+		while(!stopping && pthread_cond_timedwait(&pcond, &plock, &wake) != ETIMEDOUT){
+			;
+		}
+	}
+	pthread_mutex_unlock(&plock);
+	return NULL;
+}
+
+int start_smart_poller(void){
+	pthread_condattr_t cattr;
+	unsigned seed;
+	int r;
+
+	seed = time(NULL) ^ getpid();
+	// the scheduler's timed waits are against CLOCK_MONOTONIC
+	if(pthread_condattr_init(&cattr) || pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC)){
+		diag("Couldn't prepare poller condvar\n");
+		return -1;
+	}
+	pthread_cond_destroy(&pcond);
+	r = pthread_cond_init(&pcond, &cattr);
+	pthread_condattr_destroy(&cattr);
+	if(r){
+		diag("Couldn't create poller condvar (%s?)\n", strerror(r));
+		return -1;
+	}
+	stopping = 0;
+	for(workercount = 0 ; workercount < SMARTPOLL_THREADS ; ++workercount){
+		if( (r = pthread_create(&workers[workercount], NULL, poll_worker,
+						(void *)(uintptr_t)rand_r(&seed))) ){
+			diag("Couldn't create poller thread (%s?)\n", strerror(r));
+			stop_smart_poller();
+			return -1;
+		}
+	}
+	if( (r = pthread_create(&scheduler, NULL, poll_scheduler, (void *)(uintptr_t)rand_r(&seed))) ){
+		diag("Couldn't create poll scheduler (%s?)\n", strerror(r));
+		stop_smart_poller();
+		return -1;
+	}
+	scheduling = 1;
+	return 0;
+}
+
+int stop_smart_poller(void){
+	pollent *p;
+	int r = 0;
+	int rr;
+
+	pthread_mutex_lock(&plock);
+	stopping = 1;
+	pthread_cond_broadcast(&pcond);
+	pthread_mutex_unlock(&plock);
+	if(scheduling){
+		if( (rr = pthread_join(scheduler, NULL)) ){
+			diag("Couldn't join poll scheduler (%s?)\n", strerror(rr));
+			r = -1;
+		}
+		scheduling = 0;
+	}
+	while(workercount){
+		if( (rr = pthread_join(workers[--workercount], NULL)) ){
+			diag("Couldn't join poller thread (%s?)\n", strerror(rr));
+			r = -1;
+		}
+	}
+	pthread_mutex_lock(&plock);
+	while( (p = pollents) ){
+		pollents = p->next;
+		free(p);
+	}
+	pthread_mutex_unlock(&plock);
+	return r;
+}
+
+int set_smart_poll_interval(const device *d, unsigned secs){
+	unsigned seed = time(NULL) ^ secs;
+	pollent *p;
+
+	if(!pollable_p(d)){
+		diag("%s can't be polled for SMART\n", d->name);
+		return -1;
+	}
+	pthread_mutex_lock(&plock);
+	if((p = find_pollent(d->name)) == NULL){
+		if((p = create_pollent(d->name)) == NULL){
+			pthread_mutex_unlock(&plock);
+			return -1;
+		}
+	}
+	p->override = 1;
+	p->interval = secs;
+	if(secs && !p->queued && !p->running){
+		schedule_pollent(p, &seed);
+	}
+	pthread_mutex_unlock(&plock);
+	return 0;
+}
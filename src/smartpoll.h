@@ -0,0 +1,43 @@
+// copyright 2012–2021 nick black
+#ifndef GROWLIGHT_SMARTPOLL
+#define GROWLIGHT_SMARTPOLL
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct device;
+
+// blkdev.smart and blkdev.celsius are otherwise only refreshed when a device
+// is rescanned. The poller rereads them in the background for each ATA, SAS
+// and NVMe disk with SMART support (for SAS, the informational exceptions
+// log page), every SMARTPOLL_SSD_SECS (NVMe and other
+// solid-state devices) or SMARTPOLL_HDD_SECS (rotating media) seconds, plus
+// or minus SMARTPOLL_JITTER_PCT percent so that an enclosure's worth of disks
+// doesn't get hit in lockstep. No more than SMARTPOLL_PER_CONTROLLER
+// commands are outstanding on any one controller. Rotating ATA disks are
+// first sent CHECK POWER MODE, and skipped if they've spun down (or if we
+// can't tell). block_event is only invoked when a value has changed.
+#define SMARTPOLL_SSD_SECS 30
+#define SMARTPOLL_HDD_SECS 60
+#define SMARTPOLL_JITTER_PCT 10
+#define SMARTPOLL_PER_CONTROLLER 1
+
+// Launch the poller's threads. Called by growlight_init().
+int start_smart_poller(void);
+
+// Stop and join the poller's threads. Must not be called while holding the
+// growlight lock.
+int stop_smart_poller(void);
+
+// Poll the device every secs seconds rather than the default. 0 disables
+// polling of the device. Fails for devices the poller would never poll
+// (partitions, aggregates, and those without SMART). Called with the lock
+// held.
+int set_smart_poll_interval(const struct device *d, unsigned secs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,734 @@
+// copyright 2012–2021 nick black
+#include <zlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "image.h"
+#include "ptable.h"
+#include "stack.h"
+#include "snapshot.h"
+#include "growlight.h"
+
+#define SNAPSHOT_MAGIC "GLPTSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_SUFFIX ".ptsnap"
+// The MBR, a 128-entry primary GPT (header plus 32 512-byte sectors of
+// entries, following the MBR), and the first 32 APM entries.
+#define LEAD_SECTORS 34
+// A 128-entry backup GPT (32 512-byte sectors of entries, then the header)
+#define TRAIL_SECTORS 33
+#define MAX_REGIONS 2
+#define IO_ALIGN 4096
+
+// On-disk format: a snaphdr, then each snapregion followed immediately by its
+// sectors, then the snapentries. All integers are host-endian; snapshots are
+// meant to be restored on the machine which took them.
+typedef struct __attribute__ ((packed)) snaphdr {
+	char magic[8];			// SNAPSHOT_MAGIC
+	uint32_t version;		// SNAPSHOT_VERSION
+	uint32_t logsec;		// Logical sector size in bytes
+	uint64_t size;			// Device size in bytes
+	uint64_t when;			// Seconds since the epoch
+	char pttable[16];		// Detected table type, empty if none
+	char devname[NAME_MAX + 1];
+	uint32_t regions;		// Number of snapregions
+	uint32_t entries;		// Number of snapentries
+	uint32_t crc;			// crc32 of everything after the header
+} snaphdr;
+
+typedef struct __attribute__ ((packed)) snapregion {
+	uint64_t lba;
+	uint64_t sectors;
+} snapregion;
+
+// A parsed partition, as growlight understood it at the time of capture
+typedef struct __attribute__ ((packed)) snapentry {
+	uint32_t pnumber;
+	uint32_t ptype;
+	uint64_t fsector, lsector;	// Inclusive, logical
+	uint64_t flags;
+	char uuid[GUIDSTRLEN + 1];
+	char pname[128];		// UTF-8
+} snapentry;
+
+typedef struct snapshot {
+	snaphdr hdr;
+	snapregion reg[MAX_REGIONS];
+	void *data[MAX_REGIONS];	// IO_ALIGN-aligned, for O_DIRECT
+	snapentry *ents;
+} snapshot;
+
+static char *snapdir;	// NULL for the default per-host store
+
+int set_snapshot_dir(const char *dir){
+	char *d = NULL;
+
+	if(dir && (d = strdup(dir)) == NULL){
+		return -1;
+	}
+	free(snapdir);
+	snapdir = d;
+	return 0;
+}
+
+static int
+mkdirp(char *path){
+	char *c;
+
+	for(c = path + 1 ; *c ; ++c){
+		if(*c == '/'){
+			*c = '\0';
+			if(mkdir(path, 0700) && errno != EEXIST){
+				diag("Couldn't create %s (%s?)\n", path, strerror(errno));
+				*c = '/';
+				return -1;
+			}
+			*c = '/';
+		}
+	}
+	if(mkdir(path, 0700) && errno != EEXIST){
+		diag("Couldn't create %s (%s?)\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Returns the (created, if necessary) store directory
+static char *
+store_dir(void){
+	char host[HOST_NAME_MAX + 1];
+	char *dir;
+
+	if(snapdir){
+		dir = strdup(snapdir);
+	}else{
+		if(gethostname(host, sizeof(host))){
+			diag("Couldn't get hostname (%s?)\n", strerror(errno));
+			return NULL;
+		}
+		host[sizeof(host) - 1] = '\0';
+		if((dir = malloc(strlen(SNAPSHOT_ROOT) + strlen(host) + 2)) == NULL){
+			return NULL;
+		}
+		sprintf(dir, "%s/%s", SNAPSHOT_ROOT, host);
+	}
+	if(dir && mkdirp(dir)){
+		free(dir);
+		return NULL;
+	}
+	return dir;
+}
+
+// Snapshots are keyed by the most persistent identifier we have
+static void
+snap_ident(const device *d, char *buf, size_t len){
+	const char *id = d->blkdev.serial ? d->blkdev.serial :
+			d->blkdev.wwn ? d->blkdev.wwn : d->name;
+	char *c;
+
+	snprintf(buf, len, "%s", id);
+	for(c = buf ; *c ; ++c){
+		if(*c == '/' || *c == ' ' || *c == '\t'){
+			*c = '_';
+		}
+	}
+}
+
+// Is name (sans directory) that of a snapshot of the device identified by
+// ident? The timestamp following the identifier has no '-', so that "sda"
+// doesn't claim the snapshots of "sda-1".
+static int
+snap_named_p(const char *name, const char *ident){
+	const size_t ilen = strlen(ident);
+	const size_t slen = strlen(SNAPSHOT_SUFFIX);
+	const size_t nlen = strlen(name);
+
+	if(nlen <= ilen + 1 + slen || strncmp(name, ident, ilen) || name[ilen] != '-'){
+		return 0;
+	}
+	if(strcmp(name + nlen - slen, SNAPSHOT_SUFFIX)){
+		return 0;
+	}
+	// the suffix's own '.' may extend the span, but nothing else can
+	return strspn(name + ilen + 1, "0123456789.") >= nlen - slen - ilen - 1;
+}
+
+static unsigned
+plan_regions(const device *d, snapregion *reg){
+	const uint64_t lbas = d->size / d->logsec;
+	unsigned r = 0;
+
+	reg[r].lba = 0;
+	reg[r].sectors = lbas < LEAD_SECTORS ? lbas : LEAD_SECTORS;
+	++r;
+	if(lbas > reg[0].sectors){
+		uint64_t trail = lbas - reg[0].sectors;
+
+		if(trail > TRAIL_SECTORS){
+			trail = TRAIL_SECTORS;
+		}
+		reg[r].lba = lbas - trail;
+		reg[r].sectors = trail;
+		++r;
+	}
+	return r;
+}
+
+static void
+free_snapshot(snapshot *s){
+	unsigned r;
+
+	for(r = 0 ; r < MAX_REGIONS ; ++r){
+		free(s->data[r]);
+	}
+	free(s->ents);
+	memset(s, 0, sizeof(*s));
+}
+
+// Read the regions described by reg[0..regions) from the device
+static int
+read_regions(const device *d, const snapregion *reg, unsigned regions,
+		unsigned logsec, void **data){
+	unsigned r;
+	int fd;
+
+	if((fd = open_blockdev(d, O_RDONLY|O_CLOEXEC|O_DIRECT)) < 0){
+		diag("Couldn't open %s (%s?)\n", d->name, strerror(errno));
+		return -1;
+	}
+	for(r = 0 ; r < regions ; ++r){
+		const size_t len = reg[r].sectors * logsec;
+		ssize_t got;
+
+		if(posix_memalign(&data[r], IO_ALIGN, len)){
+			diag("Couldn't allocate %zub\n", len);
+			close(fd);
+			return -1;
+		}
+		if((got = pread(fd, data[r], len, reg[r].lba * logsec)) != (ssize_t)len){
+			diag("Couldn't read %zub at LBA %ju from %s (%s?)\n", len,
+				(uintmax_t)reg[r].lba, d->name, got < 0 ? strerror(errno) : "short read");
+			close(fd);
+			return -1;
+		}
+	}
+	if(close(fd)){
+		diag("Couldn't close %s (%s?)\n", d->name, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int
+capture_snapshot(const device *d, snapshot *s){
+	const device *p;
+	unsigned e;
+
+	memset(s, 0, sizeof(*s));
+	if(d->layout != LAYOUT_NONE){
+		diag("Will only snapshot partition tables of raw block devices\n");
+		return -1;
+	}
+	if(d->logsec == 0 || d->size < d->logsec){
+		diag("Can't snapshot %s (%ju bytes, %uB sectors)\n", d->name, d->size, d->logsec);
+		return -1;
+	}
+	memcpy(s->hdr.magic, SNAPSHOT_MAGIC, sizeof(s->hdr.magic));
+	s->hdr.version = SNAPSHOT_VERSION;
+	s->hdr.logsec = d->logsec;
+	s->hdr.size = d->size;
+	s->hdr.when = time(NULL);
+	if(d->blkdev.pttable){
+		snprintf(s->hdr.pttable, sizeof(s->hdr.pttable), "%s", d->blkdev.pttable);
+	}
+	snprintf(s->hdr.devname, sizeof(s->hdr.devname), "%s", d->name);
+	s->hdr.regions = plan_regions(d, s->reg);
+	if(read_regions(d, s->reg, s->hdr.regions, d->logsec, s->data)){
+		free_snapshot(s);
+		return -1;
+	}
+	for(p = d->parts ; p ; p = p->next){
+		++s->hdr.entries;
+	}
+	if(s->hdr.entries && (s->ents = calloc(s->hdr.entries, sizeof(*s->ents))) == NULL){
+		free_snapshot(s);
+		return -1;
+	}
+	for(e = 0, p = d->parts ; p ; p = p->next, ++e){
+		snapentry *se = &s->ents[e];
+
+		se->pnumber = p->partdev.pnumber;
+		se->ptype = p->partdev.ptype;
+		se->fsector = p->partdev.fsector;
+		se->lsector = p->partdev.lsector;
+		se->flags = p->partdev.flags;
+		if(p->partdev.uuid){
+			snprintf(se->uuid, sizeof(se->uuid), "%s", p->partdev.uuid);
+		}
+		if(p->partdev.pname){
+			snprintf(se->pname, sizeof(se->pname), "%ls", p->partdev.pname);
+		}
+	}
+	return 0;
+}
+
+static uint32_t
+snapshot_crc(const snapshot *s){
+	uint32_t crc = crc32(0, Z_NULL, 0);
+	unsigned r;
+
+	for(r = 0 ; r < s->hdr.regions ; ++r){
+		crc = crc32(crc, (const void *)&s->reg[r], sizeof(s->reg[r]));
+		crc = crc32(crc, s->data[r], s->reg[r].sectors * s->hdr.logsec);
+	}
+	if(s->hdr.entries){
+		crc = crc32(crc, (const void *)s->ents, s->hdr.entries * sizeof(*s->ents));
+	}
+	return crc;
+}
+
+static int
+write_fully(int fd, const void *buf, size_t len){
+	while(len){
+		ssize_t w = write(fd, buf, len);
+
+		if(w < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		buf = (const char *)buf + w;
+		len -= w;
+	}
+	return 0;
+}
+
+// Write to a temporary file, and rename it into place once it's durable
+static int
+write_snapshot(snapshot *s, const char *path){
+	char tmp[PATH_MAX];
+	unsigned r;
+	int fd;
+
+	if(snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)){
+		diag("Path too long: %s\n", path);
+		return -1;
+	}
+	s->hdr.crc = snapshot_crc(s);
+	if((fd = open(tmp, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, S_IRUSR|S_IWUSR)) < 0){
+		diag("Couldn't create %s (%s?)\n", tmp, strerror(errno));
+		return -1;
+	}
+	if(write_fully(fd, &s->hdr, sizeof(s->hdr))){
+		goto err;
+	}
+	for(r = 0 ; r < s->hdr.regions ; ++r){
+		if(write_fully(fd, &s->reg[r], sizeof(s->reg[r]))){
+			goto err;
+		}
+		if(write_fully(fd, s->data[r], s->reg[r].sectors * s->hdr.logsec)){
+			goto err;
+		}
+	}
+	if(s->hdr.entries && write_fully(fd, s->ents, s->hdr.entries * sizeof(*s->ents))){
+		goto err;
+	}
+	if(fsync(fd)){
+		goto err;
+	}
+	if(close(fd)){
+		diag("Couldn't close %s (%s?)\n", tmp, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	if(rename(tmp, path)){
+		diag("Couldn't rename %s to %s (%s?)\n", tmp, path, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+
+err:
+	diag("Couldn't write %s (%s?)\n", tmp, strerror(errno));
+	close(fd);
+	unlink(tmp);
+	return -1;
+}
+
+// Read and verify the snapshot at path in its entirety
+static int
+load_snapshot(const char *path, snapshot *s){
+	unsigned char *buf = NULL, *cur;
+	struct stat st;
+	size_t left;
+	unsigned r;
+	int fd;
+
+	memset(s, 0, sizeof(*s));
+	if((fd = open(path, O_RDONLY|O_CLOEXEC)) < 0){
+		diag("Couldn't open %s (%s?)\n", path, strerror(errno));
+		return -1;
+	}
+	if(fstat(fd, &st) || (size_t)st.st_size < sizeof(s->hdr)){
+		diag("Invalid snapshot %s\n", path);
+		close(fd);
+		return -1;
+	}
+	left = st.st_size;
+	if((buf = malloc(left)) == NULL || read(fd, buf, left) != (ssize_t)left){
+		diag("Couldn't read %s (%s?)\n", path, strerror(errno));
+		free(buf);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	cur = buf;
+	memcpy(&s->hdr, cur, sizeof(s->hdr));
+	cur += sizeof(s->hdr);
+	left -= sizeof(s->hdr);
+	if(memcmp(s->hdr.magic, SNAPSHOT_MAGIC, sizeof(s->hdr.magic)) ||
+			s->hdr.version != SNAPSHOT_VERSION){
+		diag("%s is not a growlight snapshot\n", path);
+		goto err;
+	}
+	if(s->hdr.regions == 0 || s->hdr.regions > MAX_REGIONS || s->hdr.logsec == 0){
+		diag("Invalid snapshot geometry in %s\n", path);
+		goto err;
+	}
+	for(r = 0 ; r < s->hdr.regions ; ++r){
+		size_t len;
+
+		if(left < sizeof(s->reg[r])){
+			goto trunc;
+		}
+		memcpy(&s->reg[r], cur, sizeof(s->reg[r]));
+		cur += sizeof(s->reg[r]);
+		left -= sizeof(s->reg[r]);
+		if(s->reg[r].sectors > LEAD_SECTORS ||
+				(s->reg[r].lba + s->reg[r].sectors) * s->hdr.logsec > s->hdr.size){
+			diag("Invalid region in %s\n", path);
+			goto err;
+		}
+		len = s->reg[r].sectors * s->hdr.logsec;
+		if(left < len){
+			goto trunc;
+		}
+		if(posix_memalign(&s->data[r], IO_ALIGN, len)){
+			goto err;
+		}
+		memcpy(s->data[r], cur, len);
+		cur += len;
+		left -= len;
+	}
+	if(left != s->hdr.entries * sizeof(*s->ents)){
+		goto trunc;
+	}
+	if(s->hdr.entries){
+		if((s->ents = malloc(left)) == NULL){
+			goto err;
+		}
+		memcpy(s->ents, cur, left);
+	}
+	if(snapshot_crc(s) != s->hdr.crc){
+		diag("Checksum mismatch in %s\n", path);
+		goto err;
+	}
+	free(buf);
+	return 0;
+
+trunc:
+	diag("Truncated snapshot %s\n", path);
+err:
+	free(buf);
+	free_snapshot(s);
+	return -1;
+}
+
+char *snapshot_ptable(const device *d){
+	char ident[NAME_MAX + 1];
+	struct timespec ts;
+	char *dir, *path;
+	snapshot s;
+	int len;
+
+	if(capture_snapshot(d, &s)){
+		return NULL;
+	}
+	if((dir = store_dir()) == NULL){
+		free_snapshot(&s);
+		return NULL;
+	}
+	snap_ident(d, ident, sizeof(ident));
+	clock_gettime(CLOCK_REALTIME, &ts);
+	len = snprintf(NULL, 0, "%s/%s-%012jd.%09ld%s", dir, ident,
+			(intmax_t)ts.tv_sec, ts.tv_nsec, SNAPSHOT_SUFFIX);
+	if((path = malloc(len + 1)) == NULL){
+		free(dir);
+		free_snapshot(&s);
+		return NULL;
+	}
+	sprintf(path, "%s/%s-%012jd.%09ld%s", dir, ident,
+			(intmax_t)ts.tv_sec, ts.tv_nsec, SNAPSHOT_SUFFIX);
+	free(dir);
+	if(write_snapshot(&s, path)){
+		free(path);
+		free_snapshot(&s);
+		return NULL;
+	}
+	verbf("Saved %s partitioning (%u entries) to %s\n", d->name, s.hdr.entries, path);
+	free_snapshot(&s);
+	return path;
+}
+
+int snapshot_before_wipe(const device *d){
+	char *path;
+
+	if((path = snapshot_ptable(d)) == NULL){
+		diag("Couldn't snapshot %s; not wiping\n", d->name);
+		return -1;
+	}
+	diag("Saved %s partitioning to %s\n", d->name, path);
+	free(path);
+	return 0;
+}
+
+char *latest_ptable_snapshot(const device *d){
+	char ident[NAME_MAX + 1];
+	char *dir, *best = NULL;
+	const struct dirent *de;
+	char *path;
+	DIR *dp;
+
+	if((dir = store_dir()) == NULL){
+		return NULL;
+	}
+	if((dp = opendir(dir)) == NULL){
+		diag("Couldn't open %s (%s?)\n", dir, strerror(errno));
+		free(dir);
+		return NULL;
+	}
+	snap_ident(d, ident, sizeof(ident));
+	// timestamps are zero-padded, so the lexicographic maximum is the latest
+	while( (de = readdir(dp)) ){
+		if(!snap_named_p(de->d_name, ident)){
+			continue;
+		}
+		if(best == NULL || strcmp(de->d_name, best) > 0){
+			char *tmp;
+
+			if((tmp = strdup(de->d_name)) == NULL){
+				break;
+			}
+			free(best);
+			best = tmp;
+		}
+	}
+	closedir(dp);
+	if(best == NULL){
+		diag("No snapshots for %s in %s\n", d->name, dir);
+		free(dir);
+		return NULL;
+	}
+	if((path = malloc(strlen(dir) + strlen(best) + 2)) ){
+		sprintf(path, "%s/%s", dir, best);
+	}
+	free(best);
+	free(dir);
+	return path;
+}
+
+// Report runs of differing sectors within a region
+static int
+diff_region(const device *d, const snapregion *reg, unsigned logsec,
+		const void *was, const void *is){
+	uint64_t s, run = 0;
+	int diffs = 0;
+
+	for(s = 0 ; s <= reg->sectors ; ++s){
+		if(s < reg->sectors && memcmp((const char *)was + s * logsec,
+					(const char *)is + s * logsec, logsec)){
+			++run;
+			continue;
+		}
+		if(run){
+			diag("%s: LBAs %ju-%ju differ from snapshot\n", d->name,
+				(uintmax_t)(reg->lba + s - run), (uintmax_t)(reg->lba + s - 1));
+			++diffs;
+			run = 0;
+		}
+	}
+	return diffs;
+}
+
+static int
+diff_entries(const device *d, const snapshot *s){
+	const device *p;
+	int diffs = 0;
+	unsigned e;
+
+	for(e = 0 ; e < s->hdr.entries ; ++e){
+		const snapentry *se = &s->ents[e];
+
+		for(p = d->parts ; p ; p = p->next){
+			if(p->partdev.pnumber == se->pnumber){
+				break;
+			}
+		}
+		if(p == NULL){
+			diag("%s: partition %u (%ju-%ju) is gone\n", d->name, se->pnumber,
+				(uintmax_t)se->fsector, (uintmax_t)se->lsector);
+			++diffs;
+		}else if(p->partdev.fsector != se->fsector || p->partdev.lsector != se->lsector ||
+				p->partdev.ptype != se->ptype || p->partdev.flags != se->flags){
+			diag("%s: partition %u was %ju-%ju 0x%04x, is %ju-%ju 0x%04x\n", d->name,
+				se->pnumber, (uintmax_t)se->fsector, (uintmax_t)se->lsector, se->ptype,
+				(uintmax_t)p->partdev.fsector, (uintmax_t)p->partdev.lsector,
+				p->partdev.ptype);
+			++diffs;
+		}
+	}
+	for(p = d->parts ; p ; p = p->next){
+		for(e = 0 ; e < s->hdr.entries ; ++e){
+			if(s->ents[e].pnumber == p->partdev.pnumber){
+				break;
+			}
+		}
+		if(e == s->hdr.entries){
+			diag("%s: partition %u (%ju-%ju) is new\n", d->name, p->partdev.pnumber,
+				(uintmax_t)p->partdev.fsector, (uintmax_t)p->partdev.lsector);
+			++diffs;
+		}
+	}
+	return diffs;
+}
+
+int diff_ptable_snapshot(const device *d, const char *path){
+	void *cur[MAX_REGIONS] = { NULL, NULL };
+	snapshot s;
+	unsigned r;
+	int diffs;
+
+	if(load_snapshot(path, &s)){
+		return -1;
+	}
+	if(s.hdr.logsec != d->logsec || s.hdr.size != d->size){
+		diag("%s: geometry changed (%ju/%uB then, %ju/%uB now)\n", d->name,
+			(uintmax_t)s.hdr.size, s.hdr.logsec, d->size, d->logsec);
+		free_snapshot(&s);
+		return -1;
+	}
+	if(read_regions(d, s.reg, s.hdr.regions, s.hdr.logsec, cur)){
+		for(r = 0 ; r < MAX_REGIONS ; ++r){
+			free(cur[r]);
+		}
+		free_snapshot(&s);
+		return -1;
+	}
+	diffs = 0;
+	for(r = 0 ; r < s.hdr.regions ; ++r){
+		diffs += diff_region(d, &s.reg[r], s.hdr.logsec, s.data[r], cur[r]);
+		free(cur[r]);
+	}
+	diffs += diff_entries(d, &s);
+	if(strcmp(s.hdr.pttable, d->blkdev.pttable ? d->blkdev.pttable : "")){
+		diag("%s: table type was %s, is %s\n", d->name,
+			*s.hdr.pttable ? s.hdr.pttable : "none",
+			d->blkdev.pttable ? d->blkdev.pttable : "none");
+		++diffs;
+	}
+	free_snapshot(&s);
+	return diffs;
+}
+
+int restore_ptable_snapshot(device *d, const char *path, int force){
+	char ident[NAME_MAX + 1];
+	const char *base;
+	const device *p;
+	char *undo;
+	snapshot s;
+	int fd, r;
+
+	if(d->layout != LAYOUT_NONE){
+		diag("Will only restore partition tables of raw block devices\n");
+		return -1;
+	}
+	if(d->mnt.count){
+		diag("%s is mounted on %s; not restoring\n", d->name, d->mnt.list[0]);
+		return -1;
+	}
+	if(d->holders){
+		diag("%s is in use by %s; not restoring\n", d->name, d->holders->holder->name);
+		return -1;
+	}
+	for(p = d->parts ; p ; p = p->next){
+		if(p->mnt.count){
+			diag("%s is mounted on %s; not restoring\n", p->name, p->mnt.list[0]);
+			return -1;
+		}
+		if(p->holders){
+			diag("%s is in use by %s; not restoring\n", p->name, p->holders->holder->name);
+			return -1;
+		}
+	}
+	// identical disks share a geometry, so only the name tells them apart
+	snap_ident(d, ident, sizeof(ident));
+	base = (base = strrchr(path, '/')) ? base + 1 : path;
+	if(!snap_named_p(base, ident) && !force){
+		diag("%s isn't a snapshot of %s (%s); not restoring without force\n",
+			path, d->name, ident);
+		return -1;
+	}
+	if(load_snapshot(path, &s)){
+		return -1;
+	}
+	if(s.hdr.logsec != d->logsec || s.hdr.size != d->size){
+		diag("Snapshot %s geometry (%ju/%uB) doesn't match %s (%ju/%uB)\n", path,
+			(uintmax_t)s.hdr.size, s.hdr.logsec, d->name, d->size, d->logsec);
+		free_snapshot(&s);
+		return -1;
+	}
+	if((undo = snapshot_ptable(d)) == NULL){
+		diag("Couldn't snapshot %s; not restoring\n", d->name);
+		free_snapshot(&s);
+		return -1;
+	}
+	diag("Saved current %s partitioning to %s\n", d->name, undo);
+	free(undo);
+	if((fd = open_blockdev(d, O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
+		diag("Couldn't open %s (%s?)\n", d->name, strerror(errno));
+		free_snapshot(&s);
+		return -1;
+	}
+	// Backup metadata first, so that an interruption leaves the primary
+	// intact (or entirely restored) for parsers which look there first.
+	for(r = s.hdr.regions - 1 ; r >= 0 ; --r){
+		const size_t len = s.reg[r].sectors * s.hdr.logsec;
+
+		if(pwrite(fd, s.data[r], len, s.reg[r].lba * s.hdr.logsec) != (ssize_t)len){
+			diag("Couldn't write %zub at LBA %ju on %s (%s?)\n", len,
+				(uintmax_t)s.reg[r].lba, d->name, strerror(errno));
+			close(fd);
+			free_snapshot(&s);
+			return -1;
+		}
+		if(fdatasync(fd)){
+			diag("Couldn't sync %s (%s?)\n", d->name, strerror(errno));
+			close(fd);
+			free_snapshot(&s);
+			return -1;
+		}
+	}
+	free_snapshot(&s);
+	if(close(fd)){
+		diag("Couldn't close %s (%s?)\n", d->name, strerror(errno));
+		return -1;
+	}
+	return rescan_blockdev_blkrrpart(d);
+}
@@ -0,0 +1,51 @@
+// copyright 2012–2021 nick black
+#ifndef GROWLIGHT_SNAPSHOT
+#define GROWLIGHT_SNAPSHOT
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct device;
+
+// Partition table snapshots capture the leading sectors of a block device
+// (MBR, primary GPT, APM), its trailing sectors (backup GPT), and the parsed
+// partition entries. They're kept in a per-host store, by default
+// SNAPSHOT_ROOT/<hostname>/, named for the device's serial number (falling
+// back to its WWN, and then its name) and the time of capture.
+#define SNAPSHOT_ROOT "/var/lib/growlight/ptables"
+
+// Use dir (which will be created if necessary) rather than the default
+// per-host store. Pass NULL to restore the default.
+int set_snapshot_dir(const char *);
+
+// Take a snapshot of the partitioning metadata. Returns the heap-allocated
+// path of the new snapshot, or NULL on error.
+char *snapshot_ptable(const struct device *);
+
+// Take a snapshot ahead of a destructive operation. Returns non-zero if one
+// couldn't be taken, in which case the operation ought be abandoned.
+int snapshot_before_wipe(const struct device *);
+
+// Returns the heap-allocated path of the device's most recent snapshot, or
+// NULL if there are none.
+char *latest_ptable_snapshot(const struct device *);
+
+// Compare the snapshot at path against the device's current metadata,
+// reporting differences via diag(). Returns the number of differing sector
+// runs and partition entries, or -1 on error.
+int diff_ptable_snapshot(const struct device *, const char *);
+
+// Verify the snapshot at path in its entirety, write it back to the device
+// (trailing sectors first, so the primary metadata lands last), and rescan
+// once. The current metadata is itself snapshotted beforehand, so a restore
+// can be undone. A snapshot named for some other device is refused unless
+// force is non-zero; a device in use (mounted, or held by an aggregate) is
+// refused regardless.
+int restore_ptable_snapshot(struct device *, const char *, int force);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
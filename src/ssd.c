@@ -3,6 +3,73 @@
 #include "popen.h"
 #include "growlight.h"
 
+static discard_e
+blkdev_discard_state(const device *d){
+	// ATA IDENTIFY and SCSI VPD page B2h fill in the trim bits
+	if(!d->blkdev.realdev || !(ata_transport_p(d->blkdev.transport) ||
+				d->blkdev.transport == SERIAL_SAS)){
+		return DISCARD_UNKNOWN;
+	}
+	if(!d->blkdev.trim){
+		return DISCARD_NONE;
+	}
+	return d->blkdev.rzat ? DISCARD_ZEROES :
+		d->blkdev.drat ? DISCARD_DETERMINISTIC : DISCARD_NONDET;
+}
+
+discard_e discard_state(const device *d){
+	const mdslave *s;
+	discard_e least;
+
+	switch(d->layout){
+		case LAYOUT_NONE:
+			return blkdev_discard_state(d);
+		case LAYOUT_PARTITION:
+			return d->partdev.parent ? discard_state(d->partdev.parent) : DISCARD_UNKNOWN;
+		case LAYOUT_MDADM:
+			s = d->mddev.slaves;
+			break;
+		case LAYOUT_DM:
+			s = d->dmdev.slaves;
+			break;
+		default:
+			return DISCARD_UNKNOWN;
+	}
+	least = DISCARD_UNKNOWN;
+	for( ; s ; s = s->next){
+		const device *c;
+		discard_e ds;
+
+		if((c = lookup_device(s->name)) == NULL){
+			return DISCARD_UNKNOWN;
+		}
+		// one member we know nothing about spoils the aggregate
+		if((ds = discard_state(c)) == DISCARD_UNKNOWN){
+			return DISCARD_UNKNOWN;
+		}
+		if(least == DISCARD_UNKNOWN || ds < least){
+			least = ds;
+		}
+	}
+	return least;
+}
+
+const char *discard_str(discard_e ds){
+	return ds == DISCARD_NONE ? "unsupported" :
+		ds == DISCARD_NONDET ? "nondeterministic" :
+		ds == DISCARD_DETERMINISTIC ? "deterministic" :
+		ds == DISCARD_ZEROES ? "zeroes" : "unknown";
+}
+
+int discard_safe_p(const device *d, int parity){
+	discard_e ds = discard_state(d);
+
+	if(ds == DISCARD_UNKNOWN){ // leave it to the kernel
+		return !parity;
+	}
+	return parity ? ds == DISCARD_ZEROES : ds != DISCARD_NONE;
+}
+
 int fstrim(const char *mnt){
 	return vspopen_drain("fstrim -v %s",mnt);
 }
@@ -15,8 +82,12 @@ int fstrim_dev(device *d){
 		diag("No filesystem on %s\n",d->name);
 		return -1;
 	}
-	if(d->mnt.count){
-		diag("%s is in use (%ux) and cannot be wiped\n",d->name,d->mnt.count);
+	if(!d->mnt.count){
+		diag("%s is not mounted, and cannot be trimmed\n",d->name);
+		return -1;
+	}
+	if(!discard_safe_p(d, 0)){
+		diag("%s doesn't support discard (%s)\n",d->name,discard_str(discard_state(d)));
 		return -1;
 	}
 	ret = 0;
@@ -8,10 +8,31 @@ extern "C" {
 
 struct device;
 
+// What a disk does with discarded (TRIMmed) blocks, per ATA IDENTIFY or, for
+// SAS disks, the logical block provisioning VPD page.
+typedef enum {
+	DISCARD_UNKNOWN,	// neither ATA nor SAS, or not interrogated
+	DISCARD_NONE,		// TRIM is unsupported
+	DISCARD_NONDET,		// reads after TRIM can return anything
+	DISCARD_DETERMINISTIC,	// reads after TRIM are stable (DRAT)
+	DISCARD_ZEROES,		// reads after TRIM return zeroes (RZAT)
+} discard_e;
+
+// Partitions are resolved to their disk. For md and dm devices, the least
+// capable component is returned.
+discard_e discard_state(const struct device *);
+
+const char *discard_str(discard_e);
+
+// Parity RAID recomputes parity from whatever discarded blocks read back as,
+// so it's only safe to pass discards through to members which return zeroes.
+// Everything else is safe provided TRIM is supported at all.
+int discard_safe_p(const struct device *, int parity);
+
 // Run the fstrim(8) command on a mounted filesystem
 int fstrim(const char *);
 
-// Run fstrim() on all a device's mounts.
+// Run fstrim() on all a device's mounts, provided discard_safe_p().
 int fstrim_dev(struct device *);
 
 #ifdef __cplusplus
@@ -0,0 +1,393 @@
+// copyright 2012–2021 nick black
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "zfs.h"
+#include "smart.h"
+#include "stack.h"
+#include "growlight.h"
+
+static int
+stack_linked_p(const device *holder,const device *member){
+	const stackedge *e;
+
+	for(e = holder->members ; e ; e = e->mnext){
+		if(e->member == member){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int stack_link(device *holder,device *member){
+	stackedge *e;
+
+	if(holder == member || stack_linked_p(holder,member)){
+		return 0;
+	}
+	if((e = malloc(sizeof(*e))) == NULL){
+		diag("Couldn't link %s atop %s (%s)\n",holder->name,member->name,strerror(errno));
+		return -1;
+	}
+	e->holder = holder;
+	e->member = member;
+	e->idle = 0;
+	if( (e->hnext = member->holders) ){
+		e->hnext->hprev = &e->hnext;
+	}
+	e->hprev = &member->holders;
+	member->holders = e;
+	if( (e->mnext = holder->members) ){
+		e->mnext->mprev = &e->mnext;
+	}
+	e->mprev = &holder->members;
+	holder->members = e;
+	verbf("\t%s is stacked atop %s\n",holder->name,member->name);
+	return 0;
+}
+
+static void
+stack_unlink(stackedge *e){
+	if(e->holder->hotmember == e->member){
+		e->holder->hotmember = NULL;
+	}
+	if( (*e->hprev = e->hnext) ){
+		e->hnext->hprev = e->hprev;
+	}
+	if( (*e->mprev = e->mnext) ){
+		e->mnext->mprev = e->mprev;
+	}
+	free(e);
+}
+
+// Link d with each extant device named in its sysfs slaves/ (holders != 0)
+// or holders/ directory.
+static int
+stack_attach_dir(device *d,const char *dname,int holders){
+	char path[PATH_MAX];
+	struct dirent *dire;
+	DIR *dir;
+	int fd,r;
+
+	if(snprintf(path,sizeof(path),"%s/%s",d->name,dname) >= (int)sizeof(path)){
+		diag("Name too long: %s\n",d->name);
+		return -1;
+	}
+	if((fd = openat(sysfd,path,O_RDONLY|O_CLOEXEC|O_DIRECTORY)) < 0){
+		return 0; // zpools, images and older kernels have no such thing
+	}
+	if((dir = fdopendir(fd)) == NULL){
+		diag("Couldn't get DIR * from fd %d for %s (%s)\n",fd,path,strerror(errno));
+		close(fd);
+		return -1;
+	}
+	r = 0;
+	while(errno = 0, (dire = readdir(dir)) != NULL){
+		device *other;
+
+		if(dire->d_type != DT_LNK){
+			continue;
+		}
+		if((other = find_device(dire->d_name)) == NULL){
+			continue; // it'll link itself to us when it arrives
+		}
+		r |= holders ? stack_link(d,other) : stack_link(other,d);
+	}
+	if(errno){
+		diag("Error reading %s (%s)\n",path,strerror(errno));
+		r = -1;
+	}
+	closedir(dir);
+	return r;
+}
+
+int stack_attach(device *d){
+	device *p;
+	int r;
+
+	r = stack_attach_dir(d,"slaves",1);
+	r |= stack_attach_dir(d,"holders",0);
+	for(p = d->parts ; p ; p = p->next){
+		r |= stack_attach_dir(p,"holders",0);
+	}
+	r |= zpool_attach(d,get_controllers());
+	return r;
+}
+
+void stack_detach(device *d){
+	while(d->holders){
+		stack_unlink(d->holders);
+	}
+	while(d->members){
+		stack_unlink(d->members);
+	}
+}
+
+static void
+stack_notify_inner(device *d,unsigned depth){
+	const glightui *gui = get_glightui();
+	stackedge *e;
+
+	if(depth > STACK_MAX_DEPTH){
+		diag("Stack above %s is too deep\n",d->name);
+		return;
+	}
+	if(d->layout == LAYOUT_NONE){
+		device *p;
+
+		for(p = d->parts ; p ; p = p->next){
+			stack_notify_inner(p,depth + 1);
+		}
+	}
+	for(e = d->holders ; e ; e = e->hnext){
+		e->holder->uistate = gui->block_event(e->holder,e->holder->uistate);
+		stack_notify_inner(e->holder,depth + 1);
+	}
+}
+
+void stack_notify(device *d){
+	stack_notify_inner(d,0);
+}
+
+static int
+stack_walk_inner(const device *d,unsigned depth,
+		int (*fxn)(const device *,void *),void *curry){
+	const stackedge *e;
+	int r;
+
+	if(depth > STACK_MAX_DEPTH){ // no diag(); UIs call us while drawing
+		return -1;
+	}
+	if(d->layout == LAYOUT_PARTITION && d->partdev.parent){
+		if( (r = fxn(d->partdev.parent,curry)) ){
+			return r;
+		}
+		return stack_walk_inner(d->partdev.parent,depth + 1,fxn,curry);
+	}
+	for(e = d->members ; e ; e = e->mnext){
+		if( (r = fxn(e->member,curry)) ){
+			return r;
+		}
+		if( (r = stack_walk_inner(e->member,depth + 1,fxn,curry)) ){
+			return r;
+		}
+	}
+	return 0;
+}
+
+int stack_walk(const device *d,int (*fxn)(const device *,void *),void *curry){
+	return stack_walk_inner(d,0,fxn,curry);
+}
+
+static unsigned
+device_problems(const device *d){
+	unsigned p = 0;
+
+	if(d->layout == LAYOUT_NONE){
+		if(d->blkdev.smart == SMART_BAD_STATUS || d->blkdev.smart == SMART_BAD_SECTOR_MANY){
+			p |= STACK_SMART_FAIL;
+		}else if(d->blkdev.smart > SMART_GOOD){
+			p |= STACK_SMART_WARN;
+		}
+		if(sata_degraded_p(d)){
+			p |= STACK_SLOW_LINK;
+		}
+	}else if(d->layout == LAYOUT_MDADM){
+		if(d->mddev.degraded){
+			p |= STACK_DEGRADED;
+		}
+	}
+	if(d->hotmember){
+		p |= STACK_IMBALANCED;
+	}
+	return p;
+}
+
+static int
+accumulate_problems(const device *d,void *vp){
+	*(unsigned *)vp |= device_problems(d);
+	return 0;
+}
+
+unsigned stack_problems(const device *d){
+	unsigned p = device_problems(d);
+
+	stack_walk(d,accumulate_problems,&p);
+	return p;
+}
+
+const char *stack_problem_str(unsigned problems){
+	if(problems & STACK_SMART_FAIL){
+		return "failing disk";
+	}else if(problems & STACK_DEGRADED){
+		return "degraded array";
+	}else if(problems & STACK_SMART_WARN){
+		return "SMART warnings";
+	}else if(problems & STACK_SLOW_LINK){
+		return "slow link";
+	}else if(problems & STACK_IMBALANCED){
+		return "imbalanced members";
+	}
+	return NULL;
+}
+
+uintmax_t stack_member_bw(const device *d){
+	uintmax_t bw;
+
+	if(d->layout != LAYOUT_NONE){
+		return 0;
+	}
+	bw = blockdev_bw(d);
+	if(d->blkdev.satalink){
+		uintmax_t link = 1500000000ull << (d->blkdev.satalink - 1);
+
+		if(!bw || link < bw){
+			bw = link;
+		}
+	}
+	if(d->blkdev.realdev && d->blkdev.rotation != SSD_ROTATION){
+		if(!bw || STACK_ROTATING_BW < bw){
+			bw = STACK_ROTATING_BW;
+		}
+	}
+	return bw;
+}
+
+struct slowest {
+	const device *d;
+	uintmax_t bw;
+};
+
+static int
+find_slowest(const device *d,void *vs){
+	struct slowest *s = vs;
+	uintmax_t bw;
+
+	// only disks, not the aggregates and partitions between us and them
+	if(d->members || (bw = stack_member_bw(d)) == 0){
+		return 0;
+	}
+	if(s->d == NULL || bw < s->bw){
+		s->d = d;
+		s->bw = bw;
+	}
+	return 0;
+}
+
+const device *stack_slowest(const device *d,uintmax_t *bw){
+	struct slowest s = { .d = NULL, .bw = 0, };
+
+	stack_walk(d,find_slowest,&s);
+	if(bw){
+		*bw = s.bw;
+	}
+	return s.d;
+}
+
+static int
+rotating_leaf(const device *d,void *vp __attribute__ ((unused))){
+	if(d->layout == LAYOUT_NONE && d->blkdev.rotation != SSD_ROTATION){
+		return 1;
+	}
+	return 0;
+}
+
+int stack_solid_state_p(const device *d){
+	if(d->layout == LAYOUT_NONE){
+		return d->blkdev.rotation == SSD_ROTATION;
+	}
+	if(d->layout == LAYOUT_PARTITION){
+		return d->partdev.parent && stack_solid_state_p(d->partdev.parent);
+	}
+	// an aggregate of nothing we know about isn't known to be fast
+	return d->members && !stack_walk(d,rotating_leaf,NULL);
+}
+
+// Ought the members of d see roughly equal I/O? Not so for concatenations,
+// dedicated parity, or caches in front of their origins.
+static int
+stack_balanced_p(const device *d){
+	const char *level;
+
+	if(d->layout == LAYOUT_MDADM){
+		if((level = d->mddev.level) == NULL){
+			return 0;
+		}
+		return strcmp(level,"linear") && strcmp(level,"raid4") &&
+			strcmp(level,"container");
+	}else if(d->layout == LAYOUT_DM){
+		if((level = d->dmdev.target) == NULL){
+			return 0;
+		}
+		return !strcmp(level,"striped") || !strcmp(level,"mirror") ||
+			!strcmp(level,"raid");
+	}
+	return 0;
+}
+
+// Does every member take every write? Their reads are balanced as the
+// mirror sees fit, often favoring one member.
+static int
+stack_mirrored_p(const device *d){
+	if(d->layout == LAYOUT_MDADM){
+		return d->mddev.level && !strcmp(d->mddev.level,"raid1");
+	}else if(d->layout == LAYOUT_DM){
+		return d->dmdev.mirrored;
+	}
+	return 0;
+}
+
+// Is a resync or rebuild hammering some members more than others?
+static int
+stack_syncing_p(const device *d){
+	if(d->layout == LAYOUT_MDADM){
+		return d->mddev.resync;
+	}else if(d->layout == LAYOUT_DM){
+		return d->dmdev.syncing;
+	}
+	return 0;
+}
+
+void stack_rollup(device *d){
+	uint64_t most = 0,total = 0;
+	const device *hot = NULL;
+	const stackedge *e;
+	unsigned n = 0,writesonly;
+
+	memset(&d->memberdelta,0,sizeof(d->memberdelta));
+	d->hotmember = NULL;
+	writesonly = stack_mirrored_p(d);
+	for(e = d->members ; e ; e = e->mnext){
+		const statpack *s = &e->member->statdelta;
+		uint64_t io;
+
+		d->memberdelta.sectors_read += s->sectors_read;
+		d->memberdelta.sectors_written += s->sectors_written;
+		d->memberdelta.reads += s->reads;
+		d->memberdelta.writes += s->writes;
+		d->memberdelta.io_ms += s->io_ms;
+		if(e->idle){
+			continue;
+		}
+		io = s->sectors_written + (writesonly ? 0 : s->sectors_read);
+		if(io > most){
+			most = io;
+			hot = e->member;
+		}
+		total += io;
+		++n;
+	}
+	if(n < 2 || most < STACK_IMBALANCE_MIN_SECTORS || !stack_balanced_p(d) ||
+			stack_syncing_p(d)){
+		return;
+	}
+	// against the mean of its peers, not of all members including itself
+	if(most > STACK_IMBALANCE_RATIO * ((total - most) / (n - 1))){
+		d->hotmember = hot;
+	}
+}
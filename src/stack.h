@@ -0,0 +1,99 @@
+// copyright 2012–2021 nick black
+#ifndef GROWLIGHT_STACK
+#define GROWLIGHT_STACK
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct device;
+
+// Block devices stack: dm and md build atop disks, partitions and one
+// another. sysfs records this as slaves/ and holders/ links, which we mirror
+// as a DAG. Each edge is on its holder's members list and its member's
+// holders list, and can be unlinked from both in O(1). Partitions are tied
+// to their disks by partdev.parent rather than edges.
+typedef struct stackedge {
+	struct device *holder;			// The stacked device
+	struct device *member;			// One of its components
+	struct stackedge *hnext, **hprev;	// On member->holders
+	struct stackedge *mnext, **mprev;	// On holder->members
+	unsigned idle;		// A spare or faulty md member, taking no
+				//  share of the holder's I/O
+} stackedge;
+
+// Anything deeper than this is assumed to be a loop in the sysfs we read
+#define STACK_MAX_DEPTH 16
+
+// A spinning disk sustains no more than this (bits/s), whatever its link
+#define STACK_ROTATING_BW 2000000000ull
+
+// Problems found at or beneath a device, as returned by stack_problems()
+#define STACK_SMART_WARN	0x1u	// SMART attribute or sector warnings
+#define STACK_SMART_FAIL	0x2u	// SMART status failure
+#define STACK_DEGRADED		0x4u	// md array missing members
+#define STACK_SLOW_LINK		0x8u	// SATA link below drive's capability
+#define STACK_IMBALANCED	0x10u	// one member doing most of the I/O
+
+// A member of a striped or mirrored aggregate doing more than
+// STACK_IMBALANCE_RATIO times the mean I/O of its peers over a stats tick is
+// flagged, provided it moved at least STACK_IMBALANCE_MIN_SECTORS (512 bytes
+// each) in that time. Below that, it's noise. Mirrors are free to send reads
+// wherever they like, so only their writes are compared. Idle (spare or
+// faulty) members aren't peers, and a syncing aggregate isn't judged at all.
+#define STACK_IMBALANCE_RATIO 2
+#define STACK_IMBALANCE_MIN_SECTORS 2048
+
+// Link the device (and its partitions) to whatever extant devices are named
+// in their slaves/ and holders/, and to any known zpool built atop them.
+// Devices not yet discovered will find us in turn when they're added. Called with the growlight lock held, as the
+// device is added (or readded, following a rescan).
+int stack_attach(struct device *d);
+
+// Stack holder atop member, for stacking sysfs doesn't know about (zpools).
+// Called with the growlight lock held.
+int stack_link(struct device *holder, struct device *member);
+
+// Unlink the device from all holders and members. Called with the lock held
+// whenever a device is reset or freed.
+void stack_detach(struct device *d);
+
+// Invoke the UI's block_event for everything stacked atop the device, so
+// that changes in its health show up on the aggregates built from it.
+void stack_notify(struct device *d);
+
+// Call fxn on every device beneath d, depth first. Partitions lead to their
+// disks. A nonzero return from fxn stops the walk, and is returned.
+int stack_walk(const struct device *d,
+		int (*fxn)(const struct device *, void *), void *curry);
+
+// STACK_* problems of the device and everything beneath it
+unsigned stack_problems(const struct device *d);
+
+// Describe the most severe of a set of STACK_* problems, NULL if none
+const char *stack_problem_str(unsigned problems);
+
+// Nominal bandwidth of a disk in bits/s, accounting for its negotiated link
+// and rotating media. 0 if unknown.
+uintmax_t stack_member_bw(const struct device *d);
+
+// The disk beneath d with the least nominal bandwidth, which bounds what a
+// striped or mirrored aggregate can deliver. NULL if d has no members or
+// none of them are known. If bw is not NULL, the bandwidth is written there.
+const struct device *stack_slowest(const struct device *d, uintmax_t *bw);
+
+// Is the device, and every disk beneath it, solid-state?
+int stack_solid_state_p(const struct device *d);
+
+// Sum the statdelta of the device's members into its memberdelta, and set
+// its hotmember should one be doing disproportionate I/O. Called each stats
+// tick with the lock held, once the members' statdeltas are up to date.
+void stack_rollup(struct device *d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -23,8 +23,7 @@ int read_proc_diskstats(diskstats **stats) {
 //
 // Technically, this function will work on any file supporting read(), but
 // usual disk files are typically better mmap()ped.
-static char *
-read_procfs_file(const char *path, size_t *buflen) {
+char *read_procfs_file(const char *path, size_t *buflen) {
 	size_t alloclen = 0;
 	char *buf = NULL;
 	int fd, terrno;
@@ -148,15 +147,19 @@ lex_diskstats(const char *sol, const char *eol, diskstats *dstat) {
 		return -1;
 	}
 	sol += consumed;
-	// sectorsRead is f3, sectorsWritten is f7
-	uintmax_t f1, f2, f3, f4, f5, f6, f7;
-	consumed = sscanf(sol, "%ju %ju %ju %ju %ju %ju %ju",
-			  &f1, &f2, &f3, &f4, &f5, &f6, &f7);
-	if(consumed != 7){
+	// readsComp is f1, sectorsRead is f3, writesComp is f5, sectorsWritten
+	// is f7, and msIOs is f10
+	uintmax_t f1, f2, f3, f4, f5, f6, f7, f8, f9, f10;
+	consumed = sscanf(sol, "%ju %ju %ju %ju %ju %ju %ju %ju %ju %ju",
+			  &f1, &f2, &f3, &f4, &f5, &f6, &f7, &f8, &f9, &f10);
+	if(consumed != 10){
 		return -1;
 	}
+	dstat->total.reads = f1;
 	dstat->total.sectors_read = f3;
+	dstat->total.writes = f5;
 	dstat->total.sectors_written = f7;
+	dstat->total.io_ms = f10;
 	return 0;
 }
 
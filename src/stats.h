@@ -7,6 +7,7 @@ extern "C" {
 #endif
 
 #include <limits.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // See Linux's documentation/iostats.txt for description of the procfs disk
@@ -22,8 +23,20 @@ extern "C" {
 typedef struct statpack {
 	uint64_t sectors_read;
 	uint64_t sectors_written;
+	uint64_t reads;		// Completed requests (readsComp)
+	uint64_t writes;	// Completed requests (writesComp)
+	uint64_t io_ms;		// Time with I/O in flight (msIOs)
 } statpack;
 
+// Throughput, IOPS and utilization of a group of disks over one stats tick.
+// Only disks are summed, as I/O to partitions and aggregates lands on them.
+typedef struct statrollup {
+	uintmax_t rxbps,txbps;	// Bits read and written per second
+	uintmax_t iops;		// Requests completed per second
+	unsigned util;		// Mean percent of the tick with I/O in flight
+	unsigned disks;		// Disks contributing
+} statrollup;
+
 typedef struct diskstats {
 	char name[NAME_MAX + 1];
 	statpack total;
@@ -39,6 +52,10 @@ int read_proc_diskstats(diskstats **stats);
 // Allows the path to be specified.
 int read_diskstats(const char *path, diskstats **stats);
 
+// Read a procfs file in one go, returning a NUL-terminated heap copy and
+// writing its length to *buflen. NULL on error.
+char *read_procfs_file(const char *path, size_t *buflen);
+
 #ifdef __cplusplus
 }
 #endif
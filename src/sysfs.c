@@ -172,10 +172,14 @@ int get_sysfs_int(int dirfd,const char *node,int *b){
 }
 
 int write_sysfs(const char *name,const char *str){
+	return write_sysfsat(AT_FDCWD,name,str);
+}
+
+int write_sysfsat(int dirfd,const char *name,const char *str){
 	ssize_t w;
 	int fd;
 
-	if((fd = open(name,O_WRONLY|O_NONBLOCK|O_CLOEXEC)) < 0){
+	if((fd = openat(dirfd,name,O_WRONLY|O_NONBLOCK|O_CLOEXEC)) < 0){
 		return -1;
 	}
 	if((w = write(fd,str,strlen(str))) <= 0 || w < (int)strlen(str)){
@@ -0,0 +1,362 @@
+// copyright 2012–2021 nick black
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tune.h"
+#include "sysfs.h"
+#include "growlight.h"
+
+static const char * const knob_nodes[TUNE_KNOBS] = {
+	"scheduler",
+	"nr_requests",
+	"read_ahead_kb",
+	"rq_affinity",
+	"wbt_lat_usec",
+	"max_sectors_kb",
+};
+
+static const struct {
+	const char *name;
+	const char *scheds[3];		// the first one available is chosen
+	unsigned long nr_requests;	// 0: leave it be
+	unsigned long readahead_kb;	// 0: derived from the stripe
+	unsigned long rq_affinity;	// 0: leave it be
+	long wbt_lat_usec;		// -1: leave it be
+	unsigned long max_sectors_kb;	// ceiling under max_hw_sectors_kb
+} profiles[] = {
+	[TUNE_NVME] = { "NVMe", { "none", NULL, }, 0, TUNE_SSD_READAHEAD_KB, 2, 0, 1024, },
+	[TUNE_SSD] = { "SSD", { "mq-deadline", "none", NULL, }, 128,
+			TUNE_SSD_READAHEAD_KB, 1, 2000, 1024, },
+	[TUNE_HDD] = { "HDD", { "mq-deadline", "bfq", NULL, }, 256,
+			TUNE_HDD_READAHEAD_KB, 1, 75000, 4096, },
+	[TUNE_STACKED] = { "md/dm", { "none", NULL, }, 0, 0, 0, -1, 0, },
+};
+
+const char *tune_profile_str(tune_profile p){
+	return profiles[p].name;
+}
+
+static char *
+queue_attr(const char *name,const char *node){
+	char path[PATH_MAX];
+
+	if((unsigned)snprintf(path,sizeof(path),"%s/queue/%s",name,node) >= sizeof(path)){
+		return NULL;
+	}
+	return get_sysfs_string(sysfd,path);
+}
+
+static char *
+ulstr(unsigned long val){
+	char *s;
+
+	if(asprintf(&s,"%lu",val) < 0){
+		return NULL;
+	}
+	return s;
+}
+
+// queue/scheduler lists those available, with the active one bracketed
+static char *
+active_sched(const char *list){
+	const char *start,*end;
+
+	if((start = strchr(list,'[')) == NULL || (end = strchr(start,']')) == NULL){
+		return strdup(list);
+	}
+	return strndup(start + 1,end - start - 1);
+}
+
+static int
+sched_available_p(const char *list,const char *sched){
+	size_t len = strlen(sched);
+	const char *s = list;
+
+	while(*s){
+		while(*s == ' ' || *s == '['){
+			++s;
+		}
+		if(strncmp(s,sched,len) == 0 && (s[len] == ' ' || s[len] == ']' || s[len] == '\0')){
+			return 1;
+		}
+		while(*s && *s != ' '){
+			++s;
+		}
+	}
+	return 0;
+}
+
+static int
+tunable_p(const device *d,tune_profile *p){
+	if(d->layout == LAYOUT_MDADM || d->layout == LAYOUT_DM){
+		*p = TUNE_STACKED;
+		return 1;
+	}
+	if(d->layout != LAYOUT_NONE || !d->blkdev.realdev){
+		return 0;
+	}
+	if(d->blkdev.transport == DIRECT_NVME || (d->c && d->c->transport == TRANSPORT_NVME)){
+		*p = TUNE_NVME;
+	}else if(d->blkdev.rotation == SSD_ROTATION){
+		*p = TUNE_SSD;
+	}else{
+		*p = TUNE_HDD;
+	}
+	return 1;
+}
+
+// Two full stripes, so that sequential reads keep every member busy
+static unsigned long
+stacked_readahead_kb(const device *d){
+	uintmax_t stripe = 0;
+
+	if(d->layout == LAYOUT_MDADM && d->mddev.stride && d->mddev.swidth){
+		stripe = d->mddev.stride * d->mddev.swidth;
+	}else if(d->optio){
+		stripe = d->optio;
+	}
+	if(stripe * 2 / 1024 < TUNE_STACKED_MIN_READAHEAD_KB){
+		return TUNE_STACKED_MIN_READAHEAD_KB;
+	}
+	return stripe * 2 / 1024;
+}
+
+static char *
+udev_match(const device *d){
+	char *s = NULL;
+	int r;
+
+	if(d->layout == LAYOUT_NONE && d->blkdev.serial &&
+			strpbrk(d->blkdev.serial,"\"\\*?[") == NULL){
+		r = asprintf(&s,"ENV{ID_SERIAL_SHORT}==\"%s\"",d->blkdev.serial);
+	}else if(d->layout == LAYOUT_DM && d->dmdev.dmname &&
+			strpbrk(d->dmdev.dmname,"\"\\*?[") == NULL){
+		r = asprintf(&s,"ENV{DM_NAME}==\"%s\"",d->dmdev.dmname);
+	}else{
+		r = asprintf(&s,"KERNEL==\"%s\"",d->name);
+	}
+	return r < 0 ? NULL : s;
+}
+
+// Called with the lock held
+static int
+plan_device(const device *d,tune_profile p,tune_plan *tp){
+	char *hwmax,*list;
+	unsigned z;
+
+	memset(tp,0,sizeof(*tp));
+	tp->profile = p;
+	if((tp->name = strdup(d->name)) == NULL || (tp->match = udev_match(d)) == NULL){
+		return -1;
+	}
+	for(z = 0 ; z < TUNE_KNOBS ; ++z){
+		tp->knobs[z].node = knob_nodes[z];
+		tp->knobs[z].current = queue_attr(d->name,knob_nodes[z]);
+	}
+	if( (list = tp->knobs[0].current) ){
+		unsigned s;
+
+		tp->knobs[0].current = active_sched(list);
+		for(s = 0 ; profiles[p].scheds[s] ; ++s){
+			if(sched_available_p(list,profiles[p].scheds[s])){
+				tp->knobs[0].recommended = strdup(profiles[p].scheds[s]);
+				break;
+			}
+		}
+		free(list);
+		if(tp->knobs[0].current == NULL){
+			return -1;
+		}
+	}
+	if(profiles[p].nr_requests){
+		tp->knobs[1].recommended = ulstr(profiles[p].nr_requests);
+	}
+	tp->knobs[2].recommended = ulstr(profiles[p].readahead_kb ?
+			profiles[p].readahead_kb : stacked_readahead_kb(d));
+	if(profiles[p].rq_affinity){
+		tp->knobs[3].recommended = ulstr(profiles[p].rq_affinity);
+	}
+	if(profiles[p].wbt_lat_usec >= 0){
+		tp->knobs[4].recommended = ulstr(profiles[p].wbt_lat_usec);
+	}
+	if(profiles[p].max_sectors_kb && (hwmax = queue_attr(d->name,"max_hw_sectors_kb"))){
+		unsigned long hw = strtoul(hwmax,NULL,10);
+
+		free(hwmax);
+		if(hw){
+			tp->knobs[5].recommended = ulstr(hw < profiles[p].max_sectors_kb ?
+						hw : profiles[p].max_sectors_kb);
+		}
+	}
+	return 0;
+}
+
+static void
+free_tune_plan(tune_plan *tp){
+	unsigned z;
+
+	for(z = 0 ; z < TUNE_KNOBS ; ++z){
+		free(tp->knobs[z].current);
+		free(tp->knobs[z].recommended);
+	}
+	free(tp->name);
+	free(tp->match);
+}
+
+void free_tune_plans(tune_plan *plans,unsigned count){
+	while(count--){
+		free_tune_plan(&plans[count]);
+	}
+	free(plans);
+}
+
+int tune_plan_device(const device *d,tune_plan *tp){
+	tune_profile p;
+
+	if(!tunable_p(d,&p)){
+		return 0;
+	}
+	if(plan_device(d,p,tp)){
+		free_tune_plan(tp);
+		return -1;
+	}
+	return 1;
+}
+
+static int
+add_plan(const device *d,tune_plan **plans,unsigned *count){
+	tune_plan *tmp,tp;
+	int r;
+
+	if((r = tune_plan_device(d,&tp)) <= 0){
+		if(r){
+			diag("Couldn't plan tuning for %s\n",d->name);
+		}
+		return r;
+	}
+	if((tmp = realloc(*plans,sizeof(**plans) * (*count + 1))) == NULL){
+		diag("Couldn't allocate tuning plan (%s?)\n",strerror(errno));
+		free_tune_plan(&tp);
+		return -1;
+	}
+	*plans = tmp;
+	tmp[(*count)++] = tp;
+	return 0;
+}
+
+int tune_plan_devices(const char *name,tune_plan **plans,unsigned *count){
+	tune_plan *tp = NULL;
+	const controller *c;
+	unsigned n = 0;
+
+	lock_growlight();
+	if(name){
+		const device *d;
+		tune_profile p;
+
+		if((d = find_device(name)) == NULL || !tunable_p(d,&p)){
+			unlock_growlight();
+			diag("%s has no queue to tune\n",name);
+			return -1;
+		}
+		if(add_plan(d,&tp,&n)){
+			unlock_growlight();
+			return -1;
+		}
+	}else for(c = get_controllers() ; c ; c = c->next){
+		const device *d;
+
+		for(d = c->blockdevs ; d ; d = d->next){
+			if(add_plan(d,&tp,&n)){
+				unlock_growlight();
+				free_tune_plans(tp,n);
+				return -1;
+			}
+		}
+	}
+	unlock_growlight();
+	*plans = tp;
+	*count = n;
+	return 0;
+}
+
+static int
+knob_change_p(const tune_knob *k){
+	return k->current && k->recommended && strcmp(k->current,k->recommended);
+}
+
+unsigned tune_plan_changes(const tune_plan *tp){
+	unsigned z,n = 0;
+
+	for(z = 0 ; z < TUNE_KNOBS ; ++z){
+		n += knob_change_p(&tp->knobs[z]);
+	}
+	return n;
+}
+
+int tune_apply(const tune_plan *plans,unsigned count,unsigned *attempted){
+	unsigned z,k;
+	int failed = 0;
+
+	*attempted = 0;
+	for(k = 0 ; k < TUNE_KNOBS ; ++k){
+		for(z = 0 ; z < count ; ++z){
+			const tune_knob *knob = &plans[z].knobs[k];
+			char path[PATH_MAX];
+
+			// a new scheduler resets nr_requests
+			if(!knob_change_p(knob) && !(k == 1 && knob->recommended &&
+						knob_change_p(&plans[z].knobs[0]))){
+				continue;
+			}
+			++*attempted;
+			if((unsigned)snprintf(path,sizeof(path),"%s/queue/%s",
+						plans[z].name,knob->node) >= sizeof(path)){
+				diag("Name too long: %s\n",plans[z].name);
+				++failed;
+				continue;
+			}
+			if(write_sysfsat(sysfd,path,knob->recommended)){
+				diag("Couldn't write %s to %s (%s?)\n",knob->recommended,path,strerror(errno));
+				++failed;
+				continue;
+			}
+			verbf("%s: %s %s -> %s\n",plans[z].name,knob->node,knob->current,knob->recommended);
+		}
+	}
+	return failed;
+}
+
+int tune_export_udev(FILE *fp,const tune_plan *plans,unsigned count){
+	unsigned z,k;
+
+	if(fprintf(fp,"# Block queue tuning generated by growlight\n") < 0){
+		return -1;
+	}
+	for(z = 0 ; z < count ; ++z){
+		const tune_plan *tp = &plans[z];
+
+		if(fprintf(fp,"\n# %s (%s)\nACTION==\"add|change\", SUBSYSTEM==\"block\", "
+					"ENV{DEVTYPE}==\"disk\", %s",tp->name,
+					tune_profile_str(tp->profile),tp->match) < 0){
+			return -1;
+		}
+		for(k = 0 ; k < TUNE_KNOBS ; ++k){
+			const tune_knob *knob = &tp->knobs[k];
+
+			if(knob->current == NULL || knob->recommended == NULL){
+				continue;
+			}
+			if(fprintf(fp,", ATTR{queue/%s}=\"%s\"",knob->node,knob->recommended) < 0){
+				return -1;
+			}
+		}
+		if(fprintf(fp,"\n") < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,75 @@
+// copyright 2012–2021 nick black
+#ifndef GROWLIGHT_TUNE
+#define GROWLIGHT_TUNE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+struct device;
+
+// Block queue tuning. Each disk, md and dm device is assigned a profile by
+// its class, from which recommended values of its queue/ attributes are
+// derived. Partitions and zpools have no queue of their own.
+typedef enum {
+	TUNE_NVME,		// none, wide dispatch, no write throttling
+	TUNE_SSD,		// mq-deadline, moderate queue and readahead
+	TUNE_HDD,		// mq-deadline, deep queue, long readahead and I/Os
+	TUNE_STACKED,		// md and dm: readahead covering two stripes
+} tune_profile;
+
+// Readahead for rotating disks, and the least for stacked devices
+#define TUNE_HDD_READAHEAD_KB 2048
+#define TUNE_SSD_READAHEAD_KB 128
+#define TUNE_STACKED_MIN_READAHEAD_KB 1024
+
+// The queue/ attributes we tune, in the order they're applied. The
+// scheduler comes first, as changing it resets nr_requests.
+#define TUNE_KNOBS 6
+
+typedef struct tune_knob {
+	const char *node;	// within queue/
+	char *current;		// NULL if the device lacks the attribute
+	char *recommended;	// NULL if we've no opinion
+} tune_knob;
+
+typedef struct tune_plan {
+	char *name;		// device name in /sys/class/block
+	char *match;		// udev match keys identifying the device
+	tune_profile profile;
+	tune_knob knobs[TUNE_KNOBS];
+} tune_plan;
+
+const char *tune_profile_str(tune_profile p);
+
+// Plan the device from its queue/ attributes beneath sysfd. Returns 0 if it
+// has no queue to tune, 1 once *tp is filled in, and -1 on error. Called with
+// the lock held.
+int tune_plan_device(const struct device *d,tune_plan *tp);
+
+// Plan every tunable device, or only the named one if name is not NULL.
+// Returns -1 on error, with *plans and *count untouched.
+int tune_plan_devices(const char *name,tune_plan **plans,unsigned *count);
+
+// Number of knobs whose current value differs from our recommendation
+unsigned tune_plan_changes(const tune_plan *tp);
+
+// Write recommended values wherever they differ from the current ones, each
+// knob across all devices before moving on to the next, so that schedulers
+// are all set before any nr_requests. A new scheduler resets nr_requests, so
+// that is rewritten too, even if it was already as recommended. Returns the
+// number of failed writes, with the number attempted in *attempted.
+int tune_apply(const tune_plan *plans,unsigned count,unsigned *attempted);
+
+// Write udev rules setting the recommended values as devices appear
+int tune_export_udev(FILE *fp,const tune_plan *plans,unsigned count);
+
+void free_tune_plans(tune_plan *plans,unsigned count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
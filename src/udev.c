@@ -25,9 +25,11 @@ int udev_event(const glightui *gui){
       udev_device_get_sysname(dev), udev_device_get_sysnum(dev),
       udev_device_get_devnode(dev));
     if(strcmp(subsys, "bdi") == 0){
-      scan_zpools(gui);
+      // dataset mounts come and go with bdis; we can't tell which pool
+      zpools_changed(gui);
     }else{
       rescan_device(udev_device_get_sysname(dev));
+      zpool_device_event(gui, udev_device_get_sysname(dev));
     }
   }
   return 0;
@@ -4,13 +4,19 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "zfs.h"
 #include "popen.h"
+#include "stack.h"
 #include "growlight.h"
+#include "aggregate.h"
 
 #ifdef USE_LIBZFS
 #include <libzfs.h>
+#include <libzutil.h>
 
 // FIXME hacks around the libspl/libzfs autotools-dominated jank
 #define ulong_t unsigned long
@@ -19,8 +25,6 @@
 //#include <libzfs.h>
 
 static libzfs_handle_t *zht;
-// FIXME taken from zpool.c source
-static char props[] = "name,size,allocated,free,capacity,dedupratio,health,altroot";
 
 struct zpoolcb_t {
 	unsigned pools;
@@ -59,6 +63,215 @@ dehumanize(const char *num){
 	return ull;
 }
 
+// Resolve a vdev path (often a /dev/disk/by-* link) to the name of its block
+// device, if it's in /dev.
+static char *
+vdev_devname(const char *path){
+	char buf[PATH_MAX];
+	const char *base;
+
+	if(realpath(path, buf) == NULL){
+		return NULL;
+	}
+	if(strncmp(buf, "/dev/", 5) || (base = strrchr(buf, '/')) == NULL){
+		return NULL;
+	}
+	return strdup(base + 1);
+}
+
+typedef int (*vdevfxn)(nvlist_t *, unsigned, void *);
+
+static int
+walk_vdev_array(nvlist_t *nv, const char *key, unsigned depth, vdevfxn fxn, void *curry){
+	nvlist_t **child;
+	uint_t children, c;
+
+	if(nvlist_lookup_nvlist_array(nv, key, &child, &children)){
+		return 0;
+	}
+	for(c = 0 ; c < children ; ++c){
+		if(fxn(child[c], depth, curry)){
+			return -1;
+		}
+		if(walk_vdev_array(child[c], ZPOOL_CONFIG_CHILDREN, depth + 1, fxn, curry)){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Visit the vdevs depth-first: each top-level vdev followed by its
+// children, then the spares and L2ARC devices.
+static int
+walk_vdevs(nvlist_t *nvroot, vdevfxn fxn, void *curry){
+	if(walk_vdev_array(nvroot, ZPOOL_CONFIG_CHILDREN, 1, fxn, curry) ||
+			walk_vdev_array(nvroot, ZPOOL_CONFIG_SPARES, 1, fxn, curry) ||
+			walk_vdev_array(nvroot, ZPOOL_CONFIG_L2CACHE, 1, fxn, curry)){
+		return -1;
+	}
+	return 0;
+}
+
+static int
+add_vdev(nvlist_t *nv, unsigned depth, void *vzi){
+	zpool_info *zi = vzi;
+	zpool_vdev *tmp, *v;
+	char *type, *path;
+
+	if(nvlist_lookup_string(nv, ZPOOL_CONFIG_TYPE, &type)){
+		diag("Couldn't get vdev type\n");
+		return -1;
+	}
+	if((tmp = realloc(zi->vdevs, sizeof(*zi->vdevs) * (zi->vdevcount + 1))) == NULL){
+		return -1;
+	}
+	zi->vdevs = tmp;
+	v = &zi->vdevs[zi->vdevcount];
+	memset(v, 0, sizeof(*v));
+	v->depth = depth;
+	v->top = depth == 1 ? zi->vdevcount : zi->vdevs[zi->vdevcount - 1].top;
+	++zi->vdevcount;
+	nvlist_lookup_uint64(nv, ZPOOL_CONFIG_GUID, &v->guid);
+	if((v->type = strdup(type)) == NULL){
+		return -1;
+	}
+	if(nvlist_lookup_string(nv, ZPOOL_CONFIG_PATH, &path) == 0){
+		if((v->path = strdup(path)) == NULL){
+			return -1;
+		}
+		v->devname = vdev_devname(path);
+	}
+	return 0;
+}
+
+// Cache the pool's properties and walk its vdev tree (including spares and
+// L2ARC devices) into a new zpool_info.
+static zpool_info *
+get_zpool_info(zpool_handle_t *zhp, nvlist_t *conf){
+	char buf[32];
+	nvlist_t *nvroot;
+	zpool_info *zi;
+
+	if((zi = malloc(sizeof(*zi))) == NULL){
+		return NULL;
+	}
+	memset(zi, 0, sizeof(*zi));
+	if(zpool_get_prop(zhp, ZPOOL_PROP_HEALTH, zi->health, sizeof(zi->health), NULL, true)){
+		strcpy(zi->health, "UNKNOWN");
+	}
+	if(zpool_get_prop(zhp, ZPOOL_PROP_ALLOCATED, buf, sizeof(buf), NULL, true) == 0){
+		zi->allocated = dehumanize(buf);
+	}
+	if(zpool_get_prop(zhp, ZPOOL_PROP_FREE, buf, sizeof(buf), NULL, true) == 0){
+		zi->free = dehumanize(buf);
+	}
+	if(zpool_get_prop(zhp, ZPOOL_PROP_CAPACITY, buf, sizeof(buf), NULL, true) == 0){
+		zi->capacity = dehumanize(buf);
+	}
+	if(zpool_get_prop(zhp, ZPOOL_PROP_DEDUPRATIO, zi->dedupratio, sizeof(zi->dedupratio), NULL, true)){
+		zi->dedupratio[0] = '\0';
+	}
+	if(nvlist_lookup_nvlist(conf, ZPOOL_CONFIG_VDEV_TREE, &nvroot) == 0){
+		if(walk_vdevs(nvroot, add_vdev, zi)){
+			diag("Couldn't walk vdevs of %s\n", zpool_get_name(zhp));
+			free_zpool_info(zi);
+			return NULL;
+		}
+	}
+	return zi;
+}
+
+static int
+zpool_info_changed(const zpool_info *a, const zpool_info *b){
+	unsigned z;
+
+	if(a == NULL || b == NULL){
+		return a != b;
+	}
+	if(strcmp(a->health, b->health) || strcmp(a->dedupratio, b->dedupratio)){
+		return 1;
+	}
+	if(a->allocated != b->allocated || a->free != b->free || a->capacity != b->capacity){
+		return 1;
+	}
+	if(a->vdevcount != b->vdevcount){
+		return 1;
+	}
+	for(z = 0 ; z < a->vdevcount ; ++z){
+		if(a->vdevs[z].guid != b->vdevs[z].guid){
+			return 1;
+		}
+		if(!a->vdevs[z].devname != !b->vdevs[z].devname){
+			return 1;
+		}
+		if(a->vdevs[z].devname && strcmp(a->vdevs[z].devname, b->vdevs[z].devname)){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Keep the I/O counters and rates sampled by zpool_tick() across a refresh,
+// so long as the vdevs haven't changed beneath us.
+static void
+carry_vdev_stats(zpool_info *zi, const zpool_info *old){
+	unsigned z;
+
+	if(zi == NULL || old == NULL || zi->vdevcount != old->vdevcount){
+		return;
+	}
+	for(z = 0 ; z < zi->vdevcount ; ++z){
+		if(zi->vdevs[z].guid != old->vdevs[z].guid){
+			return;
+		}
+	}
+	for(z = 0 ; z < zi->vdevcount ; ++z){
+		zpool_vdev *v = &zi->vdevs[z];
+		const zpool_vdev *o = &old->vdevs[z];
+
+		memcpy(v->ops, o->ops, sizeof(v->ops));
+		memcpy(v->bytes, o->bytes, sizeof(v->bytes));
+		v->errors = o->errors;
+		v->latops = o->latops;
+		v->latns = o->latns;
+		memcpy(v->bps, o->bps, sizeof(v->bps));
+		memcpy(v->iops, o->iops, sizeof(v->iops));
+		v->latus = o->latus;
+		v->slow = o->slow;
+	}
+	zi->sampled = old->sampled;
+}
+
+// Stack the pool atop each of its leaf vdevs' block devices. growlight must
+// be locked.
+static void
+link_vdevs(device *d){
+	const zpool_info *zi = d->zpool.info;
+	unsigned z;
+
+	stack_detach(d);
+	d->zpool.disks = 0;
+	d->zpool.transport = AGGREGATE_UNKNOWN;
+	if(zi == NULL){
+		return;
+	}
+	for(z = 0 ; z < zi->vdevcount ; ++z){
+		device *member;
+
+		if(zi->vdevs[z].path == NULL){
+			continue;
+		}
+		++d->zpool.disks;
+		if(zi->vdevs[z].devname == NULL){
+			continue;
+		}
+		if( (member = find_device(zi->vdevs[z].devname)) ){
+			stack_link(d, member);
+			d->zpool.transport = merge_transport(d->zpool.transport, member);
+		}
+	}
+}
+
 static int
 zpoolcb(zpool_handle_t *zhp, void *arg){
 	char size[10], guid[21], ashift[5], health[20];
@@ -66,6 +279,7 @@ zpoolcb(zpool_handle_t *zhp, void *arg){
 	const glightui *gui;
 	uint64_t version;
 	const char *name;
+	zpool_info *zi;
 	nvlist_t *conf;
 	device *d;
 	int state;
@@ -122,33 +336,53 @@ zpoolcb(zpool_handle_t *zhp, void *arg){
 		zpool_close(zhp);
 		return -1;
 	}
+	zi = get_zpool_info(zhp, conf);
+	zpool_close(zhp);
 	lock_growlight();
 	if( (d = lookup_device(name)) ){
+		int changed = 0;
+
 		if(d->layout != LAYOUT_ZPOOL){
 			diag("Zpool %s collided with %s\n", name, d->name);
-			zpool_close(zhp);
+			unlock_growlight();
+			free_zpool_info(zi);
 			return -1;
 		}
-		if(strcmp(d->uuid, guid)){
+		if(d->uuid == NULL || strcmp(d->uuid, guid)){
 			diag("UUID changed on %s\n", name);
 			free(d->uuid);
+			d->uuid = strdup(guid);
+			changed = 1;
 		}
-		d->uuid = strdup(guid);
 		if(d->size != dehumanize(size)){
 			diag("Size changed on %s (%ju->%s)\n", name, d->size, size);
+			d->size = dehumanize(size);
+			changed = 1;
+		}
+		if(d->zpool.state != (unsigned)state || d->zpool.zpoolver != version){
+			d->zpool.state = state;
+			d->zpool.zpoolver = version;
+			changed = 1;
+		}
+		if(zpool_info_changed(d->zpool.info, zi)){
+			changed = 1;
+		}
+		carry_vdev_stats(zi, d->zpool.info);
+		free_zpool_info(d->zpool.info);
+		d->zpool.info = zi;
+		// members might have been rescanned (and unlinked) even if
+		// the pool itself is unchanged
+		link_vdevs(d);
+		if(changed){
+			d->uistate = gui->block_event(d, d->uistate);
 		}
-		d->size = dehumanize(size);
-		d->zpool.state = state;
-		d->zpool.zpoolver = version;
-		zpool_close(zhp);
-		d->uistate = gui->block_event(d, d->uistate);
 		unlock_growlight();
 		return 0;
 	}
 	unlock_growlight();
 	if((d = malloc(sizeof(*d))) == NULL){
 		diag("Couldn't allocate device (%s?)\n", strerror(errno));
-		zpool_close(zhp);
+		free_zpool_info(zi);
 		return -1;
 	}
 	memset(d, 0, sizeof(*d));
@@ -163,10 +397,12 @@ zpoolcb(zpool_handle_t *zhp, void *arg){
 	}
 	d->logsec = 512;
 	d->zpool.state = state;
-	d->zpool.transport = AGGREGATE_UNKNOWN;
 	d->zpool.zpoolver = version;
+	d->zpool.info = zi;
+	lock_growlight();
+	link_vdevs(d);
+	unlock_growlight();
 	add_new_virtual_blockdev(d);
-	zpool_close(zhp);
 	return 0;
 }
 
@@ -230,20 +466,17 @@ zfscb(zfs_handle_t *zhf, void *arg){
 	return 0;
 }
 
+static struct timespec lastscan;	// CLOCK_MONOTONIC time of last full scan
+static unsigned scanpending;		// A full scan was deferred
+
 int scan_zpools(const glightui *gui){
-	libzfs_handle_t *zfs = zht;
-	zprop_list_t *pools = NULL;
 	struct zpoolcb_t cb;
 
 	if(zht == NULL){
 		return 0; // ZFS wasn't successfully initialized
 	}
-	if(zprop_get_list(zfs, props, &pools, ZFS_TYPE_POOL)){
-		diag("Couldn't list ZFS pools\n");
-		return -1;
-	}
-	// FIXME do what with it?
-	zprop_free_list(pools);
+	clock_gettime(CLOCK_MONOTONIC, &lastscan);
+	scanpending = 0;
 	memset(&cb, 0, sizeof(cb));
 	cb.gui = gui;
 	if(zpool_iter(zht, zpoolcb, &cb)){
@@ -258,6 +491,377 @@ int scan_zpools(const glightui *gui){
 	return 0;
 }
 
+static int
+rescan_due_p(void){
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec - lastscan.tv_sec >= ZPOOL_RESCAN_SECS;
+}
+
+int zpools_changed(const glightui *gui){
+	if(zht == NULL){
+		return 0;
+	}
+	if(!rescan_due_p()){
+		scanpending = 1;
+		return 0;
+	}
+	return scan_zpools(gui);
+}
+
+// Refresh a single pool and its root dataset
+static int
+refresh_zpool(const glightui *gui, const char *name){
+	struct zpoolcb_t cb;
+	zpool_handle_t *zhp;
+	zfs_handle_t *zhf;
+	int r;
+
+	memset(&cb, 0, sizeof(cb));
+	cb.gui = gui;
+	if((zhp = zpool_open_canfail(zht, name)) == NULL){
+		// it's gone (or going); let a full scan sort it out
+		return zpools_changed(gui);
+	}
+	if((r = zpoolcb(zhp, &cb)) == 0){ // zpoolcb() closes zhp
+		if( (zhf = zfs_open(zht, name, ZFS_TYPE_FILESYSTEM)) ){
+			r = zfscb(zhf, &cb);
+			zfs_close(zhf);
+		}
+	}
+	return r;
+}
+
+// Does the vdev's block device match name, either directly or as a
+// partition of the named disk?
+static int
+vdev_on_device_p(const zpool_vdev *v, const char *name){
+	const device *d;
+
+	if(v->devname == NULL){
+		return 0;
+	}
+	if(strcmp(v->devname, name) == 0){
+		return 1;
+	}
+	if((d = find_device(v->devname)) && d->layout == LAYOUT_PARTITION){
+		return strcmp(d->partdev.parent->name, name) == 0;
+	}
+	return 0;
+}
+
+typedef char poolname[NAME_MAX + 1];
+
+// Copy out the names of all pools (name == NULL), or only those using the
+// named block device. Returns the count, or -1 on error. Takes the lock.
+static int
+collect_zpools(const char *name, poolname **pools){
+	const controller *c;
+	unsigned count = 0;
+
+	*pools = NULL;
+	lock_growlight();
+	for(c = get_controllers() ; c ; c = c->next){
+		const device *d;
+
+		for(d = c->blockdevs ; d ; d = d->next){
+			const zpool_info *zi;
+			unsigned z;
+
+			if(d->layout != LAYOUT_ZPOOL || (zi = d->zpool.info) == NULL){
+				continue;
+			}
+			for(z = 0 ; name && z < zi->vdevcount ; ++z){
+				if(vdev_on_device_p(&zi->vdevs[z], name)){
+					break;
+				}
+			}
+			if(name == NULL || z < zi->vdevcount){
+				poolname *tmp = realloc(*pools, sizeof(**pools) * (count + 1));
+
+				if(tmp == NULL){
+					unlock_growlight();
+					free(*pools);
+					*pools = NULL;
+					return -1;
+				}
+				*pools = tmp;
+				strcpy((*pools)[count++], d->name);
+			}
+		}
+	}
+	unlock_growlight();
+	return count;
+}
+
+int zpool_device_event(const glightui *gui, const char *name){
+	poolname *pools;
+	int count, z;
+	int r = 0;
+
+	if(zht == NULL){
+		return 0;
+	}
+	// refresh without the lock, since zpoolcb() takes it itself
+	if((count = collect_zpools(name, &pools)) < 0){
+		return -1;
+	}
+	for(z = 0 ; z < count ; ++z){
+		verbf("Refreshing zpool %s following event on %s\n", pools[z], name);
+		r |= refresh_zpool(gui, pools[z]);
+	}
+	free(pools);
+	return r;
+}
+
+// One vdev's cumulative counters, as read during a stats tick
+typedef struct vdev_sample {
+	uint64_t guid;
+	uint64_t ops[2], bytes[2];
+	uint64_t errors;
+	uint64_t latops, latns;
+} vdev_sample;
+
+typedef struct zpool_sample {
+	vdev_sample root;
+	vdev_sample *vdevs;	// In walk_vdevs() order, like zpool_info's
+	unsigned count;
+} zpool_sample;
+
+// Bucket b of a latency histogram counts I/Os which took [2^b, 2^(b+1))
+// nanoseconds. Take each at its bucket's midpoint.
+static void
+sum_latency(nvlist_t *nvx, const char *key, vdev_sample *vs){
+	uint_t c, b;
+	uint64_t *h;
+
+	if(nvlist_lookup_uint64_array(nvx, key, &h, &c)){
+		return;
+	}
+	for(b = 0 ; b < c && b < 63 ; ++b){
+		vs->latops += h[b];
+		vs->latns += h[b] * ((3ull << b) / 2);
+	}
+}
+
+static void
+sample_vdev(nvlist_t *nv, vdev_sample *vs){
+	vdev_stat_t *st;
+	nvlist_t *nvx;
+	uint_t c;
+
+	memset(vs, 0, sizeof(*vs));
+	nvlist_lookup_uint64(nv, ZPOOL_CONFIG_GUID, &vs->guid);
+	if(nvlist_lookup_uint64_array(nv, ZPOOL_CONFIG_VDEV_STATS, (uint64_t **)&st, &c) == 0){
+		vs->ops[0] = st->vs_ops[ZIO_TYPE_READ];
+		vs->ops[1] = st->vs_ops[ZIO_TYPE_WRITE];
+		vs->bytes[0] = st->vs_bytes[ZIO_TYPE_READ];
+		vs->bytes[1] = st->vs_bytes[ZIO_TYPE_WRITE];
+		vs->errors = st->vs_read_errors + st->vs_write_errors + st->vs_checksum_errors;
+	}
+	// extended statistics arrived with ZoL 0.7
+	if(nvlist_lookup_nvlist(nv, ZPOOL_CONFIG_VDEV_STATS_EX, &nvx) == 0){
+		sum_latency(nvx, ZPOOL_CONFIG_VDEV_TOT_R_LAT_HISTO, vs);
+		sum_latency(nvx, ZPOOL_CONFIG_VDEV_TOT_W_LAT_HISTO, vs);
+	}
+}
+
+static int
+add_sample(nvlist_t *nv, unsigned depth __attribute__ ((unused)), void *vzs){
+	zpool_sample *zs = vzs;
+	vdev_sample *tmp;
+
+	if((tmp = realloc(zs->vdevs, sizeof(*zs->vdevs) * (zs->count + 1))) == NULL){
+		return -1;
+	}
+	zs->vdevs = tmp;
+	sample_vdev(nv, &zs->vdevs[zs->count++]);
+	return 0;
+}
+
+// Counters can go backwards (zpool clear, pool reimport)
+static inline uint64_t
+ctrdelta(uint64_t now, uint64_t then){
+	return now >= then ? now - then : 0;
+}
+
+static void
+update_vdev(zpool_vdev *v, const vdev_sample *vs, double secs){
+	unsigned i;
+
+	if(secs > 0){
+		for(i = 0 ; i < 2 ; ++i){
+			v->bps[i] = ctrdelta(vs->bytes[i], v->bytes[i]) / secs;
+			v->iops[i] = ctrdelta(vs->ops[i], v->ops[i]) / secs;
+		}
+		if(vs->latops > v->latops){
+			v->latus = ctrdelta(vs->latns, v->latns) / (vs->latops - v->latops) / 1000;
+		}else{
+			v->latus = 0;
+		}
+	}
+	memcpy(v->ops, vs->ops, sizeof(v->ops));
+	memcpy(v->bytes, vs->bytes, sizeof(v->bytes));
+	v->errors = vs->errors;
+	v->latops = vs->latops;
+	v->latns = vs->latns;
+}
+
+static int
+cmp_uint64(const void *va, const void *vb){
+	const uint64_t *a = va, *b = vb;
+
+	return *a < *b ? -1 : *a > *b;
+}
+
+// Compare each busy leaf's latency against the median of the other busy
+// leaves beneath the same top-level vdev.
+static void
+flag_slow_vdevs(zpool_info *zi){
+	uint64_t *lats;
+	unsigned i, j, n;
+
+	if((lats = malloc(sizeof(*lats) * zi->vdevcount)) == NULL){
+		return;
+	}
+	for(i = 0 ; i < zi->vdevcount ; ++i){
+		zpool_vdev *v = &zi->vdevs[i];
+
+		v->slow = 0;
+		if(v->path == NULL || v->latus < ZPOOL_SLOW_MIN_US){
+			continue;
+		}
+		for(j = n = 0 ; j < zi->vdevcount ; ++j){
+			const zpool_vdev *sib = &zi->vdevs[j];
+
+			if(j != i && sib->top == v->top && sib->path && sib->latus){
+				lats[n++] = sib->latus;
+			}
+		}
+		if(n){
+			qsort(lats, n, sizeof(*lats), cmp_uint64);
+			if(v->latus >= ZPOOL_SLOW_FACTOR * lats[n / 2]){
+				v->slow = 1;
+			}
+		}
+	}
+	free(lats);
+}
+
+// Fold the sample into the pool's vdevs, and its root into the pool's own
+// stats. growlight must be locked.
+static void
+apply_zpool_sample(device *d, const zpool_sample *zs, const struct timespec *now){
+	zpool_info *zi = d->zpool.info;
+	uint64_t sectors[2];
+	double secs = 0;
+	unsigned z;
+
+	if(zi->sampled.tv_sec || zi->sampled.tv_nsec){
+		secs = (now->tv_sec - zi->sampled.tv_sec) +
+			(now->tv_nsec - zi->sampled.tv_nsec) / 1000000000.0;
+	}
+	// zi->sampled dates every vdev's counters, so either all of them are
+	// updated from this sample, or none are
+	z = 0;
+	if(zs->count == zi->vdevcount){
+		while(z < zs->count && zs->vdevs[z].guid == zi->vdevs[z].guid){
+			++z;
+		}
+	}
+	if(z < zi->vdevcount || zs->count != zi->vdevcount){
+		verbf("vdevs of %s changed, rescanning\n", d->name);
+		scanpending = 1;
+		return;
+	}
+	for(z = 0 ; z < zs->count ; ++z){
+		update_vdev(&zi->vdevs[z], &zs->vdevs[z], secs);
+	}
+	flag_slow_vdevs(zi);
+	sectors[0] = zs->root.bytes[0] / 512;
+	sectors[1] = zs->root.bytes[1] / 512;
+	if(secs > 0){
+		d->statdelta.sectors_read = ctrdelta(sectors[0], d->stats.sectors_read);
+		d->statdelta.sectors_written = ctrdelta(sectors[1], d->stats.sectors_written);
+		d->statdelta.reads = ctrdelta(zs->root.ops[0], d->stats.reads);
+		d->statdelta.writes = ctrdelta(zs->root.ops[1], d->stats.writes);
+		d->statq.tv_sec = secs;
+		d->statq.tv_usec = (secs - d->statq.tv_sec) * 1000000;
+	}else{
+		d->statdelta.sectors_read = 0;
+		d->statdelta.sectors_written = 0;
+		d->statdelta.reads = 0;
+		d->statdelta.writes = 0;
+	}
+	d->stats.sectors_read = sectors[0];
+	d->stats.sectors_written = sectors[1];
+	d->stats.reads = zs->root.ops[0];
+	d->stats.writes = zs->root.ops[1];
+	zi->sampled = *now;
+}
+
+static int
+sample_zpool(const glightui *gui, const char *name){
+	zpool_handle_t *zhp;
+	nvlist_t *conf, *nvroot;
+	struct timespec now;
+	boolean_t missing;
+	zpool_sample zs;
+	device *d;
+
+	if((zhp = zpool_open_canfail(zht, name)) == NULL){
+		return -1;
+	}
+	if(zpool_refresh_stats(zhp, &missing) || missing){
+		zpool_close(zhp);
+		return -1;
+	}
+	if((conf = zpool_get_config(zhp, NULL)) == NULL ||
+			nvlist_lookup_nvlist(conf, ZPOOL_CONFIG_VDEV_TREE, &nvroot)){
+		zpool_close(zhp);
+		return -1;
+	}
+	memset(&zs, 0, sizeof(zs));
+	sample_vdev(nvroot, &zs.root);
+	if(walk_vdevs(nvroot, add_sample, &zs)){
+		free(zs.vdevs);
+		zpool_close(zhp);
+		return -1;
+	}
+	zpool_close(zhp);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	lock_growlight();
+	if((d = find_device(name)) && d->layout == LAYOUT_ZPOOL && d->zpool.info){
+		apply_zpool_sample(d, &zs, &now);
+		d->uistate = gui->block_event(d, d->uistate);
+	}
+	unlock_growlight();
+	free(zs.vdevs);
+	return 0;
+}
+
+int zpool_tick(const glightui *gui){
+	poolname *pools;
+	int count, z;
+	int r = 0;
+
+	if(zht == NULL){
+		return 0;
+	}
+	if(scanpending && rescan_due_p()){
+		r |= scan_zpools(gui);
+	}
+	if((count = collect_zpools(NULL, &pools)) < 0){
+		return -1;
+	}
+	for(z = 0 ; z < count ; ++z){
+		r |= sample_zpool(gui, pools[z]);
+	}
+	free(pools);
+	return r;
+}
+
 int init_zfs_support(const glightui *gui){
 	if((zht = libzfs_init()) == NULL){
 		diag("Warning: couldn't initialize ZFS\n");
@@ -313,6 +917,320 @@ int destroy_zpool(device *d){
 	zpool_close(zhp);
 	return 0;
 }
+
+// A pool as seen through the labels of the devices discovery marked
+// zfs_member. Each top-level vdev survives tolerance missing leaves.
+typedef struct zlabeltop {
+	uint64_t leaves;	// leaves the top-level vdev ought have
+	uint64_t tolerance;
+	uint64_t *seen;		// guids of the leaves we've found
+	unsigned seencount;
+} zlabeltop;
+
+typedef struct zlabelpool {
+	uint64_t guid;
+	char *name;
+	uint64_t topcount;	// ZPOOL_CONFIG_VDEV_CHILDREN
+	zlabeltop *tops;
+	char **paths;		// /dev paths of members found
+	unsigned pathcount;
+	struct zlabelpool *next;
+} zlabelpool;
+
+static void
+free_zlabelpools(zlabelpool *zlp){
+	zlabelpool *p;
+	unsigned z;
+
+	while( (p = zlp) ){
+		zlp = p->next;
+		for(z = 0 ; p->tops && z < p->topcount ; ++z){
+			free(p->tops[z].seen);
+		}
+		free(p->tops);
+		for(z = 0 ; z < p->pathcount ; ++z){
+			free(p->paths[z]);
+		}
+		free(p->paths);
+		free(p->name);
+		free(p);
+	}
+}
+
+static zlabelpool *
+get_zlabelpool(zlabelpool **zlp, nvlist_t *config){
+	uint64_t guid, topcount;
+	zlabelpool *p;
+	char *name;
+
+	if(nvlist_lookup_uint64(config, ZPOOL_CONFIG_POOL_GUID, &guid) ||
+			nvlist_lookup_string(config, ZPOOL_CONFIG_POOL_NAME, &name) ||
+			nvlist_lookup_uint64(config, ZPOOL_CONFIG_VDEV_CHILDREN, &topcount)){
+		return NULL;
+	}
+	for(p = *zlp ; p ; p = p->next){
+		if(p->guid == guid){
+			return p;
+		}
+	}
+	if((p = malloc(sizeof(*p))) == NULL){
+		return NULL;
+	}
+	memset(p, 0, sizeof(*p));
+	if((p->name = strdup(name)) == NULL || (p->tops = calloc(topcount, sizeof(*p->tops))) == NULL){
+		free(p->name);
+		free(p);
+		return NULL;
+	}
+	p->guid = guid;
+	p->topcount = topcount;
+	p->next = *zlp;
+	*zlp = p;
+	return p;
+}
+
+// Record the leaf described by a label within its pool and top-level vdev
+static int
+file_zlabel(zlabelpool **zlp, nvlist_t *config, const char *path){
+	uint64_t id, guid, nparity;
+	nvlist_t *tree, **child;
+	zlabelpool *p;
+	uint_t children;
+	zlabeltop *top;
+	uint64_t *seen;
+	char *type, **paths;
+	unsigned z;
+
+	if((p = get_zlabelpool(zlp, config)) == NULL){
+		return -1;
+	}
+	if(nvlist_lookup_uint64(config, ZPOOL_CONFIG_GUID, &guid) ||
+			nvlist_lookup_nvlist(config, ZPOOL_CONFIG_VDEV_TREE, &tree) ||
+			nvlist_lookup_uint64(tree, ZPOOL_CONFIG_ID, &id) ||
+			nvlist_lookup_string(tree, ZPOOL_CONFIG_TYPE, &type) ||
+			id >= p->topcount){
+		diag("Malformed ZFS label on %s\n", path);
+		return -1;
+	}
+	top = &p->tops[id];
+	if(nvlist_lookup_nvlist_array(tree, ZPOOL_CONFIG_CHILDREN, &child, &children)){
+		children = 1; // the top-level vdev is itself the leaf
+	}
+	top->leaves = children;
+	if(strcmp(type, VDEV_TYPE_MIRROR) == 0){
+		top->tolerance = children - 1;
+	}else if(strcmp(type, VDEV_TYPE_RAIDZ) == 0 &&
+			nvlist_lookup_uint64(tree, ZPOOL_CONFIG_NPARITY, &nparity) == 0){
+		top->tolerance = nparity;
+	}
+	for(z = 0 ; z < top->seencount ; ++z){
+		if(top->seen[z] == guid){
+			return 0; // the same leaf through another path
+		}
+	}
+	if((seen = realloc(top->seen, sizeof(*seen) * (top->seencount + 1))) == NULL){
+		return -1;
+	}
+	top->seen = seen;
+	top->seen[top->seencount++] = guid;
+	if((paths = realloc(p->paths, sizeof(*paths) * (p->pathcount + 1))) == NULL){
+		return -1;
+	}
+	p->paths = paths;
+	if((p->paths[p->pathcount] = strdup(path)) == NULL){
+		return -1;
+	}
+	++p->pathcount;
+	return 0;
+}
+
+// Can the pool be imported from the leaves we found, perhaps degraded?
+static int
+zlabelpool_importable_p(const zlabelpool *p){
+	unsigned z;
+
+	for(z = 0 ; z < p->topcount ; ++z){
+		const zlabeltop *top = &p->tops[z];
+
+		if(top->leaves == 0 || top->seencount + top->tolerance < top->leaves){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+typedef struct importedcb {
+	uint64_t *guids;
+	unsigned count;
+} importedcb;
+
+static int
+importedcb_add(zpool_handle_t *zhp, void *opaque){
+	importedcb *icb = opaque;
+	uint64_t *tmp;
+
+	if((tmp = realloc(icb->guids, sizeof(*tmp) * (icb->count + 1))) == NULL){
+		zpool_close(zhp);
+		return -1;
+	}
+	icb->guids = tmp;
+	icb->guids[icb->count++] = zpool_get_prop_int(zhp, ZPOOL_PROP_GUID, NULL);
+	zpool_close(zhp);
+	return 0;
+}
+
+static int
+zpool_imported_p(const importedcb *icb, uint64_t guid){
+	unsigned z;
+
+	for(z = 0 ; z < icb->count ; ++z){
+		if(icb->guids[z] == guid){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Search only the members we found, rather than all of /dev
+static nvlist_t *
+search_zlabelpool(const zlabelpool *p){
+#ifdef HAVE_LIBPC_HANDLE
+	libpc_handle_t lpch = {
+		.lpc_lib_handle = zht,
+		.lpc_ops = &libzfs_config_ops,
+		.lpc_printerr = false,
+	};
+#endif
+	importargs_t args;
+
+	memset(&args, 0, sizeof(args));
+	args.path = p->paths;
+	args.paths = p->pathcount;
+	args.guid = p->guid;
+#ifdef HAVE_LIBPC_HANDLE
+	return zpool_search_import(&lpch, &args);
+#else
+	return zpool_search_import(zht, &args, &libzfs_config_ops);
+#endif
+}
+
+// Read the label from each device marked zfs_member. Pools already imported
+// are filtered out by guid once the labels have been filed.
+static int
+read_zlabels(zlabelpool **zlp){
+	poolname *names = NULL;
+	unsigned count = 0, z;
+	const controller *c;
+	int r = 0;
+
+	lock_growlight();
+	for(c = get_controllers() ; c ; c = c->next){
+		const device *d;
+
+		for(d = c->blockdevs ; d ; d = d->next){
+			const device *p = d;
+
+			do{
+				if(p->mnttype && zpool_p(p->mnttype)){
+					poolname *tmp = realloc(names, sizeof(*names) * (count + 1));
+
+					if(tmp == NULL){
+						unlock_growlight();
+						free(names);
+						return -1;
+					}
+					names = tmp;
+					strcpy(names[count++], p->name);
+				}
+				p = p == d ? d->parts : p->next;
+			}while(p);
+		}
+	}
+	unlock_growlight();
+	for(z = 0 ; z < count ; ++z){
+		char path[PATH_MAX];
+		nvlist_t *config;
+		int fd, labels;
+
+		snprintf(path, sizeof(path), "/dev/%s", names[z]);
+		if((fd = openat(devfd, names[z], O_RDONLY|O_CLOEXEC)) < 0){
+			diag("Couldn't open %s (%s?)\n", path, strerror(errno));
+			r = -1;
+			continue;
+		}
+		if(zpool_read_label(fd, &config, &labels) || config == NULL){
+			verbf("No ZFS label on %s\n", path);
+			close(fd);
+			continue;
+		}
+		close(fd);
+		if(file_zlabel(zlp, config, path)){
+			r = -1;
+		}
+		nvlist_free(config);
+	}
+	free(names);
+	return r;
+}
+
+int import_zpools(void){
+	zlabelpool *zlp = NULL, *p;
+	unsigned imported = 0;
+	importedcb icb;
+	int r;
+
+	if(zht == NULL){
+		return 0;
+	}
+	// at startup no pool has claimed its members yet, so ask libzfs which
+	// pools are already imported rather than trusting our holders
+	memset(&icb, 0, sizeof(icb));
+	if(zpool_iter(zht, importedcb_add, &icb)){
+		diag("Couldn't enumerate imported zpools\n");
+		free(icb.guids);
+		return -1;
+	}
+	r = read_zlabels(&zlp);
+	for(p = zlp ; p ; p = p->next){
+		nvlist_t *pools;
+		nvpair_t *elem;
+
+		if(zpool_imported_p(&icb, p->guid)){
+			verbf("Zpool %s is already imported\n", p->name);
+			continue;
+		}
+		if(!zlabelpool_importable_p(p)){
+			diag("Not importing %s: too few devices present\n", p->name);
+			continue;
+		}
+		if((pools = search_zlabelpool(p)) == NULL){
+			diag("Couldn't assemble %s from its %u devices\n", p->name, p->pathcount);
+			r = -1;
+			continue;
+		}
+		for(elem = nvlist_next_nvpair(pools, NULL) ; elem ; elem = nvlist_next_nvpair(pools, elem)){
+			nvlist_t *config;
+
+			if(nvpair_value_nvlist(elem, &config) == 0){
+				if(zpool_import(zht, config, NULL, NULL)){
+					diag("Couldn't import %s\n", p->name);
+					r = -1;
+				}else{
+					diag("Imported %s from %u devices\n", p->name, p->pathcount);
+					++imported;
+				}
+			}
+		}
+		nvlist_free(pools);
+	}
+	free_zlabelpools(zlp);
+	free(icb.guids);
+	// imported pools have no sysfs presence to announce them
+	if(imported && scan_zpools(get_glightui())){
+		r = -1;
+	}
+	return r;
+}
 #else
 int init_zfs_support(const glightui *gui __attribute__ ((unused))){
 	diag("No ZFS support in this build.\n");
@@ -332,47 +1250,342 @@ int scan_zpools(const glightui *gui __attribute__ ((unused))){
 	return 0;
 }
 
+int zpools_changed(const glightui *gui __attribute__ ((unused))){
+	return 0;
+}
+
+int zpool_device_event(const glightui *gui __attribute__ ((unused)),
+			const char *name __attribute__ ((unused))){
+	return 0;
+}
+
+int zpool_tick(const glightui *gui __attribute__ ((unused))){
+	return 0;
+}
+
 int destroy_zpool(device *d __attribute__ ((unused))){
 	diag("No ZFS support in this build.\n");
 	return 0;
 }
+
+// Without libzfs, we can neither read labels nor import in-process
+int import_zpools(void){
+	const controller *c;
+	int zpool = 0;
+
+	lock_growlight();
+	for(c = get_controllers() ; c && !zpool ; c = c->next){
+		const device *d, *p;
+
+		for(d = c->blockdevs ; d && !zpool ; d = d->next){
+			zpool = d->mnttype && zpool_p(d->mnttype);
+			for(p = d->parts ; p && !zpool ; p = p->next){
+				zpool = p->mnttype && zpool_p(p->mnttype);
+			}
+		}
+	}
+	unlock_growlight();
+	if(!zpool){
+		return 0;
+	}
+	diag("Scanning for zpools...\n");
+	return vspopen_drain("zpool import -a -f");
+}
 #endif
+
+void free_zpool_info(zpool_info *zi){
+	unsigned z;
+
+	if(zi){
+		for(z = 0 ; z < zi->vdevcount ; ++z){
+			free(zi->vdevs[z].type);
+			free(zi->vdevs[z].path);
+			free(zi->vdevs[z].devname);
+		}
+		free(zi->vdevs);
+		free(zi);
+	}
+}
+
+// Stack the pool atop member, should one of its leaf vdevs lie there
 static int
-generic_make_zpool(const char *type, const char *name, char * const *vdevs, int num){
-	char buf[BUFSIZ];
-	size_t pos;
+zpool_link_member(device *pool, device *member){
+	const zpool_info *zi = pool->zpool.info;
+	unsigned z;
+
+	for(z = 0 ; z < zi->vdevcount ; ++z){
+		if(zi->vdevs[z].devname && strcmp(zi->vdevs[z].devname, member->name) == 0){
+			if(stack_link(pool, member)){
+				return -1;
+			}
+			pool->zpool.transport = merge_transport(pool->zpool.transport, member);
+			break;
+		}
+	}
+	return 0;
+}
+
+int zpool_attach(device *d, const controller *ctrls){
+	const controller *c;
+	int r = 0;
+
+	for(c = ctrls ; c ; c = c->next){
+		device *pool;
+
+		for(pool = c->blockdevs ; pool ; pool = pool->next){
+			device *p;
+
+			if(pool->layout != LAYOUT_ZPOOL || pool->zpool.info == NULL){
+				continue;
+			}
+			r |= zpool_link_member(pool, d);
+			for(p = d->parts ; p ; p = p->next){
+				r |= zpool_link_member(pool, p);
+			}
+		}
+	}
+	return r;
+}
+
+unsigned zpool_ashift(unsigned physsec){
+	unsigned ashift = ZPOOL_MIN_ASHIFT;
+
+	while((1u << ashift) < physsec && ashift < ZPOOL_MAX_ASHIFT){
+		++ashift;
+	}
+	return ashift;
+}
+
+// The vdev classes of a pool, in the order zpool(8) takes them
+typedef enum {
+	ZCLASS_DATA,
+	ZCLASS_LOG,
+	ZCLASS_CACHE,
+	ZCLASS_SPECIAL,
+	ZCLASS_COUNT
+} zclass_e;
+
+static const char * const zclass_names[ZCLASS_COUNT] = {
+	"data", "log", "cache", "special",
+};
+
+typedef struct zclass {
+	unsigned count;
+	uintmax_t minsize;	// smallest member, in bytes
+	uintmax_t bw;		// slowest member's disk in bits/s, 0 if unknown
+	size_t pos;		// length of devs
+	char devs[BUFSIZ];	// " /dev/member"...
+} zclass;
+
+static zclass_e
+zclass_keyword(const char *comp){
+	int z;
+
+	for(z = ZCLASS_LOG ; z < ZCLASS_COUNT ; ++z){
+		if(strcmp(comp, zclass_names[z]) == 0){
+			return z;
+		}
+	}
+	return ZCLASS_DATA;
+}
+
+// Sort the components into classes, and find the largest physical sector
+// among them. Returns -1 on error.
+static int
+classify_vdevs(char * const *vdevs, int num, zclass *zc, unsigned *physsec){
+	zclass_e cur = ZCLASS_DATA;
 	int z;
 
-	pos = 0;
-#define PREFIX "/dev/"
+	memset(zc, 0, sizeof(*zc) * ZCLASS_COUNT);
+	*physsec = 0;
 	for(z = 0 ; z < num ; ++z){
-		if((unsigned)snprintf(buf + pos, sizeof(buf) - pos, " %s%s", PREFIX, *vdevs) >= sizeof(buf) - pos){
+		const device *d, *disk;
+		zclass *c;
+		uintmax_t bw;
+		zclass_e k;
+
+		if((k = zclass_keyword(vdevs[z])) != ZCLASS_DATA){
+			cur = k;
+			continue;
+		}
+		c = &zc[cur];
+		if((unsigned)snprintf(c->devs + c->pos, sizeof(c->devs) - c->pos, " /dev/%s", vdevs[z])
+				>= sizeof(c->devs) - c->pos){
+			diag("Too many arguments for zpool creation\n");
+			return -1;
+		}
+		c->pos += strlen(c->devs + c->pos);
+		lock_growlight();
+		if((d = lookup_device(vdevs[z])) == NULL){
+			unlock_growlight();
+			return -1;
+		}
+		if(d->physsec > *physsec){
+			*physsec = d->physsec;
+		}
+		if(c->count == 0 || d->size < c->minsize){
+			c->minsize = d->size;
+		}
+		disk = d->layout == LAYOUT_PARTITION && d->partdev.parent ? d->partdev.parent : d;
+		bw = stack_member_bw(disk);
+		if(c->count == 0 || (bw && (c->bw == 0 || bw < c->bw))){
+			c->bw = bw;
+		}
+		unlock_growlight();
+		++c->count;
+	}
+	return 0;
+}
+
+// Describe how well each auxiliary class is sized for a pool holding
+// datacap bytes of data (0 if unknown)
+static void
+advise_zclasses(const zclass *zc, uintmax_t datacap){
+	const long pagesz = sysconf(_SC_PAGESIZE);
+	const long pages = sysconf(_SC_PHYS_PAGES);
+
+	if(zc[ZCLASS_LOG].count && zc[ZCLASS_LOG].bw){
+		uintmax_t need = zc[ZCLASS_LOG].bw / 8 * ZPOOL_LOG_TXGS * ZPOOL_TXG_SECS;
+
+		diag("log: %.1fGB holds %u transaction groups at %juMbps (have %.1fGB)\n",
+			need / 1000000000.0, ZPOOL_LOG_TXGS, zc[ZCLASS_LOG].bw / 1000000,
+			zc[ZCLASS_LOG].minsize / 1000000000.0);
+	}
+	if(zc[ZCLASS_CACHE].count && pagesz > 0 && pages > 0){
+		uintmax_t arc = (uintmax_t)pagesz * pages / 2;
+		uintmax_t have = zc[ZCLASS_CACHE].minsize * zc[ZCLASS_CACHE].count;
+
+		diag("cache: up to %.1fGB is useful with a %.1fGB ARC (have %.1fGB)\n",
+			arc * ZPOOL_L2ARC_ARC_RATIO / 1000000000.0, arc / 1000000000.0,
+			have / 1000000000.0);
+	}
+	if(zc[ZCLASS_SPECIAL].count && datacap){
+		diag("special: at least %.1fGB for the metadata of %.1fGB (have %.1fGB)\n",
+			datacap / 1000 * ZPOOL_SPECIAL_PERMILLE / 1000000000.0,
+			datacap / 1000000000.0, zc[ZCLASS_SPECIAL].minsize / 1000000000.0);
+		if(zc[ZCLASS_SPECIAL].count == 1){
+			diag("special: losing an unmirrored special vdev loses the pool\n");
+		}
+	}
+}
+
+// Append the auxiliary classes to a zpool command line. Logs and special
+// vdevs are mirrored when given more than one member; caches never are.
+static int
+zclass_args(const zclass *zc, char *buf, size_t len){
+	size_t pos = 0;
+	int z;
+
+	buf[0] = '\0';
+	for(z = ZCLASS_LOG ; z < ZCLASS_COUNT ; ++z){
+		if(zc[z].count == 0){
+			continue;
+		}
+		if((unsigned)snprintf(buf + pos, len - pos, " %s%s%s", zclass_names[z],
+				z != ZCLASS_CACHE && zc[z].count > 1 ? " mirror" : "", zc[z].devs)
+				>= len - pos){
 			diag("Too many arguments for zpool creation\n");
 			return -1;
 		}
-		++vdevs;
 		pos += strlen(buf + pos);
 	}
-#undef PREFIX
-	// FIXME also, ashift with 512-byte sectors wastes space
+	return 0;
+}
+
+static int
+generic_make_zpool(const char *type, unsigned parity, const char *name,
+			char * const *vdevs, int num){
+	zclass zc[ZCLASS_COUNT];
+	char aux[BUFSIZ * 3];
+	unsigned physsec;
+	uintmax_t datacap;
+
+	if(classify_vdevs(vdevs, num, zc, &physsec)){
+		return -1;
+	}
+	if(zc[ZCLASS_DATA].count <= parity){
+		diag("%s needs more than %u data vdevs\n", type, parity);
+		return -1;
+	}
+	if(zclass_args(zc, aux, sizeof(aux))){
+		return -1;
+	}
+	// mirrors hold one member's worth, raidz all but the parity's worth
+	datacap = zc[ZCLASS_DATA].minsize * (parity ? zc[ZCLASS_DATA].count - parity : 1);
+	advise_zclasses(zc, datacap);
 	// FIXME see notes below (make_zfs()) regarding unsafe use of -f
-	return vspopen_drain("zpool create -f -oashift=12 %s %s %s", name, type, buf);
+	return vspopen_drain("zpool create -f -oashift=%u %s %s%s%s", zpool_ashift(physsec),
+			name, type, zc[ZCLASS_DATA].devs, aux);
 }
 
 int make_zmirror(const char *name, char * const *vdevs, int num){
-	return generic_make_zpool("mirror", name, vdevs, num);
+	return generic_make_zpool("mirror", 0, name, vdevs, num);
 }
 
 int make_raidz1(const char *name, char * const *vdevs, int num){
-	return generic_make_zpool("raidz1", name, vdevs, num);
+	return generic_make_zpool("raidz1", 1, name, vdevs, num);
 }
 
 int make_raidz2(const char *name, char * const *vdevs, int num){
-	return generic_make_zpool("raidz2", name, vdevs, num);
+	return generic_make_zpool("raidz2", 2, name, vdevs, num);
 }
 
 int make_raidz3(const char *name, char * const *vdevs, int num){
-	return generic_make_zpool("raidz3", name, vdevs, num);
+	return generic_make_zpool("raidz3", 3, name, vdevs, num);
+}
+
+// Add vdevs of one auxiliary class to the existing pool name
+static int
+add_zpool_class(zclass_e class, const char *name, char * const *vdevs, int num){
+	zclass zc[ZCLASS_COUNT];
+	char aux[BUFSIZ * 3];
+	uintmax_t datacap = 0;
+	unsigned physsec;
+	const device *d;
+	int z;
+
+	for(z = 0 ; z < num ; ++z){
+		if(zclass_keyword(vdevs[z]) != ZCLASS_DATA){
+			diag("Can't add %s vdevs as %s\n", vdevs[z], zclass_names[class]);
+			return -1;
+		}
+	}
+	if(classify_vdevs(vdevs, num, zc, &physsec)){
+		return -1;
+	}
+	zc[class] = zc[ZCLASS_DATA];
+	zc[ZCLASS_DATA].count = 0;
+	if(zclass_args(zc, aux, sizeof(aux))){
+		return -1;
+	}
+	lock_growlight();
+	if((d = find_device(name)) == NULL || d->layout != LAYOUT_ZPOOL){
+		unlock_growlight();
+		diag("%s is not an imported zpool\n", name);
+		return -1;
+	}
+	datacap = d->size;
+	unlock_growlight();
+	advise_zclasses(zc, datacap);
+	// no -f: zpool's objections (mismatched replication, devices in use,
+	// existing signatures) are exactly what the user ought see
+	if(vspopen_drain("zpool add -oashift=%u %s%s", zpool_ashift(physsec), name, aux)){
+		diag("zpool refused to add %s vdevs to %s (see above)\n", zclass_names[class], name);
+		return -1;
+	}
+	return 0;
+}
+
+int make_zlog(const char *name, char * const *vdevs, int num){
+	return add_zpool_class(ZCLASS_LOG, name, vdevs, num);
+}
+
+int make_zcache(const char *name, char * const *vdevs, int num){
+	return add_zpool_class(ZCLASS_CACHE, name, vdevs, num);
+}
+
+int make_zspecial(const char *name, char * const *vdevs, int num){
+	return add_zpool_class(ZCLASS_SPECIAL, name, vdevs, num);
 }
 
 // FIXME rather than using -f with creation, we ought make the vdevs conform to
@@ -10,19 +10,125 @@ struct device;
 
 #include "fs.h"
 #include <stdio.h>
+#include <time.h>
+#include <stdint.h>
 #include "growlight.h"
 
+// A vdev of a zpool, as found in its config's vdev tree. vdevs are kept in
+// depth-first order, each top-level vdev followed by its children.
+typedef struct zpool_vdev {
+	char *type;		// "disk", "file", "mirror", "raidz", ...
+	char *path;		// Leaf vdevs only, otherwise NULL
+	char *devname;		// Block device backing a leaf, if known
+	uint64_t guid;
+	unsigned depth;		// 1 for top-level vdevs, 2 for their children...
+	unsigned top;		// Index of the top-level vdev we're under
+	// Cumulative counters from vdev_stat_t and the latency histograms
+	uint64_t ops[2];	// Reads, writes
+	uint64_t bytes[2];
+	uint64_t errors;	// Read, write and checksum errors
+	uint64_t latops;	// I/Os in the total latency histograms,
+	uint64_t latns;		//  and their approximate summed latency
+	// Rates over the most recent stats tick, once two samples are taken
+	uint64_t bps[2];	// Bytes/s read, written
+	uint64_t iops[2];
+	uint64_t latus;		// Mean latency (µs), 0 if there was no I/O
+	unsigned slow;		// A leaf well behind its siblings
+} zpool_vdev;
+
+// Cached pool properties and vdev membership, compared against each refresh
+// so that the UI is only notified of pools which actually changed.
+typedef struct zpool_info {
+	char health[20];
+	uintmax_t allocated;
+	uintmax_t free;
+	unsigned capacity;	// Percent allocated
+	char dedupratio[16];
+	unsigned vdevcount;
+	zpool_vdev *vdevs;
+	struct timespec sampled; // CLOCK_MONOTONIC time of the last stats
+				//  sample, all 0s if none has been taken
+} zpool_info;
+
+// A leaf vdev is flagged slow if its mean latency over a stats tick is at
+// least ZPOOL_SLOW_FACTOR times the median of the other leaves under its
+// top-level vdev, and at least ZPOOL_SLOW_MIN_US. One slow disk holds an
+// entire raidz back.
+#define ZPOOL_SLOW_FACTOR 3
+#define ZPOOL_SLOW_MIN_US 2000
+
+// Full rescans (following bdi events, which can't be tied to any one pool)
+// are run no more often than this. Requests arriving sooner are deferred.
+#define ZPOOL_RESCAN_SECS 5
+
 int init_zfs_support(const glightui *);
 int stop_zfs_support(void);
+
+// Refresh every pool and root dataset right away
 int scan_zpools(const glightui *);
+
+// Something changed, but we don't know which pools it affected. Rescans all
+// pools, or defers the rescan if one was run within ZPOOL_RESCAN_SECS.
+int zpools_changed(const glightui *);
+
+// A block device changed. Refresh only those pools having it as a vdev.
+int zpool_device_event(const glightui *, const char *name);
+
+// Called from the stats tick, without the lock held. Samples each pool's
+// vdev I/O counters, filling in the pools' stats and statdelta from their
+// root vdevs, and runs any deferred rescan which has come due.
+int zpool_tick(const glightui *);
+
+void free_zpool_info(zpool_info *);
+
+// Stack each pool of ctrls atop d or its partitions, wherever one of its leaf
+// vdevs lies. Pools are scanned before any disk is discovered, and sysfs
+// knows nothing of them, so disks find their pools thus as they arrive.
+// Called with the growlight lock held.
+int zpool_attach(struct device *d, const struct controller *ctrls);
+
+// Import pools found in the labels of devices discovery marked zfs_member,
+// and which no imported pool holds. Labels are grouped by pool GUID, and
+// only pools whose every top-level vdev has enough leaves present (perhaps
+// degraded) are imported, searching only the devices found, and then
+// scanned in atop their members. Call without the growlight lock held.
+int import_zpools(void);
+
 int print_zfs_version(FILE *);
 int destroy_zpool(struct device *);
 
+// ashift is the base 2 logarithm of the largest physical sector among a
+// pool's members, bounded to what ZFS supports
+#define ZPOOL_MIN_ASHIFT 9
+#define ZPOOL_MAX_ASHIFT 16
+unsigned zpool_ashift(unsigned physsec);
+
+// Sizing advice for auxiliary vdevs, reported as they're created. A log
+// need hold only ZPOOL_LOG_TXGS transaction groups of ZPOOL_TXG_SECS at its
+// device's bandwidth. A cache beyond ZPOOL_L2ARC_ARC_RATIO times the ARC
+// (taken to be half of RAM) costs more ARC in headers than it's worth.
+// Special vdevs need hold ZPOOL_SPECIAL_PERMILLE of the pool's data in
+// metadata, more if small blocks are directed there.
+#define ZPOOL_LOG_TXGS 2
+#define ZPOOL_TXG_SECS 5
+#define ZPOOL_L2ARC_ARC_RATIO 5
+#define ZPOOL_SPECIAL_PERMILLE 3
+
+// Create a pool of the data vdevs with -oashift from the largest physical
+// sector among all members. The components "log", "cache" and "special"
+// switch the class of the devices following them. Logs and special vdevs
+// with more than one member are mirrored.
 int make_zmirror(const char *,char * const *,int);
 int make_raidz1(const char *,char * const *,int);
 int make_raidz2(const char *,char * const *,int);
 int make_raidz3(const char *,char * const *,int);
 
+// Add log, cache or special vdevs to the existing pool named by the first
+// argument
+int make_zlog(const char *,char * const *,int);
+int make_zcache(const char *,char * const *,int);
+int make_zspecial(const char *,char * const *,int);
+
 // Make a zpool from a single device (not recommended)
 int make_zfs(const char *,const struct mkfsmarshal *);
 
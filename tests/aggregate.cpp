@@ -0,0 +1,196 @@
+#include "main.h"
+#include "aggregate.h"
+#include <cstring>
+#include <deque>
+#include <string>
+
+#define TB 1000000000000ull
+
+// Controllers and their disks, linked up as growlight would have them
+struct fleet {
+  std::deque<controller> ctrls;
+  std::deque<device> devs;
+
+  controller* add_controller(const char* ident, uintmax_t bw, int node) {
+    ctrls.emplace_back();
+    controller* c = &ctrls.back();
+    memset(c, 0, sizeof(*c));
+    c->ident = const_cast<char*>(ident);
+    c->bandwidth = bw;
+    c->numa_node = node;
+    if(ctrls.size() > 1){
+      ctrls[ctrls.size() - 2].next = c;
+    }
+    return c;
+  }
+
+  device* add_disk(controller* c, const char* name, const char* model, uintmax_t size) {
+    devs.emplace_back();
+    device* d = &devs.back();
+    memset(d, 0, sizeof(*d));
+    strcpy(d->name, name);
+    d->model = const_cast<char*>(model);
+    d->size = size;
+    d->c = c;
+    d->layout = LAYOUT_NONE;
+    d->blkdev.realdev = 1;
+    d->blkdev.rotation = SSD_ROTATION;
+    d->blkdev.transport = SERIAL_ATAIII;
+    d->next = c->blockdevs;
+    c->blockdevs = d;
+    return d;
+  }
+
+  device* add_partition(device* disk, const char* name, uintmax_t size) {
+    devs.emplace_back();
+    device* p = &devs.back();
+    memset(p, 0, sizeof(*p));
+    strcpy(p->name, name);
+    p->size = size;
+    p->c = disk->c;
+    p->layout = LAYOUT_PARTITION;
+    p->partdev.parent = disk;
+    p->partdev.ptype = 0xfd00; // Linux RAID
+    p->next = disk->parts;
+    disk->parts = p;
+    disk->blkdev.pttable = const_cast<char*>("gpt");
+    return p;
+  }
+
+  const controller* controllers() const {
+    return ctrls.empty() ? nullptr : &ctrls.front();
+  }
+};
+
+static bool planned(const aggplan* plan, const char* name) {
+  for(unsigned z = 0 ; z < plan->count ; ++z){
+    if(strcmp(plan->members[z], name) == 0){
+      return true;
+    }
+  }
+  return false;
+}
+
+TEST_CASE("PlanAggregate") {
+  fleet f;
+  aggplan plan;
+
+  SUBCASE("MatchingModels") {
+    controller* c = f.add_controller("sas0", 48000000000ull, 0);
+    f.add_disk(c, "sda", "ST4000", 4 * TB);
+    f.add_disk(c, "sdb", "WD4000", 4 * TB);
+    f.add_disk(c, "sdc", "ST4000", 4 * TB);
+    f.add_disk(c, "sdd", "ST4000", 4 * TB);
+    REQUIRE(0 == plan_aggregate_among(get_aggregate("mdraid5"), f.controllers(), 0, &plan));
+    CHECK(3 == plan.count);
+    CHECK(!planned(&plan, "sdb"));
+    CHECK(8 * TB == plan.capacity);
+    // three members, each at its SATA III link, with one's worth of parity
+    CHECK(2 * 6000000000ull == plan.throughput);
+    REQUIRE(nullptr != plan.explanation);
+    CHECK(nullptr != strstr(plan.explanation, "matching model and size"));
+    free_aggplan(&plan);
+  }
+
+  // The smallest member governs a set of differing sizes
+  SUBCASE("DifferingSizes") {
+    controller* c = f.add_controller("sas0", 48000000000ull, 0);
+    f.add_disk(c, "sda", "ST4000", 4 * TB);
+    f.add_disk(c, "sdb", "WD2000", 2 * TB);
+    REQUIRE(0 == plan_aggregate_among(get_aggregate("mdraid1"), f.controllers(), 0, &plan));
+    CHECK(2 == plan.count);
+    CHECK(2 * TB == plan.capacity);
+    CHECK(nullptr != strstr(plan.explanation, "smallest governs"));
+    free_aggplan(&plan);
+  }
+
+  // No more members than are needed to provide the capacity
+  SUBCASE("Capacity") {
+    controller* c = f.add_controller("sas0", 48000000000ull, 0);
+    f.add_disk(c, "sda", "ST1000", 1 * TB);
+    f.add_disk(c, "sdb", "ST1000", 1 * TB);
+    f.add_disk(c, "sdc", "ST1000", 1 * TB);
+    f.add_disk(c, "sdd", "ST1000", 1 * TB);
+    f.add_disk(c, "sde", "ST1000", 1 * TB);
+    REQUIRE(0 == plan_aggregate_among(get_aggregate("mdraid0"), f.controllers(), 2 * TB, &plan));
+    CHECK(2 == plan.count);
+    CHECK(2 * TB == plan.capacity);
+    free_aggplan(&plan);
+    REQUIRE(0 == plan_aggregate_among(get_aggregate("mdraid6"), f.controllers(), 3 * TB, &plan));
+    CHECK(5 == plan.count);
+    free_aggplan(&plan);
+    CHECK(0 > plan_aggregate_among(get_aggregate("mdraid0"), f.controllers(), 6 * TB, &plan));
+    CHECK(0 == plan.count);
+  }
+
+  // Two members on one controller would each see but half its link
+  SUBCASE("SpreadAcrossControllers") {
+    controller* c0 = f.add_controller("ahci0", 6000000000ull, 0);
+    controller* c1 = f.add_controller("ahci1", 6000000000ull, 0);
+    device* a = f.add_disk(c0, "sda", "SSD", TB);
+    f.add_disk(c0, "sdb", "SSD", TB);
+    device* c = f.add_disk(c1, "sdc", "SSD", TB);
+    f.add_disk(c1, "sdd", "SSD", TB);
+    REQUIRE(0 == plan_aggregate_among(get_aggregate("mdraid1"), f.controllers(), 0, &plan));
+    REQUIRE(2 == plan.count);
+    CHECK(planned(&plan, a->name) != planned(&plan, "sdb"));
+    CHECK(planned(&plan, c->name) != planned(&plan, "sdd"));
+    CHECK(6000000000ull == plan.throughput);
+    free_aggplan(&plan);
+  }
+
+  // Given the choice, the controller with more headroom over its demand
+  SUBCASE("Headroom") {
+    controller* c0 = f.add_controller("ahci0", 12000000000ull, 0);
+    controller* c1 = f.add_controller("ahci1", 12000000000ull, 0);
+    controller* c2 = f.add_controller("ahci2", 12000000000ull, 0);
+    c0->demand = 10000000000ull;
+    c2->demand = 8000000000ull;
+    f.add_disk(c0, "sda", "SSD", TB);
+    f.add_disk(c1, "sdb", "SSD", TB);
+    f.add_disk(c2, "sdc", "SSD", TB);
+    REQUIRE(0 == plan_aggregate_among(get_aggregate("mdraid1"), f.controllers(), 0, &plan));
+    CHECK(planned(&plan, "sdb"));
+    CHECK(planned(&plan, "sdc"));
+    free_aggplan(&plan);
+  }
+
+  // Partitions are candidates, but never two from the same disk
+  SUBCASE("OnePerDisk") {
+    controller* c = f.add_controller("sas0", 48000000000ull, 0);
+    device* sda = f.add_disk(c, "sda", "ST4000", 4 * TB);
+    f.add_partition(sda, "sda1", 2 * TB);
+    f.add_partition(sda, "sda2", 2 * TB);
+    CHECK(0 > plan_aggregate_among(get_aggregate("mdraid1"), f.controllers(), 0, &plan));
+    device* sdb = f.add_disk(c, "sdb", "ST4000", 4 * TB);
+    f.add_partition(sdb, "sdb1", 2 * TB);
+    REQUIRE(0 == plan_aggregate_among(get_aggregate("mdraid1"), f.controllers(), 0, &plan));
+    CHECK(2 == plan.count);
+    CHECK(planned(&plan, "sdb1"));
+    CHECK(planned(&plan, "sda1") != planned(&plan, "sda2"));
+    free_aggplan(&plan);
+  }
+
+  // Members of other aggregates and read-only disks aren't volunteered
+  SUBCASE("InUse") {
+    controller* c = f.add_controller("sas0", 48000000000ull, 0);
+    f.add_disk(c, "sda", "ST4000", 4 * TB)->mnttype = const_cast<char*>("linux_raid_member");
+    f.add_disk(c, "sdb", "ST4000", 4 * TB)->roflag = 1;
+    f.add_disk(c, "sdc", "ST4000", 4 * TB);
+    CHECK(0 > plan_aggregate_among(get_aggregate("mdraid1"), f.controllers(), 0, &plan));
+    f.add_disk(c, "sdd", "ST4000", 4 * TB);
+    REQUIRE(0 == plan_aggregate_among(get_aggregate("mdraid1"), f.controllers(), 0, &plan));
+    CHECK(planned(&plan, "sdc"));
+    CHECK(planned(&plan, "sdd"));
+    free_aggplan(&plan);
+  }
+
+  SUBCASE("Unplannable") {
+    controller* c = f.add_controller("sas0", 48000000000ull, 0);
+    f.add_disk(c, "sda", "ST4000", 4 * TB);
+    f.add_disk(c, "sdb", "ST4000", 4 * TB);
+    CHECK(!aggregate_plannable_p(get_aggregate("dmcache")));
+    CHECK(0 > plan_aggregate_among(get_aggregate("dmcache"), f.controllers(), 0, &plan));
+  }
+
+}
@@ -0,0 +1,97 @@
+#include "main.h"
+#include "growlight.h"
+#include "fs.h"
+#include <cstring>
+
+TEST_CASE("MkfsTopology") {
+  struct mkfsmarshal mkm;
+  device md, part, disk;
+  memset(&mkm, 0, sizeof(mkm));
+  memset(&md, 0, sizeof(md));
+  memset(&part, 0, sizeof(part));
+  memset(&disk, 0, sizeof(disk));
+  strcpy(md.name, "md0");
+  md.layout = LAYOUT_MDADM;
+  md.logsec = md.physsec = 512;
+  md.mddev.stride = 512 * 1024;
+  md.mddev.swidth = 4;
+  strcpy(part.name, "md0p1");
+  part.layout = LAYOUT_PARTITION;
+  part.logsec = part.physsec = 512;
+  part.partdev.parent = &md;
+  strcpy(disk.name, "sda");
+  disk.layout = LAYOUT_NONE;
+
+  SUBCASE("Unstriped") {
+    disk.logsec = 512;
+    disk.physsec = 4096;
+    mkfs_topology(&disk, &mkm);
+    CHECK(0 == mkm.stride);
+    CHECK(0 == mkm.swidth);
+    CHECK(4096 == mkm.sectsize);
+  }
+
+  SUBCASE("UnknownSectors") {
+    mkfs_topology(&disk, &mkm);
+    CHECK(512 == mkm.sectsize);
+  }
+
+  SUBCASE("MdArray") {
+    mkfs_topology(&md, &mkm);
+    CHECK(512 * 1024 == mkm.stride);
+    CHECK(4 == mkm.swidth);
+  }
+
+  // dm stripes and hardware RAID advertise their geometry as I/O hints
+  SUBCASE("IoHints") {
+    disk.minio = 64 * 1024;
+    disk.optio = 6 * 64 * 1024;
+    mkfs_topology(&disk, &mkm);
+    CHECK(64 * 1024 == mkm.stride);
+    CHECK(6 == mkm.swidth);
+    disk.optio = 100 * 1024;
+    mkfs_topology(&disk, &mkm);
+    CHECK(0 == mkm.stride);
+    disk.optio = disk.minio;
+    mkfs_topology(&disk, &mkm);
+    CHECK(0 == mkm.stride);
+  }
+
+  SUBCASE("AlignedPartition") {
+    part.partdev.fsector = 2048; // 1MiB, two stripe units
+    mkfs_topology(&part, &mkm);
+    CHECK(512 * 1024 == mkm.stride);
+    CHECK(4 == mkm.swidth);
+  }
+
+  // 1MiB alignment isn't enough for a 768KiB stripe unit
+  SUBCASE("MisalignedPartition") {
+    md.mddev.stride = 768 * 1024;
+    part.partdev.fsector = 2048;
+    mkfs_topology(&part, &mkm);
+    CHECK(0 == mkm.stride);
+    CHECK(0 == mkm.swidth);
+    part.partdev.fsector = 1536 * 2;
+    mkfs_topology(&part, &mkm);
+    CHECK(768 * 1024 == mkm.stride);
+  }
+
+  // sysfs reckons the start in 512-byte sectors, even on 4Kn devices
+  SUBCASE("LogicalSectors") {
+    md.logsec = md.physsec = 4096;
+    part.logsec = part.physsec = 4096;
+    part.partdev.fsector = 1024; // 512KiB
+    mkfs_topology(&part, &mkm);
+    CHECK(512 * 1024 == mkm.stride);
+    CHECK(4096 == mkm.sectsize);
+    // 256KiB is no multiple of 1MiB, though 512 4KiB sectors would be
+    md.mddev.stride = 1024 * 1024;
+    part.partdev.fsector = 512;
+    mkfs_topology(&part, &mkm);
+    CHECK(0 == mkm.stride);
+    part.partdev.fsector = 2048;
+    mkfs_topology(&part, &mkm);
+    CHECK(1024 * 1024 == mkm.stride);
+  }
+
+}
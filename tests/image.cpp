@@ -0,0 +1,278 @@
+#include "main.h"
+#include "ptypes.h"
+#include "ptable.h"
+#include "image.h"
+#include "snapshot.h"
+#include "gpt.h"
+#include "audit.h"
+#include "stack.h"
+#include "growlight.h"
+#include <zlib.h>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <ftw.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define IMAGE_SIZE (64ull * 1024 * 1024)
+#define LBA 512u
+
+static std::string imagedir;
+
+// Build a fresh image path in a private directory (no root, no loop devices)
+static std::string image_path(const char* name) {
+  if(imagedir.empty()){
+    char tmpl[] = "/tmp/growlight-tester-XXXXXX";
+    REQUIRE(nullptr != mkdtemp(tmpl));
+    imagedir = tmpl;
+    // keep destructive operations' snapshots out of the system store
+    REQUIRE(0 == set_snapshot_dir((imagedir + "/snapshots").c_str()));
+  }
+  return imagedir + "/" + name;
+}
+
+static int remove_entry(const char* path, const struct stat*, int, struct FTW*) {
+  return remove(path);
+}
+
+// Remove the directory along with any images and snapshots left within it
+static void remove_image_dir() {
+  if(!imagedir.empty()){
+    CHECK(0 == nftw(imagedir.c_str(), remove_entry, 8, FTW_DEPTH | FTW_PHYS));
+    imagedir.clear();
+  }
+}
+
+static void read_lba(const char* path, uint64_t lba, void* buf) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  REQUIRE(0 <= fd);
+  CHECK(static_cast<ssize_t>(LBA) == pread(fd, buf, LBA, lba * LBA));
+  close(fd);
+}
+
+// Verify a GPT header at LBA hlba: signature, self-reference, and both CRCs
+static void check_gpt(const char* path, uint64_t hlba, uint64_t otherlba) {
+  unsigned char sector[LBA];
+  read_lba(path, hlba, sector);
+  gpt_header* gh = reinterpret_cast<gpt_header*>(sector);
+  CHECK(0 == memcmp(&gh->signature, "EFI PART", sizeof(gh->signature)));
+  auto lba = gh->lba;
+  CHECK(hlba == lba);
+  auto backuplba = gh->backuplba;
+  CHECK(otherlba == backuplba);
+  uint32_t crc = gh->crc;
+  gh->crc = 0;
+  CHECK(crc == crc32(0, sector, gh->headsize));
+  size_t pesize = static_cast<size_t>(gh->partcount) * gh->partsize;
+  auto entries = new unsigned char[pesize];
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  REQUIRE(0 <= fd);
+  CHECK(static_cast<ssize_t>(pesize) == pread(fd, entries, pesize, gh->partlba * LBA));
+  close(fd);
+  uint32_t partcrc = gh->partcrc;
+  CHECK(partcrc == crc32(0, entries, pesize));
+  delete[] entries;
+}
+
+TEST_CASE("Image") {
+  const uint64_t lbas = IMAGE_SIZE / LBA;
+
+  SUBCASE("Sparse") {
+    auto path = image_path("sparse.img");
+    device* d = create_image_device(path.c_str(), IMAGE_SIZE, LBA, 4096, 0);
+    REQUIRE(d);
+    CHECK(image_device_p(d));
+    // no table detected, so there's nothing to wipe
+    CHECK(0 != wipe_ptable(d, nullptr));
+    struct stat st;
+    CHECK(0 == stat(path.c_str(), &st));
+    CHECK(IMAGE_SIZE == static_cast<uint64_t>(st.st_size));
+    CHECK(IMAGE_SIZE > static_cast<uint64_t>(st.st_blocks) * 512);
+    free_image_device(d);
+    unlink(path.c_str());
+  }
+
+  SUBCASE("BadGeometry") {
+    auto path = image_path("bad.img");
+    CHECK(nullptr == create_image_device(path.c_str(), IMAGE_SIZE, LBA, 1000, 0));
+    CHECK(nullptr == create_image_device(path.c_str(), IMAGE_SIZE + 1, LBA, LBA, 0));
+  }
+
+  SUBCASE("GPT") {
+    auto path = image_path("gpt.img");
+    device* d = create_image_device(path.c_str(), IMAGE_SIZE, LBA, 4096, 1);
+    REQUIRE(d);
+    CHECK(0 == make_partition_table(d, "gpt"));
+    // the new table must be detected
+    CHECK(0 != make_partition_table(d, "gpt"));
+    check_gpt(path.c_str(), 1, lbas - 1);
+    check_gpt(path.c_str(), lbas - 1, 1);
+    // protective MBR
+    unsigned char sector[LBA];
+    read_lba(path.c_str(), 0, sector);
+    CHECK(0xee == sector[MBR_OFFSET + 6 + 4]);
+    CHECK(0x55 == sector[510]);
+    CHECK(0xaa == sector[511]);
+    CHECK(0 == add_partition(d, L"growlight", 2048, 4095, PARTROLE_PRIMARY));
+    check_gpt(path.c_str(), 1, lbas - 1);
+    check_gpt(path.c_str(), lbas - 1, 1);
+    read_lba(path.c_str(), 2, sector);
+    const gpt_entry* gpe = reinterpret_cast<const gpt_entry*>(sector);
+    auto first = gpe->first_lba;
+    auto last = gpe->last_lba;
+    CHECK(2048 == first);
+    CHECK(4095 == last);
+    CHECK(0 == wipe_ptable(d, nullptr));
+    CHECK(0 != wipe_ptable(d, nullptr));
+    read_lba(path.c_str(), 1, sector);
+    CHECK(0 != memcmp(sector, "EFI PART", 8));
+    read_lba(path.c_str(), lbas - 1, sector);
+    CHECK(0 != memcmp(sector, "EFI PART", 8));
+    free_image_device(d);
+    unlink(path.c_str());
+  }
+
+  SUBCASE("MSDOS") {
+    auto path = image_path("msdos.img");
+    device* d = create_image_device(path.c_str(), IMAGE_SIZE, LBA, LBA, 0);
+    REQUIRE(d);
+    CHECK(0 == make_partition_table(d, "dos"));
+    // a GPT partition can't be added to an MBR
+    CHECK(0 != add_partition(d, L"growlight", 2048, 8191, PARTROLE_PRIMARY));
+    CHECK(0 == add_partition(d, nullptr, 2048, 8191, PARTROLE_PRIMARY));
+    unsigned char sector[LBA];
+    read_lba(path.c_str(), 0, sector);
+    CHECK(0x83 == sector[MBR_OFFSET + 6 + 4]);
+    uint32_t lbafirst;
+    memcpy(&lbafirst, sector + MBR_OFFSET + 6 + 8, sizeof(lbafirst));
+    CHECK(2048 == lbafirst);
+    CHECK(0 == wipe_ptable(d, nullptr));
+    CHECK(0 != wipe_ptable(d, nullptr));
+    read_lba(path.c_str(), 0, sector);
+    CHECK(0 == sector[510]);
+    free_image_device(d);
+    unlink(path.c_str());
+  }
+
+  SUBCASE("APM") {
+    auto path = image_path("apm.img");
+    device* d = create_image_device(path.c_str(), IMAGE_SIZE, LBA, LBA, 0);
+    REQUIRE(d);
+    CHECK(0 == make_partition_table(d, "apm"));
+    CHECK(0 != make_partition_table(d, "dos"));
+    CHECK(0 == wipe_ptable(d, nullptr));
+    CHECK(0 != wipe_ptable(d, nullptr));
+    free_image_device(d);
+    unlink(path.c_str());
+  }
+
+  SUBCASE("Snapshot") {
+    auto path = image_path("snap.img");
+    device* d = create_image_device(path.c_str(), IMAGE_SIZE, LBA, 4096, 0);
+    REQUIRE(d);
+    CHECK(0 == make_partition_table(d, "gpt"));
+    CHECK(0 == add_partition(d, L"keep", 2048, 4095, PARTROLE_PRIMARY));
+    char* snap = snapshot_ptable(d);
+    REQUIRE(snap);
+    CHECK(0 == diff_ptable_snapshot(d, snap));
+    CHECK(0 == wipe_ptable(d, nullptr));
+    CHECK(0 < diff_ptable_snapshot(d, snap));
+    CHECK(0 == restore_ptable_snapshot(d, snap, 0));
+    CHECK(0 == diff_ptable_snapshot(d, snap));
+    check_gpt(path.c_str(), 1, lbas - 1);
+    check_gpt(path.c_str(), lbas - 1, 1);
+    unsigned char sector[LBA];
+    read_lba(path.c_str(), 2, sector);
+    auto first = reinterpret_cast<const gpt_entry*>(sector)->first_lba;
+    CHECK(2048 == first);
+    // the restore saved the wiped state first, and it's now the latest
+    char* latest = latest_ptable_snapshot(d);
+    REQUIRE(latest);
+    CHECK(0 != strcmp(snap, latest));
+    CHECK(0 < diff_ptable_snapshot(d, latest));
+    free(latest);
+    free(snap);
+    free_image_device(d);
+    unlink(path.c_str());
+  }
+
+  // Identical disks share a geometry, but not one another's snapshots
+  SUBCASE("SnapshotIdentity") {
+    auto path = image_path("twin1.img");
+    auto twinpath = image_path("twin2.img");
+    device* d = create_image_device(path.c_str(), IMAGE_SIZE, LBA, 4096, 0);
+    REQUIRE(d);
+    device* twin = create_image_device(twinpath.c_str(), IMAGE_SIZE, LBA, 4096, 0);
+    REQUIRE(twin);
+    CHECK(0 == make_partition_table(d, "gpt"));
+    CHECK(0 == add_partition(d, L"mine", 2048, 4095, PARTROLE_PRIMARY));
+    char* snap = snapshot_ptable(d);
+    REQUIRE(snap);
+    CHECK(0 != restore_ptable_snapshot(twin, snap, 0));
+    CHECK(0 < diff_ptable_snapshot(twin, snap));
+    CHECK(0 == restore_ptable_snapshot(twin, snap, 1));
+    CHECK(0 == diff_ptable_snapshot(twin, snap));
+    // a device held by an aggregate is refused, forced or not
+    device holder;
+    memset(&holder, 0, sizeof(holder));
+    strcpy(holder.name, "md0");
+    REQUIRE(0 == stack_link(&holder, d));
+    CHECK(0 != restore_ptable_snapshot(d, snap, 1));
+    stack_detach(&holder);
+    CHECK(0 == restore_ptable_snapshot(d, snap, 0));
+    free(snap);
+    free_image_device(twin);
+    free_image_device(d);
+    unlink(twinpath.c_str());
+    unlink(path.c_str());
+  }
+
+  SUBCASE("Audit") {
+    auto path = image_path("audit.img");
+    device* d = create_image_device(path.c_str(), IMAGE_SIZE, LBA, 4096, 0);
+    REQUIRE(d);
+    CHECK(0 == make_partition_table(d, "gpt"));
+    CHECK(0 == add_partition(d, L"audit", 2048, 4095, PARTROLE_PRIMARY));
+    CHECK(0 == audit_ptable(d));
+    // corrupt the backup header; both its CRC and disagreement are reported
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    REQUIRE(0 <= fd);
+    CHECK(1 == pwrite(fd, "X", 1, (lbas - 1) * LBA + 24));
+    close(fd);
+    CHECK(0 < audit_ptable(d));
+    free_image_device(d);
+    unlink(path.c_str());
+  }
+
+  remove_image_dir();
+}
+
+// Create, edit, validate and destroy many tables on a single image. Set
+// GROWLIGHT_BENCH_ITERATIONS to scale it; the rate is reported either way.
+TEST_CASE("ImageBenchmark") {
+  const char* env = getenv("GROWLIGHT_BENCH_ITERATIONS");
+  const unsigned iterations = env ? strtoul(env, nullptr, 0) : 256;
+  const uint64_t lbas = IMAGE_SIZE / LBA;
+  auto path = image_path("bench.img");
+  device* d = create_image_device(path.c_str(), IMAGE_SIZE, LBA, 4096, 0);
+  REQUIRE(d);
+  auto start = std::chrono::steady_clock::now();
+  for(unsigned i = 0 ; i < iterations ; ++i){
+    REQUIRE(0 == make_partition_table(d, "gpt"));
+    REQUIRE(0 == add_partition(d, L"bench", 2048, 2048 + 8 * i + 7, PARTROLE_PRIMARY));
+    check_gpt(path.c_str(), 1, lbas - 1);
+    REQUIRE(0 == wipe_ptable(d, nullptr));
+  }
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start).count();
+  if(ns){
+    MESSAGE(iterations << " GPT create/add/verify/wipe cycles in "
+            << ns / 1000000 << "ms ("
+            << (iterations * 1000000000ull / ns) << "/s)");
+  }
+  free_image_device(d);
+  unlink(path.c_str());
+  remove_image_dir();
+}
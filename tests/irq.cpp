@@ -0,0 +1,53 @@
+#include "main.h"
+#include "irq.h"
+#include <vector>
+
+static int
+collect(unsigned cpu, void *vv) {
+  static_cast<std::vector<unsigned>*>(vv)->push_back(cpu);
+  return 0;
+}
+
+static int
+refuse(unsigned cpu, void *vv) {
+  (void)vv;
+  return cpu == 2;
+}
+
+TEST_CASE("CPUList") {
+
+  SUBCASE("Single") {
+    std::vector<unsigned> cpus;
+    CHECK(0 == cpulist_walk("5", collect, &cpus));
+    REQUIRE(1 == cpus.size());
+    CHECK(5 == cpus[0]);
+  }
+
+  SUBCASE("RangesAndSingletons") {
+    const std::vector<unsigned> expected = { 0, 1, 2, 3, 8, 10, 11, };
+    std::vector<unsigned> cpus;
+    CHECK(0 == cpulist_walk("0-3,8,10-11", collect, &cpus));
+    CHECK(expected == cpus);
+  }
+
+  SUBCASE("Empty") {
+    std::vector<unsigned> cpus;
+    CHECK(0 == cpulist_walk("", collect, &cpus));
+    CHECK(cpus.empty());
+  }
+
+  SUBCASE("Malformed") {
+    std::vector<unsigned> cpus;
+    CHECK(0 > cpulist_walk("3-1", collect, &cpus));
+    CHECK(0 > cpulist_walk("0-", collect, &cpus));
+    CHECK(0 > cpulist_walk("-2", collect, &cpus));
+    CHECK(0 > cpulist_walk("0,,1", collect, &cpus));
+    CHECK(0 > cpulist_walk("0 1", collect, &cpus));
+  }
+
+  SUBCASE("CallbackStops") {
+    CHECK(0 > cpulist_walk("0-3", refuse, nullptr));
+    CHECK(0 == cpulist_walk("0-1,3", refuse, nullptr));
+  }
+
+}
@@ -0,0 +1,90 @@
+#include "main.h"
+#include "growlight.h"
+#include <cstring>
+
+TEST_CASE("PCIe") {
+
+  // Payload rates after line encoding: 8b/10b, 128b/130b, then 242B/256B FLITs
+  SUBCASE("LinkBandwidth") {
+    CHECK(2000000000ull == pcie_link_bw(1, 1));
+    CHECK(4000000000ull == pcie_link_bw(2, 1));
+    CHECK(31507692307ull == pcie_link_bw(3, 4));
+    CHECK(252061538461ull == pcie_link_bw(4, 16));
+    CHECK(60500000000ull == pcie_link_bw(6, 1));
+  }
+
+  SUBCASE("UnknownGeneration") {
+    CHECK(0 == pcie_link_bw(0, 4));
+    CHECK(0 == pcie_link_bw(7, 4));
+  }
+
+  SUBCASE("ScalesWithLanes") {
+    for(unsigned gen = 1 ; gen <= 6 ; ++gen){
+      // lanes are summed before the encoding's rounding
+      CHECK(pcie_link_bw(gen, 1) * 8 <= pcie_link_bw(gen, 8));
+      CHECK(pcie_link_bw(gen, 1) * 8 + 8 > pcie_link_bw(gen, 8));
+      CHECK(0 == pcie_link_bw(gen, 0));
+    }
+  }
+
+  SUBCASE("Degraded") {
+    controller c;
+    memset(&c, 0, sizeof(c));
+    c.bus = BUS_PCIe;
+    c.pcie.gen = c.pcie.gen_cap = 4;
+    c.pcie.lanes_neg = c.pcie.lanes_cap = 4;
+    CHECK(!pcie_degraded_p(&c));
+    c.pcie.lanes_neg = 2;
+    CHECK(pcie_degraded_p(&c));
+    c.pcie.lanes_neg = 4;
+    c.pcie.gen = 3;
+    CHECK(pcie_degraded_p(&c));
+    c.bus = BUS_VIRTUAL;
+    CHECK(!pcie_degraded_p(&c));
+  }
+
+  // The busier direction counts, full duplex being what it is
+  SUBCASE("Saturation") {
+    controller c;
+    memset(&c, 0, sizeof(c));
+    CHECK(0 == controller_saturation(&c));
+    c.bandwidth = 1000;
+    c.load.rxbps = 250;
+    c.load.txbps = 910;
+    CHECK(91 == controller_saturation(&c));
+    CHECK(CONTROLLER_SATURATED_PCT <= controller_saturation(&c));
+  }
+
+  // Namespaces share their controller's link, which is demanded but once
+  SUBCASE("NamespaceDemand") {
+    controller c;
+    device ns1, ns2, sata;
+    memset(&c, 0, sizeof(c));
+    memset(&ns1, 0, sizeof(ns1));
+    memset(&ns2, 0, sizeof(ns2));
+    memset(&sata, 0, sizeof(sata));
+    c.bus = BUS_PCIe;
+    c.bandwidth = pcie_link_bw(3, 4);
+    ns1.c = ns2.c = &c;
+    ns1.layout = ns2.layout = LAYOUT_NONE;
+    ns1.blkdev.transport = ns2.blkdev.transport = DIRECT_NVME;
+    CHECK(c.bandwidth == blockdev_bw(&ns1));
+    // the first namespace brings the link with it
+    c.blockdevs = &ns1;
+    CHECK(c.bandwidth == blockdev_demand(&ns1));
+    ns1.next = &ns2;
+    CHECK(0 == blockdev_demand(&ns2));
+    // ns2 departs without taking the link, ns1 then takes it
+    ns1.next = nullptr;
+    CHECK(0 == blockdev_demand(&ns2));
+    c.blockdevs = nullptr;
+    CHECK(c.bandwidth == blockdev_demand(&ns1));
+    // other transports demand per disk
+    sata.c = &c;
+    sata.layout = LAYOUT_NONE;
+    sata.blkdev.transport = SERIAL_ATAIII;
+    c.blockdevs = &sata;
+    CHECK(6000000000ull == blockdev_demand(&sata));
+  }
+
+}
@@ -0,0 +1,149 @@
+#include "main.h"
+#include "growlight.h"
+#include "stack.h"
+#include <cstring>
+
+// A holder atop three members, each of which can be fed a tick of I/O
+struct stacked {
+  device holder;
+  device members[3];
+
+  stacked(layout_e layout, const char* level) {
+    memset(&holder, 0, sizeof(holder));
+    strcpy(holder.name, "agg");
+    holder.layout = layout;
+    if(layout == LAYOUT_MDADM){
+      holder.mddev.level = const_cast<char*>(level);
+    }else{
+      holder.dmdev.target = const_cast<char*>(level);
+    }
+    for(unsigned z = 0 ; z < 3 ; ++z){
+      memset(&members[z], 0, sizeof(members[z]));
+      members[z].name[0] = 'a' + z;
+      REQUIRE(0 == stack_link(&holder, &members[z]));
+    }
+  }
+
+  ~stacked() {
+    stack_detach(&holder);
+  }
+
+  void io(unsigned z, uint64_t read, uint64_t written) {
+    members[z].statdelta.sectors_read = read;
+    members[z].statdelta.sectors_written = written;
+  }
+
+  stackedge* edge(unsigned z) {
+    for(stackedge* e = holder.members ; e ; e = e->mnext){
+      if(e->member == &members[z]){
+        return e;
+      }
+    }
+    return nullptr;
+  }
+};
+
+TEST_CASE("StackRollup") {
+
+  SUBCASE("Balanced") {
+    stacked s(LAYOUT_MDADM, "raid0");
+    s.io(0, 4096, 4096);
+    s.io(1, 4096, 4096);
+    s.io(2, 4096, 4096);
+    stack_rollup(&s.holder);
+    CHECK(nullptr == s.holder.hotmember);
+    CHECK(3 * 4096 == s.holder.memberdelta.sectors_read);
+    CHECK(3 * 4096 == s.holder.memberdelta.sectors_written);
+  }
+
+  SUBCASE("HotStripe") {
+    stacked s(LAYOUT_DM, "striped");
+    s.io(0, 4096, 0);
+    s.io(1, 20000, 0);
+    s.io(2, 4096, 0);
+    stack_rollup(&s.holder);
+    CHECK(&s.members[1] == s.holder.hotmember);
+  }
+
+  // The ratio is against the mean of the peers, not including the hot one
+  SUBCASE("RatioAgainstPeers") {
+    stacked s(LAYOUT_MDADM, "raid0");
+    s.io(0, STACK_IMBALANCE_RATIO * 4096, 0);
+    s.io(1, 4096, 0);
+    s.io(2, 4096, 0);
+    stack_rollup(&s.holder);
+    CHECK(nullptr == s.holder.hotmember);
+    s.io(0, STACK_IMBALANCE_RATIO * 4096 + 1, 0);
+    stack_rollup(&s.holder);
+    CHECK(&s.members[0] == s.holder.hotmember);
+  }
+
+  SUBCASE("BelowNoise") {
+    stacked s(LAYOUT_MDADM, "raid0");
+    s.io(0, STACK_IMBALANCE_MIN_SECTORS - 1, 0);
+    stack_rollup(&s.holder);
+    CHECK(nullptr == s.holder.hotmember);
+  }
+
+  SUBCASE("Unbalanced") {
+    stacked s(LAYOUT_MDADM, "linear");
+    s.io(0, 20000, 20000);
+    stack_rollup(&s.holder);
+    CHECK(nullptr == s.holder.hotmember);
+  }
+
+  // Mirrors read from whichever member they please
+  SUBCASE("MirrorReads") {
+    stacked s(LAYOUT_MDADM, "raid1");
+    s.io(0, 20000, 4096);
+    s.io(1, 0, 4096);
+    s.io(2, 0, 4096);
+    stack_rollup(&s.holder);
+    CHECK(nullptr == s.holder.hotmember);
+    s.io(1, 0, 20000);
+    stack_rollup(&s.holder);
+    CHECK(&s.members[1] == s.holder.hotmember);
+  }
+
+  SUBCASE("DmMirrorReads") {
+    stacked s(LAYOUT_DM, "mirror");
+    s.holder.dmdev.mirrored = 1;
+    s.io(0, 20000, 4096);
+    s.io(1, 0, 4096);
+    stack_rollup(&s.holder);
+    CHECK(nullptr == s.holder.hotmember);
+  }
+
+  // A spare takes no I/O, and mustn't drag down the mean
+  SUBCASE("IdleMember") {
+    stacked s(LAYOUT_MDADM, "raid1");
+    s.io(0, 0, 12000);
+    s.io(1, 0, 8000);
+    REQUIRE(nullptr != s.edge(2));
+    stack_rollup(&s.holder);
+    CHECK(&s.members[0] == s.holder.hotmember);
+    s.edge(2)->idle = 1;
+    stack_rollup(&s.holder);
+    CHECK(nullptr == s.holder.hotmember);
+    // nor does it count as a peer of the one remaining member
+    s.edge(1)->idle = 1;
+    stack_rollup(&s.holder);
+    CHECK(nullptr == s.holder.hotmember);
+    // its I/O is still the aggregate's
+    CHECK(20000 == s.holder.memberdelta.sectors_written);
+  }
+
+  SUBCASE("Syncing") {
+    stacked s(LAYOUT_MDADM, "raid1");
+    s.io(0, 20000, 20000);
+    s.io(1, 0, 4096);
+    s.io(2, 0, 4096);
+    s.holder.mddev.resync = 1;
+    stack_rollup(&s.holder);
+    CHECK(nullptr == s.holder.hotmember);
+    s.holder.mddev.resync = 0;
+    stack_rollup(&s.holder);
+    CHECK(&s.members[0] == s.holder.hotmember);
+  }
+
+}
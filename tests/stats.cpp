@@ -0,0 +1,72 @@
+#include "main.h"
+#include "stats.h"
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+// Write contents to a fresh file, returning its path
+static std::string diskstats_file(const char* contents) {
+  char tmpl[] = "/tmp/growlight-diskstats-XXXXXX";
+  int fd = mkstemp(tmpl);
+  REQUIRE(0 <= fd);
+  std::string s(contents);
+  CHECK(static_cast<ssize_t>(s.size()) == write(fd, s.data(), s.size()));
+  close(fd);
+  return tmpl;
+}
+
+TEST_CASE("Diskstats") {
+
+  // Pre-4.18 kernels supply 11 fields following the name
+  SUBCASE("ElevenFields") {
+    auto path = diskstats_file(
+      "   8       0 sda 100 5 2000 30 200 7 4000 60 0 90 120\n"
+      "   8       1 sda1 10 0 80 3 20 0 160 6 0 9 12\n");
+    diskstats* ds;
+    REQUIRE(2 == read_diskstats(path.c_str(), &ds));
+    CHECK(0 == strcmp("sda", ds[0].name));
+    CHECK(100 == ds[0].total.reads);
+    CHECK(2000 == ds[0].total.sectors_read);
+    CHECK(200 == ds[0].total.writes);
+    CHECK(4000 == ds[0].total.sectors_written);
+    CHECK(90 == ds[0].total.io_ms);
+    CHECK(0 == strcmp("sda1", ds[1].name));
+    CHECK(9 == ds[1].total.io_ms);
+    free(ds);
+    unlink(path.c_str());
+  }
+
+  // Discard (4.18) and flush (5.5) fields trail the ten we use
+  SUBCASE("SeventeenFields") {
+    auto path = diskstats_file(
+      " 259       0 nvme0n1 7 1 56 2 9 3 72 4 1 11 6 5 0 40 8 2 1\n");
+    diskstats* ds;
+    REQUIRE(1 == read_diskstats(path.c_str(), &ds));
+    CHECK(0 == strcmp("nvme0n1", ds[0].name));
+    CHECK(7 == ds[0].total.reads);
+    CHECK(56 == ds[0].total.sectors_read);
+    CHECK(9 == ds[0].total.writes);
+    CHECK(72 == ds[0].total.sectors_written);
+    CHECK(11 == ds[0].total.io_ms);
+    free(ds);
+    unlink(path.c_str());
+  }
+
+  // Without msIOs there's no utilization to be had
+  SUBCASE("TooFewFields") {
+    auto path = diskstats_file("   8       0 sda 100 5 2000 30 200 7 4000 60 0\n");
+    diskstats* ds;
+    CHECK(0 > read_diskstats(path.c_str(), &ds));
+    unlink(path.c_str());
+  }
+
+  SUBCASE("Empty") {
+    auto path = diskstats_file("");
+    diskstats* ds;
+    CHECK(0 == read_diskstats(path.c_str(), &ds));
+    CHECK(nullptr == ds);
+    unlink(path.c_str());
+  }
+
+}
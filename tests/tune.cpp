@@ -0,0 +1,188 @@
+#include "main.h"
+#include "growlight.h"
+#include "tune.h"
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <ftw.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// A private sysfs holding the queue/ attributes of whatever we write
+static std::string tunedir;
+
+static std::string sysfs_dir() {
+  if(tunedir.empty()){
+    char tmpl[] = "/tmp/growlight-tune-XXXXXX";
+    REQUIRE(nullptr != mkdtemp(tmpl));
+    tunedir = tmpl;
+  }
+  return tunedir;
+}
+
+static int remove_entry(const char* path, const struct stat*, int, struct FTW*) {
+  return remove(path);
+}
+
+static void remove_sysfs_dir() {
+  if(!tunedir.empty()){
+    CHECK(0 == nftw(tunedir.c_str(), remove_entry, 8, FTW_DEPTH | FTW_PHYS));
+    tunedir.clear();
+  }
+}
+
+// Writes aren't truncating, so a plain file retains what lay beyond them
+static bool written(const char* dev, const char* node, const char* val) {
+  std::string path = sysfs_dir() + "/" + dev + "/queue/" + node;
+  char buf[80] = "";
+  FILE* fp = fopen(path.c_str(), "r");
+  REQUIRE(nullptr != fp);
+  CHECK(nullptr != fgets(buf, sizeof(buf), fp));
+  fclose(fp);
+  return strncmp(buf, val, strlen(val)) == 0;
+}
+
+static void queue_attr(const char* dev, const char* node, const char* val) {
+  std::string path = sysfs_dir() + "/" + dev;
+  mkdir(path.c_str(), 0755);
+  path += "/queue";
+  mkdir(path.c_str(), 0755);
+  path += std::string("/") + node;
+  FILE* fp = fopen(path.c_str(), "w");
+  REQUIRE(nullptr != fp);
+  CHECK(0 < fprintf(fp, "%s\n", val));
+  fclose(fp);
+}
+
+static const tune_knob* knob(const tune_plan* tp, const char* node) {
+  for(unsigned z = 0 ; z < TUNE_KNOBS ; ++z){
+    if(strcmp(tp->knobs[z].node, node) == 0){
+      return &tp->knobs[z];
+    }
+  }
+  return nullptr;
+}
+
+static bool recommends(const tune_plan* tp, const char* node, const char* val) {
+  const tune_knob* k = knob(tp, node);
+  if(k == nullptr || k->recommended == nullptr){
+    return val == nullptr;
+  }
+  return val && strcmp(k->recommended, val) == 0;
+}
+
+TEST_CASE("TunePlan") {
+  int oldsysfd = sysfd;
+  sysfd = open(sysfs_dir().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  REQUIRE(0 <= sysfd);
+  device d;
+  memset(&d, 0, sizeof(d));
+  d.layout = LAYOUT_NONE;
+  d.blkdev.realdev = 1;
+  auto tp = static_cast<tune_plan*>(malloc(sizeof(tune_plan)));
+  REQUIRE(nullptr != tp);
+
+  SUBCASE("NVMe") {
+    strcpy(d.name, "nvme0n1");
+    d.blkdev.transport = DIRECT_NVME;
+    queue_attr(d.name, "scheduler", "[mq-deadline] kyber none");
+    queue_attr(d.name, "nr_requests", "1023");
+    queue_attr(d.name, "read_ahead_kb", "128");
+    queue_attr(d.name, "rq_affinity", "1");
+    queue_attr(d.name, "wbt_lat_usec", "2000");
+    queue_attr(d.name, "max_sectors_kb", "128");
+    queue_attr(d.name, "max_hw_sectors_kb", "512");
+    REQUIRE(1 == tune_plan_device(&d, tp));
+    CHECK(TUNE_NVME == tp->profile);
+    CHECK(0 == strcmp("mq-deadline", knob(tp, "scheduler")->current));
+    CHECK(recommends(tp, "scheduler", "none"));
+    CHECK(recommends(tp, "nr_requests", nullptr));
+    CHECK(recommends(tp, "read_ahead_kb", "128"));
+    CHECK(recommends(tp, "rq_affinity", "2"));
+    CHECK(recommends(tp, "wbt_lat_usec", "0"));
+    // never beyond what the hardware can take
+    CHECK(recommends(tp, "max_sectors_kb", "512"));
+    CHECK(4 == tune_plan_changes(tp));
+    free_tune_plans(tp, 1);
+  }
+
+  // Falling back to the next scheduler on the list; missing knobs are left be
+  SUBCASE("HDD") {
+    strcpy(d.name, "sdb");
+    d.blkdev.serial = const_cast<char*>("WD-WX12345");
+    queue_attr(d.name, "scheduler", "[none] bfq");
+    queue_attr(d.name, "nr_requests", "256");
+    queue_attr(d.name, "max_hw_sectors_kb", "32767");
+    REQUIRE(1 == tune_plan_device(&d, tp));
+    CHECK(TUNE_HDD == tp->profile);
+    CHECK(recommends(tp, "scheduler", "bfq"));
+    CHECK(recommends(tp, "max_sectors_kb", "4096"));
+    CHECK(nullptr == knob(tp, "wbt_lat_usec")->current);
+    CHECK(1 == tune_plan_changes(tp));
+    char* udev;
+    size_t len;
+    FILE* fp = open_memstream(&udev, &len);
+    REQUIRE(nullptr != fp);
+    CHECK(0 == tune_export_udev(fp, tp, 1));
+    fclose(fp);
+    CHECK(nullptr != strstr(udev, "ENV{ID_SERIAL_SHORT}==\"WD-WX12345\""));
+    CHECK(nullptr != strstr(udev, "ATTR{queue/scheduler}=\"bfq\""));
+    CHECK(nullptr != strstr(udev, "ATTR{queue/nr_requests}=\"256\""));
+    // no rule for what the device lacks
+    CHECK(nullptr == strstr(udev, "wbt_lat_usec"));
+    free(udev);
+    // the new scheduler resets nr_requests, so it's written back as well
+    unsigned attempted;
+    CHECK(0 == tune_apply(tp, 1, &attempted));
+    CHECK(2 == attempted);
+    CHECK(written(d.name, "scheduler", "bfq"));
+    CHECK(written(d.name, "nr_requests", "256"));
+    free_tune_plans(tp, 1);
+  }
+
+  SUBCASE("SSD") {
+    strcpy(d.name, "sdc");
+    d.blkdev.rotation = SSD_ROTATION;
+    queue_attr(d.name, "scheduler", "[bfq] mq-deadline none");
+    REQUIRE(1 == tune_plan_device(&d, tp));
+    CHECK(TUNE_SSD == tp->profile);
+    CHECK(recommends(tp, "scheduler", "mq-deadline"));
+    CHECK(recommends(tp, "wbt_lat_usec", "2000"));
+    free_tune_plans(tp, 1);
+  }
+
+  // Two full stripes of readahead
+  SUBCASE("Stacked") {
+    strcpy(d.name, "md0");
+    d.layout = LAYOUT_MDADM;
+    d.mddev.stride = 512 * 1024;
+    d.mddev.swidth = 4;
+    queue_attr(d.name, "read_ahead_kb", "128");
+    REQUIRE(1 == tune_plan_device(&d, tp));
+    CHECK(TUNE_STACKED == tp->profile);
+    CHECK(recommends(tp, "read_ahead_kb", "4096"));
+    CHECK(recommends(tp, "wbt_lat_usec", nullptr));
+    CHECK(0 == strcmp("KERNEL==\"md0\"", tp->match));
+    d.mddev.stride = 64 * 1024;
+    d.mddev.swidth = 2;
+    free_tune_plans(tp, 1);
+    tp = static_cast<tune_plan*>(malloc(sizeof(*tp)));
+    REQUIRE(nullptr != tp);
+    REQUIRE(1 == tune_plan_device(&d, tp));
+    CHECK(recommends(tp, "read_ahead_kb", "1024"));
+    free_tune_plans(tp, 1);
+  }
+
+  SUBCASE("Untunable") {
+    strcpy(d.name, "sda1");
+    d.layout = LAYOUT_PARTITION;
+    CHECK(0 == tune_plan_device(&d, tp));
+    free(tp);
+  }
+
+  close(sysfd);
+  sysfd = oldsysfd;
+  remove_sysfs_dir();
+}
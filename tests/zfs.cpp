@@ -0,0 +1,97 @@
+#include "main.h"
+#include "zfs.h"
+#include "stack.h"
+#include <cstring>
+
+static unsigned members(const device* d) {
+  unsigned n = 0;
+  for(const stackedge* e = d->members ; e ; e = e->mnext){
+    ++n;
+  }
+  return n;
+}
+
+// Pools are scanned before any disk is discovered
+TEST_CASE("ZpoolAttach") {
+  zpool_vdev vdevs[3];
+  zpool_info zi;
+  controller virt, sata;
+  device pool, sda, sdb, sdb1;
+  memset(vdevs, 0, sizeof(vdevs));
+  memset(&zi, 0, sizeof(zi));
+  memset(&virt, 0, sizeof(virt));
+  memset(&sata, 0, sizeof(sata));
+  memset(&pool, 0, sizeof(pool));
+  memset(&sda, 0, sizeof(sda));
+  memset(&sdb, 0, sizeof(sdb));
+  memset(&sdb1, 0, sizeof(sdb1));
+  vdevs[0].type = const_cast<char*>("mirror");
+  vdevs[0].depth = 1;
+  vdevs[1].type = vdevs[2].type = const_cast<char*>("disk");
+  vdevs[1].depth = vdevs[2].depth = 2;
+  vdevs[1].path = const_cast<char*>("/dev/sda");
+  vdevs[1].devname = const_cast<char*>("sda");
+  vdevs[2].path = const_cast<char*>("/dev/sdb1");
+  vdevs[2].devname = const_cast<char*>("sdb1");
+  zi.vdevs = vdevs;
+  zi.vdevcount = 3;
+  strcpy(pool.name, "tank");
+  pool.layout = LAYOUT_ZPOOL;
+  pool.zpool.info = &zi;
+  pool.zpool.transport = AGGREGATE_UNKNOWN;
+  pool.c = &virt;
+  virt.blockdevs = &pool;
+  virt.next = &sata;
+  strcpy(sda.name, "sda");
+  sda.layout = LAYOUT_NONE;
+  sda.blkdev.transport = SERIAL_ATAIII;
+  sda.c = &sata;
+  strcpy(sdb.name, "sdb");
+  sdb.layout = LAYOUT_NONE;
+  sdb.blkdev.transport = SERIAL_ATAIII;
+  sdb.c = &sata;
+  sdb.parts = &sdb1;
+  strcpy(sdb1.name, "sdb1");
+  sdb1.layout = LAYOUT_PARTITION;
+  sdb1.partdev.parent = &sdb;
+
+  SUBCASE("DiskArrivesLater") {
+    CHECK(0 == zpool_attach(&sda, &virt));
+    CHECK(1 == members(&pool));
+    CHECK(&pool == sda.holders->holder);
+    CHECK(SERIAL_ATAIII == pool.zpool.transport);
+    // again, as when the disk is rescanned, links it but once
+    CHECK(0 == zpool_attach(&sda, &virt));
+    CHECK(1 == members(&pool));
+  }
+
+  // The vdev is a partition, found through its disk
+  SUBCASE("Partition") {
+    CHECK(0 == zpool_attach(&sdb, &virt));
+    CHECK(1 == members(&pool));
+    CHECK(nullptr == sdb.holders);
+    REQUIRE(nullptr != sdb1.holders);
+    CHECK(&pool == sdb1.holders->holder);
+    CHECK(0 == zpool_attach(&sda, &virt));
+    CHECK(2 == members(&pool));
+  }
+
+  SUBCASE("Stranger") {
+    device sdc;
+    memset(&sdc, 0, sizeof(sdc));
+    strcpy(sdc.name, "sdc");
+    sdc.layout = LAYOUT_NONE;
+    CHECK(0 == zpool_attach(&sdc, &virt));
+    CHECK(0 == members(&pool));
+    CHECK(AGGREGATE_UNKNOWN == pool.zpool.transport);
+  }
+
+  // Pools yet to be read have nothing to offer
+  SUBCASE("Unread") {
+    pool.zpool.info = nullptr;
+    CHECK(0 == zpool_attach(&sda, &virt));
+    CHECK(0 == members(&pool));
+  }
+
+  stack_detach(&pool);
+}